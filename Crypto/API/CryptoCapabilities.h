@@ -0,0 +1,41 @@
+#ifndef _CRYPTO_CAPABILITIES
+#define _CRYPTO_CAPABILITIES
+
+#include <vector>
+#include "CryptoTypes.h"
+
+// Instruction set extensions reported by the running CPU
+struct CpuFeatures {
+	bool bAESNI = false;	// AES round instructions
+	bool bCLMUL = false;	// Carry-less multiply, used for GCM GHASH
+	bool bSHANI = false;	// SHA-1/SHA-256 instructions
+	bool bAVX2 = false;		// AVX2, including OS support for YMM state
+};
+
+// Accelerated backends the linked mbedtls build actually uses on this host
+struct CryptoCapabilities {
+	CpuFeatures cpu;
+	bool bAESAccelerated = false;	// AES rounds via AES-NI
+	bool bGCMAccelerated = false;	// GHASH via CLMUL
+	bool bSHAAccelerated = false;	// SHA-2 via SHA-NI (unused by mbedtls 3.4
+									// on x86)
+};
+
+// Throughput of one mode measured by RecommendCryptoMode
+struct CryptoProbeResult {
+	CRYPTO_MODES nMode;
+	double dMBps;
+};
+
+// Detect CPU features and accelerated backends. Detection runs once, later
+// calls return the cached result
+const CryptoCapabilities& GetCryptoCapabilities();
+
+// Run a short benchmark (a few milliseconds per mode) of the authenticated
+// modes and return the fastest one that is constant-time on this host. AES
+// is only considered when AES-NI and CLMUL are in use, as the table based
+// fallback leaks timing. Measurements are returned in pResults if provided
+CRYPTO_MODES RecommendCryptoMode(
+	std::vector<CryptoProbeResult>* pResults = nullptr);
+
+#endif // _CRYPTO_CAPABILITIES
@@ -0,0 +1,64 @@
+#ifndef _CRYPTO_KDF
+#define _CRYPTO_KDF
+
+#include "CryptoTypes.h"
+#include "SecureMemory.h"
+
+#include <future>
+#include <string>
+#include <vector>
+
+struct KdfSchedulerCtx;
+
+// One password derivation
+struct KdfJob {
+	// Wiped when freed. Reserve past the inline buffer of short strings so
+	// moving the job never copies the password
+	SecureString strPassword;
+	uint nKeyLength = 32;		// Derived key length in bytes
+	Argon2Params params;
+	u8Vec vSalt;				// Empty selects the legacy zero salt
+};
+
+struct KdfResult {
+	CRYPTO_ERROR_CODES nResult = CRYPTO_ERROR_CODES::CRYPT_OK;
+	u8SecureVec vKey;			// Locked memory, wiped when freed
+};
+
+// Runs Argon2 derivations on a fixed pool of worker threads. A job is only
+// started once its matrix, rounded up to a whole arena region (2 MiB), fits
+// in what is left of the memory budget, so bursts of derivations queue up 
+// instead of exhausting RAM. Jobs start in submission order.
+//
+// Jobs that leave params.nThreads at 0 run their lanes on one thread, so
+// CPU use is bounded by the worker count. Set nThreads to let a single job
+// spread its lanes across cores. Matrices freed by finished jobs are kept
+// for reuse up to the arena limit (see HashArgon2::SetArenaLimit).
+class KdfScheduler {
+
+public:
+	// nWorkers 0 selects one worker per hardware core. nMemoryBudgetKiB caps
+	// the Argon2 memory of all running jobs combined
+	KdfScheduler(uint nWorkers = 0, size_t nMemoryBudgetKiB = (1 << 20));
+	// Finishes every queued job, then stops the workers
+	~KdfScheduler();
+
+	KdfScheduler(const KdfScheduler&) = delete;
+	KdfScheduler& operator=(const KdfScheduler&) = delete;
+
+	// Queue a derivation. A job whose matrix exceeds the whole budget
+	// completes immediately with CRYPT_ERROR_BAD_INPUT
+	std::future<KdfResult> Submit(KdfJob job);
+	// Queue several derivations, futures are in the order of vJobs
+	std::vector<std::future<KdfResult>> SubmitBatch(std::vector<KdfJob> vJobs);
+
+	// Argon2 memory of running jobs in KiB
+	size_t GetMemoryInUse() const;
+	// Jobs waiting to start
+	size_t GetQueueLength() const;
+
+private:
+	KdfSchedulerCtx* m_pCtx;
+};
+
+#endif // _CRYPTO_KDF
@@ -4,25 +4,87 @@
 #include <string>
 #include <vector>
 #include "CryptoTypes.h"
+#include "CryptoKeySchedule.h"
+#include "SecureMemory.h"
+
+// Uses of keys derived from a master key with CryptoKey::DeriveSubKey. Each
+// purpose yields an independent key, values are part of the derivation and
+// must not be renumbered
+enum class KEY_PURPOSE : u8 {
+	ENCRYPTION = 1,		// Document or entry encryption
+	MAC,				// Standalone authentication tags
+	SEARCH_INDEX,		// Keyed hashes of searchable fields
+	ATTACHMENT,			// Attachment encryption
+	KEY_WRAP,			// Wrapping other keys (WrapKey/UnwrapKey)
+};
+
+// Wrapped key length for a key of nKeyLength bytes (NIST KW adds 8 bytes)
+constexpr size_t GetWrappedKeyLength(size_t nKeyLength) 
+{ 
+	return nKeyLength + 8; 
+}
 
 class CryptoKey {
 
 public:
 	CryptoKey() {}
-	~CryptoKey();
+	~CryptoKey() {}
 
 	// Read from file
 	CRYPTO_ERROR_CODES ReadKeyFromFile(std::string strFileName);
 	// Write to file
 	CRYPTO_ERROR_CODES WriteKeyToFile(std::string strFileName);
-	// Derive new pseudorandom key
-	CRYPTO_ERROR_CODES DeriveNewKey(std::string strPassword, uint nTargetSize);
+	// Derive new pseudorandom key from a password with Argon2id, using the 
+	// current KDF parameters and salt
+	CRYPTO_ERROR_CODES DeriveNewKey(const SecureString& strPassword, 
+		uint nTargetSize);
+
+	// Read KDF parameters and salt recorded for a vault
+	CRYPTO_ERROR_CODES ReadKdfFromFile(std::string strFileName);
+	// Record KDF parameters and salt
+	CRYPTO_ERROR_CODES WriteKdfToFile(std::string strFileName);
+	// Benchmark this host and select the strongest parameters that derive a
+	// key within nTargetMs and nMaxMemoryKiB. A new random salt is generated
+	CRYPTO_ERROR_CODES CalibrateKdf(uint nTargetMs, uint nMaxMemoryKiB);
+	// Set KDF parameters directly. Empty salt selects the legacy zero salt
+	CRYPTO_ERROR_CODES SetKdfParams(const Argon2Params& params, 
+		const u8Vec& vSalt);
+	const Argon2Params& GetKdfParams() const { return m_kdfParams; }
+
+	// Derive a nLength byte subkey for nPurpose with HKDF-SHA256. pContext 
+	// separates keys of the same purpose (e.g. an entry id) and may be 
+	// nullptr. Cheap compared to DeriveNewKey, the master stays unchanged
+	CRYPTO_ERROR_CODES DeriveSubKey(KEY_PURPOSE nPurpose, const u8* pContext,
+		size_t nContextLength, uint nLength, CryptoKey& subKey) const;
+	// Same as above into a caller provided buffer
+	CRYPTO_ERROR_CODES DeriveSubKey(KEY_PURPOSE nPurpose, const u8* pContext,
+		size_t nContextLength, u8* pOut, size_t nLength) const;
+
+	// Wrap key with NIST SP 800-38F KW (AES-256) under a KEY_WRAP subkey of
+	// this key. pOut needs GetWrappedKeyLength(key size) bytes
+	CRYPTO_ERROR_CODES WrapKey(const CryptoKey& key, u8* pOut, 
+		size_t nOutLength) const;
+	// Unwrap a key produced by WrapKey. Returns CRYPT_ERROR_AUTH_FAILED if 
+	// this is not the key it was wrapped under or the data was modified
+	CRYPTO_ERROR_CODES UnwrapKey(const u8* pWrapped, size_t nWrappedLength, 
+		CryptoKey& key) const;
 
-	// Get Key Value
-	std::vector<u8> GetKeyValue() { return m_vValue; }
+	// Set key value directly (e.g. a KdfScheduler result), 16, 24 or 32 bytes
+	CRYPTO_ERROR_CODES SetKeyValue(const u8* pValue, size_t nLength);
+	// Get Key Value, held in locked memory
+	const u8SecureVec& GetKeyValue() const { return m_vValue; }
+	// Get round keys for the cipher used by nMode. The schedule is expanded on
+	// first use and cached until the key value changes. Returns nullptr if the
+	// key is not valid for the cipher. Not thread-safe on first use.
+	const CryptoKeySchedule* GetKeySchedule(CRYPTO_MODES nMode);
 
 private:
-	std::vector<u8> m_vValue;
+	u8SecureVec m_vValue;
+	Argon2Params m_kdfParams;
+	u8Vec m_vKdfSalt;
+	CryptoKeySchedule m_aesSchedule;
+	CryptoKeySchedule m_tdesSchedule;
+	CryptoKeySchedule m_chachaSchedule;
 };
 
 #endif // _CRYPTO_KEY
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef _CRYPTO_KEY_SCHEDULE
+#define _CRYPTO_KEY_SCHEDULE
+
+#include "CryptoTypes.h"
+
+struct KeyScheduleCtx;
+
+// Expanded cipher key. Encryption and decryption round keys are computed once
+// in Init and reused by every call made with this schedule. Round keys are 
+// zeroized on Clear and on destruction.
+// A schedule is read-only once initialized and may be shared between threads
+// (AEAD calls on a shared schedule are serialized internally).
+class CryptoKeySchedule {
+
+public:
+	CryptoKeySchedule();
+	~CryptoKeySchedule();
+
+	CryptoKeySchedule(const CryptoKeySchedule&) = delete;
+	CryptoKeySchedule& operator=(const CryptoKeySchedule&) = delete;
+
+	// Expand pKey for the cipher used by nMode (AES, TDES or ChaCha20)
+	CRYPTO_ERROR_CODES Init(CRYPTO_MODES nMode, const u8* pKey, 
+		size_t nKeyLength);
+	// Zeroize round keys
+	void Clear();
+
+	// Check whether the schedule was expanded for the cipher used by nMode
+	bool IsValidFor(CRYPTO_MODES nMode) const;
+
+	// Internal cipher contexts, only meaningful to ICrypto implementations
+	KeyScheduleCtx* GetContext() const { return m_pCtx; }
+
+private:
+	KeyScheduleCtx* m_pCtx;
+};
+
+#endif // _CRYPTO_KEY_SCHEDULE
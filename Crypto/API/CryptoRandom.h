@@ -0,0 +1,8 @@
+#pragma once
+
+#include "CryptoTypes.h"
+
+// Fill pOut with nLength bytes from a CTR_DRBG seeded from the platform 
+// entropy source. The generator is shared and seeded on first use, calls are
+// serialized. Intended for IVs, nonces and salts
+CRYPTO_ERROR_CODES GetRandomBytes(u8* pOut, size_t nLength);
@@ -0,0 +1,75 @@
+#ifndef _CRYPTO_STREAM
+#define _CRYPTO_STREAM
+
+#include "CryptoTypes.h"
+#include "CryptoKeySchedule.h"
+
+struct CipherStreamCtx;
+struct HashStreamCtx;
+
+// Incremental encryption/decryption. Chaining IV, counter and AEAD state are
+// carried across Update calls, so data can be processed in chunks of any
+// size with output identical to the one-shot ICrypto calls.
+//
+// Block modes (ECB/CBC) hold back a trailing partial block until the next
+// Update, no padding is added. pIn and pOut may be the same buffer only when
+// every Update is a whole number of blocks.
+class CipherStream {
+
+public:
+	CipherStream();
+	~CipherStream();
+
+	CipherStream(const CipherStream&) = delete;
+	CipherStream& operator=(const CipherStream&) = delete;
+
+	// Start an operation with a key schedule expanded for nMode. pIV follows
+	// the ICrypto rules (nullptr for a zero IV, required for AEAD modes).
+	// pAAD is authenticated but not encrypted (AEAD modes only). The key
+	// schedule must outlive the operation
+	CRYPTO_ERROR_CODES Init(CRYPTO_MODES nMode, bool bEncrypt,
+		const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength,
+		const u8* pAAD = nullptr, size_t nAADLength = 0);
+	// Process nInLength bytes of pIn. nWritten receives the bytes written to
+	// pOut, which needs room for nInLength plus one block for block modes
+	CRYPTO_ERROR_CODES Update(const u8* pIn, size_t nInLength, u8* pOut,
+		size_t nOutLength, size_t& nWritten);
+	// Complete the operation. Block modes fail with CRYPT_ERROR_BLOCK_SIZE
+	// if a partial block remains. AEAD encryption writes the tag to pTag,
+	// decryption checks it and returns CRYPT_ERROR_AUTH_FAILED on mismatch,
+	// in which case all output from Update must be discarded
+	CRYPTO_ERROR_CODES Finish(u8* pTag = nullptr, size_t nTagLength = 0);
+
+	// Authentication tag length in bytes, 0 if mode is not authenticated
+	size_t GetTagLength() const;
+
+private:
+	CipherStreamCtx* m_pCtx;
+};
+
+// Incremental SHA-2 digest
+class HashStream {
+
+public:
+	HashStream();
+	~HashStream();
+
+	HashStream(const HashStream&) = delete;
+	HashStream& operator=(const HashStream&) = delete;
+
+	// Start a new digest. Only SHA modes can be streamed
+	CRYPTO_ERROR_CODES Init(HASH_MODES nMode = HASH_MODES::SHA256);
+	// Add nLength bytes of pData to the digest
+	CRYPTO_ERROR_CODES Update(const u8* pData, size_t nLength);
+	// Write the digest to pHash (at least GetHashLength() bytes). Init must
+	// be called again before the next digest
+	CRYPTO_ERROR_CODES Finish(u8* pHash, size_t nHashLength);
+
+	// Retrieve digest length for the selected mode in bytes
+	size_t GetHashLength() const;
+
+private:
+	HashStreamCtx* m_pCtx;
+};
+
+#endif // _CRYPTO_STREAM
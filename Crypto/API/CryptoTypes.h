@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -17,6 +19,7 @@ enum class CRYPTO_ERROR_CODES {
 	CRYPT_ERROR_ARGON2,			// Error occurred in ARGON2 library
 	CRYPT_ERROR_BAD_INPUT,		// Bad Input
 	CRYPT_ERROR_BLOCK_SIZE,		// Input not padded correctly
+	CRYPT_ERROR_AUTH_FAILED,	// Authentication tag does not match
 	// CryptoKey Error Codes
 	CRYPT_ERROR_FILE_IO,		// File IO error
 	CRYPT_ERROR_FILE_CORRUPTED,	// File corruption or tamper detected
@@ -31,11 +34,15 @@ enum class CRYPTO_MODES {
 	AES_ECB,
 	AES_CBC,
 	AES_CTR,
+	AES_GCM,	// Authenticated, ciphertext is followed by the tag
 
 	// TDES Mode Types
 	TDES_ECB,
 	TDES_CBC,
 
+	// ChaCha Mode Types
+	CHACHA20_POLY1305,	// Authenticated, ciphertext is followed by the tag
+
 	LAST	// Dummy value for iteration
 };
 
@@ -59,4 +66,46 @@ enum class HASH_MODES {
 	LAST	// Dummy value for iteration
 };
 
-const char* GetHashModeStr(HASH_MODES nMode);
\ No newline at end of file
+const char* GetHashModeStr(HASH_MODES nMode);
+
+// Digest length in bytes for nMode. Argon2 output length is selectable, the
+// value given is the HashArgon2 default
+constexpr size_t GetHashModeLength(HASH_MODES nMode)
+{
+	switch (nMode)
+	{
+	case HASH_MODES::SHA224:
+		return 28;
+	case HASH_MODES::SHA256:
+		return 32;
+	case HASH_MODES::SHA384:
+		return 48;
+	case HASH_MODES::SHA512:
+		return 64;
+	case HASH_MODES::ARGON2I:
+	case HASH_MODES::ARGON2D:
+	case HASH_MODES::ARGON2ID:
+		return 32;
+	default:
+		return 0;
+	}
+}
+
+// Largest digest produced by any SHA mode
+constexpr size_t HASH_MAX_LENGTH = 64;
+
+// Fixed-size digest buffer for nMode, e.g. HashDigest<HASH_MODES::SHA256>
+template <HASH_MODES nMode>
+using HashDigest = std::array<u8, GetHashModeLength(nMode)>;
+
+
+// Argon2 cost parameters. Time, memory and lanes are part of the derived
+// value, threads only affect how fast it is computed. Defaults match the
+// values every existing key was derived with
+struct Argon2Params {
+	uint nTimeCost = 2;				// Passes over memory
+	uint nMemoryCost = (1 << 16);	// Memory in KiB (64 MiB)
+	uint nLanes = 1;				// Independent lanes filled in parallel
+	uint nThreads = 0;				// Worker threads, 0 for one per lane up
+									// to the number of cores
+};
\ No newline at end of file
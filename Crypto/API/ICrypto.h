@@ -4,25 +4,85 @@
 #include <vector>
 #include <iostream>
 #include "CryptoTypes.h"
+#include "CryptoKeySchedule.h"
 
 // TODO: Add retrieval of supported key size(s)
 
+// Buffers smaller than this are always processed on the calling thread
+#define PARALLEL_THRESHOLD_DEFAULT (1 << 20)
+
 // Common crypto interface for different cipher schemes
 class ICrypto {
 	
 public:
 
 	// Encrypt vPlain into vCipher
-	virtual CRYPTO_ERROR_CODES EncryptData(u8Vec vPlain, u8Vec& vCipher, 
-		u8Vec vKey, u8Vec vIV) = 0;
+	virtual CRYPTO_ERROR_CODES EncryptData(const u8Vec& vPlain, u8Vec& vCipher, 
+		const u8Vec& vKey, const u8Vec& vIV) = 0;
 	// Decrypt vCipher into vPlain
-	virtual CRYPTO_ERROR_CODES DecryptData(u8Vec vCipher, u8Vec& vPlain,
-		u8Vec vKey, u8Vec vIV) = 0;
+	virtual CRYPTO_ERROR_CODES DecryptData(const u8Vec& vCipher, u8Vec& vPlain,
+		const u8Vec& vKey, const u8Vec& vIV) = 0;
+
+	// Encrypt pPlain into caller provided pCipher without any allocation.
+	// nCipherLength must be at least nPlainLength. pCipher may equal pPlain 
+	// for in-place encryption, other overlapping buffers are not supported.
+	// pIV may be nullptr (nIVLength 0) to use a zero IV
+	virtual CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, 
+		size_t nPlainLength, u8* pCipher, size_t nCipherLength, 
+		const u8* pKey, size_t nKeyLength, const u8* pIV, 
+		size_t nIVLength) = 0;
+	// Decrypt pCipher into caller provided pPlain without any allocation.
+	// Same buffer rules as the encryption overload
+	virtual CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, 
+		size_t nCipherLength, u8* pPlain, size_t nPlainLength, 
+		const u8* pKey, size_t nKeyLength, const u8* pIV, 
+		size_t nIVLength) = 0;
+
+	// Encrypt/Decrypt with a pre-expanded key (see CryptoKey::GetKeySchedule)
+	// so round keys are not recomputed on every call
+	virtual CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, 
+		size_t nPlainLength, u8* pCipher, size_t nCipherLength, 
+		const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength) = 0;
+	virtual CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, 
+		size_t nCipherLength, u8* pPlain, size_t nPlainLength, 
+		const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength) = 0;
+
+	// Authenticated encryption for modes with a tag (GetTagLength() > 0).
+	// Ciphertext is the same length as the plaintext and may be written in
+	// place. pAAD is authenticated but not encrypted
+	virtual CRYPTO_ERROR_CODES EncryptAuthData(const u8* pPlain, 
+		size_t nPlainLength, u8* pCipher, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength, const u8* pAAD, size_t nAADLength, 
+		u8* pTag, size_t nTagLength) = 0;
+	// Authenticated decryption. Returns CRYPT_ERROR_AUTH_FAILED and zeroes 
+	// pPlain if the tag does not match
+	virtual CRYPTO_ERROR_CODES DecryptAuthData(const u8* pCipher, 
+		size_t nCipherLength, u8* pPlain, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength, const u8* pAAD, size_t nAADLength, 
+		const u8* pTag, size_t nTagLength) = 0;
+
 	// Retrieve block size for the cipher in bytes
 	virtual uint GetBlockSize() = 0;
-
-private:
-
+	// Retrieve IV (nonce) length for the selected mode in bytes
+	virtual uint GetIVLength() = 0;
+	// Retrieve authentication tag length in bytes, 0 if mode is not 
+	// authenticated. EncryptData output grows by this amount
+	virtual uint GetTagLength() = 0;
+	// Retrieve the mode selected with Init
+	virtual CRYPTO_MODES GetMode() = 0;
+
+	// Split buffers of at least nThresholdBytes across nThreads threads 
+	// (0 = one per core) in modes that have no serial dependency. Output is
+	// identical to the single-threaded path
+	void SetParallelism(uint nThreads, size_t nThresholdBytes)
+	{
+		m_nThreads = nThreads;
+		m_nParallelThreshold = nThresholdBytes;
+	}
+
+protected:
+	uint m_nThreads = 0;
+	size_t m_nParallelThreshold = PARALLEL_THRESHOLD_DEFAULT;
 };
 
 
@@ -35,23 +95,53 @@ public:
 	// Init with requested encryption mode
 	CRYPTO_ERROR_CODES Init(CRYPTO_MODES nMode = CRYPTO_MODES::AES_ECB);
 	// Encrypt vPlain into vCipher
-	CRYPTO_ERROR_CODES EncryptData(u8Vec vPlain, u8Vec& vCipher, u8Vec vKey, 
-		u8Vec vIV);
+	CRYPTO_ERROR_CODES EncryptData(const u8Vec& vPlain, u8Vec& vCipher, 
+		const u8Vec& vKey, const u8Vec& vIV);
 	// Decrypt vCipher into vPlain
-	CRYPTO_ERROR_CODES DecryptData(u8Vec vCipher, u8Vec& vPlain, u8Vec vKey, 
-		u8Vec vIV);
+	CRYPTO_ERROR_CODES DecryptData(const u8Vec& vCipher, u8Vec& vPlain, 
+		const u8Vec& vKey, const u8Vec& vIV);
+	// Encrypt pPlain into pCipher (may be the same buffer)
+	CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, size_t nPlainLength, 
+		u8* pCipher, size_t nCipherLength, const u8* pKey, size_t nKeyLength, 
+		const u8* pIV, size_t nIVLength);
+	// Decrypt pCipher into pPlain (may be the same buffer)
+	CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, size_t nCipherLength, 
+		u8* pPlain, size_t nPlainLength, const u8* pKey, size_t nKeyLength, 
+		const u8* pIV, size_t nIVLength);
+	// Encrypt/Decrypt with a pre-expanded key schedule
+	CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, size_t nPlainLength, 
+		u8* pCipher, size_t nCipherLength, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength);
+	CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, size_t nCipherLength, 
+		u8* pPlain, size_t nPlainLength, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength);
+	// Authenticated encryption/decryption (AES_GCM only)
+	CRYPTO_ERROR_CODES EncryptAuthData(const u8* pPlain, size_t nPlainLength,
+		u8* pCipher, const CryptoKeySchedule& key, const u8* pIV, 
+		size_t nIVLength, const u8* pAAD, size_t nAADLength, u8* pTag, 
+		size_t nTagLength);
+	CRYPTO_ERROR_CODES DecryptAuthData(const u8* pCipher, size_t nCipherLength,
+		u8* pPlain, const CryptoKeySchedule& key, const u8* pIV, 
+		size_t nIVLength, const u8* pAAD, size_t nAADLength, const u8* pTag, 
+		size_t nTagLength);
 	// Retrieve block size for the cipher in bytes
 	uint GetBlockSize();
+	// Retrieve IV (nonce) length for the selected mode in bytes
+	uint GetIVLength();
+	// Retrieve authentication tag length in bytes
+	uint GetTagLength();
+	// Retrieve the mode selected with Init
+	CRYPTO_MODES GetMode() { return m_nMode; }
 
 	// Perform a basic test for each mode of AES encryption supported
 	static bool SelfTest(bool bPrintToConsole = false);
 
 private:
 	CRYPTO_ERROR_CODES Encrypt(const u8* pIn, size_t nBytesIn, u8* pOut, 
-		size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, 
+		size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
 		CRYPTO_MODES nMode);
 	CRYPTO_ERROR_CODES Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut, 
-		size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, 
+		size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
 		CRYPTO_MODES nMode);
 
 	CRYPTO_MODES m_nMode;
@@ -67,28 +157,118 @@ public:
 	// Init with requested encryption mode
 	CRYPTO_ERROR_CODES Init(CRYPTO_MODES nMode = CRYPTO_MODES::TDES_ECB);
 	// Encrypt vPlain into vCipher
-	CRYPTO_ERROR_CODES EncryptData(u8Vec vPlain, u8Vec& vCipher, u8Vec vKey, 
-		u8Vec vIV);
+	CRYPTO_ERROR_CODES EncryptData(const u8Vec& vPlain, u8Vec& vCipher, 
+		const u8Vec& vKey, const u8Vec& vIV);
 	// Decrypt vCipher into vPlain
-	CRYPTO_ERROR_CODES DecryptData(u8Vec vPlain, u8Vec& vCipher, u8Vec vKey, 
-		u8Vec vIV);
+	CRYPTO_ERROR_CODES DecryptData(const u8Vec& vCipher, u8Vec& vPlain, 
+		const u8Vec& vKey, const u8Vec& vIV);
+	// Encrypt pPlain into pCipher (may be the same buffer)
+	CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, size_t nPlainLength, 
+		u8* pCipher, size_t nCipherLength, const u8* pKey, size_t nKeyLength, 
+		const u8* pIV, size_t nIVLength);
+	// Decrypt pCipher into pPlain (may be the same buffer)
+	CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, size_t nCipherLength, 
+		u8* pPlain, size_t nPlainLength, const u8* pKey, size_t nKeyLength, 
+		const u8* pIV, size_t nIVLength);
+	// Encrypt/Decrypt with a pre-expanded key schedule
+	CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, size_t nPlainLength, 
+		u8* pCipher, size_t nCipherLength, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength);
+	CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, size_t nCipherLength, 
+		u8* pPlain, size_t nPlainLength, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength);
+	// Authenticated modes are not supported by TDES
+	CRYPTO_ERROR_CODES EncryptAuthData(const u8* /* pPlain */, 
+		size_t /* nPlainLength */, u8* /* pCipher */, 
+		const CryptoKeySchedule& /* key */, const u8* /* pIV */, 
+		size_t /* nIVLength */, const u8* /* pAAD */, size_t /* nAADLength */,
+		u8* /* pTag */, size_t /* nTagLength */) 
+	{ return CRYPTO_ERROR_CODES::CRYPT_ERROR_NOT_IMPLEMENTED; }
+	CRYPTO_ERROR_CODES DecryptAuthData(const u8* /* pCipher */, 
+		size_t /* nCipherLength */, u8* /* pPlain */, 
+		const CryptoKeySchedule& /* key */, const u8* /* pIV */, 
+		size_t /* nIVLength */, const u8* /* pAAD */, size_t /* nAADLength */,
+		const u8* /* pTag */, size_t /* nTagLength */) 
+	{ return CRYPTO_ERROR_CODES::CRYPT_ERROR_NOT_IMPLEMENTED; }
 	// Retrieve block size for the cipher in bytes
 	uint GetBlockSize();
+	// Retrieve IV length for the selected mode in bytes
+	uint GetIVLength() { return GetBlockSize(); }
+	// TDES modes are not authenticated
+	uint GetTagLength() { return 0; }
+	// Retrieve the mode selected with Init
+	CRYPTO_MODES GetMode() { return m_nMode; }
 
 	// Perform a basic test for each mode of DES encryption supported
 	static bool SelfTest(bool bPrintToConsole = false);
 
 private:
 	CRYPTO_ERROR_CODES Encrypt(const u8* pIn, size_t nBytesIn, u8* pOut, 
-		size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, 
+		size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
 		CRYPTO_MODES nMode);
 	CRYPTO_ERROR_CODES Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut, 
-		size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, 
+		size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
 		CRYPTO_MODES nMode);
 
 	CRYPTO_MODES m_nMode;
 };
 
+// ChaCha20-Poly1305 AEAD (RFC 8439). Constant-time in software, intended 
+// for hosts without AES instructions. Ciphertext is followed by the tag
+class CryptoChaCha : public ICrypto
+{
+public:
+	CryptoChaCha() : m_nMode(CRYPTO_MODES::CHACHA20_POLY1305) {}
+
+	// Init with requested encryption mode
+	CRYPTO_ERROR_CODES Init(
+		CRYPTO_MODES nMode = CRYPTO_MODES::CHACHA20_POLY1305);
+	// Encrypt vPlain into vCipher
+	CRYPTO_ERROR_CODES EncryptData(const u8Vec& vPlain, u8Vec& vCipher, 
+		const u8Vec& vKey, const u8Vec& vIV);
+	// Decrypt vCipher into vPlain
+	CRYPTO_ERROR_CODES DecryptData(const u8Vec& vCipher, u8Vec& vPlain, 
+		const u8Vec& vKey, const u8Vec& vIV);
+	// Encrypt pPlain into pCipher (may be the same buffer)
+	CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, size_t nPlainLength, 
+		u8* pCipher, size_t nCipherLength, const u8* pKey, size_t nKeyLength, 
+		const u8* pIV, size_t nIVLength);
+	// Decrypt pCipher into pPlain (may be the same buffer)
+	CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, size_t nCipherLength, 
+		u8* pPlain, size_t nPlainLength, const u8* pKey, size_t nKeyLength, 
+		const u8* pIV, size_t nIVLength);
+	// Encrypt/Decrypt with a pre-expanded key schedule
+	CRYPTO_ERROR_CODES EncryptData(const u8* pPlain, size_t nPlainLength, 
+		u8* pCipher, size_t nCipherLength, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength);
+	CRYPTO_ERROR_CODES DecryptData(const u8* pCipher, size_t nCipherLength, 
+		u8* pPlain, size_t nPlainLength, const CryptoKeySchedule& key, 
+		const u8* pIV, size_t nIVLength);
+	// Authenticated encryption/decryption with separate tag and AAD
+	CRYPTO_ERROR_CODES EncryptAuthData(const u8* pPlain, size_t nPlainLength,
+		u8* pCipher, const CryptoKeySchedule& key, const u8* pIV, 
+		size_t nIVLength, const u8* pAAD, size_t nAADLength, u8* pTag, 
+		size_t nTagLength);
+	CRYPTO_ERROR_CODES DecryptAuthData(const u8* pCipher, size_t nCipherLength,
+		u8* pPlain, const CryptoKeySchedule& key, const u8* pIV, 
+		size_t nIVLength, const u8* pAAD, size_t nAADLength, const u8* pTag, 
+		size_t nTagLength);
+	// Stream cipher, no padding required
+	uint GetBlockSize();
+	// Retrieve nonce length in bytes
+	uint GetIVLength();
+	// Retrieve authentication tag length in bytes
+	uint GetTagLength();
+	// Retrieve the mode selected with Init
+	CRYPTO_MODES GetMode() { return m_nMode; }
+
+	// Perform a basic test of ChaCha20-Poly1305
+	static bool SelfTest(bool bPrintToConsole = false);
+
+private:
+	CRYPTO_MODES m_nMode;
+};
+
 /*
 // DUKPT Block Cipher Schemes
 class CryptoDUKPT : ICrypto
@@ -113,9 +293,13 @@ class IHash {
 
 public:
 	// Hash data provided
-	virtual CRYPTO_ERROR_CODES HashData(u8Vec vData, u8Vec& vHash) = 0;
-	virtual CRYPTO_ERROR_CODES HashData(u8* pData, size_t nDataLength, 
+	virtual CRYPTO_ERROR_CODES HashData(const u8Vec& vData, u8Vec& vHash) = 0;
+	virtual CRYPTO_ERROR_CODES HashData(const u8* pData, size_t nDataLength, 
 		u8Vec& vHash) = 0;
+	// Hash into caller provided pHash without any allocation. nHashLength
+	// must be at least GetHashLength(), exactly that many bytes are written
+	virtual CRYPTO_ERROR_CODES HashData(const u8* pData, size_t nDataLength, 
+		u8* pHash, size_t nHashLength) = 0;
 
 	// Retrieve hash length for the algorithm in bytes
 	virtual size_t GetHashLength() = 0;
@@ -131,30 +315,95 @@ public:
 
 	CRYPTO_ERROR_CODES Init(HASH_MODES nMode = HASH_MODES::SHA256);
 
-	CRYPTO_ERROR_CODES HashData(u8Vec vData, u8Vec& vHash);
-	CRYPTO_ERROR_CODES HashData(u8* pData, size_t nDataLength, u8Vec& vHash);
+	CRYPTO_ERROR_CODES HashData(const u8Vec& vData, u8Vec& vHash);
+	CRYPTO_ERROR_CODES HashData(const u8* pData, size_t nDataLength, 
+		u8Vec& vHash);
+	CRYPTO_ERROR_CODES HashData(const u8* pData, size_t nDataLength, 
+		u8* pHash, size_t nHashLength);
 
 	size_t GetHashLength();
+
+	// Hash with the mode fixed at compile time, the digest size is part of
+	// the output type
+	template <HASH_MODES nMode>
+	static CRYPTO_ERROR_CODES Digest(const u8* pData, size_t nDataLength,
+		HashDigest<nMode>& digest)
+	{
+		static_assert(nMode >= HASH_MODES::SHA224 && 
+			nMode <= HASH_MODES::SHA512, "Digest requires a SHA mode");
+		return Hash(nMode, pData, nDataLength, digest.data(), digest.size());
+	}
+
+	// Stateless hash of pData with nMode into pHash
+	static CRYPTO_ERROR_CODES Hash(HASH_MODES nMode, const u8* pData, 
+		size_t nDataLength, u8* pHash, size_t nHashLength);
+
 private:
 	HASH_MODES m_nMode;
 };
 
+// Memory held by the Argon2 arena (see HashArgon2::SetArenaLimit)
+struct Argon2ArenaStats {
+	size_t nRegions = 0;		// Regions currently held
+	size_t nBytes = 0;			// Bytes currently held
+	size_t nHugePageBytes = 0;	// Bytes backed by explicit huge pages
+	size_t nInUseBytes = 0;		// Bytes held by running derivations
+	size_t nAllocations = 0;	// Matrices handed out
+	size_t nReuses = 0;			// Matrices served from a held region
+};
+
 class HashArgon2 : public IHash {
 
 public:
-	HashArgon2() : m_nMode(HASH_MODES::ARGON2ID), m_nHashLength(32) {}
+	HashArgon2() : m_nMode(HASH_MODES::ARGON2ID), 
+		m_nHashLength(GetHashModeLength(HASH_MODES::ARGON2ID)) {}
 
 	CRYPTO_ERROR_CODES Init(HASH_MODES nMode = HASH_MODES::ARGON2ID);
 
-	CRYPTO_ERROR_CODES HashData(u8Vec vData, u8Vec& vHash);
-	CRYPTO_ERROR_CODES HashData(u8* pData, size_t nDataLength, u8Vec& vHash);
+	CRYPTO_ERROR_CODES HashData(const u8Vec& vData, u8Vec& vHash);
+	CRYPTO_ERROR_CODES HashData(const u8* pData, size_t nDataLength, 
+		u8Vec& vHash);
+	CRYPTO_ERROR_CODES HashData(const u8* pData, size_t nDataLength, 
+		u8* pHash, size_t nHashLength);
 
 	void SetHashLength(uint nLength) { m_nHashLength = nLength; }
 	size_t GetHashLength() { return m_nHashLength; }
 
+	// Set cost parameters used by HashData. Lanes are processed on separate
+	// threads, so raising lanes with memory keeps wall-clock time level on
+	// multi-core hosts
+	CRYPTO_ERROR_CODES SetParams(const Argon2Params& params);
+	const Argon2Params& GetParams() const { return m_params; }
+	// Set salt used by HashData. An empty salt selects the all-zero salt
+	// every key was derived with before salts were recorded
+	CRYPTO_ERROR_CODES SetSalt(const u8Vec& vSalt);
+
+	// Find the strongest parameters whose derivation takes no longer than
+	// nTargetMs on this host without exceeding nMaxMemoryKiB. Lanes follow
+	// the core count, memory is raised first, then passes
+	static CRYPTO_ERROR_CODES Calibrate(uint nTargetMs, uint nMaxMemoryKiB,
+		Argon2Params& params, HASH_MODES nMode = HASH_MODES::ARGON2ID);
+
+	// Block fill kernel used on this CPU ("ref", "sse2", "ssse3", "avx2" or
+	// "avx512f"). The fastest supported kernel is selected automatically
+	static const char* GetKernelName();
+	// Force a kernel by name (nullptr for automatic selection). Fails if the
+	// kernel was not built or the CPU cannot run it. Not thread-safe
+	static CRYPTO_ERROR_CODES SetKernel(const char* pName);
+
+	// Memory matrices are kept in a process wide arena and reused by later
+	// derivations. Free regions beyond nMaxBytes are returned to the OS,
+	// 0 disables the arena. Default is 1 GiB
+	static void SetArenaLimit(size_t nMaxBytes);
+	// Return all free arena regions to the OS
+	static void ReleaseArena();
+	static Argon2ArenaStats GetArenaStats();
+
 private:
 	HASH_MODES m_nMode;
 	size_t m_nHashLength;
+	Argon2Params m_params;
+	u8Vec m_vSalt;
 };
 
 #endif // _ICRYPTO
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef _SECURE_MEMORY
+#define _SECURE_MEMORY
+
+#include <new>
+#include <string>
+#include <vector>
+#include "CryptoTypes.h"
+
+// Process wide pool for key material and plaintext. Memory is locked against
+// swapping (mlock/VirtualLock) and excluded from core dumps (MADV_DONTDUMP)
+// where the OS allows. Small blocks are carved from shared pages and recycled
+// through per-size free lists, larger ones are mapped individually. Every
+// block is wiped when it is freed, so containers using SecureAllocator need
+// no manual zeroization.
+
+struct SecureMemoryStats {
+	size_t nChunks = 0;			// Chunks carved into small blocks
+	size_t nBytes = 0;			// Bytes mapped, chunks and large blocks
+	size_t nLockedBytes = 0;	// Bytes the OS agreed to lock
+	size_t nInUse = 0;			// Blocks currently allocated
+	size_t nAllocations = 0;
+	size_t nReuses = 0;			// Allocations served from a free list
+};
+
+// Allocate nBytes of secure memory, nullptr on failure
+void* SecureAllocate(size_t nBytes);
+// Wipe and return a block. nBytes must match the allocation
+void SecureFree(void* pMemory, size_t nBytes);
+SecureMemoryStats SecureMemoryGetStats();
+
+// Standard allocator backed by the secure pool
+template<class T>
+class SecureAllocator {
+
+public:
+	typedef T value_type;
+
+	SecureAllocator() noexcept {}
+	template<class U>
+	SecureAllocator(const SecureAllocator<U>&) noexcept {}
+
+	T* allocate(size_t nCount)
+	{
+		if (nCount > (size_t)-1 / sizeof(T))
+			throw std::bad_alloc();
+		void* _pMemory = SecureAllocate(nCount * sizeof(T));
+		if (_pMemory == nullptr)
+			throw std::bad_alloc();
+		return (T*)_pMemory;
+	}
+	void deallocate(T* pMemory, size_t nCount) noexcept
+	{
+		SecureFree(pMemory, nCount * sizeof(T));
+	}
+};
+
+template<class T, class U>
+bool operator==(const SecureAllocator<T>&, const SecureAllocator<U>&)
+{
+	return true;
+}
+template<class T, class U>
+bool operator!=(const SecureAllocator<T>&, const SecureAllocator<U>&)
+{
+	return false;
+}
+
+typedef std::vector<u8, SecureAllocator<u8>> u8SecureVec;
+typedef std::basic_string<char, std::char_traits<char>, SecureAllocator<char>>
+	SecureString;
+
+#endif // _SECURE_MEMORY
@@ -0,0 +1,448 @@
+#include "ICrypto.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+
+Throughput benchmark for every CRYPTO_MODES and HASH_MODES value.
+
+Usage: crypto_bench [options]
+	--min-size <bytes>		Smallest buffer (default 16)
+	--max-size <bytes>		Largest buffer, up to 1G (default 1G)
+	--samples <n>			Timed samples per case (default 15)
+	--warmup <n>			Untimed warm-up samples per case (default 2)
+	--max-case-time <s>		Sample budget per case in seconds (default 10)
+	--threads <n>			ICrypto::SetParallelism thread count (default 1)
+	--parallel-threshold <bytes>	ICrypto::SetParallelism threshold
+	--filter <name>			Only run algorithms whose name contains <name>
+	--argon2-kernel <name>		Force an Argon2 fill kernel (ref, sse2, ssse3,
+					avx2, avx512f), default is automatic
+
+Sizes accept a K, M or G suffix. Buffers sweep from min to max in steps of
+4x. Results are written to stdout as JSON, progress to stderr.
+
+Each sample runs the operation enough times to last at least ~2 ms, so
+small buffers are not dominated by timer resolution. Cycles are read from
+the TSC where available, which counts at the nominal frequency rather than
+the current core clock.
+
+*/
+
+#define BENCH_MAX_SIZE ((size_t)1 << 30)
+#define BENCH_MIN_SAMPLE_SECONDS 0.002
+#define BENCH_ARGON2_MAX_SIZE 1024	// Argon2 cost does not scale with input
+
+struct BenchConfig {
+	size_t nMinSize = 16;
+	size_t nMaxSize = BENCH_MAX_SIZE;
+	uint nSamples = 15;
+	uint nWarmup = 2;
+	double dMaxCaseSeconds = 10.0;
+	uint nThreads = 1;
+	size_t nParallelThreshold = PARALLEL_THRESHOLD_DEFAULT;
+	std::string strFilter;
+	std::string strArgon2Kernel;
+};
+
+struct BenchSample {
+	double dSeconds;
+	double dCycles;
+};
+
+static bool HasCycleCounter()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return true;
+#else
+	return false;
+#endif
+}
+
+static unsigned long long ReadCycleCounter()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Parse a byte count with optional K/M/G suffix, 0 on error
+static size_t ParseSize(const std::string& strValue)
+{
+	char* _pEnd = nullptr;
+	unsigned long long _nValue = strtoull(strValue.c_str(), &_pEnd, 10);
+	if (_pEnd == strValue.c_str())
+		return 0;
+	switch (*_pEnd)
+	{
+	case '\0': break;
+	case 'k': case 'K': _nValue <<= 10; break;
+	case 'm': case 'M': _nValue <<= 20; break;
+	case 'g': case 'G': _nValue <<= 30; break;
+	default: return 0;
+	}
+	return (size_t)_nValue;
+}
+
+static double Percentile(std::vector<double> vValues, double dPercent)
+{
+	if (vValues.empty())
+		return 0.0;
+	std::sort(vValues.begin(), vValues.end());
+	double _dRank = dPercent / 100.0 * (vValues.size() - 1);
+	size_t _nLow = (size_t)std::floor(_dRank);
+	size_t _nHigh = (size_t)std::ceil(_dRank);
+	return vValues[_nLow] + (vValues[_nHigh] - vValues[_nLow]) *
+		(_dRank - _nLow);
+}
+
+static void PrintStats(std::ostream& out, const char* strName,
+	const std::vector<double>& vValues)
+{
+	out << "\"" << strName << "\": {"
+		<< "\"min\": " << Percentile(vValues, 0) << ", "
+		<< "\"p10\": " << Percentile(vValues, 10) << ", "
+		<< "\"p25\": " << Percentile(vValues, 25) << ", "
+		<< "\"median\": " << Percentile(vValues, 50) << ", "
+		<< "\"p75\": " << Percentile(vValues, 75) << ", "
+		<< "\"p90\": " << Percentile(vValues, 90) << ", "
+		<< "\"max\": " << Percentile(vValues, 100) << "}";
+}
+
+// Time fnOp over the configured samples. Returns false if fnOp fails
+static bool RunCase(const BenchConfig& config,
+	const std::function<bool()>& fnOp, std::vector<BenchSample>& vSamples,
+	uint& nIterations)
+{
+	using _clock = std::chrono::steady_clock;
+
+	// First warm-up call also sizes the batch for each sample
+	_clock::time_point _tStart = _clock::now();
+	if (!fnOp())
+		return false;
+	double _dSingle = std::chrono::duration<double>(_clock::now() - _tStart)
+		.count();
+	nIterations = 1;
+	if (_dSingle < BENCH_MIN_SAMPLE_SECONDS)
+		nIterations = (uint)std::ceil(BENCH_MIN_SAMPLE_SECONDS /
+			std::max(_dSingle, 1e-9));
+
+	for (uint i = 1; i < config.nWarmup; i++)
+	{
+		for (uint j = 0; j < nIterations; j++)
+			if (!fnOp())
+				return false;
+	}
+
+	// Slow cases are capped by the time budget, keeping at least 3 samples
+	uint _nSamples = config.nSamples;
+	double _dSampleEstimate = _dSingle * nIterations;
+	if (_dSampleEstimate * _nSamples > config.dMaxCaseSeconds)
+		_nSamples = std::max(3u, (uint)(config.dMaxCaseSeconds /
+			_dSampleEstimate));
+
+	vSamples.clear();
+	for (uint i = 0; i < _nSamples; i++)
+	{
+		unsigned long long _nCycleStart = ReadCycleCounter();
+		_tStart = _clock::now();
+		for (uint j = 0; j < nIterations; j++)
+			if (!fnOp())
+				return false;
+		double _dSeconds = std::chrono::duration<double>(_clock::now() -
+			_tStart).count();
+		unsigned long long _nCycles = ReadCycleCounter() - _nCycleStart;
+		vSamples.push_back({ _dSeconds / nIterations,
+			(double)_nCycles / nIterations });
+	}
+	return true;
+}
+
+static void PrintResult(std::ostream& out, bool& bFirst,
+	const std::string& strAlgorithm, const char* strKind,
+	const char* strOperation, size_t nKeyBits, size_t nBytes, uint nIterations,
+	const std::vector<BenchSample>& vSamples)
+{
+	std::vector<double> _vMBps, _vCyclesPerByte, _vMicroseconds;
+	for (const BenchSample& _sample : vSamples)
+	{
+		_vMBps.push_back(nBytes / _sample.dSeconds / 1e6);
+		_vCyclesPerByte.push_back(_sample.dCycles / nBytes);
+		_vMicroseconds.push_back(_sample.dSeconds * 1e6);
+	}
+
+	out << (bFirst ? "\n" : ",\n") << "    {"
+		<< "\"algorithm\": \"" << strAlgorithm << "\", "
+		<< "\"kind\": \"" << strKind << "\", "
+		<< "\"operation\": \"" << strOperation << "\", "
+		<< "\"key_bits\": " << nKeyBits << ", "
+		<< "\"buffer_bytes\": " << nBytes << ", "
+		<< "\"samples\": " << vSamples.size() << ", "
+		<< "\"iterations_per_sample\": " << nIterations << ",\n      ";
+	PrintStats(out, "mb_per_s", _vMBps);
+	out << ",\n      ";
+	PrintStats(out, "us_per_op", _vMicroseconds);
+	if (HasCycleCounter())
+	{
+		out << ",\n      ";
+		PrintStats(out, "cycles_per_byte", _vCyclesPerByte);
+	}
+	out << "}";
+	bFirst = false;
+}
+
+static std::vector<size_t> GetKeySizes(CRYPTO_MODES nMode)
+{
+	switch (nMode)
+	{
+	case CRYPTO_MODES::AES_ECB:
+	case CRYPTO_MODES::AES_CBC:
+	case CRYPTO_MODES::AES_CTR:
+	case CRYPTO_MODES::AES_GCM:
+		return { 16, 24, 32 };
+	case CRYPTO_MODES::TDES_ECB:
+	case CRYPTO_MODES::TDES_CBC:
+		return { 16, 24 };	// 2-key and 3-key
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+		return { 32 };
+	default:
+		return {};
+	}
+}
+
+static void BenchCiphers(const BenchConfig& config, std::ostream& out,
+	bool& bFirst)
+{
+	CryptoAES _aes;
+	CryptoTDES _tdes;
+	CryptoChaCha _chacha;
+
+	for (int m = (int)CRYPTO_MODES::BEGIN + 1; m < (int)CRYPTO_MODES::LAST; m++)
+	{
+		CRYPTO_MODES _nMode = (CRYPTO_MODES)m;
+		std::string _strName = GetCryptoModeStr(_nMode);
+		if (_strName.find(config.strFilter) == std::string::npos)
+			continue;
+
+		ICrypto* _pCrypto;
+		if (_aes.Init(_nMode) == CRYPTO_ERROR_CODES::CRYPT_OK)
+			_pCrypto = &_aes;
+		else if (_tdes.Init(_nMode) == CRYPTO_ERROR_CODES::CRYPT_OK)
+			_pCrypto = &_tdes;
+		else if (_chacha.Init(_nMode) == CRYPTO_ERROR_CODES::CRYPT_OK)
+			_pCrypto = &_chacha;
+		else
+		{
+			std::cerr << "Skipping " << _strName << ": no implementation\n";
+			continue;
+		}
+		_pCrypto->SetParallelism(config.nThreads, config.nParallelThreshold);
+
+		size_t _nTagLength = _pCrypto->GetTagLength();
+		u8Vec _vIV(_pCrypto->GetIVLength(), 0x5a);
+		for (size_t _nKeyLength : GetKeySizes(_nMode))
+		{
+			u8Vec _vKey(_nKeyLength, 0xa5);
+			CryptoKeySchedule _schedule;
+			if (_schedule.Init(_nMode, _vKey.data(), _vKey.size()) !=
+				CRYPTO_ERROR_CODES::CRYPT_OK)
+			{
+				std::cerr << "Skipping " << _strName << " " <<
+					_nKeyLength * 8 << "-bit: key schedule failed\n";
+				continue;
+			}
+
+			for (size_t _nBytes = config.nMinSize; _nBytes <= config.nMaxSize;
+				_nBytes *= 4)
+			{
+				// Block modes need whole blocks
+				if (_nBytes % _pCrypto->GetBlockSize() != 0)
+					continue;
+
+				std::cerr << _strName << " " << _nKeyLength * 8 << "-bit "
+					<< _nBytes << " B\n";
+				u8Vec _vPlain(_nBytes, 0x3c);
+				u8Vec _vCipher(_nBytes + _nTagLength);
+				std::vector<BenchSample> _vSamples;
+				uint _nIterations;
+
+				auto _fnEncrypt = [&]() {
+					return _pCrypto->EncryptData(_vPlain.data(),
+						_vPlain.size(), _vCipher.data(), _vCipher.size(),
+						_schedule, _vIV.data(), _vIV.size()) ==
+						CRYPTO_ERROR_CODES::CRYPT_OK;
+				};
+				if (!RunCase(config, _fnEncrypt, _vSamples,
+					_nIterations))
+				{
+					std::cerr << "Encryption failed\n";
+					continue;
+				}
+				PrintResult(out, bFirst, _strName, "cipher", "encrypt",
+					_nKeyLength * 8, _nBytes, _nIterations, _vSamples);
+
+				// Decrypt from the last valid ciphertext so tags verify
+				auto _fnDecrypt = [&]() {
+					return _pCrypto->DecryptData(_vCipher.data(),
+						_vCipher.size(), _vPlain.data(), _vPlain.size(),
+						_schedule, _vIV.data(), _vIV.size()) ==
+						CRYPTO_ERROR_CODES::CRYPT_OK;
+				};
+				if (!RunCase(config, _fnDecrypt, _vSamples,
+					_nIterations))
+				{
+					std::cerr << "Decryption failed\n";
+					continue;
+				}
+				PrintResult(out, bFirst, _strName, "cipher", "decrypt",
+					_nKeyLength * 8, _nBytes, _nIterations, _vSamples);
+			}
+		}
+	}
+}
+
+static void BenchHashes(const BenchConfig& config, std::ostream& out,
+	bool& bFirst)
+{
+	for (int m = (int)HASH_MODES::BEGIN + 1; m < (int)HASH_MODES::LAST; m++)
+	{
+		HASH_MODES _nMode = (HASH_MODES)m;
+		std::string _strName = GetHashModeStr(_nMode);
+		if (_strName.find(config.strFilter) == std::string::npos)
+			continue;
+
+		HashSHA _sha;
+		HashArgon2 _argon2;
+		IHash* _pHash;
+		size_t _nMaxSize = config.nMaxSize;
+		if (_sha.Init(_nMode) == CRYPTO_ERROR_CODES::CRYPT_OK)
+			_pHash = &_sha;
+		else if (_argon2.Init(_nMode) == CRYPTO_ERROR_CODES::CRYPT_OK)
+		{
+			_pHash = &_argon2;
+			_nMaxSize = std::min(_nMaxSize, (size_t)BENCH_ARGON2_MAX_SIZE);
+		}
+		else
+		{
+			std::cerr << "Skipping " << _strName << ": no implementation\n";
+			continue;
+		}
+
+		for (size_t _nBytes = config.nMinSize; _nBytes <= _nMaxSize;
+			_nBytes *= 4)
+		{
+			std::cerr << _strName << " " << _nBytes << " B\n";
+			u8Vec _vData(_nBytes, 0x3c);
+			u8 _hash[HASH_MAX_LENGTH];
+			std::vector<BenchSample> _vSamples;
+			uint _nIterations;
+
+			auto _fnHash = [&]() {
+				return _pHash->HashData(_vData.data(), _vData.size(), _hash,
+					sizeof(_hash)) == CRYPTO_ERROR_CODES::CRYPT_OK;
+			};
+			if (!RunCase(config, _fnHash, _vSamples, _nIterations))
+			{
+				std::cerr << "Hashing failed\n";
+				continue;
+			}
+			PrintResult(out, bFirst, _strName, "hash", "hash", 0, _nBytes,
+				_nIterations, _vSamples);
+		}
+	}
+}
+
+static bool ParseArgs(int argc, char** argv, BenchConfig& config)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string _strArg = argv[i];
+		if (i + 1 >= argc)
+			return false;
+		std::string _strValue = argv[++i];
+
+		if (_strArg == "--min-size")
+			config.nMinSize = ParseSize(_strValue);
+		else if (_strArg == "--max-size")
+			config.nMaxSize = ParseSize(_strValue);
+		else if (_strArg == "--samples")
+			config.nSamples = (uint)strtoul(_strValue.c_str(), nullptr, 10);
+		else if (_strArg == "--warmup")
+			config.nWarmup = (uint)strtoul(_strValue.c_str(), nullptr, 10);
+		else if (_strArg == "--max-case-time")
+			config.dMaxCaseSeconds = strtod(_strValue.c_str(), nullptr);
+		else if (_strArg == "--threads")
+			config.nThreads = (uint)strtoul(_strValue.c_str(), nullptr, 10);
+		else if (_strArg == "--parallel-threshold")
+			config.nParallelThreshold = ParseSize(_strValue);
+		else if (_strArg == "--filter")
+			config.strFilter = _strValue;
+		else if (_strArg == "--argon2-kernel")
+			config.strArgon2Kernel = _strValue;
+		else
+			return false;
+	}
+
+	return config.nMinSize > 0 && config.nMinSize <= config.nMaxSize &&
+		config.nMaxSize <= BENCH_MAX_SIZE && config.nSamples > 0 &&
+		config.nWarmup > 0;
+}
+
+int main(int argc, char** argv)
+{
+	BenchConfig _config;
+	if (!ParseArgs(argc, argv, _config))
+	{
+		std::cerr << "Usage: crypto_bench [--min-size N] [--max-size N (<= 1G)]"
+			" [--samples N] [--warmup N] [--max-case-time S] [--threads N]"
+			" [--parallel-threshold N] [--filter NAME]"
+			" [--argon2-kernel NAME]\n";
+		return 1;
+	}
+	if (!_config.strArgon2Kernel.empty() && HashArgon2::SetKernel(
+		_config.strArgon2Kernel.c_str()) != CRYPTO_ERROR_CODES::CRYPT_OK)
+	{
+		std::cerr << "Argon2 kernel " << _config.strArgon2Kernel << 
+			" not available on this host\n";
+		return 1;
+	}
+
+	std::ostream& _out = std::cout;
+	_out << std::setprecision(6);
+	_out << "{\n  \"config\": {"
+		<< "\"min_size\": " << _config.nMinSize << ", "
+		<< "\"max_size\": " << _config.nMaxSize << ", "
+		<< "\"samples\": " << _config.nSamples << ", "
+		<< "\"warmup\": " << _config.nWarmup << ", "
+		<< "\"threads\": " << _config.nThreads << ", "
+		<< "\"parallel_threshold\": " << _config.nParallelThreshold << ", "
+		<< "\"hardware_threads\": " << std::thread::hardware_concurrency()
+		<< ", "
+		<< "\"cycle_counter\": \"" << (HasCycleCounter() ? "tsc" : "none")
+		<< "\", "
+		<< "\"argon2_kernel\": \"" << HashArgon2::GetKernelName()
+		<< "\"},\n  \"results\": [";
+
+	bool _bFirst = true;
+	BenchCiphers(_config, _out, _bFirst);
+	BenchHashes(_config, _out, _bFirst);
+
+	_out << "\n  ]\n}" << std::endl;
+	return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _ARGON2_ARENA
+#define _ARGON2_ARENA
+
+#include "ICrypto.h"
+
+// Process wide pool of Argon2 memory matrices, installed through the argon2
+// allocate_cbk/free_cbk hooks. Regions are pre-faulted, backed by huge pages
+// where the OS allows and reused by later derivations of the same or smaller
+// size. argon2 wipes the matrix before handing it back, so a reused region 
+// never holds a previous derivation's state.
+
+// argon2 allocate_fptr, returns ARGON2_OK or ARGON2_MEMORY_ALLOCATION_ERROR
+int Argon2ArenaAllocate(uint8_t** ppMemory, size_t nBytes);
+// argon2 deallocate_fptr
+void Argon2ArenaFree(uint8_t* pMemory, size_t nBytes);
+
+// Largest region handed out for nBytes, the size a new mapping may be 
+// rounded up to. Free regions beyond it are not reused for nBytes, so a 
+// derivation never holds more than this
+size_t Argon2ArenaGetRegionSize(size_t nBytes);
+
+// Free regions are released once the arena holds more than nMaxBytes
+void Argon2ArenaSetLimit(size_t nMaxBytes);
+// Release every free region
+void Argon2ArenaRelease();
+Argon2ArenaStats Argon2ArenaGetStats();
+
+#endif // _ARGON2_ARENA
@@ -0,0 +1,36 @@
+#ifndef _CRYPTO_PARALLEL
+#define _CRYPTO_PARALLEL
+
+#include "CryptoTypes.h"
+#include <functional>
+
+// Callback processing blocks [nFirstBlock, nFirstBlock + nNumBlocks) of range
+// number nRange
+typedef std::function<bool(uint nRange, size_t nFirstBlock, 
+	size_t nNumBlocks)> block_range_fn;
+
+// Callback running CBC decryption over nLength bytes using chaining block pIV
+typedef std::function<bool(u8* pIV, const u8* pIn, size_t nLength, 
+	u8* pOut)> cbc_range_fn;
+
+// Resolve requested thread count, 0 selects one thread per hardware core
+uint GetThreadCount(uint nRequested);
+
+// Number of ranges RunBlockRanges splits nBlocks into
+uint GetRangeCount(size_t nBlocks, uint nThreads);
+// First block of range nRange when nBlocks are split into nRanges ranges
+size_t GetRangeStart(size_t nBlocks, uint nRanges, uint nRange);
+
+// Split nBlocks into at most nThreads contiguous ranges and run fnWork for
+// each range on its own thread. The calling thread processes the first range.
+// Returns false if any range failed.
+bool RunBlockRanges(size_t nBlocks, uint nThreads, 
+	const block_range_fn& fnWork);
+
+// CBC decryption split into ranges. The chaining block of every range is
+// captured before any thread starts, so pOut may equal pIn.
+bool RunCBCDecryptRanges(const u8* pIn, size_t nBytesIn, u8* pOut, 
+	const u8* pIV, size_t nBlockSize, uint nThreads, 
+	const cbc_range_fn& fnDecrypt);
+
+#endif // _CRYPTO_PARALLEL
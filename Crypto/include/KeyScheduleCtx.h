@@ -0,0 +1,61 @@
+#ifndef _KEY_SCHEDULE_CTX
+#define _KEY_SCHEDULE_CTX
+
+#include "CryptoTypes.h"
+#include "SecureMemory.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/chachapoly.h"
+#include "mbedtls/des.h"
+#include "mbedtls/gcm.h"
+
+#include <mutex>
+
+enum class KEY_SCHEDULE_TYPE {
+	NONE,
+	AES,
+	TDES,
+	CHACHA,
+};
+
+// Cipher contexts held by CryptoKeySchedule
+struct KeyScheduleCtx {
+	KEY_SCHEDULE_TYPE nType;
+	size_t nKeyLength;		// Key length in bytes
+	// Key value, for operations that need a private AEAD context such as
+	// CipherStream. AES round key 0 is the key itself, so this adds no
+	// exposure beyond the round keys
+	u8 key[32];
+
+	// AES round keys
+	mbedtls_aes_context aesEnc;
+	mbedtls_aes_context aesDec;
+	// AES-GCM key and hash subkey table
+	mbedtls_gcm_context gcm;
+
+	// ChaCha20-Poly1305 key
+	mbedtls_chachapoly_context chachapoly;
+
+	// AEAD contexts keep per-message state, so calls sharing the schedule 
+	// are serialized with aeadLock
+	std::mutex aeadLock;
+
+	// TDES round keys
+	mbedtls_des3_context desEnc;
+	mbedtls_des3_context desDec;
+
+	// Key material lives in the secure pool, wiped when freed
+	static void* operator new(size_t nBytes)
+	{
+		void* _pMemory = SecureAllocate(nBytes);
+		if (_pMemory == nullptr)
+			throw std::bad_alloc();
+		return _pMemory;
+	}
+
+	static void operator delete(void* pMemory, size_t nBytes)
+	{
+		SecureFree(pMemory, nBytes);
+	}
+};
+
+#endif // _KEY_SCHEDULE_CTX
@@ -0,0 +1,222 @@
+#include "Argon2Arena.h"
+#include "argon2.h"
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+#define ARENA_DEFAULT_LIMIT ((size_t)1 << 30)
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+namespace
+{
+	struct ArenaRegion
+	{
+		u8* pMemory;
+		size_t nSize;
+		bool bHugePages;	// Explicit huge page mapping (MAP_HUGETLB)
+		bool bInUse;
+	};
+
+	// Process wide arena, regions are unmapped at exit
+	struct ArenaCtx
+	{
+		~ArenaCtx();
+
+		std::vector<ArenaRegion> vRegions;
+		size_t nLimit = ARENA_DEFAULT_LIMIT;
+		size_t nAllocations = 0;
+		size_t nReuses = 0;
+		std::mutex lock;
+	};
+
+	ArenaCtx g_arena;
+}
+
+static size_t RoundUp(size_t nValue, size_t nMultiple)
+{
+	return (nValue + nMultiple - 1) / nMultiple * nMultiple;
+}
+
+// Map a pre-faulted region of at least nBytes. Explicit huge pages are tried
+// first, then normal pages aligned and advised for transparent huge pages
+static bool MapRegion(size_t nBytes, ArenaRegion& region)
+{
+	region.bInUse = false;
+	region.bHugePages = false;
+#ifdef _WIN32
+	region.nSize = nBytes;
+	region.pMemory = (u8*)VirtualAlloc(nullptr, nBytes, 
+		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (region.pMemory == nullptr)
+		return false;
+#else
+	void* _pMap;
+#ifdef MAP_HUGETLB
+	// Reserved up front, fails cleanly if the huge page pool is too small
+	region.nSize = RoundUp(nBytes, HUGE_PAGE_SIZE);
+	_pMap = mmap(nullptr, region.nSize, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if (_pMap != MAP_FAILED)
+	{
+		region.pMemory = (u8*)_pMap;
+		region.bHugePages = true;
+		return true;
+	}
+#endif
+	// Over-map so the region can start on a huge page boundary, then trim
+	region.nSize = RoundUp(nBytes, (size_t)sysconf(_SC_PAGESIZE));
+	size_t _nMapSize = region.nSize + HUGE_PAGE_SIZE;
+	_pMap = mmap(nullptr, _nMapSize, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (_pMap == MAP_FAILED)
+		return false;
+	u8* _pStart = (u8*)RoundUp((size_t)_pMap, HUGE_PAGE_SIZE);
+	size_t _nHead = _pStart - (u8*)_pMap;
+	if (_nHead > 0)
+		munmap(_pMap, _nHead);
+	if (_nMapSize - _nHead - region.nSize > 0)
+		munmap(_pStart + region.nSize, _nMapSize - _nHead - region.nSize);
+	region.pMemory = _pStart;
+#ifdef MADV_HUGEPAGE
+	madvise(region.pMemory, region.nSize, MADV_HUGEPAGE);
+#endif
+#endif
+	// Fault every page in now rather than during the first derivation
+	memset(region.pMemory, 0, region.nSize);
+	return true;
+}
+
+static void UnmapRegion(ArenaRegion& region)
+{
+#ifdef _WIN32
+	VirtualFree(region.pMemory, 0, MEM_RELEASE);
+#else
+	munmap(region.pMemory, region.nSize);
+#endif
+	region.pMemory = nullptr;
+}
+
+ArenaCtx::~ArenaCtx()
+{
+	for (ArenaRegion& region : vRegions)
+		if (!region.bInUse)
+			UnmapRegion(region);
+}
+
+// Drop free regions until the arena fits its limit. Caller holds the lock
+static void TrimArena()
+{
+	size_t _nHeld = 0;
+	for (const ArenaRegion& region : g_arena.vRegions)
+		_nHeld += region.nSize;
+
+	for (size_t i = g_arena.vRegions.size(); i-- > 0 && 
+		_nHeld > g_arena.nLimit; )
+	{
+		ArenaRegion& region = g_arena.vRegions[i];
+		if (region.bInUse)
+			continue;
+		_nHeld -= region.nSize;
+		UnmapRegion(region);
+		g_arena.vRegions.erase(g_arena.vRegions.begin() + i);
+	}
+}
+
+int Argon2ArenaAllocate(uint8_t** ppMemory, size_t nBytes)
+{
+	std::lock_guard<std::mutex> _lock(g_arena.lock);
+	g_arena.nAllocations++;
+
+	// Smallest free region that fits, but no larger than a new mapping so 
+	// the caller's accounting holds
+	size_t _nMaxSize = Argon2ArenaGetRegionSize(nBytes);
+	ArenaRegion* _pBest = nullptr;
+	for (ArenaRegion& region : g_arena.vRegions)
+		if (!region.bInUse && region.nSize >= nBytes && 
+			region.nSize <= _nMaxSize &&
+			(_pBest == nullptr || region.nSize < _pBest->nSize))
+			_pBest = &region;
+	if (_pBest != nullptr)
+	{
+		g_arena.nReuses++;
+		_pBest->bInUse = true;
+		*ppMemory = _pBest->pMemory;
+		return ARGON2_OK;
+	}
+
+	// Make room for the new region before mapping it
+	size_t _nLimit = g_arena.nLimit;
+	g_arena.nLimit = _nLimit > nBytes ? _nLimit - nBytes : 0;
+	TrimArena();
+	g_arena.nLimit = _nLimit;
+
+	ArenaRegion _region;
+	if (!MapRegion(nBytes, _region))
+		return ARGON2_MEMORY_ALLOCATION_ERROR;
+	_region.bInUse = true;
+	g_arena.vRegions.push_back(_region);
+	*ppMemory = _region.pMemory;
+	return ARGON2_OK;
+}
+
+size_t Argon2ArenaGetRegionSize(size_t nBytes)
+{
+	return RoundUp(nBytes, HUGE_PAGE_SIZE);
+}
+
+void Argon2ArenaFree(uint8_t* pMemory, size_t /* nBytes */)
+{
+	// argon2 has already wiped the matrix (clear_internal_memory)
+	std::lock_guard<std::mutex> _lock(g_arena.lock);
+	for (ArenaRegion& region : g_arena.vRegions)
+	{
+		if (region.pMemory == pMemory)
+		{
+			region.bInUse = false;
+			break;
+		}
+	}
+	TrimArena();
+}
+
+void Argon2ArenaSetLimit(size_t nMaxBytes)
+{
+	std::lock_guard<std::mutex> _lock(g_arena.lock);
+	g_arena.nLimit = nMaxBytes;
+	TrimArena();
+}
+
+void Argon2ArenaRelease()
+{
+	std::lock_guard<std::mutex> _lock(g_arena.lock);
+	size_t _nLimit = g_arena.nLimit;
+	g_arena.nLimit = 0;
+	TrimArena();
+	g_arena.nLimit = _nLimit;
+}
+
+Argon2ArenaStats Argon2ArenaGetStats()
+{
+	std::lock_guard<std::mutex> _lock(g_arena.lock);
+	Argon2ArenaStats _stats;
+	for (const ArenaRegion& region : g_arena.vRegions)
+	{
+		_stats.nRegions++;
+		_stats.nBytes += region.nSize;
+		if (region.bHugePages)
+			_stats.nHugePageBytes += region.nSize;
+		if (region.bInUse)
+			_stats.nInUseBytes += region.nSize;
+	}
+	_stats.nAllocations = g_arena.nAllocations;
+	_stats.nReuses = g_arena.nReuses;
+	return _stats;
+}
@@ -1,6 +1,10 @@
 #include "ICrypto.h"
+#include "KeyScheduleCtx.h"
+#include "CryptoParallel.h"
 #include "mbedtls/aes.h"
+#include "mbedtls/gcm.h"
 
+#include <algorithm>
 #include <iostream>
 #ifdef __GNUC__
 #include <cstring>
@@ -11,6 +15,29 @@
 #define N_COL 4
 #define N_BLOCK (N_ROW * N_COL)
 
+#define GCM_IV_LENGTH 12	// 96-bit nonce, used directly as the initial counter
+#define GCM_TAG_LENGTH 16
+
+// Check buffer sizes and IV requirements for nMode
+static CRYPTO_ERROR_CODES CheckParams(size_t nBytesIn, size_t nBytesOut,
+	const u8* pIV, CRYPTO_MODES nMode);
+// Run nMode over pIn into pOut using the round keys already set in pCtx.
+// Buffers of at least nThreshold bytes may be split across nThreads threads
+static CRYPTO_ERROR_CODES Crypt(mbedtls_aes_context* pCtx, int nOperation,
+	const u8* pIn, size_t nBytesIn, u8* pOut, const u8* pIV, 
+	CRYPTO_MODES nMode, uint nThreads, size_t nThreshold);
+// CTR over independent counter ranges, one range per thread
+static CRYPTO_ERROR_CODES CryptCTRParallel(mbedtls_aes_context* pCtx,
+	const u8* pIn, size_t nBytesIn, u8* pOut, const u8* pIV, uint nThreads);
+// GCM encryption of pIn into pOut, tag written to pTag
+static CRYPTO_ERROR_CODES EncryptGCM(mbedtls_gcm_context* pCtx, 
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD, 
+	size_t nAADLength, u8* pTag);
+// GCM decryption of pIn into pOut, verified against pTag
+static CRYPTO_ERROR_CODES DecryptGCM(mbedtls_gcm_context* pCtx, 
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD, 
+	size_t nAADLength, const u8* pTag);
+
 CRYPTO_ERROR_CODES CryptoAES::Init(
 	CRYPTO_MODES nMode /* = CRYPTO_MODES::AES_ECB */)
 {
@@ -19,6 +46,7 @@ CRYPTO_ERROR_CODES CryptoAES::Init(
 	case CRYPTO_MODES::AES_ECB:
 	case CRYPTO_MODES::AES_CBC:
 	case CRYPTO_MODES::AES_CTR:
+	case CRYPTO_MODES::AES_GCM:
 		break;
 	default:
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
@@ -28,59 +56,183 @@ CRYPTO_ERROR_CODES CryptoAES::Init(
 }
 
 // Encrypt vPlain into vCipher
-CRYPTO_ERROR_CODES CryptoAES::EncryptData(u8Vec vPlain, u8Vec& vCipher, 
-	u8Vec vKey, u8Vec vIV)
+CRYPTO_ERROR_CODES CryptoAES::EncryptData(const u8Vec& vPlain, u8Vec& vCipher, 
+	const u8Vec& vKey, const u8Vec& vIV)
 {
-	// Make sure vIV is correct size or empty
-	if (vIV.size() != 0 && vIV.size() != N_BLOCK)
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	// Resize output vector. For AES, input size == output size, plus the tag
+	// for authenticated modes
+	vCipher.resize(vPlain.size() + GetTagLength());
 
-	// Resize output vector. For AES, input size == output size
-	vCipher.resize(vPlain.size());
-
-	return Encrypt(&vPlain[0], vPlain.size(), &vCipher[0], vCipher.size(), 
-		&vKey[0], vKey.size(), vIV.size() == 0 ? nullptr : &vIV[0], m_nMode);
+	return EncryptData(vPlain.data(), vPlain.size(), vCipher.data(), 
+		vCipher.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
 }
 
 // Decrypt vCipher into vPlain
-CRYPTO_ERROR_CODES CryptoAES::DecryptData(u8Vec vCipher, u8Vec& vPlain, 
-	u8Vec vKey, u8Vec vIV)
+CRYPTO_ERROR_CODES CryptoAES::DecryptData(const u8Vec& vCipher, u8Vec& vPlain, 
+	const u8Vec& vKey, const u8Vec& vIV)
 {
-	// Make sure vIV is correct size or empty
-	if (vIV.size() != 0 && vIV.size() != N_BLOCK)
+	// Resize output vector. For AES, input size == output size, less the tag
+	// for authenticated modes
+	if (vCipher.size() < GetTagLength())
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	vPlain.resize(vCipher.size() - GetTagLength());
+
+	return DecryptData(vCipher.data(), vCipher.size(), vPlain.data(), 
+		vPlain.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+}
 
-	// Resize output vector. For AES, input size == output size
-	vPlain.resize(vCipher.size());
+// Encrypt pPlain into pCipher (may be the same buffer)
+CRYPTO_ERROR_CODES CryptoAES::EncryptData(const u8* pPlain, 
+	size_t nPlainLength, u8* pCipher, size_t nCipherLength, const u8* pKey, 
+	size_t nKeyLength, const u8* pIV, size_t nIVLength)
+{
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != GetIVLength())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 
-	return Decrypt(&vCipher[0], vCipher.size(), &vPlain[0], vPlain.size(), 
-		&vKey[0], vKey.size(), vIV.size() == 0 ? nullptr : &vIV[0], m_nMode);
+	return Encrypt(pPlain, nPlainLength, pCipher, nCipherLength, pKey, 
+		nKeyLength, nIVLength == 0 ? nullptr : pIV, m_nMode);
 }
 
-// Retrieve block size for the cipher in bytes
-uint CryptoAES::GetBlockSize()
+// Decrypt pCipher into pPlain (may be the same buffer)
+CRYPTO_ERROR_CODES CryptoAES::DecryptData(const u8* pCipher, 
+	size_t nCipherLength, u8* pPlain, size_t nPlainLength, const u8* pKey, 
+	size_t nKeyLength, const u8* pIV, size_t nIVLength)
 {
-	return N_BLOCK;
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != GetIVLength())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	return Decrypt(pCipher, nCipherLength, pPlain, nPlainLength, pKey, 
+		nKeyLength, nIVLength == 0 ? nullptr : pIV, m_nMode);
 }
 
-CRYPTO_ERROR_CODES CryptoAES::Encrypt(const u8* pIn, size_t nBytesIn, u8* pOut, 
-	size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, CRYPTO_MODES nMode)
+// Encrypt with a pre-expanded key schedule
+CRYPTO_ERROR_CODES CryptoAES::EncryptData(const u8* pPlain, 
+	size_t nPlainLength, u8* pCipher, size_t nCipherLength, 
+	const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength)
 {
-	// Parameter checking
-	switch (nMode)
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != GetIVLength())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (!key.IsValidFor(m_nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	const u8* _pIV = nIVLength == 0 ? nullptr : pIV;
+	if (m_nMode == CRYPTO_MODES::AES_GCM)
 	{
-	case CRYPTO_MODES::AES_ECB:
-	case CRYPTO_MODES::AES_CBC:
-		break;
-	case CRYPTO_MODES::AES_CTR:
-		if (pIV == nullptr)
-			// Don't allow zero IV for CTR since it is used as the nonce counter
+		// Tag is appended to the ciphertext
+		if (_pIV == nullptr || nCipherLength < nPlainLength + GCM_TAG_LENGTH)
 			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
-		break;
-	default:
+		std::lock_guard<std::mutex> _lock(key.GetContext()->aeadLock);
+		return EncryptGCM(&key.GetContext()->gcm, pPlain, nPlainLength, 
+			pCipher, _pIV, nullptr, 0, pCipher + nPlainLength);
+	}
+
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nPlainLength, nCipherLength, _pIV,
+		m_nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	return Crypt(&key.GetContext()->aesEnc, MBEDTLS_AES_ENCRYPT, pPlain, 
+		nPlainLength, pCipher, _pIV, m_nMode, m_nThreads, m_nParallelThreshold);
+}
+
+// Decrypt with a pre-expanded key schedule
+CRYPTO_ERROR_CODES CryptoAES::DecryptData(const u8* pCipher, 
+	size_t nCipherLength, u8* pPlain, size_t nPlainLength, 
+	const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength)
+{
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != GetIVLength())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (!key.IsValidFor(m_nMode))
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	const u8* _pIV = nIVLength == 0 ? nullptr : pIV;
+	if (m_nMode == CRYPTO_MODES::AES_GCM)
+	{
+		// Tag follows the ciphertext
+		if (_pIV == nullptr || nCipherLength < GCM_TAG_LENGTH ||
+			nPlainLength < nCipherLength - GCM_TAG_LENGTH)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		nCipherLength -= GCM_TAG_LENGTH;
+		std::lock_guard<std::mutex> _lock(key.GetContext()->aeadLock);
+		return DecryptGCM(&key.GetContext()->gcm, pCipher, nCipherLength, 
+			pPlain, _pIV, nullptr, 0, pCipher + nCipherLength);
 	}
 
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nCipherLength, nPlainLength, _pIV,
+		m_nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	// CTR decryption is same as encryption and uses the encryption key
+	if (m_nMode == CRYPTO_MODES::AES_CTR)
+		return Crypt(&key.GetContext()->aesEnc, MBEDTLS_AES_ENCRYPT, pCipher, 
+			nCipherLength, pPlain, _pIV, m_nMode, m_nThreads, 
+			m_nParallelThreshold);
+
+	return Crypt(&key.GetContext()->aesDec, MBEDTLS_AES_DECRYPT, pCipher, 
+		nCipherLength, pPlain, _pIV, m_nMode, m_nThreads, m_nParallelThreshold);
+}
+
+// Authenticated encryption (AES_GCM only)
+CRYPTO_ERROR_CODES CryptoAES::EncryptAuthData(const u8* pPlain, 
+	size_t nPlainLength, u8* pCipher, const CryptoKeySchedule& key, 
+	const u8* pIV, size_t nIVLength, const u8* pAAD, size_t nAADLength, 
+	u8* pTag, size_t nTagLength)
+{
+	if (m_nMode != CRYPTO_MODES::AES_GCM)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_NOT_IMPLEMENTED;
+	if (pIV == nullptr || nIVLength != GCM_IV_LENGTH || 
+		nTagLength != GCM_TAG_LENGTH || !key.IsValidFor(m_nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	std::lock_guard<std::mutex> _lock(key.GetContext()->aeadLock);
+	return EncryptGCM(&key.GetContext()->gcm, pPlain, nPlainLength, pCipher, 
+		pIV, pAAD, nAADLength, pTag);
+}
+
+// Authenticated decryption (AES_GCM only)
+CRYPTO_ERROR_CODES CryptoAES::DecryptAuthData(const u8* pCipher, 
+	size_t nCipherLength, u8* pPlain, const CryptoKeySchedule& key, 
+	const u8* pIV, size_t nIVLength, const u8* pAAD, size_t nAADLength, 
+	const u8* pTag, size_t nTagLength)
+{
+	if (m_nMode != CRYPTO_MODES::AES_GCM)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_NOT_IMPLEMENTED;
+	if (pIV == nullptr || nIVLength != GCM_IV_LENGTH || 
+		nTagLength != GCM_TAG_LENGTH || !key.IsValidFor(m_nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	std::lock_guard<std::mutex> _lock(key.GetContext()->aeadLock);
+	return DecryptGCM(&key.GetContext()->gcm, pCipher, nCipherLength, pPlain, 
+		pIV, pAAD, nAADLength, pTag);
+}
+
+// Retrieve block size for the cipher in bytes
+uint CryptoAES::GetBlockSize()
+{
+	return N_BLOCK;
+}
+
+// Retrieve IV (nonce) length for the selected mode in bytes
+uint CryptoAES::GetIVLength()
+{
+	return m_nMode == CRYPTO_MODES::AES_GCM ? GCM_IV_LENGTH : N_BLOCK;
+}
+
+// Retrieve authentication tag length in bytes
+uint CryptoAES::GetTagLength()
+{
+	return m_nMode == CRYPTO_MODES::AES_GCM ? GCM_TAG_LENGTH : 0;
+}
+
+CRYPTO_ERROR_CODES CryptoAES::Encrypt(const u8* pIn, size_t nBytesIn, u8* pOut, 
+	size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
+	CRYPTO_MODES nMode)
+{
 	nKeyLength *= 8;	// Convert from bytes to bits
 	switch (nKeyLength)
 	{
@@ -92,77 +244,51 @@ CRYPTO_ERROR_CODES CryptoAES::Encrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 
-	if (nMode != CRYPTO_MODES::AES_CTR && ((nBytesIn % N_BLOCK) != 0))
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (nMode == CRYPTO_MODES::AES_GCM)
+	{
+		// Tag is appended to the ciphertext
+		if (pIV == nullptr || nBytesOut < nBytesIn + GCM_TAG_LENGTH)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 
+		mbedtls_gcm_context _gcm;
+		mbedtls_gcm_init(&_gcm);
+		CRYPTO_ERROR_CODES _nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		if (mbedtls_gcm_setkey(&_gcm, MBEDTLS_CIPHER_ID_AES, pKey, 
+			(uint)nKeyLength) == 0)
+			_nRC = EncryptGCM(&_gcm, pIn, nBytesIn, pOut, pIV, nullptr, 0, 
+				pOut + nBytesIn);
+		mbedtls_gcm_free(&_gcm);
+		return _nRC;
+	}
+
+	// Parameter checking
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nBytesIn, nBytesOut, pIV, nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
 
-	// Initialize context and buffers
+	// Initialize context
 	mbedtls_aes_context _ctx;
 	mbedtls_aes_init(&_ctx);
 	if (mbedtls_aes_setkey_enc(&_ctx, pKey, (uint)nKeyLength) != 0)
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-
-	u8 _strmBlock[N_BLOCK] = {};
-	u8 _iv[N_BLOCK] = {};
-	size_t _ncOff = 0;
-
-	// Use IV provided otherwise leave as zero default
-	if (pIV)
-		memcpy(_iv, pIV, N_BLOCK);
-
-	// Encrypt
-	switch (nMode)
-	{
-	case CRYPTO_MODES::AES_ECB:
-	{
-		uint _nLength = (uint)nBytesIn;
-		while (_nLength > 0)
-		{
-			if (mbedtls_aes_crypt_ecb(&_ctx, MBEDTLS_AES_ENCRYPT, pIn, pOut) 
-				!= 0)
-				return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-			pIn += N_BLOCK;
-			pOut += N_BLOCK;
-			_nLength -= N_BLOCK;
-		}
-	} break;
-	case CRYPTO_MODES::AES_CBC:
-	{
-		if (mbedtls_aes_crypt_cbc(&_ctx, MBEDTLS_AES_ENCRYPT, nBytesIn, _iv, 
-			pIn, pOut) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-	} break;
-	case CRYPTO_MODES::AES_CTR:
-	{
-		if (mbedtls_aes_crypt_ctr(&_ctx, nBytesIn, &_ncOff, _iv, _strmBlock, 
-			pIn, pOut) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-	} break;
-	}
+		_nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	else
+		_nRC = Crypt(&_ctx, MBEDTLS_AES_ENCRYPT, pIn, nBytesIn, pOut, pIV, 
+			nMode, m_nThreads, m_nParallelThreshold);
 
-	// Copy out IV
-	if (pIV)
-		memcpy(pIV, _iv, N_BLOCK);
+	// Zeroize round keys
+	mbedtls_aes_free(&_ctx);
 
-	return CRYPTO_ERROR_CODES::CRYPT_OK;
+	return _nRC;
 }
 
 CRYPTO_ERROR_CODES CryptoAES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut, 
-	size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, CRYPTO_MODES nMode)
+	size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
+	CRYPTO_MODES nMode)
 {
-	// Parameter checking
-	switch (nMode)
-	{
-	case CRYPTO_MODES::AES_ECB:
-	case CRYPTO_MODES::AES_CBC:
-		break;
-	case CRYPTO_MODES::AES_CTR:
-		// CTR decryption is same as encryption
+	// CTR decryption is same as encryption
+	if (nMode == CRYPTO_MODES::AES_CTR)
 		return Encrypt(pIn, nBytesIn, pOut, nBytesOut, pKey, nKeyLength, pIV, 
 			nMode);
-	default:
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
-	}
 
 	nKeyLength *= 8;	// Convert from bytes to bits
 	switch (nKeyLength)
@@ -175,34 +301,91 @@ CRYPTO_ERROR_CODES CryptoAES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 
-	if (nMode != CRYPTO_MODES::AES_CTR && ((nBytesIn % N_BLOCK) != 0))
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (nMode == CRYPTO_MODES::AES_GCM)
+	{
+		// Tag follows the ciphertext
+		if (pIV == nullptr || nBytesIn < GCM_TAG_LENGTH || 
+			nBytesOut < nBytesIn - GCM_TAG_LENGTH)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		nBytesIn -= GCM_TAG_LENGTH;
 
+		mbedtls_gcm_context _gcm;
+		mbedtls_gcm_init(&_gcm);
+		CRYPTO_ERROR_CODES _nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		if (mbedtls_gcm_setkey(&_gcm, MBEDTLS_CIPHER_ID_AES, pKey, 
+			(uint)nKeyLength) == 0)
+			_nRC = DecryptGCM(&_gcm, pIn, nBytesIn, pOut, pIV, nullptr, 0, 
+				pIn + nBytesIn);
+		mbedtls_gcm_free(&_gcm);
+		return _nRC;
+	}
 
-	// Initialize context and buffers
+	// Parameter checking
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nBytesIn, nBytesOut, pIV, nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	// Initialize context
 	mbedtls_aes_context _ctx;
+	mbedtls_aes_init(&_ctx);
 	if (mbedtls_aes_setkey_dec(&_ctx, pKey, (uint)nKeyLength) != 0)
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		_nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	else
+		_nRC = Crypt(&_ctx, MBEDTLS_AES_DECRYPT, pIn, nBytesIn, pOut, pIV, 
+			nMode, m_nThreads, m_nParallelThreshold);
+
+	// Zeroize round keys
+	mbedtls_aes_free(&_ctx);
 
+	return _nRC;
+}
+
+static CRYPTO_ERROR_CODES CheckParams(size_t nBytesIn, size_t nBytesOut,
+	const u8* pIV, CRYPTO_MODES nMode)
+{
+	switch (nMode)
+	{
+	case CRYPTO_MODES::AES_ECB:
+	case CRYPTO_MODES::AES_CBC:
+		if ((nBytesIn % N_BLOCK) != 0)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		break;
+	case CRYPTO_MODES::AES_CTR:
+		if (pIV == nullptr)
+			// Don't allow zero IV for CTR since it is used as the nonce counter
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	}
+
+	if (nBytesOut < nBytesIn)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+static CRYPTO_ERROR_CODES Crypt(mbedtls_aes_context* pCtx, int nOperation,
+	const u8* pIn, size_t nBytesIn, u8* pOut, const u8* pIV, 
+	CRYPTO_MODES nMode, uint nThreads, size_t nThreshold)
+{
 	u8 _strmBlock[N_BLOCK] = {};
 	u8 _iv[N_BLOCK] = {};
 	size_t _ncOff = 0;
+	int _nRC = 0;
 
 	// Use IV provided otherwise leave as zero default
 	if (pIV)
 		memcpy(_iv, pIV, N_BLOCK);
 
-	// Encrypt
 	switch (nMode)
 	{
 	case CRYPTO_MODES::AES_ECB:
 	{
-		uint _nLength = (uint)nBytesIn;
-		while (_nLength > 0)
+		size_t _nLength = nBytesIn;
+		while (_nLength > 0 && _nRC == 0)
 		{
-			if (mbedtls_aes_crypt_ecb(&_ctx, MBEDTLS_AES_DECRYPT, pIn, pOut) 
-				!= 0)
-				return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+			_nRC = mbedtls_aes_crypt_ecb(pCtx, nOperation, pIn, pOut);
 			pIn += N_BLOCK;
 			pOut += N_BLOCK;
 			_nLength -= N_BLOCK;
@@ -210,21 +393,104 @@ CRYPTO_ERROR_CODES CryptoAES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
 	} break;
 	case CRYPTO_MODES::AES_CBC:
 	{
-		if (mbedtls_aes_crypt_cbc(&_ctx, MBEDTLS_AES_DECRYPT, nBytesIn, _iv, 
-			pIn, pOut) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		// Each plaintext block only depends on its own and the previous
+		// ciphertext block, so decryption can be split across cores
+		nThreads = GetThreadCount(nThreads);
+		if (nOperation == MBEDTLS_AES_DECRYPT && nThreads > 1 && 
+			nBytesIn >= nThreshold)
+		{
+			if (!RunCBCDecryptRanges(pIn, nBytesIn, pOut, _iv, N_BLOCK, 
+				nThreads, [pCtx](u8* pIV, const u8* pIn, size_t nLength, 
+				u8* pOut) {
+				return mbedtls_aes_crypt_cbc(pCtx, MBEDTLS_AES_DECRYPT, nLength,
+					pIV, pIn, pOut) == 0;
+			}))
+				return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+			break;
+		}
+
+		_nRC = mbedtls_aes_crypt_cbc(pCtx, nOperation, nBytesIn, _iv, pIn, 
+			pOut);
 	} break;
 	case CRYPTO_MODES::AES_CTR:
 	{
-		if (mbedtls_aes_crypt_ctr(&_ctx, nBytesIn, &_ncOff, _iv, _strmBlock, 
-			pIn, pOut) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		// Keystream blocks are independent, split large buffers across cores
+		nThreads = GetThreadCount(nThreads);
+		if (nThreads > 1 && nBytesIn >= nThreshold)
+			return CryptCTRParallel(pCtx, pIn, nBytesIn, pOut, _iv, nThreads);
+
+		_nRC = mbedtls_aes_crypt_ctr(pCtx, nBytesIn, &_ncOff, _iv, _strmBlock, 
+			pIn, pOut);
+		memset(_strmBlock, 0, N_BLOCK);
 	} break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 
-	// Copy out IV
-	if (pIV)
-		memcpy(pIV, _iv, N_BLOCK);
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+static CRYPTO_ERROR_CODES CryptCTRParallel(mbedtls_aes_context* pCtx,
+	const u8* pIn, size_t nBytesIn, u8* pOut, const u8* pIV, uint nThreads)
+{
+	size_t _nBlocks = (nBytesIn + N_BLOCK - 1) / N_BLOCK;
+
+	bool _bSuccess = RunBlockRanges(_nBlocks, nThreads, 
+		[&](uint /* nRange */, size_t nFirstBlock, size_t nNumBlocks) {
+		u8 _strmBlock[N_BLOCK] = {};
+		u8 _counter[N_BLOCK];
+		size_t _ncOff = 0;
+		memcpy(_counter, pIV, N_BLOCK);
+
+		// Advance the 128-bit big-endian counter to the first block of the
+		// range, matching the increment done by mbedtls_aes_crypt_ctr
+		size_t _nCarry = nFirstBlock;
+		for (int i = N_BLOCK - 1; i >= 0 && _nCarry != 0; i--)
+		{
+			_nCarry += _counter[i];
+			_counter[i] = (u8)_nCarry;
+			_nCarry >>= 8;
+		}
+
+		size_t _nOffset = nFirstBlock * N_BLOCK;
+		size_t _nLength = std::min(nNumBlocks * N_BLOCK, nBytesIn - _nOffset);
+		int _nRC = mbedtls_aes_crypt_ctr(pCtx, _nLength, &_ncOff, _counter, 
+			_strmBlock, pIn + _nOffset, pOut + _nOffset);
+		memset(_strmBlock, 0, N_BLOCK);
+		return _nRC == 0;
+	});
+
+	if (!_bSuccess)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+static CRYPTO_ERROR_CODES EncryptGCM(mbedtls_gcm_context* pCtx, 
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD, 
+	size_t nAADLength, u8* pTag)
+{
+	if (mbedtls_gcm_crypt_and_tag(pCtx, MBEDTLS_GCM_ENCRYPT, nLength, pIV, 
+		GCM_IV_LENGTH, pAAD, nAADLength, pIn, pOut, GCM_TAG_LENGTH, pTag) != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+static CRYPTO_ERROR_CODES DecryptGCM(mbedtls_gcm_context* pCtx, 
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD, 
+	size_t nAADLength, const u8* pTag)
+{
+	// Output is zeroed by mbedtls if the tag does not match
+	int _nRC = mbedtls_gcm_auth_decrypt(pCtx, nLength, pIV, GCM_IV_LENGTH, 
+		pAAD, nAADLength, pTag, GCM_TAG_LENGTH, pIn, pOut);
+	if (_nRC == MBEDTLS_ERR_GCM_AUTH_FAILED)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED;
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
 
 	return CRYPTO_ERROR_CODES::CRYPT_OK;
 }
@@ -232,6 +498,12 @@ CRYPTO_ERROR_CODES CryptoAES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
 // Helper function for self test to reduce code duplication
 bool RunTest(CryptoAES* pAES, u8Vec vPlain, u8Vec& vCipher, u8Vec vKey, 
 	u8Vec vIV, CRYPTO_MODES nMode, bool bPrintToConsole = false);
+// Compare multi-threaded output against the single-threaded path
+static bool RunParallelTest(CRYPTO_MODES nMode, size_t nLength, 
+	bool bPrintToConsole = false);
+// GCM with additional authenticated data, including tamper rejection
+static bool RunAuthTest(u8Vec vPlain, u8Vec vCipher, u8Vec vTag, u8Vec vKey, 
+	u8Vec vIV, u8Vec vAAD, bool bPrintToConsole = false);
 
 bool CryptoAES::SelfTest(bool bPrintToConsole /* = false */)
 {
@@ -361,6 +633,38 @@ bool CryptoAES::SelfTest(bool bPrintToConsole /* = false */)
 			_bSuccess = false;
 	}
 
+	// CBC, 128-bit key, 4 blocks (NIST SP 800-38A F.2.1)
+	{
+		u8Vec _key = 
+		{ 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 
+		  0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+		u8Vec _plain = 
+		{ 0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 
+		  0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+		  0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 
+		  0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+		  0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 
+		  0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+		  0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 
+		  0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+		u8Vec _cipher = 
+		{ 0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 
+		  0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+		  0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 
+		  0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+		  0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 
+		  0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+		  0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 
+		  0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7 };
+		u8Vec _iv = 
+		{ 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 
+		  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+
+		if (!RunTest(&_aes, _plain, _cipher, _key, _iv, CRYPTO_MODES::AES_CBC, 
+			bPrintToConsole))
+			_bSuccess = false;
+	}
+
 	// CTR, 128-bit key
 	{
 		u8Vec _key = 
@@ -424,6 +728,100 @@ bool CryptoAES::SelfTest(bool bPrintToConsole /* = false */)
 			_bSuccess = false;
 	}
 
+	// GCM test vectors from mbedtls gcm.c (NIST GCM spec test cases 3, 15 
+	// and 16). Expected ciphertext is followed by the tag
+	u8Vec _gcmPlain = 
+	{ 0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 
+	  0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a, 
+	  0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 
+	  0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72, 
+	  0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 
+	  0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25, 
+	  0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 
+	  0xba, 0x63, 0x7b, 0x39, 0x1a, 0xaf, 0xd2, 0x55 };
+	u8Vec _gcmIV = 
+	{ 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 
+	  0xde, 0xca, 0xf8, 0x88 };
+
+	// GCM, 128-bit key
+	{
+		u8Vec _key = 
+		{ 0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 
+		  0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08 };
+		u8Vec _cipher = 
+		{ 0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 
+		  0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c, 
+		  0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0, 
+		  0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e, 
+		  0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 
+		  0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05, 
+		  0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 
+		  0x3d, 0x58, 0xe0, 0x91, 0x47, 0x3f, 0x59, 0x85, 
+		  0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6, 
+		  0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4 };
+
+		if (!RunTest(&_aes, _gcmPlain, _cipher, _key, _gcmIV, 
+			CRYPTO_MODES::AES_GCM, bPrintToConsole))
+			_bSuccess = false;
+	}
+
+	// GCM, 256-bit key
+	u8Vec _gcmKey256 = 
+	{ 0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 
+	  0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08, 
+	  0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 
+	  0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08 };
+	{
+		u8Vec _cipher = 
+		{ 0x52, 0x2d, 0xc1, 0xf0, 0x99, 0x56, 0x7d, 0x07, 
+		  0xf4, 0x7f, 0x37, 0xa3, 0x2a, 0x84, 0x42, 0x7d, 
+		  0x64, 0x3a, 0x8c, 0xdc, 0xbf, 0xe5, 0xc0, 0xc9, 
+		  0x75, 0x98, 0xa2, 0xbd, 0x25, 0x55, 0xd1, 0xaa, 
+		  0x8c, 0xb0, 0x8e, 0x48, 0x59, 0x0d, 0xbb, 0x3d, 
+		  0xa7, 0xb0, 0x8b, 0x10, 0x56, 0x82, 0x88, 0x38, 
+		  0xc5, 0xf6, 0x1e, 0x63, 0x93, 0xba, 0x7a, 0x0a, 
+		  0xbc, 0xc9, 0xf6, 0x62, 0x89, 0x80, 0x15, 0xad, 
+		  0xb0, 0x94, 0xda, 0xc5, 0xd9, 0x34, 0x71, 0xbd, 
+		  0xec, 0x1a, 0x50, 0x22, 0x70, 0xe3, 0xcc, 0x6c };
+
+		if (!RunTest(&_aes, _gcmPlain, _cipher, _gcmKey256, _gcmIV, 
+			CRYPTO_MODES::AES_GCM, bPrintToConsole))
+			_bSuccess = false;
+	}
+
+	// GCM with additional authenticated data, 256-bit key
+	{
+		u8Vec _plain(_gcmPlain.begin(), _gcmPlain.begin() + 60);
+		u8Vec _cipher = 
+		{ 0x52, 0x2d, 0xc1, 0xf0, 0x99, 0x56, 0x7d, 0x07, 
+		  0xf4, 0x7f, 0x37, 0xa3, 0x2a, 0x84, 0x42, 0x7d, 
+		  0x64, 0x3a, 0x8c, 0xdc, 0xbf, 0xe5, 0xc0, 0xc9, 
+		  0x75, 0x98, 0xa2, 0xbd, 0x25, 0x55, 0xd1, 0xaa, 
+		  0x8c, 0xb0, 0x8e, 0x48, 0x59, 0x0d, 0xbb, 0x3d, 
+		  0xa7, 0xb0, 0x8b, 0x10, 0x56, 0x82, 0x88, 0x38, 
+		  0xc5, 0xf6, 0x1e, 0x63, 0x93, 0xba, 0x7a, 0x0a, 
+		  0xbc, 0xc9, 0xf6, 0x62 };
+		u8Vec _tag = 
+		{ 0x76, 0xfc, 0x6e, 0xce, 0x0f, 0x4e, 0x17, 0x68, 
+		  0xcd, 0xdf, 0x88, 0x53, 0xbb, 0x2d, 0x55, 0x1b };
+		u8Vec _aad = 
+		{ 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 
+		  0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 
+		  0xab, 0xad, 0xda, 0xd2 };
+
+		if (!RunAuthTest(_plain, _cipher, _tag, _gcmKey256, _gcmIV, _aad, 
+			bPrintToConsole))
+			_bSuccess = false;
+	}
+
+	// Multi-threaded CTR, odd length to cover a trailing partial block
+	if (!RunParallelTest(CRYPTO_MODES::AES_CTR, (1 << 16) + 7, bPrintToConsole))
+		_bSuccess = false;
+	// Multi-threaded CBC decryption, block count not divisible by threads
+	if (!RunParallelTest(CRYPTO_MODES::AES_CBC, (1 << 16) + 3 * N_BLOCK, 
+		bPrintToConsole))
+		_bSuccess = false;
+
 	return _bSuccess;
 }
 
@@ -448,6 +846,9 @@ bool RunTest(CryptoAES* pAES, u8Vec vPlain, u8Vec& vCipher, u8Vec vKey,
 	case CRYPTO_MODES::AES_CTR:
 		_strModeName = "AES_CTR ";
 		break;
+	case CRYPTO_MODES::AES_GCM:
+		_strModeName = "AES_GCM ";
+		break;
 	default:
 		_strModeName = "AES_UNKNOWN";
 		break;
@@ -492,9 +893,201 @@ bool RunTest(CryptoAES* pAES, u8Vec vPlain, u8Vec& vCipher, u8Vec vKey,
 		_bSuccess = false;
 	}
 
+	// In-place encryption and decryption through the buffer interface. The
+	// buffer is sized for the ciphertext, which includes the tag for GCM
+	u8Vec _inPlace = vPlain;
+	_inPlace.resize(vCipher.size());
+	_nRC = pAES->EncryptData(_inPlace.data(), vPlain.size(), _inPlace.data(),
+		_inPlace.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vCipher[0], &_inPlace[0], vCipher.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (" << _strModeName << _strKeySize
+			<< ") : FAIL - In-place encryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+	_nRC = pAES->DecryptData(_inPlace.data(), _inPlace.size(), _inPlace.data(),
+		vPlain.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vPlain[0], &_inPlace[0], vPlain.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (" << _strModeName << _strKeySize
+			<< ") : FAIL - In-place decryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	// Multi-threaded in-place decryption, every block is its own range
+	CryptoAES _parallel;
+	_parallel.Init(nMode);
+	_parallel.SetParallelism((uint)(vCipher.size() / N_BLOCK), 0);
+	_inPlace = vCipher;
+	_nRC = _parallel.DecryptData(_inPlace.data(), _inPlace.size(), 
+		_inPlace.data(), vPlain.size(), vKey.data(), vKey.size(), vIV.data(),
+		vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vPlain[0], &_inPlace[0], vPlain.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (" << _strModeName << _strKeySize
+			<< ") : FAIL - Parallel decryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	// Pre-expanded key schedule
+	CryptoKeySchedule _schedule;
+	_nRC = _schedule.Init(nMode, vKey.data(), vKey.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK == _nRC)
+		_nRC = pAES->EncryptData(vPlain.data(), vPlain.size(), 
+			_inPlace.data(), _inPlace.size(), _schedule, vIV.data(), 
+			vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vCipher[0], &_inPlace[0], vCipher.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (" << _strModeName << _strKeySize
+			<< ") : FAIL - Key schedule encryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+	_nRC = pAES->DecryptData(_inPlace.data(), _inPlace.size(), _inPlace.data(),
+		vPlain.size(), _schedule, vIV.data(), vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vPlain[0], &_inPlace[0], vPlain.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (" << _strModeName << _strKeySize
+			<< ") : FAIL - Key schedule decryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+
 	if (_bSuccess && bPrintToConsole)
 		std::cout << "CryptoAES SelfTest (" << _strModeName << _strKeySize
 		<< ") : PASS" << std::endl << std::endl;
 
 	return _bSuccess;
 }
+
+static bool RunParallelTest(CRYPTO_MODES nMode, size_t nLength, 
+	bool bPrintToConsole /* = false */)
+{
+	bool _bSuccess = true;
+	CryptoAES _serial, _parallel;
+	u8Vec _vPlain(nLength), _vKey(32), _vIV(N_BLOCK);
+	u8Vec _vSerial, _vParallel, _vDecrypted;
+
+	for (size_t i = 0; i < _vPlain.size(); i++)
+		_vPlain[i] = (u8)(i * 31 + 7);
+	for (size_t i = 0; i < _vKey.size(); i++)
+		_vKey[i] = (u8)(0xa5 ^ i);
+	// Counter close to wrapping so ranges have to carry across bytes
+	for (size_t i = 0; i < _vIV.size(); i++)
+		_vIV[i] = (u8)(0xf0 + i);
+
+	_serial.Init(nMode);
+	_serial.SetParallelism(1, 0);
+	_parallel.Init(nMode);
+	_parallel.SetParallelism(4, 0);
+
+	if (_serial.EncryptData(_vPlain, _vSerial, _vKey, _vIV) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_parallel.EncryptData(_vPlain, _vParallel, _vKey, _vIV) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_vSerial != _vParallel)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (" << GetCryptoModeStr(nMode) 
+			<< " parallel) : FAIL - Encrypted output does not match serial" 
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	if (_parallel.DecryptData(_vSerial, _vDecrypted, _vKey, _vIV) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK || _vDecrypted != _vPlain)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (" << GetCryptoModeStr(nMode) 
+			<< " parallel) : FAIL - Decrypted output does not match expected" 
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	if (_bSuccess && bPrintToConsole)
+		std::cout << "CryptoAES SelfTest (" << GetCryptoModeStr(nMode)
+		<< " parallel) : PASS" << std::endl << std::endl;
+
+	return _bSuccess;
+}
+
+static bool RunAuthTest(u8Vec vPlain, u8Vec vCipher, u8Vec vTag, u8Vec vKey, 
+	u8Vec vIV, u8Vec vAAD, bool bPrintToConsole /* = false */)
+{
+	bool _bSuccess = true;
+	CryptoAES _aes;
+	_aes.Init(CRYPTO_MODES::AES_GCM);
+	CryptoKeySchedule _schedule;
+	CRYPTO_ERROR_CODES _nRC = _schedule.Init(CRYPTO_MODES::AES_GCM, 
+		vKey.data(), vKey.size());
+
+	u8Vec _encrypted(vPlain.size()), _decrypted(vPlain.size());
+	u8Vec _tag(GCM_TAG_LENGTH);
+	if (CRYPTO_ERROR_CODES::CRYPT_OK == _nRC)
+		_nRC = _aes.EncryptAuthData(vPlain.data(), vPlain.size(), 
+			_encrypted.data(), _schedule, vIV.data(), vIV.size(), vAAD.data(),
+			vAAD.size(), _tag.data(), _tag.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC || _encrypted != vCipher || 
+		_tag != vTag)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (AES_GCM with AAD) : FAIL - "
+			<< "Encrypted output does not match expected" << std::endl;
+		_bSuccess = false;
+	}
+
+	_nRC = _aes.DecryptAuthData(vCipher.data(), vCipher.size(), 
+		_decrypted.data(), _schedule, vIV.data(), vIV.size(), vAAD.data(), 
+		vAAD.size(), vTag.data(), vTag.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC || _decrypted != vPlain)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (AES_GCM with AAD) : FAIL - "
+			<< "Decrypted output does not match expected" << std::endl;
+		_bSuccess = false;
+	}
+
+	// Any change to the ciphertext or the AAD must be rejected
+	vCipher[0] ^= 0x01;
+	_nRC = _aes.DecryptAuthData(vCipher.data(), vCipher.size(), 
+		_decrypted.data(), _schedule, vIV.data(), vIV.size(), vAAD.data(), 
+		vAAD.size(), vTag.data(), vTag.size());
+	vCipher[0] ^= 0x01;
+	if (CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED != _nRC)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (AES_GCM with AAD) : FAIL - "
+			<< "Modified ciphertext was not rejected" << std::endl;
+		_bSuccess = false;
+	}
+	vAAD.back() ^= 0x01;
+	_nRC = _aes.DecryptAuthData(vCipher.data(), vCipher.size(), 
+		_decrypted.data(), _schedule, vIV.data(), vIV.size(), vAAD.data(), 
+		vAAD.size(), vTag.data(), vTag.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED != _nRC)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoAES SelfTest (AES_GCM with AAD) : FAIL - "
+			<< "Modified AAD was not rejected" << std::endl;
+		_bSuccess = false;
+	}
+
+	if (_bSuccess && bPrintToConsole)
+		std::cout << "CryptoAES SelfTest (AES_GCM with AAD) : PASS" 
+		<< std::endl << std::endl;
+
+	return _bSuccess;
+}
@@ -1,6 +1,11 @@
 #include "ICrypto.h"
+#include "Argon2Arena.h"
 #include "argon2.h"
+#include "argon2_dispatch.h"
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
 #ifdef __GNUC__
 #include <cstring>
 #endif
@@ -8,7 +13,13 @@
 
 #define SALT_LENGTH 16
 
-bool Hash(HASH_MODES nMode, u8* pData, size_t nDataLength, u8* pHash,
+// Calibration limits
+#define CALIBRATE_MAX_LANES 8
+#define CALIBRATE_START_MEMORY (1 << 14)	// 16 MiB
+#define CALIBRATE_MAX_TIME_COST 64
+
+static bool Hash(HASH_MODES nMode, const Argon2Params& params, 
+	const u8Vec& vSalt, const u8* pData, size_t nDataLength, u8* pHash, 
 	size_t nHashLength);
 
 CRYPTO_ERROR_CODES HashArgon2::Init(HASH_MODES nMode /* = HASH_MODES::ARGON2ID */)
@@ -19,62 +30,195 @@ CRYPTO_ERROR_CODES HashArgon2::Init(HASH_MODES nMode /* = HASH_MODES::ARGON2ID *
 	case HASH_MODES::ARGON2I:
 	case HASH_MODES::ARGON2ID:
 		m_nMode = nMode;
+		break;
 	default:
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 	return CRYPTO_ERROR_CODES::CRYPT_OK;
 }
 
-CRYPTO_ERROR_CODES HashArgon2::HashData(u8Vec vData, u8Vec& vHash)
+CRYPTO_ERROR_CODES HashArgon2::HashData(const u8Vec& vData, u8Vec& vHash)
+{
+	return HashData(vData.data(), vData.size(), vHash);
+}
+
+CRYPTO_ERROR_CODES HashArgon2::HashData(const u8* pData, size_t nDataLength,
+	u8Vec& vHash)
 {
 	vHash.resize(m_nHashLength);
+	return HashData(pData, nDataLength, vHash.data(), vHash.size());
+}
 
-	if (!Hash(m_nMode, &vData[0], vData.size(), &vHash[0], vHash.size()))
+CRYPTO_ERROR_CODES HashArgon2::HashData(const u8* pData, size_t nDataLength,
+	u8* pHash, size_t nHashLength)
+{
+	if (pHash == nullptr || nHashLength < m_nHashLength)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	if (!Hash(m_nMode, m_params, m_vSalt, pData, nDataLength, pHash, 
+		m_nHashLength))
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_ARGON2;
 
 	return CRYPTO_ERROR_CODES::CRYPT_OK;
 }
 
+CRYPTO_ERROR_CODES HashArgon2::SetParams(const Argon2Params& params)
+{
+	// Argon2 needs at least 2 blocks per lane per sync point
+	if (params.nTimeCost < ARGON2_MIN_TIME || params.nLanes < ARGON2_MIN_LANES
+		|| params.nLanes > ARGON2_MAX_LANES || params.nThreads > 
+		ARGON2_MAX_THREADS || params.nMemoryCost < 
+		(uint64_t)ARGON2_MIN_MEMORY * params.nLanes)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 
-CRYPTO_ERROR_CODES HashArgon2::HashData(u8* pData, size_t nDataLength,
-	u8Vec& vHash)
+	m_params = params;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES HashArgon2::SetSalt(const u8Vec& vSalt)
 {
-	vHash.resize(m_nHashLength);
+	if (!vSalt.empty() && vSalt.size() < ARGON2_MIN_SALT_LENGTH)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	m_vSalt = vSalt;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+// Time a single derivation with params, returns a negative value on failure
+// (typically when the memory cannot be allocated)
+static double TimeHash(HASH_MODES nMode, const Argon2Params& params)
+{
+	const u8 _password[] = "calibration";
+	u8 _hash[32];
+	u8Vec _vSalt;
+
+	auto _start = std::chrono::steady_clock::now();
+	if (!Hash(nMode, params, _vSalt, _password, sizeof(_password), _hash,
+		sizeof(_hash)))
+		return -1.0;
+	std::chrono::duration<double, std::milli> _elapsed =
+		std::chrono::steady_clock::now() - _start;
+	return _elapsed.count();
+}
 
-	if (!Hash(m_nMode, pData, nDataLength, &vHash[0], vHash.size()))
+CRYPTO_ERROR_CODES HashArgon2::Calibrate(uint nTargetMs, uint nMaxMemoryKiB,
+	Argon2Params& params, HASH_MODES nMode /* = HASH_MODES::ARGON2ID */)
+{
+	Argon2Params _params;
+	_params.nTimeCost = 1;
+	_params.nThreads = 0;
+	_params.nLanes = std::max(1u, std::min((uint)CALIBRATE_MAX_LANES,
+		std::thread::hardware_concurrency()));
+	// Every lane needs its own minimum number of blocks
+	while (_params.nLanes > 1 && 
+		nMaxMemoryKiB < ARGON2_MIN_MEMORY * _params.nLanes)
+		_params.nLanes--;
+	if (nTargetMs == 0 || nMaxMemoryKiB < ARGON2_MIN_MEMORY * _params.nLanes)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	// Single pass with as much memory as fits the budget. Run time grows 
+	// linearly with memory, so keep doubling while twice the last 
+	// measurement is still within target
+	_params.nMemoryCost = std::min((uint)CALIBRATE_START_MEMORY, 
+		nMaxMemoryKiB);
+	double _dTime = TimeHash(nMode, _params);
+	if (_dTime < 0)
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_ARGON2;
+	while (_params.nMemoryCost < nMaxMemoryKiB && _dTime * 2 <= nTargetMs)
+	{
+		Argon2Params _next = _params;
+		_next.nMemoryCost = (uint)std::min((uint64_t)_params.nMemoryCost * 2,
+			(uint64_t)nMaxMemoryKiB);
+		double _dNextTime = TimeHash(nMode, _next);
+		if (_dNextTime < 0 || _dNextTime > nTargetMs)
+			break;
+		_params = _next;
+		_dTime = _dNextTime;
+	}
+
+	// Spend what is left of the budget on extra passes
+	_params.nTimeCost = (uint)std::max(1.0, std::min(
+		(double)CALIBRATE_MAX_TIME_COST, nTargetMs / std::max(_dTime, 1.0)));
+
+	params = _params;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+const char* HashArgon2::GetKernelName()
+{
+	return argon2_fill_kernel_name();
+}
 
+CRYPTO_ERROR_CODES HashArgon2::SetKernel(const char* pName)
+{
+	if (argon2_set_fill_kernel(pName) != ARGON2_OK)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	return CRYPTO_ERROR_CODES::CRYPT_OK;
 }
 
-bool Hash(HASH_MODES nMode, u8* pData, size_t nDataLength, u8* pHash, 
+void HashArgon2::SetArenaLimit(size_t nMaxBytes)
+{
+	Argon2ArenaSetLimit(nMaxBytes);
+}
+
+void HashArgon2::ReleaseArena()
+{
+	Argon2ArenaRelease();
+}
+
+Argon2ArenaStats HashArgon2::GetArenaStats()
+{
+	return Argon2ArenaGetStats();
+}
+
+static bool Hash(HASH_MODES nMode, const Argon2Params& params, 
+	const u8Vec& vSalt, const u8* pData, size_t nDataLength, u8* pHash, 
 	size_t nHashLength)
 {
-	int _nRC;
 	uint8_t _pSalt[SALT_LENGTH];
 	memset(_pSalt, 0x00, SALT_LENGTH);
 
-	uint32_t _nTCost = 2;			// 2-pass computation
-	uint32_t _nMCost = (1 << 16);	// 64 MB memory usage
-	uint32_t _nParallelism = 1;		// number of threads and lanes
-
+	// One thread per lane, never more than the host can run at once
+	uint _nThreads = params.nThreads;
+	if (_nThreads == 0)
+		_nThreads = std::max(1u, std::min(params.nLanes, 
+			std::thread::hardware_concurrency()));
+	_nThreads = std::min(_nThreads, params.nLanes);
+
+	// Raw context so lanes and threads can differ, the *_hash_raw helpers
+	// tie both to a single parallelism value
+	argon2_context _ctx;
+	memset(&_ctx, 0, sizeof(_ctx));
+	_ctx.out = pHash;
+	_ctx.outlen = (uint32_t)nHashLength;
+	_ctx.pwd = const_cast<u8*>(pData);
+	_ctx.pwdlen = (uint32_t)nDataLength;
+	_ctx.salt = vSalt.empty() ? _pSalt : const_cast<u8*>(vSalt.data());
+	_ctx.saltlen = vSalt.empty() ? SALT_LENGTH : (uint32_t)vSalt.size();
+	_ctx.t_cost = params.nTimeCost;
+	_ctx.m_cost = params.nMemoryCost;
+	_ctx.lanes = params.nLanes;
+	_ctx.threads = _nThreads;
+	_ctx.version = ARGON2_VERSION_NUMBER;
+	_ctx.flags = ARGON2_DEFAULT_FLAGS;
+	_ctx.allocate_cbk = Argon2ArenaAllocate;
+	_ctx.free_cbk = Argon2ArenaFree;
+
+	argon2_type _nType;
 	switch (nMode)
 	{
 	case HASH_MODES::ARGON2D:
-		_nRC = argon2d_hash_raw(_nTCost, _nMCost, _nParallelism, pData,
-			nDataLength, _pSalt, SALT_LENGTH, pHash, nHashLength);
+		_nType = Argon2_d;
 		break;
 	case HASH_MODES::ARGON2I:
-		_nRC = argon2i_hash_raw(_nTCost, _nMCost, _nParallelism, pData,
-			nDataLength, _pSalt, SALT_LENGTH, pHash, nHashLength);
+		_nType = Argon2_i;
 		break;
 	case HASH_MODES::ARGON2ID:
-		_nRC = argon2id_hash_raw(_nTCost, _nMCost, _nParallelism, pData,
-			nDataLength, _pSalt, SALT_LENGTH, pHash, nHashLength);
+		_nType = Argon2_id;
 		break;
 	default:
 		return false;
 	}
 
-	return _nRC == 0;
-}
\ No newline at end of file
+	return argon2_ctx(&_ctx, _nType) == ARGON2_OK;
+}
@@ -0,0 +1,328 @@
+#include "ICrypto.h"
+#include "KeyScheduleCtx.h"
+#include "mbedtls/chachapoly.h"
+
+#include <iostream>
+#ifdef __GNUC__
+#include <cstring>
+#endif
+
+
+#define CHACHA_KEY_LENGTH 32
+#define CHACHA_NONCE_LENGTH 12
+#define CHACHA_TAG_LENGTH 16
+
+// ChaCha20-Poly1305 encryption of pIn into pOut, tag written to pTag
+static CRYPTO_ERROR_CODES EncryptChaCha(mbedtls_chachapoly_context* pCtx,
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD,
+	size_t nAADLength, u8* pTag);
+// ChaCha20-Poly1305 decryption of pIn into pOut, verified against pTag
+static CRYPTO_ERROR_CODES DecryptChaCha(mbedtls_chachapoly_context* pCtx,
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD,
+	size_t nAADLength, const u8* pTag);
+
+CRYPTO_ERROR_CODES CryptoChaCha::Init(
+	CRYPTO_MODES nMode /* = CRYPTO_MODES::CHACHA20_POLY1305 */)
+{
+	switch (nMode)
+	{
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+		break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	}
+	m_nMode = nMode;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES CryptoChaCha::EncryptData(const u8Vec& vPlain,
+	u8Vec& vCipher, const u8Vec& vKey, const u8Vec& vIV)
+{
+	// Resize output vector. Ciphertext is followed by the tag
+	vCipher.resize(vPlain.size() + CHACHA_TAG_LENGTH);
+
+	return EncryptData(vPlain.data(), vPlain.size(), vCipher.data(),
+		vCipher.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+}
+
+CRYPTO_ERROR_CODES CryptoChaCha::DecryptData(const u8Vec& vCipher,
+	u8Vec& vPlain, const u8Vec& vKey, const u8Vec& vIV)
+{
+	// Resize output vector. Plaintext does not include the tag
+	if (vCipher.size() < CHACHA_TAG_LENGTH)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	vPlain.resize(vCipher.size() - CHACHA_TAG_LENGTH);
+
+	return DecryptData(vCipher.data(), vCipher.size(), vPlain.data(),
+		vPlain.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+}
+
+CRYPTO_ERROR_CODES CryptoChaCha::EncryptData(const u8* pPlain,
+	size_t nPlainLength, u8* pCipher, size_t nCipherLength, const u8* pKey,
+	size_t nKeyLength, const u8* pIV, size_t nIVLength)
+{
+	// Nonce is required, reusing one with the same key breaks the cipher
+	if (pIV == nullptr || nIVLength != CHACHA_NONCE_LENGTH ||
+		pKey == nullptr || nKeyLength != CHACHA_KEY_LENGTH ||
+		nCipherLength < nPlainLength + CHACHA_TAG_LENGTH)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	mbedtls_chachapoly_context _ctx;
+	mbedtls_chachapoly_init(&_ctx);
+	CRYPTO_ERROR_CODES _nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	if (mbedtls_chachapoly_setkey(&_ctx, pKey) == 0)
+		_nRC = EncryptChaCha(&_ctx, pPlain, nPlainLength, pCipher, pIV,
+			nullptr, 0, pCipher + nPlainLength);
+	mbedtls_chachapoly_free(&_ctx);
+
+	return _nRC;
+}
+
+CRYPTO_ERROR_CODES CryptoChaCha::DecryptData(const u8* pCipher,
+	size_t nCipherLength, u8* pPlain, size_t nPlainLength, const u8* pKey,
+	size_t nKeyLength, const u8* pIV, size_t nIVLength)
+{
+	if (pIV == nullptr || nIVLength != CHACHA_NONCE_LENGTH ||
+		pKey == nullptr || nKeyLength != CHACHA_KEY_LENGTH ||
+		nCipherLength < CHACHA_TAG_LENGTH ||
+		nPlainLength < nCipherLength - CHACHA_TAG_LENGTH)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	nCipherLength -= CHACHA_TAG_LENGTH;
+
+	mbedtls_chachapoly_context _ctx;
+	mbedtls_chachapoly_init(&_ctx);
+	CRYPTO_ERROR_CODES _nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	if (mbedtls_chachapoly_setkey(&_ctx, pKey) == 0)
+		_nRC = DecryptChaCha(&_ctx, pCipher, nCipherLength, pPlain, pIV,
+			nullptr, 0, pCipher + nCipherLength);
+	mbedtls_chachapoly_free(&_ctx);
+
+	return _nRC;
+}
+
+// Encrypt with a pre-expanded key schedule
+CRYPTO_ERROR_CODES CryptoChaCha::EncryptData(const u8* pPlain,
+	size_t nPlainLength, u8* pCipher, size_t nCipherLength,
+	const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength)
+{
+	if (nCipherLength < nPlainLength + CHACHA_TAG_LENGTH)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	return EncryptAuthData(pPlain, nPlainLength, pCipher, key, pIV,
+		nIVLength, nullptr, 0, pCipher + nPlainLength, CHACHA_TAG_LENGTH);
+}
+
+// Decrypt with a pre-expanded key schedule
+CRYPTO_ERROR_CODES CryptoChaCha::DecryptData(const u8* pCipher,
+	size_t nCipherLength, u8* pPlain, size_t nPlainLength,
+	const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength)
+{
+	if (nCipherLength < CHACHA_TAG_LENGTH ||
+		nPlainLength < nCipherLength - CHACHA_TAG_LENGTH)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	nCipherLength -= CHACHA_TAG_LENGTH;
+
+	return DecryptAuthData(pCipher, nCipherLength, pPlain, key, pIV,
+		nIVLength, nullptr, 0, pCipher + nCipherLength, CHACHA_TAG_LENGTH);
+}
+
+CRYPTO_ERROR_CODES CryptoChaCha::EncryptAuthData(const u8* pPlain,
+	size_t nPlainLength, u8* pCipher, const CryptoKeySchedule& key,
+	const u8* pIV, size_t nIVLength, const u8* pAAD, size_t nAADLength,
+	u8* pTag, size_t nTagLength)
+{
+	if (pIV == nullptr || nIVLength != CHACHA_NONCE_LENGTH ||
+		nTagLength != CHACHA_TAG_LENGTH || !key.IsValidFor(m_nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	std::lock_guard<std::mutex> _lock(key.GetContext()->aeadLock);
+	return EncryptChaCha(&key.GetContext()->chachapoly, pPlain, nPlainLength,
+		pCipher, pIV, pAAD, nAADLength, pTag);
+}
+
+CRYPTO_ERROR_CODES CryptoChaCha::DecryptAuthData(const u8* pCipher,
+	size_t nCipherLength, u8* pPlain, const CryptoKeySchedule& key,
+	const u8* pIV, size_t nIVLength, const u8* pAAD, size_t nAADLength,
+	const u8* pTag, size_t nTagLength)
+{
+	if (pIV == nullptr || nIVLength != CHACHA_NONCE_LENGTH ||
+		nTagLength != CHACHA_TAG_LENGTH || !key.IsValidFor(m_nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	std::lock_guard<std::mutex> _lock(key.GetContext()->aeadLock);
+	return DecryptChaCha(&key.GetContext()->chachapoly, pCipher,
+		nCipherLength, pPlain, pIV, pAAD, nAADLength, pTag);
+}
+
+uint CryptoChaCha::GetBlockSize()
+{
+	return 1;
+}
+
+uint CryptoChaCha::GetIVLength()
+{
+	return CHACHA_NONCE_LENGTH;
+}
+
+uint CryptoChaCha::GetTagLength()
+{
+	return CHACHA_TAG_LENGTH;
+}
+
+static CRYPTO_ERROR_CODES EncryptChaCha(mbedtls_chachapoly_context* pCtx,
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD,
+	size_t nAADLength, u8* pTag)
+{
+	if (mbedtls_chachapoly_encrypt_and_tag(pCtx, nLength, pIV, pAAD,
+		nAADLength, pIn, pOut, pTag) != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+static CRYPTO_ERROR_CODES DecryptChaCha(mbedtls_chachapoly_context* pCtx,
+	const u8* pIn, size_t nLength, u8* pOut, const u8* pIV, const u8* pAAD,
+	size_t nAADLength, const u8* pTag)
+{
+	// Output is zeroed by mbedtls if the tag does not match
+	int _nRC = mbedtls_chachapoly_auth_decrypt(pCtx, nLength, pIV, pAAD,
+		nAADLength, pTag, pIn, pOut);
+	if (_nRC == MBEDTLS_ERR_CHACHAPOLY_AUTH_FAILED)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED;
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+bool CryptoChaCha::SelfTest(bool bPrintToConsole /* = false */)
+{
+	bool _bSuccess = true;
+	CRYPTO_ERROR_CODES _nRC;
+	CryptoChaCha _chacha;
+	_chacha.Init(CRYPTO_MODES::CHACHA20_POLY1305);
+
+	// RFC 8439 section 2.8.2 test vector
+	u8Vec _key =
+	{ 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	  0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	  0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+	  0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f };
+	u8Vec _iv =
+	{ 0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43,
+	  0x44, 0x45, 0x46, 0x47 };
+	u8Vec _aad =
+	{ 0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3,
+	  0xc4, 0xc5, 0xc6, 0xc7 };
+	std::string _strPlain = "Ladies and Gentlemen of the class of '99: If I "
+		"could offer you only one tip for the future, sunscreen would be it.";
+	u8Vec _plain(_strPlain.begin(), _strPlain.end());
+	u8Vec _cipher =
+	{ 0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb,
+	  0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+	  0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe,
+	  0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+	  0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12,
+	  0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+	  0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29,
+	  0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+	  0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c,
+	  0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+	  0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94,
+	  0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+	  0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d,
+	  0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+	  0x61, 0x16 };
+	u8Vec _tag =
+	{ 0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a,
+	  0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91 };
+
+	CryptoKeySchedule _schedule;
+	_nRC = _schedule.Init(CRYPTO_MODES::CHACHA20_POLY1305, _key.data(),
+		_key.size());
+
+	// Known answer with additional authenticated data
+	u8Vec _encrypted(_plain.size()), _calcTag(CHACHA_TAG_LENGTH);
+	if (CRYPTO_ERROR_CODES::CRYPT_OK == _nRC)
+		_nRC = _chacha.EncryptAuthData(_plain.data(), _plain.size(),
+			_encrypted.data(), _schedule, _iv.data(), _iv.size(), _aad.data(),
+			_aad.size(), _calcTag.data(), _calcTag.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC || _encrypted != _cipher ||
+		_calcTag != _tag)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoChaCha SelfTest (CHACHA20_POLY1305) : FAIL - "
+			<< "Encrypted output does not match expected" << std::endl;
+		_bSuccess = false;
+	}
+
+	// In-place decryption
+	u8Vec _decrypted = _cipher;
+	_nRC = _chacha.DecryptAuthData(_decrypted.data(), _decrypted.size(),
+		_decrypted.data(), _schedule, _iv.data(), _iv.size(), _aad.data(),
+		_aad.size(), _tag.data(), _tag.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC || _decrypted != _plain)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoChaCha SelfTest (CHACHA20_POLY1305) : FAIL - "
+			<< "Decrypted output does not match expected" << std::endl;
+		_bSuccess = false;
+	}
+
+	// Modified AAD must be rejected
+	_aad[0] ^= 0x01;
+	_nRC = _chacha.DecryptAuthData(_cipher.data(), _cipher.size(),
+		_decrypted.data(), _schedule, _iv.data(), _iv.size(), _aad.data(),
+		_aad.size(), _tag.data(), _tag.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED != _nRC)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoChaCha SelfTest (CHACHA20_POLY1305) : FAIL - "
+			<< "Modified AAD was not rejected" << std::endl;
+		_bSuccess = false;
+	}
+
+	// Vector interface round trip, tag appended to the ciphertext
+	u8Vec _vCipherTag, _vPlain;
+	_nRC = _chacha.EncryptData(_plain, _vCipherTag, _key, _iv);
+	if (CRYPTO_ERROR_CODES::CRYPT_OK == _nRC)
+		_nRC = _chacha.DecryptData(_vCipherTag, _vPlain, _key, _iv);
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC || _vPlain != _plain ||
+		_vCipherTag.size() != _plain.size() + CHACHA_TAG_LENGTH)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoChaCha SelfTest (CHACHA20_POLY1305) : FAIL - "
+			<< "Round trip does not match" << std::endl;
+		_bSuccess = false;
+	}
+
+	// Key schedule output must match the raw key path
+	u8Vec _inPlace = _plain;
+	_inPlace.resize(_vCipherTag.size());
+	_nRC = _chacha.EncryptData(_inPlace.data(), _plain.size(),
+		_inPlace.data(), _inPlace.size(), _schedule, _iv.data(), _iv.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC || _inPlace != _vCipherTag)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoChaCha SelfTest (CHACHA20_POLY1305) : FAIL - "
+			<< "Key schedule encryption does not match expected" << std::endl;
+		_bSuccess = false;
+	}
+
+	// Modified ciphertext must be rejected
+	_vCipherTag[0] ^= 0x01;
+	_nRC = _chacha.DecryptData(_vCipherTag, _vPlain, _key, _iv);
+	if (CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED != _nRC)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoChaCha SelfTest (CHACHA20_POLY1305) : FAIL - "
+			<< "Modified ciphertext was not rejected" << std::endl;
+		_bSuccess = false;
+	}
+
+	if (_bSuccess && bPrintToConsole)
+		std::cout << "CryptoChaCha SelfTest (CHACHA20_POLY1305) : PASS"
+		<< std::endl << std::endl;
+
+	return _bSuccess;
+}
@@ -0,0 +1,154 @@
+#include "CryptoCapabilities.h"
+#include "ICrypto.h"
+#include "mbedtls/build_info.h"
+
+#include <chrono>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define PROBE_BUFFER_SIZE (64 * 1024)
+#define PROBE_SECONDS 0.01
+
+// mbedtls only builds its AES-NI code for these targets (see aesni.h). The
+// query below reports the same runtime decision aes.c and gcm.c make
+#if defined(MBEDTLS_AESNI_C) && (defined(_MSC_VER) || \
+	(defined(MBEDTLS_HAVE_ASM) && defined(__GNUC__) && \
+	(defined(__amd64__) || defined(__x86_64__))))
+#define CRYPTO_HAVE_MBEDTLS_AESNI
+#define MBEDTLS_AESNI_AES 0x02000000u
+#define MBEDTLS_AESNI_CLMUL 0x00000002u
+extern "C" int mbedtls_aesni_has_support(unsigned int what);
+#endif
+
+static CpuFeatures DetectCpuFeatures()
+{
+	CpuFeatures _features;
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	unsigned int _regs[4] = { 0 };	// eax, ebx, ecx, edx
+	unsigned int _nMaxLeaf;
+#if defined(_MSC_VER)
+	__cpuid((int*)_regs, 0);
+	_nMaxLeaf = _regs[0];
+	__cpuid((int*)_regs, 1);
+#else
+	_nMaxLeaf = __get_cpuid_max(0, nullptr);
+	__get_cpuid(1, &_regs[0], &_regs[1], &_regs[2], &_regs[3]);
+#endif
+	_features.bAESNI = (_regs[2] & (1u << 25)) != 0;
+	_features.bCLMUL = (_regs[2] & (1u << 1)) != 0;
+	bool _bAVX = (_regs[2] & (1u << 28)) != 0;
+	bool _bOSXSAVE = (_regs[2] & (1u << 27)) != 0;
+
+	// AVX2 also needs the OS to save YMM registers on context switch
+	bool _bYMMState = false;
+	if (_bAVX && _bOSXSAVE)
+	{
+		unsigned int _nXCR0Low;
+#if defined(_MSC_VER)
+		_nXCR0Low = (unsigned int)_xgetbv(0);
+#else
+		unsigned int _nXCR0High;
+		__asm__ volatile("xgetbv" : "=a"(_nXCR0Low), "=d"(_nXCR0High) 
+			: "c"(0));
+#endif
+		_bYMMState = (_nXCR0Low & 0x6) == 0x6;
+	}
+
+	if (_nMaxLeaf >= 7)
+	{
+#if defined(_MSC_VER)
+		__cpuidex((int*)_regs, 7, 0);
+#else
+		__cpuid_count(7, 0, _regs[0], _regs[1], _regs[2], _regs[3]);
+#endif
+		_features.bAVX2 = _bYMMState && (_regs[1] & (1u << 5)) != 0;
+		_features.bSHANI = (_regs[1] & (1u << 29)) != 0;
+	}
+#endif
+	return _features;
+}
+
+const CryptoCapabilities& GetCryptoCapabilities()
+{
+	// Thread-safe one time initialization
+	static const CryptoCapabilities _caps = []() {
+		CryptoCapabilities _result;
+		_result.cpu = DetectCpuFeatures();
+#ifdef CRYPTO_HAVE_MBEDTLS_AESNI
+		_result.bAESAccelerated = 
+			mbedtls_aesni_has_support(MBEDTLS_AESNI_AES) != 0;
+		_result.bGCMAccelerated = 
+			mbedtls_aesni_has_support(MBEDTLS_AESNI_CLMUL) != 0;
+#endif
+		// mbedtls 3.4 only has SHA-2 instruction support for Armv8
+		_result.bSHAAccelerated = false;
+		return _result;
+	}();
+	return _caps;
+}
+
+// Encrypt a fixed buffer repeatedly for PROBE_SECONDS and return MB/s
+static double ProbeMode(ICrypto* pCrypto, CRYPTO_MODES nMode)
+{
+	using _clock = std::chrono::steady_clock;
+
+	u8Vec _vKey(32, 0xa5), _vIV(pCrypto->GetIVLength(), 0x5a);
+	u8Vec _vBuffer(PROBE_BUFFER_SIZE + pCrypto->GetTagLength(), 0x3c);
+	CryptoKeySchedule _schedule;
+	if (_schedule.Init(nMode, _vKey.data(), _vKey.size()) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return 0.0;
+
+	// Warm up caches and frequency before timing
+	size_t _nBytes = 0;
+	if (pCrypto->EncryptData(_vBuffer.data(), PROBE_BUFFER_SIZE, 
+		_vBuffer.data(), _vBuffer.size(), _schedule, _vIV.data(), _vIV.size())
+		!= CRYPTO_ERROR_CODES::CRYPT_OK)
+		return 0.0;
+
+	_clock::time_point _tStart = _clock::now();
+	double _dElapsed = 0.0;
+	while (_dElapsed < PROBE_SECONDS)
+	{
+		pCrypto->EncryptData(_vBuffer.data(), PROBE_BUFFER_SIZE, 
+			_vBuffer.data(), _vBuffer.size(), _schedule, _vIV.data(), 
+			_vIV.size());
+		_nBytes += PROBE_BUFFER_SIZE;
+		_dElapsed = std::chrono::duration<double>(_clock::now() - _tStart)
+			.count();
+	}
+	return _nBytes / _dElapsed / 1e6;
+}
+
+CRYPTO_MODES RecommendCryptoMode(
+	std::vector<CryptoProbeResult>* pResults /* = nullptr */)
+{
+	const CryptoCapabilities& _caps = GetCryptoCapabilities();
+
+	CryptoAES _aes;
+	CryptoChaCha _chacha;
+	_aes.Init(CRYPTO_MODES::AES_GCM);
+	_chacha.Init(CRYPTO_MODES::CHACHA20_POLY1305);
+	// Measure the single-threaded path, as used for small documents
+	_aes.SetParallelism(1, PARALLEL_THRESHOLD_DEFAULT);
+	_chacha.SetParallelism(1, PARALLEL_THRESHOLD_DEFAULT);
+
+	CryptoProbeResult _gcm = { CRYPTO_MODES::AES_GCM, 
+		ProbeMode(&_aes, CRYPTO_MODES::AES_GCM) };
+	CryptoProbeResult _chachapoly = { CRYPTO_MODES::CHACHA20_POLY1305, 
+		ProbeMode(&_chacha, CRYPTO_MODES::CHACHA20_POLY1305) };
+	if (pResults != nullptr)
+	{
+		pResults->clear();
+		pResults->push_back(_gcm);
+		pResults->push_back(_chachapoly);
+	}
+
+	if (_caps.bAESAccelerated && _caps.bGCMAccelerated && 
+		_gcm.dMBps >= _chachapoly.dMBps)
+		return CRYPTO_MODES::AES_GCM;
+	return CRYPTO_MODES::CHACHA20_POLY1305;
+}
@@ -1,4 +1,6 @@
 #include "ICrypto.h"
+#include "KeyScheduleCtx.h"
+#include "CryptoParallel.h"
 #include "mbedtls/des.h"
 
 #include <iostream>
@@ -9,6 +11,15 @@
 
 #define N_BLOCK 8
 
+// Check buffer sizes for nMode
+static CRYPTO_ERROR_CODES CheckParams(size_t nBytesIn, size_t nBytesOut,
+	CRYPTO_MODES nMode);
+// Run nMode over pIn into pOut using the key schedule already set in pCtx.
+// Buffers of at least nThreshold bytes may be split across nThreads threads
+static CRYPTO_ERROR_CODES Crypt(mbedtls_des3_context* pCtx, int nOperation,
+	const u8* pIn, size_t nBytesIn, u8* pOut, const u8* pIV, 
+	CRYPTO_MODES nMode, uint nThreads, size_t nThreshold);
+
 CRYPTO_ERROR_CODES CryptoTDES::Init(
 	CRYPTO_MODES nMode /* = CRYPTO_MODES::TDES_ECB */)
 {
@@ -24,32 +35,88 @@ CRYPTO_ERROR_CODES CryptoTDES::Init(
 	return CRYPTO_ERROR_CODES::CRYPT_OK;
 }
 
-CRYPTO_ERROR_CODES CryptoTDES::EncryptData(u8Vec vPlain, u8Vec& vCipher, 
-	u8Vec vKey, u8Vec vIV)
+CRYPTO_ERROR_CODES CryptoTDES::EncryptData(const u8Vec& vPlain, 
+	u8Vec& vCipher, const u8Vec& vKey, const u8Vec& vIV)
 {
-	// Make sure vIV is correct size or empty
-	if (vIV.size() != 0 && vIV.size() != N_BLOCK)
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
-
 	// Resize output vector. For TDES, input size == output size
 	vCipher.resize(vPlain.size());
 
-	return Encrypt(&vPlain[0], vPlain.size(), &vCipher[0], vCipher.size(), 
-		&vKey[0], vKey.size(), vIV.size() == 0 ? nullptr : &vIV[0], m_nMode);
+	return EncryptData(vPlain.data(), vPlain.size(), vCipher.data(), 
+		vCipher.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
 }
 
-CRYPTO_ERROR_CODES CryptoTDES::DecryptData(u8Vec vCipher, u8Vec& vPlain, 
-	u8Vec vKey, u8Vec vIV)
+CRYPTO_ERROR_CODES CryptoTDES::DecryptData(const u8Vec& vCipher, 
+	u8Vec& vPlain, const u8Vec& vKey, const u8Vec& vIV)
 {
-	// Make sure vIV is correct size or empty
-	if (vIV.size() != 0 && vIV.size() != N_BLOCK)
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
-
 	// Resize output vector. For TDES, input size == output size
 	vPlain.resize(vCipher.size());
 
-	return Decrypt(&vCipher[0], vCipher.size(), &vPlain[0], vPlain.size(), 
-		&vKey[0], vKey.size(), vIV.size() == 0 ? nullptr : &vIV[0], m_nMode);
+	return DecryptData(vCipher.data(), vCipher.size(), vPlain.data(), 
+		vPlain.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+}
+
+CRYPTO_ERROR_CODES CryptoTDES::EncryptData(const u8* pPlain, 
+	size_t nPlainLength, u8* pCipher, size_t nCipherLength, const u8* pKey, 
+	size_t nKeyLength, const u8* pIV, size_t nIVLength)
+{
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != N_BLOCK)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	return Encrypt(pPlain, nPlainLength, pCipher, nCipherLength, pKey, 
+		nKeyLength, nIVLength == 0 ? nullptr : pIV, m_nMode);
+}
+
+CRYPTO_ERROR_CODES CryptoTDES::DecryptData(const u8* pCipher, 
+	size_t nCipherLength, u8* pPlain, size_t nPlainLength, const u8* pKey, 
+	size_t nKeyLength, const u8* pIV, size_t nIVLength)
+{
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != N_BLOCK)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	return Decrypt(pCipher, nCipherLength, pPlain, nPlainLength, pKey, 
+		nKeyLength, nIVLength == 0 ? nullptr : pIV, m_nMode);
+}
+
+CRYPTO_ERROR_CODES CryptoTDES::EncryptData(const u8* pPlain, 
+	size_t nPlainLength, u8* pCipher, size_t nCipherLength, 
+	const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength)
+{
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != N_BLOCK)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (!key.IsValidFor(m_nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nPlainLength, nCipherLength, 
+		m_nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	return Crypt(&key.GetContext()->desEnc, MBEDTLS_DES_ENCRYPT, pPlain, 
+		nPlainLength, pCipher, nIVLength == 0 ? nullptr : pIV, m_nMode, 
+		m_nThreads, m_nParallelThreshold);
+}
+
+CRYPTO_ERROR_CODES CryptoTDES::DecryptData(const u8* pCipher, 
+	size_t nCipherLength, u8* pPlain, size_t nPlainLength, 
+	const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength)
+{
+	// Make sure IV is correct size or empty
+	if (nIVLength != 0 && nIVLength != N_BLOCK)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (!key.IsValidFor(m_nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nCipherLength, nPlainLength, 
+		m_nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	return Crypt(&key.GetContext()->desDec, MBEDTLS_DES_DECRYPT, pCipher, 
+		nCipherLength, pPlain, nIVLength == 0 ? nullptr : pIV, m_nMode, 
+		m_nThreads, m_nParallelThreshold);
 }
 
 uint CryptoTDES::GetBlockSize()
@@ -58,86 +125,82 @@ uint CryptoTDES::GetBlockSize()
 }
 
 CRYPTO_ERROR_CODES CryptoTDES::Encrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
-	size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, CRYPTO_MODES nMode)
+	size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
+	CRYPTO_MODES nMode)
 {
 	// Parameter checking
-	switch (nMode)
-	{
-	case CRYPTO_MODES::TDES_ECB:
-	case CRYPTO_MODES::TDES_CBC:
-		break;
-	default:
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
-	}
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nBytesIn, nBytesOut, nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
 
-	nKeyLength *= 8;	// Convert from bytes to bits
-	switch (nKeyLength)
+	// Initialize context
+	mbedtls_des3_context _ctx;
+	mbedtls_des3_init(&_ctx);
+	int _nSetKeyRC = 0;
+	switch (nKeyLength * 8)
 	{
 	case 128:	// TDES - 2 key
+		_nSetKeyRC = mbedtls_des3_set2key_enc(&_ctx, pKey);
+		break;
 	case 192:	// TDES - 3 key
+		_nSetKeyRC = mbedtls_des3_set3key_enc(&_ctx, pKey);
 		break;
 	default:
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
-	}
+	}	
 
-	if (nBytesIn % N_BLOCK != 0)
-		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (_nSetKeyRC != 0)
+		_nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	else
+		_nRC = Crypt(&_ctx, MBEDTLS_DES_ENCRYPT, pIn, nBytesIn, pOut, pIV, 
+			nMode, m_nThreads, m_nParallelThreshold);
+
+	// Zeroize key schedule
+	mbedtls_des3_free(&_ctx);
+
+	return _nRC;
+}
+
+CRYPTO_ERROR_CODES CryptoTDES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
+	size_t nBytesOut, const u8* pKey, size_t nKeyLength, const u8* pIV, 
+	CRYPTO_MODES nMode)
+{
+	// Parameter checking
+	CRYPTO_ERROR_CODES _nRC = CheckParams(nBytesIn, nBytesOut, nMode);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
 
-	// Initialize context and buffers
+	// Initialize context
 	mbedtls_des3_context _ctx;
 	mbedtls_des3_init(&_ctx);
-	switch (nKeyLength)
+	int _nSetKeyRC = 0;
+	switch (nKeyLength * 8)
 	{
-	case 128:	// 2-key
-		if (mbedtls_des3_set2key_enc(&_ctx, pKey) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	case 128:	// TDES - 2 key
+		_nSetKeyRC = mbedtls_des3_set2key_dec(&_ctx, pKey);
 		break;
-	case 192:	// 3-key
-		if (mbedtls_des3_set3key_enc(&_ctx, pKey) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	case 192:	// TDES - 3 key
+		_nSetKeyRC = mbedtls_des3_set3key_dec(&_ctx, pKey);
 		break;
-	}	
-
-	u8 _iv[N_BLOCK] = {};
-
-	// Use IV provided otherwise leave as zero default
-	if (pIV)
-		memcpy(_iv, pIV, N_BLOCK);
-
-	// Encrypt
-	switch (nMode)
-	{
-	case CRYPTO_MODES::TDES_ECB:
-	{
-		uint _nLength = (uint)nBytesIn;
-		while (_nLength > 0)
-		{
-			if (mbedtls_des3_crypt_ecb(&_ctx, pIn, pOut) != 0)
-				return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-			pIn += N_BLOCK;
-			pOut += N_BLOCK;	// NOTE: Using blocks of size 8 here
-			_nLength -= N_BLOCK;
-		}
-	} break;
-	case CRYPTO_MODES::TDES_CBC:
-	{
-		if (mbedtls_des3_crypt_cbc(&_ctx, MBEDTLS_DES_ENCRYPT, nBytesIn, _iv, 
-			pIn, pOut))
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-	} break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 
-	// Copy out IV
-	if (pIV)
-		memcpy(pIV, _iv, N_BLOCK);
+	if (_nSetKeyRC != 0)
+		_nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	else
+		_nRC = Crypt(&_ctx, MBEDTLS_DES_DECRYPT, pIn, nBytesIn, pOut, pIV, 
+			nMode, m_nThreads, m_nParallelThreshold);
 
-	return CRYPTO_ERROR_CODES::CRYPT_OK;
+	// Zeroize key schedule
+	mbedtls_des3_free(&_ctx);
+
+	return _nRC;
 }
 
-CRYPTO_ERROR_CODES CryptoTDES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
-	size_t nBytesOut, u8* pKey, size_t nKeyLength, u8* pIV, CRYPTO_MODES nMode)
+static CRYPTO_ERROR_CODES CheckParams(size_t nBytesIn, size_t nBytesOut,
+	CRYPTO_MODES nMode)
 {
-	// Parameter checking
 	switch (nMode)
 	{
 	case CRYPTO_MODES::TDES_ECB:
@@ -147,50 +210,35 @@ CRYPTO_ERROR_CODES CryptoTDES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 
-	nKeyLength *= 8;	// Convert from bytes to bits
-	switch (nKeyLength)
-	{
-	case 128:	// TDES - 2 key
-	case 192:	// TDES - 3 key
-		break;
-	default:
+	if (nBytesIn % N_BLOCK != 0)
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
-	}
 
-	if (nBytesIn % N_BLOCK != 0)
+	if (nBytesOut < nBytesIn)
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 
-	// Initialize context and buffers
-	mbedtls_des3_context _ctx;
-	mbedtls_des3_init(&_ctx);
-	switch (nKeyLength)
-	{
-	case 128:	// 2-key
-		if (mbedtls_des3_set2key_dec(&_ctx, pKey) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-		break;
-	case 192:	// 3-key
-		if (mbedtls_des3_set3key_dec(&_ctx, pKey) != 0)
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
-		break;
-	}
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
 
+static CRYPTO_ERROR_CODES Crypt(mbedtls_des3_context* pCtx, int nOperation,
+	const u8* pIn, size_t nBytesIn, u8* pOut, const u8* pIV, 
+	CRYPTO_MODES nMode, uint nThreads, size_t nThreshold)
+{
 	u8 _iv[N_BLOCK] = {};
+	int _nRC = 0;
 
 	// Use IV provided otherwise leave as zero default
 	if (pIV)
 		memcpy(_iv, pIV, N_BLOCK);
 
-	// Encrypt
 	switch (nMode)
 	{
 	case CRYPTO_MODES::TDES_ECB:
 	{
-		uint _nLength = (uint)nBytesIn;
-		while (_nLength > 0)
+		// NOTE: mbedtls_des3_crypt_ecb direction is set by the key schedule
+		size_t _nLength = nBytesIn;
+		while (_nLength > 0 && _nRC == 0)
 		{
-			if (mbedtls_des3_crypt_ecb(&_ctx, pIn, pOut) != 0)
-				return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+			_nRC = mbedtls_des3_crypt_ecb(pCtx, pIn, pOut);
 			pIn += N_BLOCK;
 			pOut += N_BLOCK;	// NOTE: Using blocks of size 8 here
 			_nLength -= N_BLOCK;
@@ -198,15 +246,31 @@ CRYPTO_ERROR_CODES CryptoTDES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
 	} break;
 	case CRYPTO_MODES::TDES_CBC:
 	{
-		if (mbedtls_des3_crypt_cbc(&_ctx, MBEDTLS_DES_DECRYPT, nBytesIn, _iv, 
-			pIn, pOut))
-			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		// Each plaintext block only depends on its own and the previous
+		// ciphertext block, so decryption can be split across cores
+		nThreads = GetThreadCount(nThreads);
+		if (nOperation == MBEDTLS_DES_DECRYPT && nThreads > 1 && 
+			nBytesIn >= nThreshold)
+		{
+			if (!RunCBCDecryptRanges(pIn, nBytesIn, pOut, _iv, N_BLOCK, 
+				nThreads, [pCtx](u8* pIV, const u8* pIn, size_t nLength, 
+				u8* pOut) {
+				return mbedtls_des3_crypt_cbc(pCtx, MBEDTLS_DES_DECRYPT, 
+					nLength, pIV, pIn, pOut) == 0;
+			}))
+				return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+			break;
+		}
+
+		_nRC = mbedtls_des3_crypt_cbc(pCtx, nOperation, nBytesIn, _iv, pIn, 
+			pOut);
 	} break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 
-	// Copy out IV
-	if (pIV)
-		memcpy(pIV, _iv, N_BLOCK);
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
 
 	return CRYPTO_ERROR_CODES::CRYPT_OK;
 }
@@ -214,6 +278,9 @@ CRYPTO_ERROR_CODES CryptoTDES::Decrypt(const u8* pIn, size_t nBytesIn, u8* pOut,
 // Helper function for self test to reduce code duplication
 bool RunTest(CryptoTDES* pTDES, u8Vec vPlain, u8Vec& vCipher, u8Vec vKey, u8Vec 
 	vIV, CRYPTO_MODES nMode, bool bPrintToConsole = false);
+// Compare multi-threaded output against the single-threaded path
+static bool RunParallelTest(CRYPTO_MODES nMode, size_t nLength, 
+	bool bPrintToConsole = false);
 
 bool CryptoTDES::SelfTest(bool bPrintToConsole /* = false */)
 {
@@ -306,6 +373,11 @@ bool CryptoTDES::SelfTest(bool bPrintToConsole /* = false */)
 			_bSuccess = false;
 	}
 
+	// Multi-threaded CBC decryption, block count not divisible by threads
+	if (!RunParallelTest(CRYPTO_MODES::TDES_CBC, (1 << 16) + 3 * N_BLOCK, 
+		bPrintToConsole))
+		_bSuccess = false;
+
 	return _bSuccess;
 }
 
@@ -381,9 +453,130 @@ bool RunTest(CryptoTDES* pTDES, u8Vec vPlain, u8Vec& vCipher, u8Vec vKey,
 		_bSuccess = false;
 	}
 
+	// In-place encryption and decryption through the buffer interface
+	u8Vec _inPlace = vPlain;
+	_nRC = pTDES->EncryptData(_inPlace.data(), _inPlace.size(), _inPlace.data(),
+		_inPlace.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vCipher[0], &_inPlace[0], _inPlace.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoDES SelfTest (" << _strNumKeys << _strModeName
+			<< ") : FAIL - In-place encryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+	_nRC = pTDES->DecryptData(_inPlace.data(), _inPlace.size(), _inPlace.data(),
+		_inPlace.size(), vKey.data(), vKey.size(), vIV.data(), vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vPlain[0], &_inPlace[0], _inPlace.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoDES SelfTest (" << _strNumKeys << _strModeName
+			<< ") : FAIL - In-place decryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	// Multi-threaded in-place decryption, every block is its own range
+	CryptoTDES _parallel;
+	_parallel.Init(nMode);
+	_parallel.SetParallelism((uint)(vCipher.size() / N_BLOCK), 0);
+	_inPlace = vCipher;
+	_nRC = _parallel.DecryptData(_inPlace.data(), _inPlace.size(), 
+		_inPlace.data(), _inPlace.size(), vKey.data(), vKey.size(), vIV.data(),
+		vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vPlain[0], &_inPlace[0], _inPlace.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoDES SelfTest (" << _strNumKeys << _strModeName
+			<< ") : FAIL - Parallel decryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	// Pre-expanded key schedule
+	CryptoKeySchedule _schedule;
+	_nRC = _schedule.Init(nMode, vKey.data(), vKey.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK == _nRC)
+		_nRC = pTDES->EncryptData(vPlain.data(), vPlain.size(), 
+			_inPlace.data(), _inPlace.size(), _schedule, vIV.data(), 
+			vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vCipher[0], &_inPlace[0], _inPlace.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoDES SelfTest (" << _strNumKeys << _strModeName
+			<< ") : FAIL - Key schedule encryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+	_nRC = pTDES->DecryptData(_inPlace.data(), _inPlace.size(), _inPlace.data(),
+		_inPlace.size(), _schedule, vIV.data(), vIV.size());
+	if (CRYPTO_ERROR_CODES::CRYPT_OK != _nRC ||
+		memcmp(&vPlain[0], &_inPlace[0], _inPlace.size()) != 0)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoDES SelfTest (" << _strNumKeys << _strModeName
+			<< ") : FAIL - Key schedule decryption does not match expected"
+			<< std::endl;
+		_bSuccess = false;
+	}
+
 	if (_bSuccess && bPrintToConsole)
 		std::cout << "CryptoDES SelfTest (" << _strNumKeys << _strModeName
 		<< ") : PASS" << std::endl << std::endl;
 
 	return _bSuccess;
-}
\ No newline at end of file
+}
+
+static bool RunParallelTest(CRYPTO_MODES nMode, size_t nLength, 
+	bool bPrintToConsole /* = false */)
+{
+	bool _bSuccess = true;
+	CryptoTDES _serial, _parallel;
+	u8Vec _vPlain(nLength), _vKey(24), _vIV(N_BLOCK);
+	u8Vec _vSerial, _vParallel, _vDecrypted;
+
+	for (size_t i = 0; i < _vPlain.size(); i++)
+		_vPlain[i] = (u8)(i * 31 + 7);
+	for (size_t i = 0; i < _vKey.size(); i++)
+		_vKey[i] = (u8)(0xa5 ^ i);
+	for (size_t i = 0; i < _vIV.size(); i++)
+		_vIV[i] = (u8)(0xf0 + i);
+
+	_serial.Init(nMode);
+	_serial.SetParallelism(1, 0);
+	_parallel.Init(nMode);
+	_parallel.SetParallelism(4, 0);
+
+	if (_serial.EncryptData(_vPlain, _vSerial, _vKey, _vIV) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_parallel.EncryptData(_vPlain, _vParallel, _vKey, _vIV) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_vSerial != _vParallel)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoDES SelfTest (" << GetCryptoModeStr(nMode) 
+			<< " parallel) : FAIL - Encrypted output does not match serial" 
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	if (_parallel.DecryptData(_vSerial, _vDecrypted, _vKey, _vIV) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK || _vDecrypted != _vPlain)
+	{
+		if (bPrintToConsole)
+			std::cout << "CryptoDES SelfTest (" << GetCryptoModeStr(nMode) 
+			<< " parallel) : FAIL - Decrypted output does not match expected" 
+			<< std::endl;
+		_bSuccess = false;
+	}
+
+	if (_bSuccess && bPrintToConsole)
+		std::cout << "CryptoDES SelfTest (" << GetCryptoModeStr(nMode)
+		<< " parallel) : PASS" << std::endl << std::endl;
+
+	return _bSuccess;
+}
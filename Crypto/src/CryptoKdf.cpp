@@ -0,0 +1,157 @@
+#include "CryptoKdf.h"
+#include "Argon2Arena.h"
+#include "CryptoParallel.h"
+#include "ICrypto.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+
+struct KdfTask {
+	KdfJob job;
+	std::promise<KdfResult> result;
+};
+
+struct KdfSchedulerCtx {
+	std::vector<std::thread> vWorkers;
+	std::deque<KdfTask> queue;
+	size_t nBudget;			// KiB
+	size_t nInUse = 0;		// KiB
+	bool bStopping = false;
+	mutable std::mutex lock;
+	std::condition_variable wake;
+};
+
+// Arena memory a job holds in KiB. argon2 allocates at least 8 blocks per 
+// lane and the arena rounds the matrix up to a whole region
+static size_t GetJobMemory(const Argon2Params& params)
+{
+	size_t _nBlocks = std::max((size_t)params.nMemoryCost, 
+		(size_t)8 * params.nLanes);
+	return Argon2ArenaGetRegionSize(_nBlocks * 1024) / 1024;
+}
+
+static KdfResult RunJob(KdfJob& job)
+{
+	KdfResult _result;
+	Argon2Params _params = job.params;
+	if (_params.nThreads == 0)
+		_params.nThreads = 1;
+
+	HashArgon2 _argon2;
+	_argon2.SetHashLength(job.nKeyLength);
+	_result.nResult = _argon2.SetParams(_params);
+	if (_result.nResult == CRYPTO_ERROR_CODES::CRYPT_OK)
+		_result.nResult = _argon2.SetSalt(job.vSalt);
+	if (_result.nResult == CRYPTO_ERROR_CODES::CRYPT_OK)
+	{
+		_result.vKey.resize(_argon2.GetHashLength());
+		_result.nResult = _argon2.HashData(
+			(const u8*)job.strPassword.data(), job.strPassword.size(),
+			_result.vKey.data(), _result.vKey.size());
+	}
+
+	if (_result.nResult != CRYPTO_ERROR_CODES::CRYPT_OK)
+		_result.vKey.clear();
+	return _result;
+}
+
+static void WorkerLoop(KdfSchedulerCtx* pCtx)
+{
+	std::unique_lock<std::mutex> _lock(pCtx->lock);
+	while (true)
+	{
+		// Strict FIFO, a large job at the head is not overtaken by smaller
+		// ones so it cannot starve
+		pCtx->wake.wait(_lock, [pCtx]() {
+			return (pCtx->bStopping && pCtx->queue.empty()) ||
+				(!pCtx->queue.empty() && pCtx->nInUse + 
+				GetJobMemory(pCtx->queue.front().job.params) <= pCtx->nBudget);
+		});
+		if (pCtx->queue.empty())
+			return;
+
+		KdfTask _task = std::move(pCtx->queue.front());
+		pCtx->queue.pop_front();
+		size_t _nMemory = GetJobMemory(_task.job.params);
+		pCtx->nInUse += _nMemory;
+		// Next job may fit alongside this one
+		pCtx->wake.notify_all();
+
+		_lock.unlock();
+		_task.result.set_value(RunJob(_task.job));
+		_lock.lock();
+
+		pCtx->nInUse -= _nMemory;
+		pCtx->wake.notify_all();
+	}
+}
+
+KdfScheduler::KdfScheduler(uint nWorkers /* = 0 */, 
+	size_t nMemoryBudgetKiB /* = (1 << 20) */)
+{
+	m_pCtx = new KdfSchedulerCtx();
+	m_pCtx->nBudget = nMemoryBudgetKiB;
+	uint _nWorkers = GetThreadCount(nWorkers);
+	for (uint i = 0; i < _nWorkers; i++)
+		m_pCtx->vWorkers.emplace_back(WorkerLoop, m_pCtx);
+}
+
+KdfScheduler::~KdfScheduler()
+{
+	{
+		std::lock_guard<std::mutex> _lock(m_pCtx->lock);
+		m_pCtx->bStopping = true;
+	}
+	m_pCtx->wake.notify_all();
+	for (std::thread& worker : m_pCtx->vWorkers)
+		worker.join();
+	delete m_pCtx;
+}
+
+std::future<KdfResult> KdfScheduler::Submit(KdfJob job)
+{
+	KdfTask _task;
+	std::future<KdfResult> _future = _task.result.get_future();
+
+	if (GetJobMemory(job.params) > m_pCtx->nBudget)
+	{
+		KdfResult _result;
+		_result.nResult = CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		_task.result.set_value(_result);
+		return _future;
+	}
+
+	_task.job = std::move(job);
+	{
+		std::lock_guard<std::mutex> _lock(m_pCtx->lock);
+		m_pCtx->queue.push_back(std::move(_task));
+	}
+	m_pCtx->wake.notify_all();
+	return _future;
+}
+
+std::vector<std::future<KdfResult>> KdfScheduler::SubmitBatch(
+	std::vector<KdfJob> vJobs)
+{
+	std::vector<std::future<KdfResult>> _vFutures;
+	_vFutures.reserve(vJobs.size());
+	for (KdfJob& job : vJobs)
+		_vFutures.push_back(Submit(std::move(job)));
+	return _vFutures;
+}
+
+size_t KdfScheduler::GetMemoryInUse() const
+{
+	std::lock_guard<std::mutex> _lock(m_pCtx->lock);
+	return m_pCtx->nInUse;
+}
+
+size_t KdfScheduler::GetQueueLength() const
+{
+	std::lock_guard<std::mutex> _lock(m_pCtx->lock);
+	return m_pCtx->queue.size();
+}
@@ -1,5 +1,9 @@
 #include "CryptoKey.h"
+#include "CryptoRandom.h"
 #include "ICrypto.h"
+#include "mbedtls/hkdf.h"
+#include "mbedtls/nist_kw.h"
+#include "mbedtls/platform_util.h"
 
 #include <fstream>
 #ifdef __GNUC__
@@ -9,20 +13,43 @@
 
 #define MIN_KEY_LENGTH 16
 
-CryptoKey::~CryptoKey()
+// KDF file: SHA256 | "PMKD" | version | hash mode | t | m | lanes (u32 LE) |
+// salt length | salt
+#define KDF_MAGIC "PMKD"
+#define KDF_MAGIC_LENGTH 4
+#define KDF_VERSION 1
+#define KDF_FIXED_LENGTH (KDF_MAGIC_LENGTH + 2 + 12 + 1)
+#define KDF_SALT_LENGTH 16
+
+// HKDF info: label | purpose | context
+#define SUBKEY_LABEL "PasswordManager subkey v1"
+#define SUBKEY_LABEL_LENGTH (sizeof(SUBKEY_LABEL) - 1)
+#define SUBKEY_MAX_LENGTH (255 * 32)	// HKDF-SHA256 output limit
+
+#define KEK_LENGTH 32	// Key wrapping always runs with AES-256
+
+static void PutU32(u8* pOut, uint nValue)
+{
+	for (int i = 0; i < 4; i++)
+		pOut[i] = (u8)(nValue >> (8 * i));
+}
+
+static uint GetU32(const u8* pIn)
 {
-	if (m_vValue.size() == 0)
-		return;
-	// Zeroize memory
-	memset(&m_vValue[0], 0, m_vValue.size());
+	return (uint)pIn[0] | ((uint)pIn[1] << 8) | ((uint)pIn[2] << 16) | 
+		((uint)pIn[3] << 24);
 }
 
 CRYPTO_ERROR_CODES CryptoKey::ReadKeyFromFile(std::string strFileName)
 {
-	// Prepare SHA256 hash
-	HashSHA _sha;
-	u8Vec _vHash, _vCalcHash;
-	size_t _nHashLength = _sha.GetHashLength();
+	// SHA256 digest of the key value is stored ahead of it
+	HashDigest<HASH_MODES::SHA256> _hash, _calcHash;
+	size_t _nHashLength = _hash.size();
+
+	// Key value is about to change, drop cached round keys
+	m_aesSchedule.Clear();
+	m_tdesSchedule.Clear();
+	m_chachaSchedule.Clear();
 
 	// Open file requested
 	std::ifstream _fileIn(strFileName.c_str(), std::ios::in | std::ios::binary);
@@ -45,16 +72,16 @@ CRYPTO_ERROR_CODES CryptoKey::ReadKeyFromFile(std::string strFileName)
 	}
 
 	// Read data
-	_vHash.resize(_nHashLength);
-	_fileIn.read((char*)&_vHash[0], _nHashLength);
+	_fileIn.read((char*)_hash.data(), _nHashLength);
 	m_vValue.resize(_nFileSize - _nHashLength);
 	_fileIn.read((char*)&m_vValue[0], _nFileSize - _nHashLength);
 
 	// Calculate hash and compare
-	CRYPTO_ERROR_CODES _nRC = _sha.HashData(m_vValue, _vCalcHash);
+	CRYPTO_ERROR_CODES _nRC = HashSHA::Digest<HASH_MODES::SHA256>(
+		m_vValue.data(), m_vValue.size(), _calcHash);
 	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
 		return _nRC;
-	if (memcmp(&_vHash[0], &_vCalcHash[0], _nHashLength) != 0)
+	if (_hash != _calcHash)
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_CORRUPTED;
 
 	_fileIn.close();
@@ -65,10 +92,9 @@ CRYPTO_ERROR_CODES CryptoKey::ReadKeyFromFile(std::string strFileName)
 CRYPTO_ERROR_CODES CryptoKey::WriteKeyToFile(std::string strFileName)
 {
 	// Calculate SHA256 hash
-	HashSHA _sha;
-	u8Vec _vHash;
-	size_t _nHashLength = _sha.GetHashLength();
-	CRYPTO_ERROR_CODES _nRC = _sha.HashData(m_vValue, _vHash);
+	HashDigest<HASH_MODES::SHA256> _hash;
+	CRYPTO_ERROR_CODES _nRC = HashSHA::Digest<HASH_MODES::SHA256>(
+		m_vValue.data(), m_vValue.size(), _hash);
 	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
 		return _nRC;
 
@@ -79,7 +105,7 @@ CRYPTO_ERROR_CODES CryptoKey::WriteKeyToFile(std::string strFileName)
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO;
 
 	// Write data
-	_fileOut.write((char*)&_vHash[0], _nHashLength);
+	_fileOut.write((char*)_hash.data(), _hash.size());
 	_fileOut.write((char*)&m_vValue[0], m_vValue.size());
 
 	_fileOut.flush();
@@ -88,7 +114,7 @@ CRYPTO_ERROR_CODES CryptoKey::WriteKeyToFile(std::string strFileName)
 	return CRYPTO_ERROR_CODES::CRYPT_OK;
 }
 
-CRYPTO_ERROR_CODES CryptoKey::DeriveNewKey(std::string strPassword, 
+CRYPTO_ERROR_CODES CryptoKey::DeriveNewKey(const SecureString& strPassword, 
 	uint nTargetSize)
 {
 	// Check for valid key size
@@ -102,9 +128,292 @@ CRYPTO_ERROR_CODES CryptoKey::DeriveNewKey(std::string strPassword,
 		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
 	}
 
+	// Key value is about to change, drop cached round keys
+	m_aesSchedule.Clear();
+	m_tdesSchedule.Clear();
+	m_chachaSchedule.Clear();
+
 	// Use argon2id password hashing to derive new key
 	HashArgon2 _argon2;
 	_argon2.SetHashLength(nTargetSize);
-	return _argon2.HashData((u8*)strPassword.c_str(), strPassword.size(), 
-		m_vValue);
+	CRYPTO_ERROR_CODES _nRC = _argon2.SetParams(m_kdfParams);
+	if (_nRC == CRYPTO_ERROR_CODES::CRYPT_OK)
+		_nRC = _argon2.SetSalt(m_vKdfSalt);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+	m_vValue.resize(nTargetSize);
+	return _argon2.HashData((const u8*)strPassword.c_str(), 
+		strPassword.size(), m_vValue.data(), m_vValue.size());
+}
+
+CRYPTO_ERROR_CODES CryptoKey::ReadKdfFromFile(std::string strFileName)
+{
+	std::ifstream _fileIn(strFileName.c_str(), std::ios::in | std::ios::binary);
+	if (!_fileIn.is_open())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO;
+
+	// Check file size
+	HashDigest<HASH_MODES::SHA256> _hash, _calcHash;
+	size_t _nFileSize;
+	_fileIn.seekg(0, _fileIn.end);
+	_nFileSize = _fileIn.tellg();
+	_fileIn.seekg(0, _fileIn.beg);
+	if (_nFileSize < _hash.size() + KDF_FIXED_LENGTH || 
+		_nFileSize > _hash.size() + KDF_FIXED_LENGTH + 255)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_SIZE;
+
+	// Read data and check hash
+	u8Vec _vBody(_nFileSize - _hash.size());
+	_fileIn.read((char*)_hash.data(), _hash.size());
+	_fileIn.read((char*)_vBody.data(), _vBody.size());
+	if (!_fileIn.good())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO;
+	CRYPTO_ERROR_CODES _nRC = HashSHA::Digest<HASH_MODES::SHA256>(
+		_vBody.data(), _vBody.size(), _calcHash);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+	if (_hash != _calcHash || memcmp(&_vBody[0], KDF_MAGIC, 
+		KDF_MAGIC_LENGTH) != 0 || _vBody[KDF_MAGIC_LENGTH] != KDF_VERSION ||
+		_vBody[KDF_MAGIC_LENGTH + 1] != (u8)HASH_MODES::ARGON2ID)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_CORRUPTED;
+
+	const u8* _pFields = &_vBody[KDF_MAGIC_LENGTH + 2];
+	Argon2Params _params;
+	_params.nTimeCost = GetU32(_pFields);
+	_params.nMemoryCost = GetU32(_pFields + 4);
+	_params.nLanes = GetU32(_pFields + 8);
+	size_t _nSaltLength = _pFields[12];
+	if (_vBody.size() != KDF_FIXED_LENGTH + _nSaltLength)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_CORRUPTED;
+	u8Vec _vSalt(_vBody.begin() + KDF_FIXED_LENGTH, _vBody.end());
+
+	return SetKdfParams(_params, _vSalt);
+}
+
+CRYPTO_ERROR_CODES CryptoKey::WriteKdfToFile(std::string strFileName)
+{
+	if (m_vKdfSalt.size() > 255)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	u8Vec _vBody(KDF_FIXED_LENGTH);
+	memcpy(&_vBody[0], KDF_MAGIC, KDF_MAGIC_LENGTH);
+	_vBody[KDF_MAGIC_LENGTH] = KDF_VERSION;
+	_vBody[KDF_MAGIC_LENGTH + 1] = (u8)HASH_MODES::ARGON2ID;
+	u8* _pFields = &_vBody[KDF_MAGIC_LENGTH + 2];
+	PutU32(_pFields, m_kdfParams.nTimeCost);
+	PutU32(_pFields + 4, m_kdfParams.nMemoryCost);
+	PutU32(_pFields + 8, m_kdfParams.nLanes);
+	_pFields[12] = (u8)m_vKdfSalt.size();
+	_vBody.insert(_vBody.end(), m_vKdfSalt.begin(), m_vKdfSalt.end());
+
+	HashDigest<HASH_MODES::SHA256> _hash;
+	CRYPTO_ERROR_CODES _nRC = HashSHA::Digest<HASH_MODES::SHA256>(
+		_vBody.data(), _vBody.size(), _hash);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	std::ofstream _fileOut(strFileName.c_str(), std::ios::out | 
+		std::ios::binary);
+	if (!_fileOut.is_open())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO;
+	_fileOut.write((char*)_hash.data(), _hash.size());
+	_fileOut.write((char*)_vBody.data(), _vBody.size());
+	_fileOut.flush();
+	if (!_fileOut.good())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES CryptoKey::CalibrateKdf(uint nTargetMs, uint nMaxMemoryKiB)
+{
+	Argon2Params _params;
+	CRYPTO_ERROR_CODES _nRC = HashArgon2::Calibrate(nTargetMs, nMaxMemoryKiB,
+		_params);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	u8Vec _vSalt(KDF_SALT_LENGTH);
+	_nRC = GetRandomBytes(_vSalt.data(), _vSalt.size());
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	return SetKdfParams(_params, _vSalt);
+}
+
+CRYPTO_ERROR_CODES CryptoKey::SetKdfParams(const Argon2Params& params, 
+	const u8Vec& vSalt)
+{
+	// Validate before accepting
+	HashArgon2 _argon2;
+	CRYPTO_ERROR_CODES _nRC = _argon2.SetParams(params);
+	if (_nRC == CRYPTO_ERROR_CODES::CRYPT_OK)
+		_nRC = _argon2.SetSalt(vSalt);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	m_kdfParams = params;
+	m_vKdfSalt = vSalt;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES CryptoKey::DeriveSubKey(KEY_PURPOSE nPurpose, 
+	const u8* pContext, size_t nContextLength, uint nLength, 
+	CryptoKey& subKey) const
+{
+	u8 _subKey[32];
+	if (nLength > sizeof(_subKey))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	CRYPTO_ERROR_CODES _nRC = DeriveSubKey(nPurpose, pContext, nContextLength,
+		_subKey, nLength);
+	if (_nRC == CRYPTO_ERROR_CODES::CRYPT_OK)
+		_nRC = subKey.SetKeyValue(_subKey, nLength);
+	mbedtls_platform_zeroize(_subKey, sizeof(_subKey));
+	return _nRC;
+}
+
+CRYPTO_ERROR_CODES CryptoKey::DeriveSubKey(KEY_PURPOSE nPurpose, 
+	const u8* pContext, size_t nContextLength, u8* pOut, size_t nLength) const
+{
+	if (m_vValue.empty() || pOut == nullptr || nLength == 0 || 
+		nLength > SUBKEY_MAX_LENGTH || 
+		(pContext == nullptr && nContextLength != 0))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	u8Vec _vInfo(SUBKEY_LABEL_LENGTH + 1 + nContextLength);
+	memcpy(&_vInfo[0], SUBKEY_LABEL, SUBKEY_LABEL_LENGTH);
+	_vInfo[SUBKEY_LABEL_LENGTH] = (u8)nPurpose;
+	if (nContextLength > 0)
+		memcpy(&_vInfo[SUBKEY_LABEL_LENGTH + 1], pContext, nContextLength);
+
+	// Master is already uniformly random (Argon2 output or random key file),
+	// extract runs with the default all-zero salt
+	if (mbedtls_hkdf(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), nullptr, 0,
+		m_vValue.data(), m_vValue.size(), _vInfo.data(), _vInfo.size(), pOut,
+		nLength) != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES CryptoKey::WrapKey(const CryptoKey& key, u8* pOut, 
+	size_t nOutLength) const
+{
+	const u8SecureVec& _vKey = key.GetKeyValue();
+	if (_vKey.empty() || pOut == nullptr || 
+		nOutLength < GetWrappedKeyLength(_vKey.size()))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	// Never wrap with the master directly, it also keys the document cipher
+	// for legacy vaults
+	u8 _kek[KEK_LENGTH];
+	CRYPTO_ERROR_CODES _nRC = DeriveSubKey(KEY_PURPOSE::KEY_WRAP, nullptr, 0,
+		_kek, sizeof(_kek));
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	mbedtls_nist_kw_context _ctx;
+	mbedtls_nist_kw_init(&_ctx);
+	size_t _nWritten = 0;
+	if (mbedtls_nist_kw_setkey(&_ctx, MBEDTLS_CIPHER_ID_AES, _kek, 
+		KEK_LENGTH * 8, 1) != 0 || 
+		mbedtls_nist_kw_wrap(&_ctx, MBEDTLS_KW_MODE_KW, _vKey.data(), 
+		_vKey.size(), pOut, &_nWritten, nOutLength) != 0)
+		_nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	mbedtls_nist_kw_free(&_ctx);
+	mbedtls_platform_zeroize(_kek, sizeof(_kek));
+	return _nRC;
+}
+
+CRYPTO_ERROR_CODES CryptoKey::UnwrapKey(const u8* pWrapped, 
+	size_t nWrappedLength, CryptoKey& key) const
+{
+	u8 _key[32];
+	if (pWrapped == nullptr || nWrappedLength < GetWrappedKeyLength(16) || 
+		nWrappedLength > GetWrappedKeyLength(sizeof(_key)))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	u8 _kek[KEK_LENGTH];
+	CRYPTO_ERROR_CODES _nRC = DeriveSubKey(KEY_PURPOSE::KEY_WRAP, nullptr, 0,
+		_kek, sizeof(_kek));
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	mbedtls_nist_kw_context _ctx;
+	mbedtls_nist_kw_init(&_ctx);
+	size_t _nWritten = 0;
+	int _nMbedRC = mbedtls_nist_kw_setkey(&_ctx, MBEDTLS_CIPHER_ID_AES, _kek,
+		KEK_LENGTH * 8, 0);
+	if (_nMbedRC == 0)
+		_nMbedRC = mbedtls_nist_kw_unwrap(&_ctx, MBEDTLS_KW_MODE_KW, pWrapped,
+			nWrappedLength, _key, &_nWritten, sizeof(_key));
+	mbedtls_nist_kw_free(&_ctx);
+	mbedtls_platform_zeroize(_kek, sizeof(_kek));
+
+	// Integrity check value mismatch: wrong KEK or modified data
+	if (_nMbedRC == MBEDTLS_ERR_CIPHER_AUTH_FAILED)
+		_nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED;
+	else if (_nMbedRC != 0)
+		_nRC = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	else
+		_nRC = key.SetKeyValue(_key, _nWritten);
+	mbedtls_platform_zeroize(_key, sizeof(_key));
+	return _nRC;
+}
+
+CRYPTO_ERROR_CODES CryptoKey::SetKeyValue(const u8* pValue, size_t nLength)
+{
+	switch (nLength * 8)
+	{
+	case 128:
+	case 192:
+	case 256:
+		break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	}
+	if (pValue == nullptr)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	// Key value is about to change, drop cached round keys
+	m_aesSchedule.Clear();
+	m_tdesSchedule.Clear();
+	m_chachaSchedule.Clear();
+
+	if (!m_vValue.empty())
+		mbedtls_platform_zeroize(m_vValue.data(), m_vValue.size());
+	m_vValue.assign(pValue, pValue + nLength);
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+const CryptoKeySchedule* CryptoKey::GetKeySchedule(CRYPTO_MODES nMode)
+{
+	CryptoKeySchedule* _pSchedule;
+	switch (nMode)
+	{
+	case CRYPTO_MODES::AES_ECB:
+	case CRYPTO_MODES::AES_CBC:
+	case CRYPTO_MODES::AES_CTR:
+	case CRYPTO_MODES::AES_GCM:
+		_pSchedule = &m_aesSchedule;
+		break;
+	case CRYPTO_MODES::TDES_ECB:
+	case CRYPTO_MODES::TDES_CBC:
+		_pSchedule = &m_tdesSchedule;
+		break;
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+		_pSchedule = &m_chachaSchedule;
+		break;
+	default:
+		return nullptr;
+	}
+
+	if (!_pSchedule->IsValidFor(nMode))
+	{
+		if (_pSchedule->Init(nMode, m_vValue.data(), m_vValue.size()) != 
+			CRYPTO_ERROR_CODES::CRYPT_OK)
+			return nullptr;
+	}
+	return _pSchedule;
 }
@@ -0,0 +1,141 @@
+#include "CryptoKeySchedule.h"
+#include "KeyScheduleCtx.h"
+#include "mbedtls/platform_util.h"
+
+#include <cstring>
+
+
+CryptoKeySchedule::CryptoKeySchedule()
+{
+	m_pCtx = new KeyScheduleCtx();
+	m_pCtx->nType = KEY_SCHEDULE_TYPE::NONE;
+	m_pCtx->nKeyLength = 0;
+	mbedtls_aes_init(&m_pCtx->aesEnc);
+	mbedtls_aes_init(&m_pCtx->aesDec);
+	mbedtls_gcm_init(&m_pCtx->gcm);
+	mbedtls_chachapoly_init(&m_pCtx->chachapoly);
+	mbedtls_des3_init(&m_pCtx->desEnc);
+	mbedtls_des3_init(&m_pCtx->desDec);
+}
+
+CryptoKeySchedule::~CryptoKeySchedule()
+{
+	Clear();
+	delete m_pCtx;
+}
+
+CRYPTO_ERROR_CODES CryptoKeySchedule::Init(CRYPTO_MODES nMode, const u8* pKey,
+	size_t nKeyLength)
+{
+	Clear();
+
+	if (pKey == nullptr)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	int _nRC = 0;
+	switch (nMode)
+	{
+	case CRYPTO_MODES::AES_ECB:
+	case CRYPTO_MODES::AES_CBC:
+	case CRYPTO_MODES::AES_CTR:
+	case CRYPTO_MODES::AES_GCM:
+	{
+		switch (nKeyLength * 8)
+		{
+		case 128:
+		case 192:
+		case 256:
+			break;
+		default:
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		}
+		_nRC = mbedtls_aes_setkey_enc(&m_pCtx->aesEnc, pKey, 
+			(uint)nKeyLength * 8);
+		if (_nRC == 0)
+			_nRC = mbedtls_aes_setkey_dec(&m_pCtx->aesDec, pKey, 
+				(uint)nKeyLength * 8);
+		if (_nRC == 0)
+			_nRC = mbedtls_gcm_setkey(&m_pCtx->gcm, MBEDTLS_CIPHER_ID_AES, pKey,
+				(uint)nKeyLength * 8);
+		m_pCtx->nType = KEY_SCHEDULE_TYPE::AES;
+	} break;
+	case CRYPTO_MODES::TDES_ECB:
+	case CRYPTO_MODES::TDES_CBC:
+	{
+		switch (nKeyLength * 8)
+		{
+		case 128:	// 2-key
+			_nRC = mbedtls_des3_set2key_enc(&m_pCtx->desEnc, pKey);
+			if (_nRC == 0)
+				_nRC = mbedtls_des3_set2key_dec(&m_pCtx->desDec, pKey);
+			break;
+		case 192:	// 3-key
+			_nRC = mbedtls_des3_set3key_enc(&m_pCtx->desEnc, pKey);
+			if (_nRC == 0)
+				_nRC = mbedtls_des3_set3key_dec(&m_pCtx->desDec, pKey);
+			break;
+		default:
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		}
+		m_pCtx->nType = KEY_SCHEDULE_TYPE::TDES;
+	} break;
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+	{
+		if (nKeyLength != 32)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		_nRC = mbedtls_chachapoly_setkey(&m_pCtx->chachapoly, pKey);
+		m_pCtx->nType = KEY_SCHEDULE_TYPE::CHACHA;
+	} break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	}
+
+	if (_nRC != 0)
+	{
+		Clear();
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	}
+	m_pCtx->nKeyLength = nKeyLength;
+	memcpy(m_pCtx->key, pKey, nKeyLength);
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+void CryptoKeySchedule::Clear()
+{
+	// mbedtls *_free zeroizes the context, re-init leaves it ready for reuse
+	mbedtls_aes_free(&m_pCtx->aesEnc);
+	mbedtls_aes_free(&m_pCtx->aesDec);
+	mbedtls_gcm_free(&m_pCtx->gcm);
+	mbedtls_chachapoly_free(&m_pCtx->chachapoly);
+	mbedtls_des3_free(&m_pCtx->desEnc);
+	mbedtls_des3_free(&m_pCtx->desDec);
+	mbedtls_aes_init(&m_pCtx->aesEnc);
+	mbedtls_aes_init(&m_pCtx->aesDec);
+	mbedtls_gcm_init(&m_pCtx->gcm);
+	mbedtls_chachapoly_init(&m_pCtx->chachapoly);
+	mbedtls_des3_init(&m_pCtx->desEnc);
+	mbedtls_des3_init(&m_pCtx->desDec);
+	mbedtls_platform_zeroize(m_pCtx->key, sizeof(m_pCtx->key));
+	m_pCtx->nType = KEY_SCHEDULE_TYPE::NONE;
+	m_pCtx->nKeyLength = 0;
+}
+
+bool CryptoKeySchedule::IsValidFor(CRYPTO_MODES nMode) const
+{
+	switch (nMode)
+	{
+	case CRYPTO_MODES::AES_ECB:
+	case CRYPTO_MODES::AES_CBC:
+	case CRYPTO_MODES::AES_CTR:
+	case CRYPTO_MODES::AES_GCM:
+		return m_pCtx->nType == KEY_SCHEDULE_TYPE::AES;
+	case CRYPTO_MODES::TDES_ECB:
+	case CRYPTO_MODES::TDES_CBC:
+		return m_pCtx->nType == KEY_SCHEDULE_TYPE::TDES;
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+		return m_pCtx->nType == KEY_SCHEDULE_TYPE::CHACHA;
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,92 @@
+#include "CryptoParallel.h"
+
+#include <thread>
+#include <vector>
+#ifdef __GNUC__
+#include <cstring>
+#endif
+
+
+uint GetThreadCount(uint nRequested)
+{
+	if (nRequested != 0)
+		return nRequested;
+
+	uint _nCores = std::thread::hardware_concurrency();
+	return _nCores == 0 ? 1 : _nCores;
+}
+
+uint GetRangeCount(size_t nBlocks, uint nThreads)
+{
+	if (nThreads > nBlocks)
+		nThreads = (uint)nBlocks;
+	return nThreads == 0 ? 1 : nThreads;
+}
+
+size_t GetRangeStart(size_t nBlocks, uint nRanges, uint nRange)
+{
+	// First (nBlocks % nRanges) ranges take one extra block
+	size_t _nPerRange = nBlocks / nRanges;
+	size_t _nRemainder = nBlocks % nRanges;
+	return nRange * _nPerRange + (nRange < _nRemainder ? nRange : _nRemainder);
+}
+
+bool RunBlockRanges(size_t nBlocks, uint nThreads, 
+	const block_range_fn& fnWork)
+{
+	uint _nRanges = GetRangeCount(nBlocks, nThreads);
+	if (_nRanges == 1)
+		return fnWork(0, 0, nBlocks);
+
+	// Results are written per range so no synchronization is needed
+	std::vector<char> _vResults(_nRanges, 0);
+	std::vector<std::thread> _vThreads;
+	_vThreads.reserve(_nRanges - 1);
+
+	for (uint i = 1; i < _nRanges; i++)
+	{
+		size_t _nFirst = GetRangeStart(nBlocks, _nRanges, i);
+		size_t _nCount = GetRangeStart(nBlocks, _nRanges, i + 1) - _nFirst;
+		_vThreads.push_back(std::thread([&fnWork, &_vResults, i, _nFirst, 
+			_nCount]() {
+			_vResults[i] = fnWork(i, _nFirst, _nCount) ? 1 : 0;
+		}));
+	}
+
+	_vResults[0] = fnWork(0, 0, GetRangeStart(nBlocks, _nRanges, 1)) ? 1 : 0;
+
+	bool _bSuccess = true;
+	for (uint i = 0; i < _vThreads.size(); i++)
+		_vThreads[i].join();
+	for (uint i = 0; i < _nRanges; i++)
+		_bSuccess = _bSuccess && _vResults[i] != 0;
+
+	return _bSuccess;
+}
+
+bool RunCBCDecryptRanges(const u8* pIn, size_t nBytesIn, u8* pOut, 
+	const u8* pIV, size_t nBlockSize, uint nThreads, 
+	const cbc_range_fn& fnDecrypt)
+{
+	size_t _nBlocks = nBytesIn / nBlockSize;
+	uint _nRanges = GetRangeCount(_nBlocks, nThreads);
+
+	// Chaining block for each range is the ciphertext block preceding it.
+	// Copy them now since in-place decryption overwrites the ciphertext
+	std::vector<u8> _vIVs(_nRanges * nBlockSize, 0);
+	if (pIV)
+		memcpy(&_vIVs[0], pIV, nBlockSize);
+	for (uint i = 1; i < _nRanges; i++)
+	{
+		size_t _nFirst = GetRangeStart(_nBlocks, _nRanges, i);
+		memcpy(&_vIVs[i * nBlockSize], pIn + (_nFirst - 1) * nBlockSize, 
+			nBlockSize);
+	}
+
+	return RunBlockRanges(_nBlocks, _nRanges, 
+		[&](uint nRange, size_t nFirstBlock, size_t nNumBlocks) {
+		size_t _nOffset = nFirstBlock * nBlockSize;
+		return fnDecrypt(&_vIVs[nRange * nBlockSize], pIn + _nOffset, 
+			nNumBlocks * nBlockSize, pOut + _nOffset);
+	});
+}
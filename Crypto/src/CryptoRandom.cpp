@@ -0,0 +1,60 @@
+#include "CryptoRandom.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+
+#include <mutex>
+
+namespace
+{
+	// Process wide generator, freed at exit
+	struct RandomCtx
+	{
+		RandomCtx()
+		{
+			mbedtls_entropy_init(&entropy);
+			mbedtls_ctr_drbg_init(&drbg);
+		}
+		~RandomCtx()
+		{
+			mbedtls_ctr_drbg_free(&drbg);
+			mbedtls_entropy_free(&entropy);
+		}
+
+		mbedtls_entropy_context entropy;
+		mbedtls_ctr_drbg_context drbg;
+		std::mutex lock;
+		bool bSeeded = false;
+	};
+
+	RandomCtx g_random;
+}
+
+CRYPTO_ERROR_CODES GetRandomBytes(u8* pOut, size_t nLength)
+{
+	if (pOut == nullptr && nLength != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	std::lock_guard<std::mutex> _lock(g_random.lock);
+	if (!g_random.bSeeded)
+	{
+		static const char _strPers[] = "PasswordManager";
+		if (mbedtls_ctr_drbg_seed(&g_random.drbg, mbedtls_entropy_func, 
+			&g_random.entropy, (const unsigned char*)_strPers, 
+			sizeof(_strPers) - 1) != 0)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		g_random.bSeeded = true;
+	}
+
+	// Generator output is limited per request
+	while (nLength > 0)
+	{
+		size_t _nChunk = nLength < MBEDTLS_CTR_DRBG_MAX_REQUEST ? 
+			nLength : MBEDTLS_CTR_DRBG_MAX_REQUEST;
+		if (mbedtls_ctr_drbg_random(&g_random.drbg, pOut, _nChunk) != 0)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		pOut += _nChunk;
+		nLength -= _nChunk;
+	}
+
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
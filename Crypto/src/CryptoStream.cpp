@@ -0,0 +1,432 @@
+#include "CryptoStream.h"
+#include "KeyScheduleCtx.h"
+#include "mbedtls/platform_util.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/sha512.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define MAX_BLOCK 16
+#define AEAD_IV_LENGTH 12
+#define AEAD_TAG_LENGTH 16
+
+// State of one CipherStream operation. Round keys stay in the shared key
+// schedule, AEAD modes keep a private context so streams on the same
+// schedule do not interfere
+struct CipherStreamCtx {
+	CRYPTO_MODES nMode;
+	bool bEncrypt;
+	bool bActive;
+	const KeyScheduleCtx* pKey;
+	size_t nBlockSize;		// 0 for stream and AEAD modes
+
+	u8 iv[MAX_BLOCK];		// CBC chaining value or CTR counter
+	u8 streamBlock[MAX_BLOCK];	// CTR keystream
+	size_t nStreamOffset;	// CTR position in streamBlock
+	u8 pending[MAX_BLOCK];	// Block modes: partial input block
+	size_t nPending;
+
+	mbedtls_gcm_context gcm;
+	mbedtls_chachapoly_context chachapoly;
+
+	// AEAD modes copy the key into gcm and chachapoly, so the context lives
+	// in the secure pool
+	static void* operator new(size_t nBytes)
+	{
+		void* _pMemory = SecureAllocate(nBytes);
+		if (_pMemory == nullptr)
+			throw std::bad_alloc();
+		return _pMemory;
+	}
+
+	static void operator delete(void* pMemory, size_t nBytes)
+	{
+		SecureFree(pMemory, nBytes);
+	}
+};
+
+struct HashStreamCtx {
+	HASH_MODES nMode;
+	bool bActive;
+	mbedtls_sha256_context sha256;
+	mbedtls_sha512_context sha512;
+};
+
+static void ResetCipherCtx(CipherStreamCtx* pCtx)
+{
+	mbedtls_gcm_free(&pCtx->gcm);
+	mbedtls_chachapoly_free(&pCtx->chachapoly);
+	mbedtls_platform_zeroize(pCtx->iv, sizeof(pCtx->iv));
+	mbedtls_platform_zeroize(pCtx->streamBlock, sizeof(pCtx->streamBlock));
+	mbedtls_platform_zeroize(pCtx->pending, sizeof(pCtx->pending));
+	mbedtls_gcm_init(&pCtx->gcm);
+	mbedtls_chachapoly_init(&pCtx->chachapoly);
+	pCtx->bActive = false;
+	pCtx->pKey = nullptr;
+	pCtx->nBlockSize = 0;
+	pCtx->nStreamOffset = 0;
+	pCtx->nPending = 0;
+}
+
+// Run whole blocks of a block mode. nLength is a multiple of the block size
+static bool CryptBlocks(CipherStreamCtx* pCtx, const u8* pIn, size_t nLength,
+	u8* pOut)
+{
+	if (nLength == 0)
+		return true;
+
+	const KeyScheduleCtx* _pKey = pCtx->pKey;
+	// mbedtls takes non-const contexts but does not modify round keys
+	mbedtls_aes_context* _pAES = const_cast<mbedtls_aes_context*>(
+		pCtx->bEncrypt ? &_pKey->aesEnc : &_pKey->aesDec);
+	mbedtls_des3_context* _pDES = const_cast<mbedtls_des3_context*>(
+		pCtx->bEncrypt ? &_pKey->desEnc : &_pKey->desDec);
+
+	switch (pCtx->nMode)
+	{
+	case CRYPTO_MODES::AES_ECB:
+		for (size_t i = 0; i < nLength; i += pCtx->nBlockSize)
+			if (mbedtls_aes_crypt_ecb(_pAES, pCtx->bEncrypt ?
+				MBEDTLS_AES_ENCRYPT : MBEDTLS_AES_DECRYPT, pIn + i, pOut + i)
+				!= 0)
+				return false;
+		return true;
+	case CRYPTO_MODES::AES_CBC:
+		return mbedtls_aes_crypt_cbc(_pAES, pCtx->bEncrypt ?
+			MBEDTLS_AES_ENCRYPT : MBEDTLS_AES_DECRYPT, nLength, pCtx->iv, pIn,
+			pOut) == 0;
+	case CRYPTO_MODES::TDES_ECB:
+		for (size_t i = 0; i < nLength; i += pCtx->nBlockSize)
+			if (mbedtls_des3_crypt_ecb(_pDES, pIn + i, pOut + i) != 0)
+				return false;
+		return true;
+	case CRYPTO_MODES::TDES_CBC:
+		return mbedtls_des3_crypt_cbc(_pDES, pCtx->bEncrypt ?
+			MBEDTLS_DES_ENCRYPT : MBEDTLS_DES_DECRYPT, nLength, pCtx->iv, pIn,
+			pOut) == 0;
+	default:
+		return false;
+	}
+}
+
+CipherStream::CipherStream()
+{
+	m_pCtx = new CipherStreamCtx();
+	mbedtls_gcm_init(&m_pCtx->gcm);
+	mbedtls_chachapoly_init(&m_pCtx->chachapoly);
+	ResetCipherCtx(m_pCtx);
+}
+
+CipherStream::~CipherStream()
+{
+	ResetCipherCtx(m_pCtx);
+	mbedtls_gcm_free(&m_pCtx->gcm);
+	mbedtls_chachapoly_free(&m_pCtx->chachapoly);
+	delete m_pCtx;
+}
+
+CRYPTO_ERROR_CODES CipherStream::Init(CRYPTO_MODES nMode, bool bEncrypt,
+	const CryptoKeySchedule& key, const u8* pIV, size_t nIVLength,
+	const u8* pAAD /* = nullptr */, size_t nAADLength /* = 0 */)
+{
+	ResetCipherCtx(m_pCtx);
+	if (!key.IsValidFor(nMode))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	if (nIVLength == 0)
+		pIV = nullptr;
+	if (pAAD == nullptr && nAADLength != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	m_pCtx->nMode = nMode;
+	m_pCtx->bEncrypt = bEncrypt;
+	m_pCtx->pKey = key.GetContext();
+	const KeyScheduleCtx* _pKey = m_pCtx->pKey;
+
+	int _nRC = 0;
+	switch (nMode)
+	{
+	case CRYPTO_MODES::AES_ECB:
+	case CRYPTO_MODES::AES_CBC:
+	case CRYPTO_MODES::AES_CTR:
+		if ((pIV != nullptr && nIVLength != 16) || nAADLength != 0)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		if (nMode == CRYPTO_MODES::AES_CTR && pIV == nullptr)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		if (pIV != nullptr)
+			memcpy(m_pCtx->iv, pIV, nIVLength);
+		m_pCtx->nBlockSize = nMode == CRYPTO_MODES::AES_CTR ? 0 : 16;
+		break;
+	case CRYPTO_MODES::TDES_ECB:
+	case CRYPTO_MODES::TDES_CBC:
+		if ((pIV != nullptr && nIVLength != 8) || nAADLength != 0)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		if (pIV != nullptr)
+			memcpy(m_pCtx->iv, pIV, nIVLength);
+		m_pCtx->nBlockSize = 8;
+		break;
+	case CRYPTO_MODES::AES_GCM:
+		if (pIV == nullptr || nIVLength != AEAD_IV_LENGTH)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		_nRC = mbedtls_gcm_setkey(&m_pCtx->gcm, MBEDTLS_CIPHER_ID_AES,
+			_pKey->key, (uint)_pKey->nKeyLength * 8);
+		if (_nRC == 0)
+			_nRC = mbedtls_gcm_starts(&m_pCtx->gcm, bEncrypt ?
+				MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT, pIV, nIVLength);
+		if (_nRC == 0 && nAADLength != 0)
+			_nRC = mbedtls_gcm_update_ad(&m_pCtx->gcm, pAAD, nAADLength);
+		break;
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+		if (pIV == nullptr || nIVLength != AEAD_IV_LENGTH)
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+		_nRC = mbedtls_chachapoly_setkey(&m_pCtx->chachapoly, _pKey->key);
+		if (_nRC == 0)
+			_nRC = mbedtls_chachapoly_starts(&m_pCtx->chachapoly, pIV,
+				bEncrypt ? MBEDTLS_CHACHAPOLY_ENCRYPT :
+				MBEDTLS_CHACHAPOLY_DECRYPT);
+		if (_nRC == 0 && nAADLength != 0)
+			_nRC = mbedtls_chachapoly_update_aad(&m_pCtx->chachapoly, pAAD,
+				nAADLength);
+		break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	}
+
+	if (_nRC != 0)
+	{
+		ResetCipherCtx(m_pCtx);
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	}
+	m_pCtx->bActive = true;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES CipherStream::Update(const u8* pIn, size_t nInLength,
+	u8* pOut, size_t nOutLength, size_t& nWritten)
+{
+	nWritten = 0;
+	if (!m_pCtx->bActive || (nInLength != 0 && (pIn == nullptr ||
+		pOut == nullptr)))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	size_t _nBlock = m_pCtx->nBlockSize;
+	size_t _nRequired = _nBlock == 0 ? nInLength :
+		(m_pCtx->nPending + nInLength) / _nBlock * _nBlock;
+	if (nOutLength < _nRequired)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	int _nRC = 0;
+	switch (m_pCtx->nMode)
+	{
+	case CRYPTO_MODES::AES_CTR:
+		_nRC = mbedtls_aes_crypt_ctr(
+			const_cast<mbedtls_aes_context*>(&m_pCtx->pKey->aesEnc),
+			nInLength, &m_pCtx->nStreamOffset, m_pCtx->iv,
+			m_pCtx->streamBlock, pIn, pOut);
+		nWritten = nInLength;
+		break;
+	case CRYPTO_MODES::AES_GCM:
+		_nRC = mbedtls_gcm_update(&m_pCtx->gcm, pIn, nInLength, pOut,
+			nOutLength, &nWritten);
+		break;
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+		_nRC = mbedtls_chachapoly_update(&m_pCtx->chachapoly, nInLength, pIn,
+			pOut);
+		nWritten = nInLength;
+		break;
+	default:
+	{
+		// Complete a block held back by the previous call first
+		if (m_pCtx->nPending > 0)
+		{
+			size_t _nTake = std::min(_nBlock - m_pCtx->nPending, nInLength);
+			memcpy(m_pCtx->pending + m_pCtx->nPending, pIn, _nTake);
+			m_pCtx->nPending += _nTake;
+			pIn += _nTake;
+			nInLength -= _nTake;
+			if (m_pCtx->nPending < _nBlock)
+				return CRYPTO_ERROR_CODES::CRYPT_OK;
+			if (!CryptBlocks(m_pCtx, m_pCtx->pending, _nBlock, pOut))
+				return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+			m_pCtx->nPending = 0;
+			nWritten = _nBlock;
+		}
+
+		size_t _nWhole = nInLength / _nBlock * _nBlock;
+		if (!CryptBlocks(m_pCtx, pIn, _nWhole, pOut + nWritten))
+			return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+		nWritten += _nWhole;
+
+		m_pCtx->nPending = nInLength - _nWhole;
+		memcpy(m_pCtx->pending, pIn + _nWhole, m_pCtx->nPending);
+	} break;
+	}
+
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES CipherStream::Finish(u8* pTag /* = nullptr */,
+	size_t nTagLength /* = 0 */)
+{
+	if (!m_pCtx->bActive)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	CRYPTO_ERROR_CODES _nResult = CRYPTO_ERROR_CODES::CRYPT_OK;
+	u8 _calcTag[AEAD_TAG_LENGTH];
+	int _nRC = 0;
+	switch (m_pCtx->nMode)
+	{
+	case CRYPTO_MODES::AES_GCM:
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+	{
+		if (pTag == nullptr || nTagLength != AEAD_TAG_LENGTH)
+		{
+			_nResult = CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+			break;
+		}
+		if (m_pCtx->nMode == CRYPTO_MODES::AES_GCM)
+		{
+			// Software GCM output is never buffered, no trailing output
+			size_t _nOut = 0;
+			_nRC = mbedtls_gcm_finish(&m_pCtx->gcm, nullptr, 0, &_nOut,
+				_calcTag, AEAD_TAG_LENGTH);
+		}
+		else
+			_nRC = mbedtls_chachapoly_finish(&m_pCtx->chachapoly, _calcTag);
+		if (_nRC != 0)
+		{
+			_nResult = CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+			break;
+		}
+
+		if (m_pCtx->bEncrypt)
+			memcpy(pTag, _calcTag, AEAD_TAG_LENGTH);
+		else
+		{
+			// Constant-time compare
+			u8 _nDiff = 0;
+			for (size_t i = 0; i < AEAD_TAG_LENGTH; i++)
+				_nDiff |= _calcTag[i] ^ pTag[i];
+			if (_nDiff != 0)
+				_nResult = CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED;
+		}
+	} break;
+	case CRYPTO_MODES::AES_CTR:
+		break;
+	default:
+		if (m_pCtx->nPending != 0)
+			_nResult = CRYPTO_ERROR_CODES::CRYPT_ERROR_BLOCK_SIZE;
+		break;
+	}
+
+	mbedtls_platform_zeroize(_calcTag, sizeof(_calcTag));
+	ResetCipherCtx(m_pCtx);
+	return _nResult;
+}
+
+size_t CipherStream::GetTagLength() const
+{
+	switch (m_pCtx->nMode)
+	{
+	case CRYPTO_MODES::AES_GCM:
+	case CRYPTO_MODES::CHACHA20_POLY1305:
+		return AEAD_TAG_LENGTH;
+	default:
+		return 0;
+	}
+}
+
+
+HashStream::HashStream()
+{
+	m_pCtx = new HashStreamCtx();
+	m_pCtx->nMode = HASH_MODES::SHA256;
+	m_pCtx->bActive = false;
+	mbedtls_sha256_init(&m_pCtx->sha256);
+	mbedtls_sha512_init(&m_pCtx->sha512);
+}
+
+HashStream::~HashStream()
+{
+	mbedtls_sha256_free(&m_pCtx->sha256);
+	mbedtls_sha512_free(&m_pCtx->sha512);
+	delete m_pCtx;
+}
+
+CRYPTO_ERROR_CODES HashStream::Init(
+	HASH_MODES nMode /* = HASH_MODES::SHA256 */)
+{
+	m_pCtx->bActive = false;
+	int _nRC;
+	switch (nMode)
+	{
+	case HASH_MODES::SHA224:
+	case HASH_MODES::SHA256:
+		_nRC = mbedtls_sha256_starts(&m_pCtx->sha256,
+			nMode == HASH_MODES::SHA224 ? 1 : 0);
+		break;
+	case HASH_MODES::SHA384:
+	case HASH_MODES::SHA512:
+		_nRC = mbedtls_sha512_starts(&m_pCtx->sha512,
+			nMode == HASH_MODES::SHA384 ? 1 : 0);
+		break;
+	default:
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+	}
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+
+	m_pCtx->nMode = nMode;
+	m_pCtx->bActive = true;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES HashStream::Update(const u8* pData, size_t nLength)
+{
+	if (!m_pCtx->bActive || (pData == nullptr && nLength != 0))
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	int _nRC;
+	switch (m_pCtx->nMode)
+	{
+	case HASH_MODES::SHA224:
+	case HASH_MODES::SHA256:
+		_nRC = mbedtls_sha256_update(&m_pCtx->sha256, pData, nLength);
+		break;
+	default:
+		_nRC = mbedtls_sha512_update(&m_pCtx->sha512, pData, nLength);
+		break;
+	}
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+CRYPTO_ERROR_CODES HashStream::Finish(u8* pHash, size_t nHashLength)
+{
+	if (!m_pCtx->bActive || pHash == nullptr || nHashLength < GetHashLength())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT;
+
+	int _nRC;
+	switch (m_pCtx->nMode)
+	{
+	case HASH_MODES::SHA224:
+	case HASH_MODES::SHA256:
+		_nRC = mbedtls_sha256_finish(&m_pCtx->sha256, pHash);
+		break;
+	default:
+		_nRC = mbedtls_sha512_finish(&m_pCtx->sha512, pHash);
+		break;
+	}
+	m_pCtx->bActive = false;
+	if (_nRC != 0)
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_MBEDCRYPTO;
+	return CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+size_t HashStream::GetHashLength() const
+{
+	return GetHashModeLength(m_pCtx->nMode);
+}
@@ -6,9 +6,11 @@ const char* GetCryptoModeStr(CRYPTO_MODES nMode)
 	{
 	case CRYPTO_MODES::AES_ECB: return "AES_ECB";
 	case CRYPTO_MODES::AES_CBC: return "AES_CBC";
-	case CRYPTO_MODES::AES_CTR: return "AES_CBC";
+	case CRYPTO_MODES::AES_CTR: return "AES_CTR";
+	case CRYPTO_MODES::AES_GCM: return "AES_GCM";
 	case CRYPTO_MODES::TDES_ECB: return "TDES_ECB";
 	case CRYPTO_MODES::TDES_CBC: return "TDES_CBC";
+	case CRYPTO_MODES::CHACHA20_POLY1305: return "CHACHA20_POLY1305";
 	default: return "UNKNOWN";
 	}
 }
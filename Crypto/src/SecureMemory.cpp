@@ -0,0 +1,227 @@
+#include "SecureMemory.h"
+#include "mbedtls/platform_util.h"
+
+#include <mutex>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+#define SECURE_CHUNK_SIZE ((size_t)64 << 10)
+#define SECURE_MIN_BLOCK ((size_t)32)
+#define SECURE_MAX_BLOCK ((size_t)4096)
+#define SECURE_CLASSES 8	// Powers of two, SECURE_MIN_BLOCK to SECURE_MAX_BLOCK
+
+namespace
+{
+	// Free blocks are linked through their first bytes
+	struct FreeBlock
+	{
+		FreeBlock* pNext;
+	};
+
+	struct LargeBlock
+	{
+		u8* pMemory;
+		size_t nSize;
+		bool bLocked;
+	};
+
+	struct SecurePool
+	{
+		FreeBlock* vFree[SECURE_CLASSES] = {};
+		u8* pCarve = nullptr;		// Unused tail of the newest chunk
+		size_t nCarveLeft = 0;
+		std::vector<LargeBlock> vLarge;
+		SecureMemoryStats stats;
+		std::mutex lock;
+	};
+
+	// Never destroyed, containers with static storage may still free into
+	// the pool during exit. Blocks are wiped on free and chunks are excluded
+	// from dumps, the OS reclaims the mappings
+	SecurePool& GetPool()
+	{
+		static SecurePool* s_pPool = new SecurePool();
+		return *s_pPool;
+	}
+}
+
+static size_t GetPageSize()
+{
+#ifdef _WIN32
+	SYSTEM_INFO _info;
+	GetSystemInfo(&_info);
+	return _info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static size_t GetSizeClass(size_t nBytes)
+{
+	size_t _nClass = 0;
+	for (size_t _nSize = SECURE_MIN_BLOCK; _nSize < nBytes; _nSize <<= 1)
+		_nClass++;
+	return _nClass;
+}
+
+// Map nBytes (a page multiple), excluded from core dumps and locked if the
+// OS allows. Locking fails beyond RLIMIT_MEMLOCK, the memory is still used
+static u8* MapSecure(size_t nBytes, bool& bLocked)
+{
+	bLocked = false;
+#ifdef _WIN32
+	u8* _pMemory = (u8*)VirtualAlloc(nullptr, nBytes,
+		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (_pMemory == nullptr)
+		return nullptr;
+	bLocked = VirtualLock(_pMemory, nBytes) != 0;
+#else
+	void* _pMap = mmap(nullptr, nBytes, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (_pMap == MAP_FAILED)
+		return nullptr;
+	u8* _pMemory = (u8*)_pMap;
+#ifdef MADV_DONTDUMP
+	madvise(_pMemory, nBytes, MADV_DONTDUMP);
+#endif
+	bLocked = mlock(_pMemory, nBytes) == 0;
+#endif
+	return _pMemory;
+}
+
+static void UnmapSecure(u8* pMemory, size_t nBytes, bool bLocked)
+{
+#ifdef _WIN32
+	if (bLocked)
+		VirtualUnlock(pMemory, nBytes);
+	VirtualFree(pMemory, 0, MEM_RELEASE);
+#else
+	if (bLocked)
+		munlock(pMemory, nBytes);
+	munmap(pMemory, nBytes);
+#endif
+}
+
+// Hand the unused tail of the current chunk to the free lists, largest
+// blocks first. Caller holds the lock
+static void RetireChunkTail(SecurePool& pool)
+{
+	for (size_t _nClass = SECURE_CLASSES; _nClass-- > 0; )
+	{
+		size_t _nBlock = SECURE_MIN_BLOCK << _nClass;
+		while (pool.nCarveLeft >= _nBlock)
+		{
+			FreeBlock* _pBlock = (FreeBlock*)pool.pCarve;
+			_pBlock->pNext = pool.vFree[_nClass];
+			pool.vFree[_nClass] = _pBlock;
+			pool.pCarve += _nBlock;
+			pool.nCarveLeft -= _nBlock;
+		}
+	}
+}
+
+void* SecureAllocate(size_t nBytes)
+{
+	SecurePool& _pool = GetPool();
+	std::lock_guard<std::mutex> _lock(_pool.lock);
+	_pool.stats.nAllocations++;
+
+	if (nBytes > SECURE_MAX_BLOCK)
+	{
+		size_t _nPageSize = GetPageSize();
+		LargeBlock _block;
+		_block.nSize = (nBytes + _nPageSize - 1) / _nPageSize * _nPageSize;
+		_block.pMemory = MapSecure(_block.nSize, _block.bLocked);
+		if (_block.pMemory == nullptr)
+			return nullptr;
+		_pool.vLarge.push_back(_block);
+		_pool.stats.nBytes += _block.nSize;
+		if (_block.bLocked)
+			_pool.stats.nLockedBytes += _block.nSize;
+		_pool.stats.nInUse++;
+		return _block.pMemory;
+	}
+
+	size_t _nClass = GetSizeClass(nBytes);
+	size_t _nBlock = SECURE_MIN_BLOCK << _nClass;
+	FreeBlock* _pBlock = _pool.vFree[_nClass];
+	if (_pBlock != nullptr)
+	{
+		_pool.vFree[_nClass] = _pBlock->pNext;
+		_pBlock->pNext = nullptr;
+		_pool.stats.nReuses++;
+		_pool.stats.nInUse++;
+		return _pBlock;
+	}
+
+	if (_pool.nCarveLeft < _nBlock)
+	{
+		RetireChunkTail(_pool);
+		bool _bLocked;
+		u8* _pChunk = MapSecure(SECURE_CHUNK_SIZE, _bLocked);
+		if (_pChunk == nullptr)
+			return nullptr;
+		_pool.pCarve = _pChunk;
+		_pool.nCarveLeft = SECURE_CHUNK_SIZE;
+		_pool.stats.nChunks++;
+		_pool.stats.nBytes += SECURE_CHUNK_SIZE;
+		if (_bLocked)
+			_pool.stats.nLockedBytes += SECURE_CHUNK_SIZE;
+	}
+
+	void* _pMemory = _pool.pCarve;
+	_pool.pCarve += _nBlock;
+	_pool.nCarveLeft -= _nBlock;
+	_pool.stats.nInUse++;
+	return _pMemory;
+}
+
+void SecureFree(void* pMemory, size_t nBytes)
+{
+	if (pMemory == nullptr)
+		return;
+
+	SecurePool& _pool = GetPool();
+	if (nBytes > SECURE_MAX_BLOCK)
+	{
+		std::lock_guard<std::mutex> _lock(_pool.lock);
+		for (size_t i = 0; i < _pool.vLarge.size(); i++)
+		{
+			LargeBlock _block = _pool.vLarge[i];
+			if (_block.pMemory != pMemory)
+				continue;
+			mbedtls_platform_zeroize(_block.pMemory, nBytes);
+			UnmapSecure(_block.pMemory, _block.nSize, _block.bLocked);
+			_pool.stats.nBytes -= _block.nSize;
+			if (_block.bLocked)
+				_pool.stats.nLockedBytes -= _block.nSize;
+			_pool.stats.nInUse--;
+			_pool.vLarge[i] = _pool.vLarge.back();
+			_pool.vLarge.pop_back();
+			break;
+		}
+		return;
+	}
+
+	// Wipe outside the lock, the block is still owned by the caller
+	size_t _nClass = GetSizeClass(nBytes);
+	mbedtls_platform_zeroize(pMemory, SECURE_MIN_BLOCK << _nClass);
+
+	std::lock_guard<std::mutex> _lock(_pool.lock);
+	FreeBlock* _pBlock = (FreeBlock*)pMemory;
+	_pBlock->pNext = _pool.vFree[_nClass];
+	_pool.vFree[_nClass] = _pBlock;
+	_pool.stats.nInUse--;
+}
+
+SecureMemoryStats SecureMemoryGetStats()
+{
+	SecurePool& _pool = GetPool();
+	std::lock_guard<std::mutex> _lock(_pool.lock);
+	return _pool.stats;
+}
@@ -0,0 +1,148 @@
+#include "ICrypto.h"
+#include "argon2.h"
+
+#include <iostream>
+#include <cstring>
+
+
+int main()
+{
+	uint nNumErrors = 0;
+	const char* pPassword = "test_password";
+	size_t nPasswordLength = strlen(pPassword);
+	u8 _salt[16] = { 0 };
+	u8 _expected[32], _hash[32];
+
+	// Default parameters must reproduce keys derived before they were
+	// configurable (t=2, m=64 MiB, p=1, zero salt)
+	argon2id_hash_raw(2, (1 << 16), 1, pPassword, nPasswordLength, _salt,
+		sizeof(_salt), _expected, sizeof(_expected));
+	HashArgon2 _argon2;
+	if (_argon2.HashData((const u8*)pPassword, nPasswordLength, _hash,
+		sizeof(_hash)) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+		memcmp(_hash, _expected, sizeof(_hash)) != 0)
+	{
+		std::cout << "Default parameters do not match legacy derivation"
+			<< std::endl;
+		nNumErrors++;
+	}
+
+	// Thread count must not change the derived value
+	Argon2Params _params;
+	_params.nTimeCost = 1;
+	_params.nMemoryCost = (1 << 14);
+	_params.nLanes = 4;
+	_params.nThreads = 1;
+	argon2id_hash_raw(_params.nTimeCost, _params.nMemoryCost, _params.nLanes,
+		pPassword, nPasswordLength, _salt, sizeof(_salt), _expected,
+		sizeof(_expected));
+	for (uint nThreads : { 1u, 2u, 4u, 0u })
+	{
+		_params.nThreads = nThreads;
+		memset(_hash, 0, sizeof(_hash));
+		if (_argon2.SetParams(_params) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+			_argon2.HashData((const u8*)pPassword, nPasswordLength, _hash,
+			sizeof(_hash)) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+			memcmp(_hash, _expected, sizeof(_hash)) != 0)
+		{
+			std::cout << "4 lanes on " << nThreads << 
+				" threads does not match reference" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Invalid parameters are rejected and leave the previous ones in place
+	Argon2Params _bad = _params;
+	_bad.nMemoryCost = 8 * _bad.nLanes - 1;
+	if (_argon2.SetParams(_bad) != CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT ||
+		_argon2.GetParams().nMemoryCost != _params.nMemoryCost)
+	{
+		std::cout << "Too little memory per lane accepted" << std::endl;
+		nNumErrors++;
+	}
+	_bad = _params;
+	_bad.nTimeCost = 0;
+	if (_argon2.SetParams(_bad) != CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT)
+	{
+		std::cout << "Zero time cost accepted" << std::endl;
+		nNumErrors++;
+	}
+
+	// Every fill kernel the CPU can run matches the reference kernel
+	_params.nThreads = 0;
+	_argon2.SetParams(_params);
+	for (const char* pKernel : { "sse2", "ssse3", "avx2", "avx512f", "ref" })
+	{
+		if (HashArgon2::SetKernel(pKernel) != CRYPTO_ERROR_CODES::CRYPT_OK)
+			continue;
+		memset(_hash, 0, sizeof(_hash));
+		_argon2.HashData((const u8*)pPassword, nPasswordLength, _hash,
+			sizeof(_hash));
+		if (strcmp(HashArgon2::GetKernelName(), pKernel) != 0 ||
+			memcmp(_hash, _expected, sizeof(_hash)) != 0)
+		{
+			std::cout << "Fill kernel " << pKernel << 
+				" does not match reference" << std::endl;
+			nNumErrors++;
+		}
+	}
+	if (HashArgon2::SetKernel("none") != 
+		CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT)
+	{
+		std::cout << "Unknown fill kernel accepted" << std::endl;
+		nNumErrors++;
+	}
+	HashArgon2::SetKernel(nullptr);
+	std::cout << "Argon2 fill kernel: " << HashArgon2::GetKernelName() << 
+		std::endl;
+
+	// Arena reuses the matrix for a second derivation of the same size and
+	// gives memory back when released or disabled
+	HashArgon2::ReleaseArena();
+	Argon2ArenaStats _before = HashArgon2::GetArenaStats();
+	for (int i = 0; i < 2; i++)
+	{
+		memset(_hash, 0, sizeof(_hash));
+		_argon2.HashData((const u8*)pPassword, nPasswordLength, _hash,
+			sizeof(_hash));
+		if (memcmp(_hash, _expected, sizeof(_hash)) != 0)
+		{
+			std::cout << "Derivation from arena memory does not match" <<
+				std::endl;
+			nNumErrors++;
+		}
+	}
+	Argon2ArenaStats _after = HashArgon2::GetArenaStats();
+	if (_after.nAllocations - _before.nAllocations != 2 ||
+		_after.nReuses - _before.nReuses != 1 || _after.nRegions != 1 ||
+		_after.nBytes < (size_t)_params.nMemoryCost * 1024)
+	{
+		std::cout << "Arena did not reuse the matrix" << std::endl;
+		nNumErrors++;
+	}
+	std::cout << "Argon2 arena: " << (_after.nHugePageBytes > 0 ? 
+		"huge pages" : "normal pages") << std::endl;
+	HashArgon2::ReleaseArena();
+	if (HashArgon2::GetArenaStats().nBytes != 0)
+	{
+		std::cout << "ReleaseArena kept memory" << std::endl;
+		nNumErrors++;
+	}
+	HashArgon2::SetArenaLimit(0);
+	_argon2.HashData((const u8*)pPassword, nPasswordLength, _hash,
+		sizeof(_hash));
+	if (HashArgon2::GetArenaStats().nBytes != 0 || 
+		memcmp(_hash, _expected, sizeof(_hash)) != 0)
+	{
+		std::cout << "Disabled arena kept memory" << std::endl;
+		nNumErrors++;
+	}
+
+	if (nNumErrors == 0)
+		std::cout << "*** HashArgon2 test: PASS" << std::endl;
+	else
+		std::cout << "*** HashArgon2 test: FAIL (" << nNumErrors << 
+			" errors)" << std::endl;
+
+	return nNumErrors;
+}
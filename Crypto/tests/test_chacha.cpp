@@ -0,0 +1,14 @@
+#include <iostream>
+
+#include "ICrypto.h"
+
+int main()
+{
+	bool bSuccess = CryptoChaCha::SelfTest(true);
+	if (bSuccess)
+		std::cout << "*** CryptoChaCha self test: PASS" << std::endl;
+	else
+		std::cout << "*** CryptoChaCha self test: FAIL" << std::endl;
+
+	return bSuccess;
+}
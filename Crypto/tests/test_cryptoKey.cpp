@@ -1,5 +1,7 @@
 #include "CryptoKey.h"
 
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #ifdef __GNUC__
 #include <cstring>
@@ -83,6 +85,152 @@ int main()
 			nNumErrors++;
 		}
 	}
+
+	// Calibrated KDF parameters survive a round trip through the KDF file
+	// and derive the same key
+	_nRC = _key1.CalibrateKdf(50, (1 << 15));
+	const Argon2Params& _params = _key1.GetKdfParams();
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK || _params.nTimeCost < 1 ||
+		_params.nMemoryCost > (1 << 15))
+	{
+		std::cout << "CalibrateKdf returned " << (uint)_nRC << std::endl;
+		nNumErrors++;
+	}
+	_nRC = _key1.WriteKdfToFile("kdf_out.txt");
+	if (_nRC == CRYPTO_ERROR_CODES::CRYPT_OK)
+		_nRC = _key2.ReadKdfFromFile("kdf_out.txt");
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_key2.GetKdfParams().nTimeCost != _params.nTimeCost ||
+		_key2.GetKdfParams().nMemoryCost != _params.nMemoryCost ||
+		_key2.GetKdfParams().nLanes != _params.nLanes)
+	{
+		std::cout << "KDF file round trip failed" << std::endl;
+		nNumErrors++;
+	}
+	_key1.DeriveNewKey(pTestPassword, 32);
+	_key2.DeriveNewKey(pTestPassword, 32);
+	_key3.DeriveNewKey(pTestPassword, 32);	// Legacy parameters
+	if (_key1.GetKeyValue() != _key2.GetKeyValue() ||
+		_key1.GetKeyValue() == _key3.GetKeyValue())
+	{
+		std::cout << "Key derived with recorded KDF parameters does not match"
+			<< std::endl;
+		nNumErrors++;
+	}
+	// Corrupted KDF file is rejected
+	{
+		std::fstream _file("kdf_out.txt", std::ios::in | std::ios::out | 
+			std::ios::binary);
+		_file.seekp(40);
+		_file.put('\x7f');
+	}
+	if (_key2.ReadKdfFromFile("kdf_out.txt") != 
+		CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_CORRUPTED)
+	{
+		std::cout << "Corrupted KDF file accepted" << std::endl;
+		nNumErrors++;
+	}
+	remove("kdf_out.txt");
+
+	// Subkeys: fixed HKDF-SHA256 output for a known master, independent per
+	// purpose and context
+	{
+		const u8 _expected[32] = {
+			0xbc, 0xfe, 0x9c, 0xc3, 0xe5, 0x8f, 0x40, 0x1c, 0x43, 0x70, 0xcf,
+			0xd2, 0xf1, 0xa9, 0x2c, 0x70, 0x5d, 0x9c, 0x03, 0x5e, 0x06, 0x4f,
+			0x0a, 0x9a, 0xdf, 0xec, 0x83, 0x20, 0xa8, 0x20, 0x27, 0xf0 };
+		u8 _master[32];
+		for (u8 i = 0; i < sizeof(_master); i++)
+			_master[i] = i;
+		CryptoKey _masterKey, _subKey1, _subKey2;
+		if (_masterKey.SetKeyValue(_master, sizeof(_master)) != 
+			CRYPTO_ERROR_CODES::CRYPT_OK ||
+			_masterKey.SetKeyValue(_master, 20) != 
+			CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT)
+		{
+			std::cout << "SetKeyValue size check failed" << std::endl;
+			nNumErrors++;
+		}
+
+		_nRC = _masterKey.DeriveSubKey(KEY_PURPOSE::ENCRYPTION, 
+			(const u8*)"entry", 5, 32, _subKey1);
+		if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK || 
+			_subKey1.GetKeyValue().size() != 32 ||
+			memcmp(_subKey1.GetKeyValue().data(), _expected, 32) != 0)
+		{
+			std::cout << "DeriveSubKey does not match known answer" << 
+				std::endl;
+			nNumErrors++;
+		}
+
+		u8 _buffer[16];
+		_masterKey.DeriveSubKey(KEY_PURPOSE::MAC, (const u8*)"entry", 5, 
+			32, _subKey2);
+		_masterKey.DeriveSubKey(KEY_PURPOSE::ENCRYPTION, (const u8*)"other",
+			5, _buffer, sizeof(_buffer));
+		if (_subKey1.GetKeyValue() == _subKey2.GetKeyValue() ||
+			memcmp(_subKey1.GetKeyValue().data(), _buffer, 
+			sizeof(_buffer)) == 0)
+		{
+			std::cout << "Subkeys for different purposes or contexts match" <<
+				std::endl;
+			nNumErrors++;
+		}
+		if (_masterKey.GetKeyValue() != u8SecureVec(_master, _master + 32))
+		{
+			std::cout << "DeriveSubKey changed the master key" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Test wrapping a data key under two different unlock keys
+	{
+		u8 _kek1[32], _kek2[32], _dek[32];
+		for (int i = 0; i < 32; i++)
+		{
+			_kek1[i] = (u8)i;
+			_kek2[i] = (u8)(0xA0 + i);
+			_dek[i] = (u8)(0x55 ^ i);
+		}
+		CryptoKey _unlock1, _unlock2, _dataKey, _unwrapped;
+		_unlock1.SetKeyValue(_kek1, 32);
+		_unlock2.SetKeyValue(_kek2, 32);
+		_dataKey.SetKeyValue(_dek, 32);
+
+		u8 _wrapped[GetWrappedKeyLength(32)];
+		_nRC = _unlock1.WrapKey(_dataKey, _wrapped, sizeof(_wrapped));
+		if (_nRC == CRYPTO_ERROR_CODES::CRYPT_OK)
+			_nRC = _unlock1.UnwrapKey(_wrapped, sizeof(_wrapped), _unwrapped);
+		if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK || 
+			_unwrapped.GetKeyValue() != _dataKey.GetKeyValue())
+		{
+			std::cout << "UnwrapKey does not recover the wrapped key" << 
+				std::endl;
+			nNumErrors++;
+		}
+
+		if (_unlock2.UnwrapKey(_wrapped, sizeof(_wrapped), _unwrapped) != 
+			CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED)
+		{
+			std::cout << "UnwrapKey accepted the wrong unlock key" << 
+				std::endl;
+			nNumErrors++;
+		}
+
+		_wrapped[5] ^= 1;
+		if (_unlock1.UnwrapKey(_wrapped, sizeof(_wrapped), _unwrapped) != 
+			CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED)
+		{
+			std::cout << "UnwrapKey accepted modified data" << std::endl;
+			nNumErrors++;
+		}
+		if (_unlock1.WrapKey(_dataKey, _wrapped, sizeof(_wrapped) - 1) != 
+			CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT)
+		{
+			std::cout << "WrapKey accepted a short buffer" << std::endl;
+			nNumErrors++;
+		}
+	}
 	
 	if (nNumErrors == 0)
 		std::cout << "CryptoKey test: PASS" << std::endl;
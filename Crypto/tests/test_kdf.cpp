@@ -0,0 +1,98 @@
+#include "CryptoKdf.h"
+#include "ICrypto.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+
+int main()
+{
+	uint nNumErrors = 0;
+	const size_t nBudget = (1 << 14);	// Room for two 8 MiB jobs
+
+	// Reference keys derived directly
+	std::vector<KdfJob> _vJobs;
+	std::vector<u8SecureVec> _vExpected;
+	for (int i = 0; i < 6; i++)
+	{
+		KdfJob _job;
+		_job.strPassword.reserve(64);
+		_job.strPassword = ("password " + std::to_string(i)).c_str();
+		_job.params.nTimeCost = 1;
+		_job.params.nMemoryCost = (1 << 13);
+		_job.params.nLanes = 1 + (i % 2);
+		_job.vSalt = u8Vec(16, (u8)i);
+		_vJobs.push_back(_job);
+
+		HashArgon2 _argon2;
+		u8Vec _vKey;
+		_argon2.SetParams(_job.params);
+		_argon2.SetSalt(_job.vSalt);
+		_argon2.HashData((const u8*)_job.strPassword.data(), 
+			_job.strPassword.size(), _vKey);
+		_vExpected.push_back(u8SecureVec(_vKey.begin(), _vKey.end()));
+	}
+
+	// Leave a free region four times the budget in the arena. Jobs must not
+	// run in it
+	{
+		Argon2Params _params;
+		_params.nTimeCost = 1;
+		_params.nMemoryCost = nBudget * 4;
+		HashArgon2 _argon2;
+		u8Vec _vKey;
+		_argon2.SetParams(_params);
+		_argon2.HashData((const u8*)"seed", 4, _vKey);
+	}
+
+	KdfScheduler _scheduler(4, nBudget);
+	std::vector<std::future<KdfResult>> _vFutures = 
+		_scheduler.SubmitBatch(_vJobs);
+
+	// Running jobs never exceed the budget, in the arena regions they hold
+	bool _bDone = false;
+	while (!_bDone)
+	{
+		if (_scheduler.GetMemoryInUse() > nBudget ||
+			HashArgon2::GetArenaStats().nInUseBytes > nBudget * 1024)
+		{
+			std::cout << "Memory budget exceeded" << std::endl;
+			nNumErrors++;
+			break;
+		}
+		_bDone = _vFutures.back().wait_for(std::chrono::milliseconds(1)) ==
+			std::future_status::ready;
+	}
+
+	for (size_t i = 0; i < _vFutures.size(); i++)
+	{
+		KdfResult _result = _vFutures[i].get();
+		if (_result.nResult != CRYPTO_ERROR_CODES::CRYPT_OK || 
+			_result.vKey != _vExpected[i])
+		{
+			std::cout << "Job " << i << " does not match direct derivation"
+				<< std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// A job larger than the whole budget is refused rather than queued
+	KdfJob _large;
+	_large.strPassword = "large";
+	_large.params.nMemoryCost = nBudget * 2;
+	if (_scheduler.Submit(_large).get().nResult != 
+		CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT)
+	{
+		std::cout << "Job over budget accepted" << std::endl;
+		nNumErrors++;
+	}
+
+	if (nNumErrors == 0)
+		std::cout << "*** KdfScheduler test: PASS" << std::endl;
+	else
+		std::cout << "*** KdfScheduler test: FAIL (" << nNumErrors << 
+			" errors)" << std::endl;
+
+	return nNumErrors;
+}
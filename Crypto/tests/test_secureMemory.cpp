@@ -0,0 +1,100 @@
+#include "SecureMemory.h"
+
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+
+int main()
+{
+	uint nNumErrors = 0;
+	SecureMemoryStats _start = SecureMemoryGetStats();
+
+	// Freed blocks are wiped and recycled for the next request of their size
+	{
+		u8* _pBlock = (u8*)SecureAllocate(100);
+		if (_pBlock == nullptr)
+		{
+			std::cout << "SecureAllocate failed" << std::endl;
+			return 1;
+		}
+		memset(_pBlock, 0xA5, 100);
+		SecureFree(_pBlock, 100);
+
+		SecureMemoryStats _before = SecureMemoryGetStats();
+		u8* _pReused = (u8*)SecureAllocate(120);
+		SecureMemoryStats _after = SecureMemoryGetStats();
+		if (_pReused != _pBlock || _after.nReuses != _before.nReuses + 1)
+		{
+			std::cout << "Freed block was not reused" << std::endl;
+			nNumErrors++;
+		}
+		for (int i = 8; i < 100; i++)
+		{
+			// First bytes held the free list link
+			if (_pReused[i] != 0)
+			{
+				std::cout << "Freed block was not wiped" << std::endl;
+				nNumErrors++;
+				break;
+			}
+		}
+		SecureFree(_pReused, 120);
+	}
+
+	// Containers, including blocks mapped individually
+	{
+		u8SecureVec _vSmall(32, 0x11);
+		u8SecureVec _vLarge(1 << 20, 0x22);
+		SecureString _str("a field longer than the inline string buffer");
+		_str += _str;
+		if (_vLarge[12345] != 0x22 || _str.size() != 88 ||
+			SecureMemoryGetStats().nInUse != _start.nInUse + 3)
+		{
+			std::cout << "Secure containers are not served by the pool" <<
+				std::endl;
+			nNumErrors++;
+		}
+	}
+	SecureMemoryStats _end = SecureMemoryGetStats();
+	if (_end.nInUse != _start.nInUse || _end.nBytes >
+		_start.nBytes + ((size_t)1 << 17))
+	{
+		std::cout << "Blocks or large mappings were not returned" << std::endl;
+		nNumErrors++;
+	}
+
+	// Concurrent use
+	{
+		std::vector<std::thread> _vThreads;
+		for (int t = 0; t < 4; t++)
+		{
+			_vThreads.emplace_back([t]() {
+				for (int i = 0; i < 2000; i++)
+				{
+					SecureString _str((size_t)(1 + (i * 7 + t) % 300), 'x');
+					u8SecureVec _v(_str.begin(), _str.end());
+				}
+			});
+		}
+		for (std::thread& thread : _vThreads)
+			thread.join();
+		if (SecureMemoryGetStats().nInUse != _start.nInUse)
+		{
+			std::cout << "Blocks leaked under concurrent use" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	_end = SecureMemoryGetStats();
+	std::cout << _end.nLockedBytes << " of " << _end.nBytes <<
+		" bytes locked" << std::endl;
+
+	if (nNumErrors == 0)
+		std::cout << "*** SecureMemory test: PASS" << std::endl;
+	else
+		std::cout << "*** SecureMemory test: FAIL (" << nNumErrors <<
+			" errors)" << std::endl;
+
+	return nNumErrors;
+}
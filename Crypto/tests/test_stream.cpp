@@ -0,0 +1,280 @@
+#include "CryptoStream.h"
+#include "ICrypto.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+// Odd chunk sizes so partial blocks are carried across Update calls
+static const size_t s_chunks[] = { 1, 7, 16, 3, 33, 64, 5, 100 };
+
+// Run a whole buffer through a CipherStream in uneven chunks
+static CRYPTO_ERROR_CODES StreamCrypt(CRYPTO_MODES nMode, bool bEncrypt,
+	const CryptoKeySchedule& key, const u8Vec& vIV, const u8Vec& vAAD,
+	const u8Vec& vIn, u8Vec& vOut, u8* pTag, size_t nTagLength)
+{
+	CipherStream _stream;
+	CRYPTO_ERROR_CODES _nRC = _stream.Init(nMode, bEncrypt, key,
+		vIV.empty() ? nullptr : &vIV[0], vIV.size(),
+		vAAD.empty() ? nullptr : &vAAD[0], vAAD.size());
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return _nRC;
+
+	vOut.assign(vIn.size(), 0);
+	size_t _nIn = 0, _nOut = 0, _nChunk = 0;
+	while (_nIn < vIn.size())
+	{
+		size_t _nLength = std::min(s_chunks[_nChunk++ % 8], vIn.size() - _nIn);
+		size_t _nWritten = 0;
+		_nRC = _stream.Update(&vIn[_nIn], _nLength, &vOut[_nOut],
+			vOut.size() - _nOut, _nWritten);
+		if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+			return _nRC;
+		_nIn += _nLength;
+		_nOut += _nWritten;
+	}
+	if (_nOut != vIn.size())
+		return CRYPTO_ERROR_CODES::CRYPT_ERROR_BLOCK_SIZE;
+	return _stream.Finish(pTag, nTagLength);
+}
+
+static uint TestCipher(ICrypto& crypto, CRYPTO_MODES nMode, size_t nKeyLength,
+	size_t nDataLength)
+{
+	uint nNumErrors = 0;
+	std::string _strName = std::string(GetCryptoModeStr(nMode)) + " (" +
+		std::to_string(nDataLength) + " bytes)";
+
+	u8Vec _vKey(nKeyLength), _vIV(crypto.GetIVLength()), _vAAD(13);
+	u8Vec _vPlain(nDataLength);
+	for (size_t i = 0; i < _vKey.size(); i++)
+		_vKey[i] = (u8)(i * 7 + 1);
+	for (size_t i = 0; i < _vIV.size(); i++)
+		_vIV[i] = (u8)(0xA0 + i);
+	for (size_t i = 0; i < _vAAD.size(); i++)
+		_vAAD[i] = (u8)(i * 3);
+	for (size_t i = 0; i < _vPlain.size(); i++)
+		_vPlain[i] = (u8)(i * 13 + 5);
+
+	CryptoKeySchedule _key;
+	if (_key.Init(nMode, &_vKey[0], _vKey.size()) !=
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+	{
+		std::cout << _strName << ": key schedule failed" << std::endl;
+		return 1;
+	}
+
+	size_t _nTag = crypto.GetTagLength();
+	u8 _tagOneShot[16] = { 0 }, _tagStream[16] = { 0 };
+	u8Vec _vOneShot(nDataLength), _vStream, _vDecrypted;
+	const u8* _pAAD = _nTag > 0 ? &_vAAD[0] : nullptr;
+	size_t _nAAD = _nTag > 0 ? _vAAD.size() : 0;
+	u8Vec _vStreamAAD = _nTag > 0 ? _vAAD : u8Vec();
+
+	// One-shot reference
+	CRYPTO_ERROR_CODES _nRC;
+	if (_nTag > 0)
+		_nRC = crypto.EncryptAuthData(_vPlain.data(), _vPlain.size(),
+			_vOneShot.data(), _key, &_vIV[0], _vIV.size(), _pAAD, _nAAD,
+			_tagOneShot, _nTag);
+	else
+		_nRC = crypto.EncryptData(_vPlain.data(), _vPlain.size(),
+			_vOneShot.data(), _vOneShot.size(), _key, &_vIV[0], _vIV.size());
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+	{
+		std::cout << _strName << ": one-shot encrypt returned " << (uint)_nRC
+			<< std::endl;
+		return 1;
+	}
+
+	// Chunked encryption must match
+	_nRC = StreamCrypt(nMode, true, _key, _vIV, _vStreamAAD, _vPlain,
+		_vStream, _tagStream, _nTag);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK)
+	{
+		std::cout << _strName << ": stream encrypt returned " << (uint)_nRC
+			<< std::endl;
+		nNumErrors++;
+	}
+	else if (_vStream != _vOneShot ||
+		memcmp(_tagStream, _tagOneShot, sizeof(_tagStream)) != 0)
+	{
+		std::cout << _strName << ": stream output does not match one-shot"
+			<< std::endl;
+		nNumErrors++;
+	}
+
+	// Chunked decryption restores the plaintext
+	_nRC = StreamCrypt(nMode, false, _key, _vIV, _vStreamAAD, _vOneShot,
+		_vDecrypted, _tagOneShot, _nTag);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_OK || _vDecrypted != _vPlain)
+	{
+		std::cout << _strName << ": stream decrypt failed" << std::endl;
+		nNumErrors++;
+	}
+
+	// Tampered ciphertext must be rejected in AEAD modes
+	if (_nTag > 0 && nDataLength > 0)
+	{
+		u8Vec _vTampered = _vOneShot;
+		_vTampered[nDataLength / 2] ^= 0x01;
+		_nRC = StreamCrypt(nMode, false, _key, _vIV, _vStreamAAD, _vTampered,
+			_vDecrypted, _tagOneShot, _nTag);
+		if (_nRC != CRYPTO_ERROR_CODES::CRYPT_ERROR_AUTH_FAILED)
+		{
+			std::cout << _strName << ": tampered ciphertext accepted"
+				<< std::endl;
+			nNumErrors++;
+		}
+	}
+
+	return nNumErrors;
+}
+
+static uint TestHash(HASH_MODES nMode, size_t nDataLength)
+{
+	u8Vec _vData(nDataLength), _vHash;
+	for (size_t i = 0; i < _vData.size(); i++)
+		_vData[i] = (u8)(i * 31 + 11);
+
+	HashSHA _sha;
+	_sha.Init(nMode);
+	if (_sha.HashData(_vData, _vHash) != CRYPTO_ERROR_CODES::CRYPT_OK)
+	{
+		std::cout << "HashSHA failed" << std::endl;
+		return 1;
+	}
+
+	HashStream _stream;
+	u8 _digest[64];
+	size_t _nIn = 0, _nChunk = 0;
+	bool _bOK = _stream.Init(nMode) == CRYPTO_ERROR_CODES::CRYPT_OK;
+	while (_bOK && _nIn < _vData.size())
+	{
+		size_t _nLength = std::min(s_chunks[_nChunk++ % 8],
+			_vData.size() - _nIn);
+		_bOK = _stream.Update(&_vData[_nIn], _nLength) ==
+			CRYPTO_ERROR_CODES::CRYPT_OK;
+		_nIn += _nLength;
+	}
+	_bOK = _bOK && _stream.Finish(_digest, sizeof(_digest)) ==
+		CRYPTO_ERROR_CODES::CRYPT_OK;
+	if (!_bOK || _stream.GetHashLength() != _vHash.size() ||
+		memcmp(_digest, &_vHash[0], _vHash.size()) != 0)
+	{
+		std::cout << "HashStream (" << _vHash.size() * 8 << " bits, " <<
+			nDataLength << " bytes) does not match HashSHA" << std::endl;
+		return 1;
+	}
+
+	// Caller buffer overload writes the same digest and checks its size
+	u8 _buffer[HASH_MAX_LENGTH];
+	if (_sha.HashData(_vData.data(), _vData.size(), _buffer, sizeof(_buffer))
+		!= CRYPTO_ERROR_CODES::CRYPT_OK ||
+		memcmp(_buffer, &_vHash[0], _vHash.size()) != 0 ||
+		_sha.HashData(_vData.data(), _vData.size(), _buffer, 
+		_vHash.size() - 1) != CRYPTO_ERROR_CODES::CRYPT_ERROR_BAD_INPUT)
+	{
+		std::cout << "HashSHA buffer overload (" << _vHash.size() * 8 << 
+			" bits) failed" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Compile-time sized digests
+template <HASH_MODES nMode>
+static uint TestDigest()
+{
+	static_assert(HashDigest<nMode>().size() == GetHashModeLength(nMode),
+		"HashDigest size mismatch");
+	const u8 _data[] = "abc";
+	HashDigest<nMode> _digest;
+	u8Vec _vHash;
+	HashSHA _sha;
+	_sha.Init(nMode);
+	_sha.HashData(_data, 3, _vHash);
+	if (HashSHA::Digest<nMode>(_data, 3, _digest) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK || _vHash.size() != _digest.size() ||
+		memcmp(_digest.data(), _vHash.data(), _digest.size()) != 0)
+	{
+		std::cout << "HashSHA::Digest (" << _digest.size() * 8 << 
+			" bits) does not match HashData" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+int main()
+{
+	uint nNumErrors = 0;
+	CryptoAES _aes;
+	CryptoTDES _tdes;
+	CryptoChaCha _chacha;
+	const size_t _sizes[] = { 0, 48, 1024, 4096 + 16 };
+	const size_t _streamSizes[] = { 1, 15, 1000, 4099 };
+
+	for (size_t nSize : _sizes)
+	{
+		for (CRYPTO_MODES nMode : { CRYPTO_MODES::AES_ECB,
+			CRYPTO_MODES::AES_CBC, CRYPTO_MODES::AES_CTR,
+			CRYPTO_MODES::AES_GCM })
+		{
+			_aes.Init(nMode);
+			for (size_t nKeyLength = 16; nKeyLength <= 32; nKeyLength += 8)
+				nNumErrors += TestCipher(_aes, nMode, nKeyLength, nSize);
+		}
+		for (CRYPTO_MODES nMode : { CRYPTO_MODES::TDES_ECB,
+			CRYPTO_MODES::TDES_CBC })
+		{
+			_tdes.Init(nMode);
+			nNumErrors += TestCipher(_tdes, nMode, 24, nSize);
+		}
+	}
+
+	// Stream and AEAD modes take any length
+	for (size_t nSize : _streamSizes)
+	{
+		_aes.Init(CRYPTO_MODES::AES_CTR);
+		nNumErrors += TestCipher(_aes, CRYPTO_MODES::AES_CTR, 32, nSize);
+		_aes.Init(CRYPTO_MODES::AES_GCM);
+		nNumErrors += TestCipher(_aes, CRYPTO_MODES::AES_GCM, 32, nSize);
+		_chacha.Init(CRYPTO_MODES::CHACHA20_POLY1305);
+		nNumErrors += TestCipher(_chacha, CRYPTO_MODES::CHACHA20_POLY1305, 32,
+			nSize);
+	}
+
+	// Block modes refuse to finish on a partial block
+	{
+		u8 _key[16] = { 0 }, _data[20] = { 0 }, _out[32];
+		size_t _nWritten;
+		CryptoKeySchedule _schedule;
+		_schedule.Init(CRYPTO_MODES::AES_CBC, _key, sizeof(_key));
+		CipherStream _stream;
+		_stream.Init(CRYPTO_MODES::AES_CBC, true, _schedule, nullptr, 0);
+		_stream.Update(_data, sizeof(_data), _out, sizeof(_out), _nWritten);
+		if (_nWritten != 16 || _stream.Finish() !=
+			CRYPTO_ERROR_CODES::CRYPT_ERROR_BLOCK_SIZE)
+		{
+			std::cout << "Partial block not rejected" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	for (HASH_MODES nMode : { HASH_MODES::SHA224, HASH_MODES::SHA256,
+		HASH_MODES::SHA384, HASH_MODES::SHA512 })
+		for (size_t nSize : { 0, 1, 127, 128, 129, 5000 })
+			nNumErrors += TestHash(nMode, nSize);
+	nNumErrors += TestDigest<HASH_MODES::SHA224>();
+	nNumErrors += TestDigest<HASH_MODES::SHA256>();
+	nNumErrors += TestDigest<HASH_MODES::SHA384>();
+	nNumErrors += TestDigest<HASH_MODES::SHA512>();
+
+	if (nNumErrors == 0)
+		std::cout << "*** CipherStream/HashStream test: PASS" << std::endl;
+	else
+		std::cout << "*** CipherStream/HashStream test: FAIL (" << nNumErrors
+			<< " errors)" << std::endl;
+
+	return nNumErrors;
+}
@@ -1,10 +1,13 @@
 #include "ICrypto.h"
 #include "CryptoKey.h"
-#include <unordered_map>
-
-typedef std::vector<std::string> pass_fields;
-typedef std::unordered_map<std::string, pass_fields> pass_map;
-typedef std::pair<std::string, pass_fields> pass_entry;
+#include "CryptoStream.h"
+#include "PassStore.h"
+#include "PagedStore.h"
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 class DocHandler
 {
@@ -13,11 +16,51 @@ public:
 	DocHandler();
 	~DocHandler();
 
-	bool CreateDoc(std::string strFileName);
+	// Paged documents keep entries in an encrypted B+tree and read only the
+	// pages a lookup needs (authenticated modes only). They are laid out when
+	// OpenDoc is called with the key set
+	bool CreateDoc(std::string strFileName, bool bPaged = false);
 	bool OpenDoc(std::string strFileName);
+	// Full saves of documents loaded whole run on a writer thread, entries
+	// can be changed while it runs. The document is written to a temporary
+	// file and renamed over the old one once on disk. Journal and paged 
+	// saves are written before returning. False if the save could not be
+	// started, WaitForSave reports whether it reached the disk
 	bool SaveDoc();
+	// Block until a save in flight is on disk. False if the last save failed
+	bool WaitForSave();
+
+	// Unlock keys (authenticated modes only). Contents are encrypted with a
+	// random data key, each unlock key holds a wrapped copy of it in a header
+	// slot. Changes rewrite single slots in place and sync them, the contents
+	// are not re-encrypted. Legacy documents are converted by a full save
+	// first
+	// Replace the unlock key the document was opened with. The new key takes
+	// a free slot before the old one is cleared; with every slot in use the
+	// document is rewritten whole (not supported for paged documents)
+	bool ChangeUnlockKey(const CryptoKey& newKey);
+	// Allow newKey to open the document as well
+	bool AddUnlockKey(const CryptoKey& newKey);
+	// Number of key slots in use
+	int GetUnlockKeyCount() const;
+
+	const std::string& GetFileName() const { return m_strFileName; }
 
-	pass_map* GetData() { return &m_mapData; }
+	// Entries are changed through PutEntry and EraseEntry, so SaveDoc knows 
+	// what changed
+	size_t GetEntryCount() const;
+	// Copy the fields of the entry called name, false if there is none
+	bool FindEntry(std::string_view name, pass_fields& fields);
+	// Visit every entry, in name order for paged documents
+	bool ForEachEntry(const pass_visitor& fn);
+	bool IsPaged() const { return m_pPaged != nullptr; }
+	// Entries of documents loaded whole, empty for paged documents
+	const PassStore* GetData() const { return &m_store; }
+	// Add an entry or replace the fields of an existing one
+	bool PutEntry(std::string_view name, const std::string_view* pFields,
+		size_t nFields);
+	bool PutEntry(std::string_view name, const pass_fields& fields);
+	bool EraseEntry(std::string_view name);
 
 	void SetKeyHandler(CryptoKey* pKeyHandler) { m_pKeyHandler = pKeyHandler; }
 	CryptoKey* GetKeyHandler() { return m_pKeyHandler; }
@@ -25,8 +68,103 @@ public:
 	void SetCrypto(ICrypto* pCrypto) { m_pCrypto = pCrypto; }
 
 private:
+	// Called with each serialized chunk of the contents
+	typedef std::function<bool(const u8* pData, size_t nLength)> chunk_sink;
+
+	// Full save handed to the writer thread, which only touches the job
+	struct SaveJob
+	{
+		std::string strFileName;
+		ICrypto* pCrypto = nullptr;
+		PassStore store;	// Entries at the time of the save
+		CryptoKey key;		// Data key, or the unlock key for hashed modes
+		u8Vec vKeySlots;
+		// Results, applied by WaitForSave
+		bool bSaved = false;
+		u8Vec vDocIV;		// Authenticated modes only
+		size_t nDocLength = 0;
+	};
+
+	// Decrypt the document body from the file image pFile into the store
+	bool ReadAuthDoc(const u8* pFile, size_t nFileSize);
+	bool ReadHashedDoc(const u8* pFile, size_t nFileSize);
+	// Serialize, encrypt and write the document a chunk at a time
+	static bool WriteAuthDoc(std::ofstream& fileOut, SaveJob& job);
+	static bool WriteHashedDoc(std::ofstream& fileOut, SaveJob& job);
+	// Snapshot the store and start a full save, no save may be in flight
+	bool QueueDoc();
+	void RunWriter();
+	// Write the whole document (writer thread)
+	static bool WriteDoc(SaveJob& job);
+	// Write the header page of a new paged document and an empty tree
+	bool CreatePagedDoc();
+	bool OpenPagedDoc(const u8* pFile, size_t nFileSize);
+	// Decrypt nLength bytes of pCipher with stream a chunk at a time and 
+	// fill the store as entries complete. pHash receives the plaintext if
+	// set. Legacy layout contents are not parsed, they are returned in 
+	// vLegacy with bLegacy set, for ReadLegacyContents once authenticated
+	bool ReadContents(CipherStream& stream, const u8* pCipher, 
+		size_t nLength, HashStream* pHash, u8SecureVec& vLegacy, 
+		bool& bLegacy);
+	bool ReadLegacyContents(const u8SecureVec& vPlain);
+	// Serialize the store in the compact layout, fnWrite receives it one
+	// chunk at a time
+	static bool WriteContents(const PassStore& store, 
+		const chunk_sink& fnWrite);
+
+	// Generate a data key and wrap it for the current key handler
+	bool InitEnvelope();
+	// Recover the data key from the first slot the key handler opens
+	bool OpenKeySlots();
+	// First unused slot, -1 if all are in use
+	int GetFreeKeySlot() const;
+	// Wrap the data key for pKey into slot nSlot, clear it if pKey is nullptr
+	bool SetKeySlot(int nSlot, const CryptoKey* pKey);
+	// Write slot nSlot over the document on disk and sync it. Documents
+	// without slots on disk are saved whole
+	bool SaveKeySlot(int nSlot);
+
+	// Journal (authenticated modes). Changes since the last full save are 
+	// appended to a sidecar file, one encrypted record each, and replayed
+	// over the document when it is opened
+	// Apply a serialized change to the store and queue it for the next save
+	bool QueueChange(u8SecureVec&& vChange);
+	// Apply a serialized change to the store
+	bool ApplyChange(const u8* pChange, size_t nLength);
+	// Replay the journal of the document just read
+	bool ReadJournal();
+	// Append queued changes to the journal
+	bool WriteJournal();
+	// Start an empty journal for the document on disk
+	bool ResetJournal();
+	// Bytes on disk of the record for a change of nChangeLength bytes
+	size_t GetJournalRecordLength(size_t nChangeLength) const;
+	// Header of the journal, also authenticated with every record
+	u8Vec GetJournalHeader() const;
+
 	std::string m_strFileName;
-	pass_map m_mapData;
+	PassStore m_store;
+	std::unique_ptr<PagedStore> m_pPaged;	// Replaces m_store when set
+	bool m_bCreatePaged;
 	CryptoKey* m_pKeyHandler;
 	ICrypto* m_pCrypto;
+
+	CryptoKey m_dataKey;	// Encrypts the contents
+	u8Vec m_vKeySlots;		// Slot table as stored in the header
+	int m_nOpenSlot;		// Slot opened by the key handler, -1 if none
+	bool m_bEnvelopeSaved;	// Document on disk already uses key slots
+
+	std::vector<u8SecureVec> m_vPending;	// Changes not saved yet
+	u8Vec m_vDocIV;				// IV of the document on disk
+	size_t m_nDocLength;		// Size of the document on disk
+	size_t m_nJournalLength;	// Bytes of valid journal, 0 if none
+	uint64_t m_nJournalRecords;
+
+	std::thread m_writer;	// Started by the first full save
+	std::mutex m_saveMutex;
+	std::condition_variable m_saveCond;
+	std::unique_ptr<SaveJob> m_pSaveJob;	// Until WaitForSave collects it
+	bool m_bSaveBusy;		// Writer is working on m_pSaveJob
+	bool m_bSaveFailed;		// Last full save did not reach the disk
+	bool m_bStopWriter;
 };
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef _FILE_SYNC
+#define _FILE_SYNC
+
+#include <string>
+
+// Durability helpers. Streams only hand data to the OS, these wait for the
+// storage device
+
+// Flush the contents of strFileName to disk
+bool SyncFile(const std::string& strFileName);
+// Flush the directory holding strFileName, making its creation or rename
+// durable. Nothing to do on Windows
+bool SyncParentDir(const std::string& strFileName);
+// Rename strFrom over strTo in a single step, so strTo is either the old or
+// the new file after a crash. Durable once it returns
+bool ReplaceFileAtomic(const std::string& strFrom, const std::string& strTo);
+
+#endif // _FILE_SYNC
@@ -0,0 +1,39 @@
+#ifndef _MAPPED_FILE
+#define _MAPPED_FILE
+
+#include "CryptoTypes.h"
+#include <string>
+
+// Read-only view of a whole file. The file is memory mapped with sequential
+// readahead where the OS allows, otherwise it is read into memory. The view
+// is only valid while the file is not truncated by another writer.
+class MappedFile
+{
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string& strFileName);
+	void Close();
+
+	// nullptr for an empty file
+	const u8* GetData() const { return m_pData; }
+	size_t GetSize() const { return m_nSize; }
+	bool IsMapped() const { return m_bMapped; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const u8* m_pData;
+	size_t m_nSize;
+	bool m_bMapped;
+	u8Vec m_vBuffer;	// Contents when mapping is not available
+#ifdef _WIN32
+	void* m_hFile;
+	void* m_hMapping;
+#endif
+};
+
+#endif // _MAPPED_FILE
@@ -0,0 +1,137 @@
+#ifndef _PAGED_STORE
+#define _PAGED_STORE
+
+#include "ICrypto.h"
+#include "CryptoKey.h"
+#include "PassStore.h"
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Password entries in a B+tree of fixed size pages, for vaults too large to
+// load whole. Every page is encrypted and authenticated on its own and
+// parents hold the tags of their children, so a page cannot be swapped for
+// an older copy. Lookups read the pages on one root to leaf path. Changes go
+// to fresh pages (copy on write) and are committed by writing one of two
+// alternating meta pages, the previous tree stays intact until then.
+//
+// Page 0 belongs to the caller (the document header), pages 1 and 2 are the
+// meta pages. Decrypted nodes are cached in secure memory, clean ones are
+// dropped once the cache grows past a limit. Entries are limited to a
+// quarter of a page. Emptied pages are released, partly filled ones are not
+// merged.
+class PagedStore
+{
+
+public:
+	static const size_t PAGE_SIZE = 4096;
+
+	PagedStore();
+	~PagedStore();
+
+	// Write an empty tree behind the caller's page 0. pKey encrypts the
+	// pages, vContext (e.g. the document header) is authenticated with each
+	bool Create(const std::string& strFileName, ICrypto* pCrypto,
+		CryptoKey* pKey, const u8Vec& vContext);
+	// Read the newest valid meta page
+	bool Open(const std::string& strFileName, ICrypto* pCrypto,
+		CryptoKey* pKey, const u8Vec& vContext);
+
+	size_t GetCount() const { return (size_t)m_nCount; }
+	bool IsDirty() const { return m_bDirty; }
+
+	// Copy the fields of the entry called name, false if there is none
+	bool Find(std::string_view name, pass_fields& fields);
+	// Add an entry or replace the fields of an existing one
+	bool Put(std::string_view name, const std::string_view* pFields,
+		size_t nFields);
+	bool Erase(std::string_view name);
+	// Visit entries in name order, stops when fn returns false. fn must not
+	// change the store
+	bool ForEach(const pass_visitor& fn);
+	// Write changed pages and commit them, durable once it returns
+	bool Flush();
+
+	// Page I/O since the store was opened
+	size_t GetPagesRead() const { return m_nPagesRead; }
+	size_t GetPagesWritten() const { return m_nPagesWritten; }
+
+private:
+	struct PageRef
+	{
+		uint nPage;
+		u8 tag[16];		// Tag of the page as last written
+	};
+	struct Node
+	{
+		bool bLeaf = true;
+		bool bDirty = false;
+		bool bFresh = false;	// Page is not part of the committed tree
+		pass_fields vKeys;		// Entry names, or separators between children
+		std::vector<pass_fields> vFields;	// Leaf only
+		std::vector<PageRef> vChildren;		// Internal only, one more than keys
+	};
+	// New right sibling of a node that was split
+	struct Split
+	{
+		bool bSplit = false;
+		SecureString key;
+		PageRef right;
+	};
+
+	// Open the file and reset the tree state
+	bool Init(const std::string& strFileName, ICrypto* pCrypto,
+		CryptoKey* pKey, const u8Vec& vContext);
+	bool ReadPage(uint nPage, u8SecureVec& vBody, u8* pTag);
+	bool WritePage(uint nPage, u8SecureVec& vBody, u8* pTag);
+	bool DecodeNode(const u8SecureVec& vBody, Node& node) const;
+	void EncodeNode(const Node& node, const std::vector<PageRef>& vChildren,
+		u8SecureVec& vBody) const;
+	size_t GetNodeLength(const Node& node) const;
+	size_t GetEntryLength(const Node& node, size_t nEntry) const;
+	size_t GetKeyLength(const Node& node, size_t nKey) const;
+
+	// Cached node for ref, read and verified against ref's tag on a miss
+	Node* LoadNode(const PageRef& ref);
+	Node* NewNode(bool bLeaf, PageRef& ref);
+	void FreeNode(uint nPage);
+	uint AllocatePage();
+	void TrimCache();
+
+	bool PutNode(const PageRef& ref, std::string_view name,
+		const std::string_view* pFields, size_t nFields, Split& split);
+	bool EraseNode(const PageRef& ref, std::string_view name, bool& bEmpty);
+	void SplitNode(Node& node, Split& split);
+	bool VisitNode(const PageRef& ref, const pass_visitor& fn, bool& bStop);
+	// Write ref's dirty subtree, children first. Old pages are released
+	bool WriteNode(const PageRef& ref, PageRef& written,
+		std::unordered_map<uint, PageRef>& mapWritten,
+		std::vector<uint>& vReleased);
+	bool WriteMeta(uint64_t nGeneration, const PageRef& root,
+		const std::vector<uint>& vFree);
+	// Validate a meta page, bLoad makes it current
+	bool ReadMeta(uint nPage, uint64_t& nGeneration, bool bLoad);
+
+	std::fstream m_file;
+	std::string m_strFileName;
+	ICrypto* m_pCrypto;
+	CryptoKey* m_pKey;
+	u8Vec m_vAAD;			// Context followed by the page number
+	size_t m_nBodyLength;	// Plaintext bytes per page
+
+	PageRef m_root;
+	uint64_t m_nCount;
+	uint64_t m_nGeneration;
+	uint m_nPageCount;			// Pages in the file
+	std::vector<uint> m_vFree;	// Free in the committed tree
+	std::vector<uint> m_vFreed;	// Released since, free after the next commit
+	bool m_bDirty;
+
+	std::unordered_map<uint, std::unique_ptr<Node>> m_mapNodes;
+	size_t m_nCacheLimit;	// Size that triggers the next trim
+	size_t m_nPagesRead;
+	size_t m_nPagesWritten;
+};
+
+#endif // _PAGED_STORE
@@ -0,0 +1,84 @@
+#ifndef _PASS_STORE
+#define _PASS_STORE
+
+#include "SecureMemory.h"
+#include <functional>
+#include <string_view>
+#include <vector>
+
+// Fields of one entry as entered by the user
+typedef std::vector<SecureString, SecureAllocator<SecureString>> pass_fields;
+// Called with each entry's name and fields, returns false to stop
+typedef std::function<bool(std::string_view name, 
+	const std::string_view* pFields, size_t nFields)> pass_visitor;
+
+// Password entries keyed by name. Names and field values are packed into a
+// single locked arena, entries and fields are offset/length records and
+// names are indexed by an open addressing hash table. Loading a document is a
+// handful of allocations and the arena is wiped in one pass when freed.
+//
+// Entries are addressed by index, 0 to GetCount() - 1, in no particular
+// order. Views returned by GetName/GetField point into the arena and are
+// invalidated by any change to the store.
+class PassStore
+{
+
+public:
+	static const size_t NOT_FOUND = (size_t)-1;
+
+	PassStore() {}
+	~PassStore() {}
+
+	size_t GetCount() const { return m_vEntries.size(); }
+	// Bytes of names and values held, excluding erased entries
+	size_t GetDataSize() const { return m_vArena.size() - m_nErasedBytes; }
+
+	// Index of the entry called name, NOT_FOUND if there is none
+	size_t Find(std::string_view name) const;
+	std::string_view GetName(size_t nEntry) const;
+	size_t GetFieldCount(size_t nEntry) const;
+	std::string_view GetField(size_t nEntry, size_t nField) const;
+
+	// Add an entry, fails if the name is already present
+	bool Insert(std::string_view name, const std::string_view* pFields,
+		size_t nFields);
+	bool Insert(std::string_view name, const pass_fields& fields);
+	// Remove an entry, its bytes are wiped immediately
+	bool Erase(std::string_view name);
+	void Clear();
+
+	// Make room for nEntries entries, nFields fields and nBytes of names
+	// and values in total
+	void Reserve(size_t nEntries, size_t nFields, size_t nBytes);
+
+private:
+	struct PassSpan
+	{
+		uint nOffset;
+		uint nLength;
+	};
+	struct PassRecord
+	{
+		PassSpan name;
+		uint nFirstField;	// Index in m_vFields
+		uint nFieldCount;
+		uint nHash;
+	};
+
+	static uint HashName(std::string_view name);
+	std::string_view GetView(const PassSpan& span) const;
+	// Slot in m_vIndex holding nEntry, or the empty slot ending its probe
+	size_t FindSlot(std::string_view name, uint nHash) const;
+	void GrowIndex(size_t nEntries);
+	// Rewrite the arena and field table without erased entries
+	void Compact();
+
+	u8SecureVec m_vArena;
+	std::vector<PassSpan> m_vFields;
+	std::vector<PassRecord> m_vEntries;
+	std::vector<uint> m_vIndex;		// Entry index + 1, 0 for an empty slot
+	size_t m_nErasedBytes = 0;
+	size_t m_nErasedFields = 0;
+};
+
+#endif // _PASS_STORE
@@ -0,0 +1,80 @@
+#ifndef _SERIALIZE
+#define _SERIALIZE
+
+#include "CryptoTypes.h"
+#include <cstring>
+#include <string_view>
+
+// Encoding helpers shared by the document formats. var is an unsigned LEB128
+// integer, fixed size integers are little endian
+
+inline size_t GetVarLength(size_t nValue)
+{
+	size_t _nLength = 1;
+	for (; nValue >= 0x80; nValue >>= 7)
+		_nLength++;
+	return _nLength;
+}
+
+inline u8* PutVar(u8* pOut, size_t nValue)
+{
+	for (; nValue >= 0x80; nValue >>= 7)
+		*pOut++ = (u8)(nValue | 0x80);
+	*pOut++ = (u8)nValue;
+	return pOut;
+}
+
+// Decode a var at pIn, advancing it. Fails past pEnd or if the value does
+// not fit size_t
+inline bool GetVar(const u8*& pIn, const u8* pEnd, size_t& nValue)
+{
+	nValue = 0;
+	for (uint _nShift = 0; pIn < pEnd && _nShift < sizeof(size_t) * 8;
+		_nShift += 7)
+	{
+		u8 _byte = *pIn++;
+		// The last byte only has room for the bits left, e.g. one at 63
+		uint _nBits = sizeof(size_t) * 8 - _nShift;
+		if (_nBits < 7 && (_byte & 0x7F) >> _nBits != 0)
+			return false;
+		nValue |= (size_t)(_byte & 0x7F) << _nShift;
+		if ((_byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Var length followed by the bytes of str
+inline u8* PutString(u8* pOut, std::string_view str)
+{
+	pOut = PutVar(pOut, str.size());
+	memcpy(pOut, str.data(), str.size());
+	return pOut + str.size();
+}
+
+// Decode a string written by PutString, the view points into the input
+inline bool GetString(const u8*& pIn, const u8* pEnd, std::string_view& str)
+{
+	size_t _nLength;
+	if (!GetVar(pIn, pEnd, _nLength) || _nLength > (size_t)(pEnd - pIn))
+		return false;
+	str = std::string_view((const char*)pIn, _nLength);
+	pIn += _nLength;
+	return true;
+}
+
+inline void PutLittleEndian(u8* pOut, uint64_t nValue, size_t nBytes)
+{
+	for (size_t i = 0; i < nBytes; i++, nValue >>= 8)
+		pOut[i] = (u8)nValue;
+}
+
+inline uint64_t GetLittleEndian(const u8* pIn, size_t nBytes)
+{
+	uint64_t _nValue = 0;
+	for (size_t i = nBytes; i-- > 0; )
+		_nValue = (_nValue << 8) | pIn[i];
+	return _nValue;
+}
+
+#endif // _SERIALIZE
@@ -1,9 +1,13 @@
 #include "IUserInterface.h"
 #include "CryptoTypes.h"
+#include "CryptoCapabilities.h"
+#include "CryptoRandom.h"
 #include "DocHandler.h"
 
 #include <iostream>
 #include <iomanip>
+#include <cstring>
+#include <cstdio>
 #ifdef _WIN32
 #include <conio.h>
 #endif
@@ -24,22 +28,46 @@ UI_STATE g_nState = UI_STATE::HOME;
 DocHandler* g_pDocHandler;
 CryptoAES g_AES;
 CryptoTDES g_TDES;
+CryptoChaCha g_ChaCha;
+CRYPTO_MODES g_nRecommendedMode = CRYPTO_MODES::AES_GCM;
 
 #define DIVIDER_STR \
 "\n--------------------------------------------------------------------------\n"
 
+// Password key derivation for new documents is calibrated to this unlock time
+// and memory ceiling. Parameters are kept in a file next to the document
+#define KDF_TARGET_MS 500
+#define KDF_MAX_MEMORY_KIB (1 << 20)	// 1 GiB
+#define KDF_FILE_EXT ".kdf"
+#define INPUT_RESERVE_LENGTH 64	// Past the inline buffer of short strings
+
 // Get first character input from user with input hidden in console
 int GetInputSingle();
-// Get string input from user with input displayed in console
-std::string GetInputString();
-// Get string input from user with input hidden in console
-std::string GetInputStringHidden();
+// Get string input from user with input displayed in console. Storage is
+// reserved up front so a SecureString keeps even short input in locked
+// memory rather than its inline buffer, which is never wiped
+template<class STRING = std::string>
+STRING GetInputString();
+// Get string input from user with input hidden in console, kept in locked
+// memory as above
+SecureString GetInputStringHidden();
 // Prompt user for password fields (service, username, password, etc)
 pass_fields InputPasswordFields();
 // Prompt user for cipher mode to use
 CRYPTO_MODES SelectCryptoMode();
+// Display accelerated crypto backends in use on this host
+std::string GetHardwareCryptoStr();
+// Load password KDF parameters for strDocFile into pKey, calibrating and 
+// recording new ones for a newly created document. Legacy parameters are 
+// only used for a missing file once the user confirms
+bool LoadKdfParams(CryptoKey* pKey, const std::string& strDocFile, 
+	bool bDocCreated);
+// Benchmark this host and select KDF parameters with a new random salt
+bool CalibrateKdfParams(CryptoKey* pKey);
+// Read the key file strKeyFile into key, generating it if it does not exist
+bool LoadOrCreateKeyFile(const std::string& strKeyFile, CryptoKey& key);
 // Display formatted password table
-void DisplayPasswordTable(pass_map* pMap);
+void DisplayPasswordTable(DocHandler* pDoc);
 
 
 
@@ -52,6 +80,8 @@ ConsoleInterface::~ConsoleInterface()
 
 bool ConsoleInterface::Init()
 {
+	// Short startup probe to pick the fastest constant-time cipher
+	g_nRecommendedMode = RecommendCryptoMode();
 	return true;
 }
 
@@ -107,10 +137,11 @@ void ConsoleInterface::RunSetupMenu()
 {
 	bool _bShowMenu = true;
 	bool _bKeyGenerated = false;
-	CRYPTO_MODES _nMode = CRYPTO_MODES::AES_CBC;
+	bool _bDocCreated = false;
+	CRYPTO_MODES _nMode = g_nRecommendedMode;
 	std::string _strKeyFile;
 	std::string _strDocFile;
-	std::string _strPassword;
+	SecureString _strPassword;	// Wiped when freed
 
 	if (g_pDocHandler)
 		delete g_pDocHandler;
@@ -122,6 +153,9 @@ void ConsoleInterface::RunSetupMenu()
 		std::cout << "    PASSWORD MANAGER - SETUP\n\n";
 		std::cout << " Crypto Mode       : " << GetCryptoModeStr(_nMode) 
 			<< "\n";
+		std::cout << " Hardware Crypto   : " << GetHardwareCryptoStr() << "\n";
+		std::cout << " Argon2 Kernel     : " << HashArgon2::GetKernelName() 
+			<< "\n";
 		std::cout << " Key Selected      : " << (_bKeyGenerated ? "Generated" 
 			: _strKeyFile) << "\n";
 		std::cout << " Document Selected : " << _strDocFile << "\n\n";
@@ -130,7 +164,8 @@ void ConsoleInterface::RunSetupMenu()
 		std::cout << " 1 - Read Key From File\n";
 		std::cout << " 2 - Generate Key From Password\n";
 		std::cout << " 3 - Select Password Document\n";
-		std::cout << " 4 - Generate New Password Document\n\n";
+		std::cout << " 4 - Generate New Password Document\n";
+		std::cout << " 5 - Generate New Paged Password Document\n\n";
 
 		std::cout << " f - Finish Setup\n";
 		std::cout << " h - Return to Home Page\n";
@@ -157,15 +192,20 @@ void ConsoleInterface::RunSetupMenu()
 		case '3':	// Select Password Document
 			std::cout << "Enter full or relative path to password document:\n";
 			_strDocFile = GetInputString();
+			_bDocCreated = false;
 			break;
 		case '4':	// Generate New Password Document
+		case '5':	// Generate New Paged Password Document
+			if (_nInput == '5')
+				std::cout << "Paged documents are for large vaults and require AES-GCM or ChaCha20-Poly1305\n";
 			std::cout << "Enter full or relative path to save the document:\n";
 			_strDocFile = GetInputString();
-			if (!g_pDocHandler->CreateDoc(_strDocFile))
+			if (!g_pDocHandler->CreateDoc(_strDocFile, _nInput == '5'))
 			{
 				std::cout << "Failed to create document or found existing document with the name provided\n";
 				_strDocFile.clear();
 			}
+			_bDocCreated = _strDocFile.size() > 0;
 			break;
 		case 'f':
 			if (!_bKeyGenerated && _strKeyFile.size() == 0)
@@ -201,6 +241,7 @@ void ConsoleInterface::RunSetupMenu()
 		case CRYPTO_MODES::AES_ECB:
 		case CRYPTO_MODES::AES_CBC:
 		case CRYPTO_MODES::AES_CTR:
+		case CRYPTO_MODES::AES_GCM:
 		{
 			_nKeySize = 32;	// If generating key, use 256-bit key
 			g_AES.Init(_nMode);
@@ -213,10 +254,23 @@ void ConsoleInterface::RunSetupMenu()
 			_nKeySize = 24;	// If generating key, use 192-bit key (3-key)
 			g_TDES.Init(_nMode);
 			g_pDocHandler->SetCrypto(&g_TDES);
+		} break;
+			// ChaCha Mode Types
+		case CRYPTO_MODES::CHACHA20_POLY1305:
+		{
+			_nKeySize = 32;	// 256-bit key only
+			g_ChaCha.Init(_nMode);
+			g_pDocHandler->SetCrypto(&g_ChaCha);
 		} break;
 		}
 		// Initialize Key
-		if (_bKeyGenerated)
+		if (_bKeyGenerated && !LoadKdfParams(g_pDocHandler->GetKeyHandler(),
+			_strDocFile, _bDocCreated))
+		{
+			std::cout << "Failed to load key derivation parameters\n";
+			g_nState = UI_STATE::SETUP;
+		}
+		else if (_bKeyGenerated)
 		{
 			if (g_pDocHandler->GetKeyHandler()->DeriveNewKey(_strPassword,
 				_nKeySize) != CRYPTO_ERROR_CODES::CRYPT_OK)
@@ -224,6 +278,8 @@ void ConsoleInterface::RunSetupMenu()
 				std::cout << "Failed to generate key\n";
 				g_nState = UI_STATE::SETUP;
 			}
+			// Only one derivation per unlock, return the matrix to the OS
+			HashArgon2::ReleaseArena();
 		}
 		else
 		{
@@ -247,8 +303,6 @@ void ConsoleInterface::RunSetupMenu()
 		_strKeyFile = std::string(_strKeyFile.size(), '\0');
 	if (_strDocFile.size() > 0)
 		_strDocFile = std::string(_strDocFile.size(), '\0');
-	if (_strPassword.size() > 0)
-		_strPassword = std::string(_strPassword.size(), '\0');
 
 	return;
 }
@@ -256,17 +310,18 @@ void ConsoleInterface::RunSetupMenu()
 void ConsoleInterface::RunManagementMenu()
 {
 	bool _bShowMenu = true;
-	pass_map* _pMap = g_pDocHandler->GetData();
 	while (_bShowMenu)
 	{
 		std::cout << DIVIDER_STR;
 		std::cout << "    PASSWORD MANAGER - MANAGEMENT\n\n";
 
-		DisplayPasswordTable(_pMap);
+		DisplayPasswordTable(g_pDocHandler);
 
 		std::cout << " 0 - Add New Entry\n";
 		std::cout << " 1 - Delete Entry\n";
 		std::cout << " 2 - Save Changes\n";
+		std::cout << " 3 - Change Unlock Password\n";
+		std::cout << " 4 - Add Unlock Key File\n";
 
 		std::cout << " h - Return to Home Page\n";
 		std::cout << " x - Exit Application\n";
@@ -279,32 +334,87 @@ void ConsoleInterface::RunManagementMenu()
 		{
 			std::cout << "Enter name of entry to add:\n";
 			std::string _strTmp = GetInputString();
-			if (_pMap->find(_strTmp) != _pMap->end())
+			pass_fields _fields;
+			if (g_pDocHandler->FindEntry(_strTmp, _fields))
 				std::cout << _strTmp << " already exists\n";
-			else
-				_pMap->insert(pass_entry(_strTmp, InputPasswordFields()));
+			else if (!g_pDocHandler->PutEntry(_strTmp, InputPasswordFields()))
+				std::cout << "Failed to add " << _strTmp << "\n";
 		} break;
 		case '1':	// Delete Entry
 		{
 			std::cout << "Enter name of entry to delete:\n";
 			std::string _strTmp = GetInputString();
-			if (_pMap->find(_strTmp) != _pMap->end())
-				_pMap->erase(_strTmp);
-			else
+			if (!g_pDocHandler->EraseEntry(_strTmp))
 				std::cout << _strTmp << " not found\n";
 		} break;
 		case '2':	// Save Changes
 		{
-			g_pDocHandler->SaveDoc();
-			std::cout << "Changes saved to file\n";
+			// Full saves finish in the background
+			if (g_pDocHandler->SaveDoc())
+				std::cout << "Saving changes to file\n";
+			else
+				std::cout << "Failed to save changes to file\n";
+		} break;
+		case '3':	// Change Unlock Password
+		{
+			// Replaces the key this session was unlocked with. New passwords
+			// share the document's recorded KDF parameters. Without any 
+			// (key file sessions, older documents) fresh ones are calibrated
+			// with a random salt and recorded, and removed again if the 
+			// change fails
+			std::cout << "Enter new password:\n";
+			SecureString _strPassword = GetInputStringHidden();
+			std::string _strKdfFile = g_pDocHandler->GetFileName() + 
+				KDF_FILE_EXT;
+			CryptoKey _newKey;
+			CRYPTO_ERROR_CODES _nRC = _newKey.ReadKdfFromFile(_strKdfFile);
+			bool _bRecord = _nRC == CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO;
+			bool _bChanged = (_nRC == CRYPTO_ERROR_CODES::CRYPT_OK || 
+				(_bRecord && CalibrateKdfParams(&_newKey))) && 
+				_newKey.DeriveNewKey(_strPassword, (uint)g_pDocHandler->
+				GetKeyHandler()->GetKeyValue().size()) == 
+				CRYPTO_ERROR_CODES::CRYPT_OK;
+			HashArgon2::ReleaseArena();
+			// Hand the block back to the pool now, which wipes it
+			_strPassword.clear();
+			_strPassword.shrink_to_fit();
+			if (_bChanged && _bRecord)
+				_bChanged = _newKey.WriteKdfToFile(_strKdfFile) == 
+					CRYPTO_ERROR_CODES::CRYPT_OK;
+			if (_bChanged)
+			{
+				_bChanged = g_pDocHandler->ChangeUnlockKey(_newKey);
+				if (!_bChanged && _bRecord)
+					std::remove(_strKdfFile.c_str());
+			}
+			if (_bChanged)
+				std::cout << "Unlock password changed\n";
+			else
+				std::cout << "Failed to change unlock password (requires an authenticated crypto mode, and a free key slot for paged documents)\n";
+		} break;
+		case '4':	// Add Unlock Key File
+		{
+			std::cout << "Enter full or relative path to key file (generated if it does not exist):\n";
+			std::string _strKeyFile = GetInputString();
+			CryptoKey _newKey;
+			if (LoadOrCreateKeyFile(_strKeyFile, _newKey) && 
+				g_pDocHandler->AddUnlockKey(_newKey))
+				std::cout << "Key file added, " << 
+					g_pDocHandler->GetUnlockKeyCount() << " unlock keys\n";
+			else
+				std::cout << "Failed to add key file (requires an authenticated crypto mode and a free key slot)\n";
 		} break;
 		case 'h':
 		{
+			if (!g_pDocHandler->WaitForSave())
+				std::cout << "Failed to save changes to file\n";
 			g_nState = UI_STATE::HOME;
 			_bShowMenu = false;
 		} break;
 		case 'x':
 		{
+			if (!g_pDocHandler->WaitForSave())
+				std::cout << "Failed to save changes to file\n";
 			g_nState = UI_STATE::EXITING;
 			_bShowMenu = false;
 		} break;
@@ -331,9 +441,11 @@ int GetInputSingle()
 	return _ch;
 }
 
-std::string GetInputString()
+template<class STRING>
+STRING GetInputString()
 {
-	std::string _str;
+	STRING _str;
+	_str.reserve(INPUT_RESERVE_LENGTH);
 	int _ch = GetInputSingle();
 	while (_ch != '\n' && _ch != '\r')
 	{
@@ -358,9 +470,10 @@ std::string GetInputString()
 	return _str;
 }
 
-std::string GetInputStringHidden()
+SecureString GetInputStringHidden()
 {
-	std::string _str;
+	SecureString _str;
+	_str.reserve(INPUT_RESERVE_LENGTH);
 	int _ch = GetInputSingle();
 	while (_ch != '\n' && _ch != '\r')
 	{
@@ -383,13 +496,13 @@ pass_fields InputPasswordFields()
 {
 	pass_fields _fields;
 	std::cout << "Enter field:\n";
-	_fields.push_back(GetInputString());
+	_fields.push_back(GetInputString<SecureString>());
 	std::cout << "Add more fields? <y/N>\n";
 	int _nInput = GetInputSingle();
 	while (_nInput == 'y' || _nInput == 'Y')
 	{
 		std::cout << "Enter field:\n";
-		_fields.push_back(GetInputString());
+		_fields.push_back(GetInputString<SecureString>());
 
 		std::cout << "Add more fields? <y/N>\n";
 		_nInput = GetInputSingle();
@@ -404,7 +517,10 @@ CRYPTO_MODES SelectCryptoMode()
 	std::cout << " Select Crypto Mode:\n";
 	for (int i = (int)CRYPTO_MODES::BEGIN + 1; i < (int)CRYPTO_MODES::LAST; i++)
 	{
-		std::cout << i << " - " << GetCryptoModeStr((CRYPTO_MODES)i) << "\n";
+		std::cout << i << " - " << GetCryptoModeStr((CRYPTO_MODES)i);
+		if ((CRYPTO_MODES)i == g_nRecommendedMode)
+			std::cout << " (recommended)";
+		std::cout << "\n";
 	}
 
 	while (!_bValid)
@@ -417,48 +533,125 @@ CRYPTO_MODES SelectCryptoMode()
 	return (CRYPTO_MODES)_nInput;
 }
 
-void DisplayPasswordTable(pass_map* pMap)
+std::string GetHardwareCryptoStr()
+{
+	const CryptoCapabilities& _caps = GetCryptoCapabilities();
+	std::string _strResult;
+	if (_caps.bAESAccelerated)
+		_strResult += "AES-NI ";
+	if (_caps.bGCMAccelerated)
+		_strResult += "CLMUL ";
+	if (_caps.bSHAAccelerated)
+		_strResult += "SHA-NI ";
+	if (_caps.cpu.bAVX2)
+		_strResult += "AVX2 ";
+	return _strResult.empty() ? "None (software only)" : _strResult;
+}
+
+bool LoadKdfParams(CryptoKey* pKey, const std::string& strDocFile, 
+	bool bDocCreated)
+{
+	CryptoKey* _pKey = pKey;
+	std::string _strKdfFile = strDocFile + KDF_FILE_EXT;
+
+	CRYPTO_ERROR_CODES _nRC = _pKey->ReadKdfFromFile(_strKdfFile);
+	if (_nRC == CRYPTO_ERROR_CODES::CRYPT_OK)
+		return true;
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO)
+		return false;
+
+	// Documents created before parameters were recorded use the original
+	// fixed parameters and zero salt. A lost file looks the same, so the 
+	// user decides rather than deriving a key that cannot match
+	if (!bDocCreated)
+	{
+		std::cout << "Key derivation parameters missing (" << _strKdfFile << 
+			")\n";
+		std::cout << "Use the fixed parameters of documents created before they were recorded? <y/N>\n";
+		int _nInput = GetInputSingle();
+		if (_nInput != 'y' && _nInput != 'Y')
+			return false;
+		return _pKey->SetKdfParams(Argon2Params(), u8Vec()) == 
+			CRYPTO_ERROR_CODES::CRYPT_OK;
+	}
+
+	return CalibrateKdfParams(_pKey) && 
+		_pKey->WriteKdfToFile(_strKdfFile) == CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+bool CalibrateKdfParams(CryptoKey* pKey)
+{
+	std::cout << "Calibrating key derivation for this host...\n";
+	if (pKey->CalibrateKdf(KDF_TARGET_MS, KDF_MAX_MEMORY_KIB) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+	const Argon2Params& _params = pKey->GetKdfParams();
+	std::cout << "Argon2id: " << _params.nTimeCost << " passes, " << 
+		(_params.nMemoryCost >> 10) << " MiB, " << _params.nLanes << 
+		" lanes\n";
+	return true;
+}
+
+bool LoadOrCreateKeyFile(const std::string& strKeyFile, CryptoKey& key)
+{
+	CRYPTO_ERROR_CODES _nRC = key.ReadKeyFromFile(strKeyFile);
+	if (_nRC != CRYPTO_ERROR_CODES::CRYPT_ERROR_FILE_IO)
+		return _nRC == CRYPTO_ERROR_CODES::CRYPT_OK;
+
+	// Random 256-bit key
+	u8 _value[32];
+	bool _bCreated = GetRandomBytes(_value, sizeof(_value)) == 
+		CRYPTO_ERROR_CODES::CRYPT_OK && key.SetKeyValue(_value, 
+		sizeof(_value)) == CRYPTO_ERROR_CODES::CRYPT_OK && 
+		key.WriteKeyToFile(strKeyFile) == CRYPTO_ERROR_CODES::CRYPT_OK;
+	memset(_value, 0, sizeof(_value));
+	return _bCreated;
+}
+
+void DisplayPasswordTable(DocHandler* pDoc)
 {
 	// Determine entry sizes for table formatting
 	std::vector<size_t> _vMaxSizes;
 	size_t _nMaxFields = 0;
-	for (pass_map::iterator it = pMap->begin(); it != pMap->end(); it++)
-	{
+	pDoc->ForEachEntry([&](std::string_view name, 
+		const std::string_view* pFields, size_t nFields) {
 		size_t _nIndx = 0;
 		if (_vMaxSizes.size() < _nIndx + 1)
-			_vMaxSizes.push_back(it->first.size());
-		else if (_vMaxSizes[_nIndx] < it->first.size())
-			_vMaxSizes[_nIndx] = it->first.size();
+			_vMaxSizes.push_back(name.size());
+		else if (_vMaxSizes[_nIndx] < name.size())
+			_vMaxSizes[_nIndx] = name.size();
 		_nIndx++;
-		for (pass_fields::iterator it2 = it->second.begin(); it2 != it->second.end(); it2++)
+		for (size_t j = 0; j < nFields; j++)
 		{
+			size_t _nSize = pFields[j].size();
 			if (_vMaxSizes.size() < _nIndx + 1)
-				_vMaxSizes.push_back(it2->size());
-			else if (_vMaxSizes[_nIndx] < it2->size())
-				_vMaxSizes[_nIndx] = it2->size();
+				_vMaxSizes.push_back(_nSize);
+			else if (_vMaxSizes[_nIndx] < _nSize)
+				_vMaxSizes[_nIndx] = _nSize;
 			_nIndx++;
 			if (_nIndx > _nMaxFields)
 				_nMaxFields = _nIndx;
 		}
-	}
+		return true;
+	});
 
-	// Print map to stdout
-	for (pass_map::iterator it = pMap->begin(); it != pMap->end(); it++)
-	{
+	// Print entries to stdout
+	pDoc->ForEachEntry([&](std::string_view name, 
+		const std::string_view* pFields, size_t nFields) {
 		int _nFieldIndx = 0;
 		std::cout << " | ";
 		std::cout << std::setw(_vMaxSizes[_nFieldIndx++]) << std::left;
-		std::cout << it->first << " | ";
-		//for (pass_fields::iterator it2 = it->second.begin(); it2 != it->second.end(); it2++)
-		for (int i = 0; i < _nMaxFields - 1; i++)
+		std::cout << name << " | ";
+		for (int j = 0; j < (int)_nMaxFields - 1; j++)
 		{
 			std::cout << std::setw(_vMaxSizes[_nFieldIndx++]) << std::left;
-			if (it->second.size() >= (size_t)i + 1)
-				std::cout << it->second[i] << " | ";
+			if (nFields >= (size_t)j + 1)
+				std::cout << pFields[j] << " | ";
 			else
 				std::cout << std::string() << " | ";
 		}
 		std::cout << "\n";
-	}
+		return true;
+	});
 	std::cout << "\n";
-}
\ No newline at end of file
+}
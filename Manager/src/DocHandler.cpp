@@ -1,5 +1,11 @@
 #include "DocHandler.h"
+#include "CryptoRandom.h"
+#include "FileSync.h"
+#include "MappedFile.h"
+#include "Serialize.h"
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
 #ifdef __GNUC__
@@ -8,41 +14,285 @@
 
 /*
 
-Data saved in the following format:
-HASH[CRYPTO[CONTENTS]]
+Authenticated modes (ICrypto::GetTagLength() > 0) save data as:
+HEADER
+CRYPTO[CONTENTS]
+TAG
+
+Where HEADER = [
+	char magic[4] "PMDB", u8 version, u8 cipherId, u8 ivSize, u8 iv[ivSize],
+	u8 numSlots, SLOT slot0, ... SLOT slotN
+]
+SLOT = [ u8 used, u8 wrappedKey[40] ]
+CONTENTS are encrypted with a random 256-bit data key. Each used SLOT holds 
+the data key wrapped (NIST KW) under one unlock key. The header up to the IV
+is authenticated along with the contents, slots are protected by the key 
+wrap so they can be rewritten in place. CONTENTS is not padded.
+Version 1 documents have no slots, the unlock key encrypts the contents.
+
+All other modes save data in the following format:
+HASH[IV CRYPTO[CONTENTS]]
 HASH[CONTENTS]
+IV
 CRYPTO [CONTENTS]
 
+IV is only present in CTR mode, a random u8 iv[16] for every save. Block
+modes have none and keep the zero IV they were always written with.
+
 Where CONTENTS = [
-	int numMapKeys
-	int key0Size, str key0, int numEntries, int data0Size, str data0, ... int dataNSize, str dataN
+	char magic[4] "PMCE", u8 version,
+	var numKeys,
+	var key0Size, str key0, var numEntries, var data0Size, str data0, ... var dataNSize, str dataN
+	...
+	var keyNSize, str keyN, var numEntries, var data0Size, str data0, ... var dataNSize, str dataN
+]
+var is an unsigned LEB128 integer. Block mode padding follows the last entry.
+
+Documents written before the compact layout have CONTENTS = [
+	size_t numMapKeys
+	size_t key0Size, str key0, size_t numEntries, size_t data0Size, str data0, ... size_t dataNSize, str dataN
 	...
-	int keyNSize, str keyN, int numEntries, int data0Size, str data0, ... int dataNSize, str dataN
 ]
+They are still read and are rewritten in the compact layout on save.
+
+Paged documents (authenticated modes) start with a plain header page:
+[ char magic[4] "PMPG", u8 version, u8 cipherId, u8 ivSize, u8 numSlots, 
+	SLOT slot0, ... SLOT slotN ]
+padded to PagedStore::PAGE_SIZE. The pages that follow hold the entries as a
+B+tree (see PagedStore.cpp), encrypted with the data key and authenticated 
+with the header up to ivSize.
+
+Authenticated documents on disk keep the changes made since their last full 
+save in a journal, <document>.jnl:
+JOURNAL = [
+	char magic[4] "PMJL", u8 version, u8 cipherId, u8 ivSize, u8 docIV[ivSize],
+	RECORD record0, ... RECORD recordN
+]
+RECORD = [ u32 length, u8 iv[ivSize], CRYPTO[CHANGE], TAG ]
+CHANGE = [ u8 op, var keySize, str key, 
+	(put only) var numEntries, var data0Size, str data0, ... ]
+Records are encrypted with the data key and authenticated with the journal
+header and their u64 index, so they cannot be moved to another journal or
+reordered. docIV ties the journal to one save of the document, a journal with
+another IV is stale and ignored. A record cut short at the end of the file is
+dropped. length is little endian. Once the journal outgrows half the document
+the next save is a full one and the journal is removed.
 
 
 */
 
+#define DOC_MAGIC "PMDB"
+#define DOC_MAGIC_LENGTH 4
+#define DOC_VERSION 2
+#define DOC_VERSION_LEGACY 1
+#define DOC_HEADER_FIXED_LENGTH (DOC_MAGIC_LENGTH + 3)
+
+#define CONTENTS_MAGIC "PMCE"
+#define CONTENTS_MAGIC_LENGTH 4
+#define CONTENTS_VERSION 1
+#define CONTENTS_HEADER_LENGTH (CONTENTS_MAGIC_LENGTH + 1)
+
+#define DOC_DATA_KEY_LENGTH 32
+#define DOC_KEY_SLOTS 4
+#define DOC_SLOT_LENGTH (1 + GetWrappedKeyLength(DOC_DATA_KEY_LENGTH))
+#define DOC_SLOTS_LENGTH (DOC_KEY_SLOTS * DOC_SLOT_LENGTH)
+#define DOC_SLOT_EMPTY 0
+#define DOC_SLOT_USED 1
+
+#define PAGED_MAGIC "PMPG"
+#define PAGED_VERSION 1
+
+#define DOC_CHUNK_LENGTH ((size_t)64 << 10)	// Contents pipeline unit
+
+#define DOC_TEMP_EXT ".tmp"
+#define DOC_JOURNAL_EXT ".jnl"
+#define JOURNAL_MAGIC "PMJL"
+#define JOURNAL_MAGIC_LENGTH 4
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_FIXED_LENGTH (JOURNAL_MAGIC_LENGTH + 3)
+#define JOURNAL_COMPACT_MIN ((size_t)16 << 10)	// Journal always allowed
+#define JOURNAL_PUT 1
+#define JOURNAL_ERASE 2
+
+// Cipher identifiers stored in the document header
+static u8 GetDocCipherId(CRYPTO_MODES nMode)
+{
+	switch (nMode)
+	{
+	case CRYPTO_MODES::AES_GCM: return 1;
+	case CRYPTO_MODES::CHACHA20_POLY1305: return 2;
+	default: return 0;
+	}
+}
+
+// IV stored ahead of hashed contents, only CTR needs a nonce
+static size_t GetHashedIVLength(ICrypto* pCrypto)
+{
+	return pCrypto->GetMode() == CRYPTO_MODES::AES_CTR ? 
+		pCrypto->GetIVLength() : 0;
+}
+
+// Parses CONTENTS as it is decrypted. Each chunk is written to GetInput(), 
+// right behind an entry left incomplete by the previous chunk, so only the
+// unparsed tail is kept. Legacy contents have no framing that can be parsed
+// in pieces, they are collected whole for ReadLegacyContents.
+class ContentsReader
+{
+
+public:
+	ContentsReader(PassStore& store, size_t nLength) : m_store(store)
+	{
+		m_nLength = nLength;
+		m_nReceived = 0;
+		m_nUsed = 0;
+		m_nEntries = 0;
+		m_nState = STATE_HEADER;
+	}
+
+	// Room for nLength more bytes
+	u8* GetInput(size_t nLength)
+	{
+		if (m_vBuffer.size() < m_nUsed + nLength)
+			m_vBuffer.resize(m_nUsed + nLength);
+		return &m_vBuffer[m_nUsed];
+	}
+
+	// Parse the nLength bytes just written to GetInput()
+	bool Commit(size_t nLength)
+	{
+		m_nUsed += nLength;
+		m_nReceived += nLength;
+
+		const u8* _pIn = m_vBuffer.data();
+		const u8* _pEnd = _pIn + m_nUsed;
+		bool _bLast = m_nReceived >= m_nLength;
+		if (m_nState == STATE_HEADER)
+		{
+			if (m_nUsed < CONTENTS_HEADER_LENGTH)
+			{
+				if (_bLast)
+					m_nState = STATE_LEGACY;
+				return true;
+			}
+			if (memcmp(_pIn, CONTENTS_MAGIC, CONTENTS_MAGIC_LENGTH) != 0)
+			{
+				m_nState = STATE_LEGACY;
+				return true;
+			}
+			if (_pIn[CONTENTS_MAGIC_LENGTH] != CONTENTS_VERSION)
+				return false;
+
+			// Every entry takes at least two bytes, which bounds the 
+			// reservation
+			const u8* _pCount = _pIn + CONTENTS_HEADER_LENGTH;
+			if (!GetVar(_pCount, _pEnd, m_nEntries))
+				return !_bLast;
+			if (m_nEntries > m_nLength / 2)
+				return false;
+			m_store.Clear();
+			m_store.Reserve(m_nEntries, m_nEntries * 2, m_nLength);
+			_pIn = _pCount;
+			m_nState = STATE_ENTRIES;
+		}
+		if (m_nState == STATE_ENTRIES)
+		{
+			while (m_nEntries > 0 && ParseEntry(_pIn, _pEnd))
+				m_nEntries--;
+			if (m_nEntries == 0)
+				m_nState = STATE_DONE;
+		}
+		if (m_nState == STATE_LEGACY)
+			return true;
+
+		// Keep the incomplete entry, anything after the last one is padding
+		size_t _nRest = m_nState == STATE_DONE ? 0 : _pEnd - _pIn;
+		if (_nRest > 0 && _pIn != m_vBuffer.data())
+			memmove(&m_vBuffer[0], _pIn, _nRest);
+		m_nUsed = _nRest;
+		return true;
+	}
+
+	// Every entry was read, or legacy contents are complete
+	bool Finish()
+	{
+		if (m_nState == STATE_LEGACY)
+			m_vBuffer.resize(m_nUsed);
+		return m_nState == STATE_DONE || m_nState == STATE_LEGACY;
+	}
+
+	bool IsLegacy() const { return m_nState == STATE_LEGACY; }
+	u8SecureVec& GetLegacy() { return m_vBuffer; }
+
+private:
+	enum { STATE_HEADER, STATE_ENTRIES, STATE_DONE, STATE_LEGACY };
+
+	// Insert the entry at pIn and move past it. False if it is incomplete
+	bool ParseEntry(const u8*& pIn, const u8* pEnd)
+	{
+		const u8* _pIn = pIn;
+		std::string_view _name, _field;
+		size_t _nFieldSize;
+		if (!GetString(_pIn, pEnd, _name) || 
+			!GetVar(_pIn, pEnd, _nFieldSize))
+			return false;
+		m_vFields.clear();
+		for (size_t j = 0; j < _nFieldSize; j++)
+		{
+			if (!GetString(_pIn, pEnd, _field))
+				return false;
+			// Copied into the store's arena below
+			m_vFields.push_back(_field);
+		}
+
+		m_store.Insert(_name, m_vFields.data(), m_vFields.size());
+		pIn = _pIn;
+		return true;
+	}
+
+	PassStore& m_store;
+	size_t m_nLength;		// Plaintext bytes expected in total
+	size_t m_nReceived;
+	u8SecureVec m_vBuffer;
+	size_t m_nUsed;			// Bytes of m_vBuffer not parsed yet
+	size_t m_nEntries;		// Entries left to parse
+	int m_nState;
+	std::vector<std::string_view> m_vFields;
+};
+
 DocHandler::DocHandler()
 {
 	m_pCrypto = nullptr;
 	m_pKeyHandler = new CryptoKey();
+	m_nOpenSlot = -1;
+	m_bEnvelopeSaved = false;
+	m_bCreatePaged = false;
+	m_nDocLength = 0;
+	m_nJournalLength = 0;
+	m_nJournalRecords = 0;
+	m_bSaveBusy = false;
+	m_bSaveFailed = false;
+	m_bStopWriter = false;
 }
 
 DocHandler::~DocHandler()
 {
-	// Clear any sensitive data from memory
-	for (pass_map::iterator entry = m_mapData.begin(); entry != m_mapData.end(); entry++)
+	// A save in flight is finished before the writer stops
+	WaitForSave();
+	if (m_writer.joinable())
 	{
-		for (pass_fields::iterator data = entry->second.begin(); data != entry->second.end(); data++)
 		{
-			*data = std::string(data->size(), '\0');
+			std::lock_guard<std::mutex> _lock(m_saveMutex);
+			m_bStopWriter = true;
 		}
+		m_saveCond.notify_all();
+		m_writer.join();
 	}
+	// The store's arena is wiped by the secure allocator as it is freed
 }
 
-bool DocHandler::CreateDoc(std::string strFileName)
+bool DocHandler::CreateDoc(std::string strFileName, bool bPaged)
 {
+	WaitForSave();
 	std::ifstream _fileIn(strFileName.c_str(), std::ios::in | std::ios::binary);
 	if (_fileIn.is_open())
 	{
@@ -56,193 +306,1146 @@ bool DocHandler::CreateDoc(std::string strFileName)
 		return false;
 	_fileOut.close();
 	m_strFileName = strFileName;
+	m_bCreatePaged = bPaged;
 	return true;
 }
 
 
 bool DocHandler::OpenDoc(std::string strFileName)
 {
-	std::ifstream _fileIn(strFileName.c_str(), std::ios::in | std::ios::binary);
-	if (!_fileIn.is_open())
+	WaitForSave();
+	// The document is parsed, hashed and decrypted straight from the mapped
+	// file, the kernel reads ahead while the cipher walks it
+	MappedFile _fileIn;
+	if (!_fileIn.Open(strFileName))
 	{
 		// Failed to establish file handle
 		//std::cout << "OpenDoc: Failed to establish file handle!\n";
 		return false;
 	}
 	m_strFileName = strFileName;
+	m_pPaged.reset();
+	m_vPending.clear();
+	m_vDocIV.clear();
+	m_nJournalLength = 0;
+	m_nJournalRecords = 0;
 
-	// Check file size
-	size_t _nFileSize;
-	_fileIn.seekg(0, _fileIn.end);
-	_nFileSize = _fileIn.tellg();
-	_fileIn.seekg(0, _fileIn.beg);
+	const u8* _pFile = _fileIn.GetData();
+	size_t _nFileSize = _fileIn.GetSize();
 
-	// If empty file, return
+	// If empty file, return. Paged documents need the key to be laid out
 	if (_nFileSize == 0)
+		return !m_bCreatePaged || CreatePagedDoc();
+
+	// Paged documents read pages on demand
+	if (_nFileSize >= PagedStore::PAGE_SIZE && 
+		memcmp(_pFile, PAGED_MAGIC, DOC_MAGIC_LENGTH) == 0)
+		return OpenPagedDoc(_pFile, _nFileSize);
+
+	// Contents are decrypted a chunk at a time into the store
+	bool _bRead;
+	if (m_pCrypto->GetTagLength() > 0)
+		_bRead = ReadAuthDoc(_pFile, _nFileSize);
+	else
+		_bRead = ReadHashedDoc(_pFile, _nFileSize);
+	_fileIn.Close();
+	if (!_bRead)
+		return false;
+
+	// Records replayed before a bad one are not kept either
+	if (m_bEnvelopeSaved && !ReadJournal())
+	{
+		m_store.Clear();
+		m_nJournalLength = 0;
+		m_nJournalRecords = 0;
+		return false;
+	}
+	return true;
+}
+
+
+bool DocHandler::SaveDoc()
+{
+	// Only the changed pages are written
+	if (m_pPaged)
+		return m_pPaged->Flush();
+
+	// One save at a time. The journal is only current after a successful
+	// full save, after a failed one only a full save holds every change
+	bool _bLastSaved = WaitForSave();
+
+	// If data is empty return
+	if (m_store.GetCount() == 0 && m_vPending.empty())
 		return true;
 
-	HashSHA _sha;
-	u8Vec _vHashPlain, _vHashCipher, _vCalcHash, _vIV;
-	_vHashPlain.resize(_sha.GetHashLength());
-	_vHashCipher.resize(_sha.GetHashLength());
+	// Documents with key slots on disk only append the changes, until the 
+	// journal grows past half the document and is folded into a full save
+	if (m_pCrypto->GetTagLength() > 0 && m_bEnvelopeSaved && _bLastSaved)
+	{
+		size_t _nRecordsLength = 0;
+		for (const u8SecureVec& change : m_vPending)
+			_nRecordsLength += GetJournalRecordLength(change.size());
+		if (m_nJournalLength + _nRecordsLength <= 
+			std::max(JOURNAL_COMPACT_MIN, m_nDocLength / 2))
+			return WriteJournal();
+	}
 
-	// Make sure file is appropriate size
-	if (_nFileSize < (_sha.GetHashLength() * (size_t)2) + m_pCrypto->GetBlockSize())
+	return QueueDoc();
+}
+
+bool DocHandler::WaitForSave()
+{
+	std::unique_lock<std::mutex> _lock(m_saveMutex);
+	m_saveCond.wait(_lock, [this] { return !m_bSaveBusy; });
+	if (m_pSaveJob)
+	{
+		// Results are applied here, the writer only touches its job
+		SaveJob& _job = *m_pSaveJob;
+		m_bSaveFailed = !_job.bSaved;
+		if (_job.bSaved && !_job.vDocIV.empty())
+		{
+			m_bEnvelopeSaved = true;
+			m_vDocIV = _job.vDocIV;
+			m_nDocLength = _job.nDocLength;
+		}
+		m_pSaveJob.reset();
+	}
+	return !m_bSaveFailed;
+}
+
+
+bool DocHandler::PutEntry(std::string_view name, 
+	const std::string_view* pFields, size_t nFields)
+{
+	if (m_pPaged)
+		return m_pPaged->Put(name, pFields, nFields);
+
+	size_t _nLength = 1 + GetVarLength(name.size()) + name.size() + 
+		GetVarLength(nFields);
+	for (size_t i = 0; i < nFields; i++)
+		_nLength += GetVarLength(pFields[i].size()) + pFields[i].size();
+
+	// Serialized first, the fields may be views of the entry being replaced
+	u8SecureVec _vChange(_nLength);
+	u8* _pOut = _vChange.data();
+	*_pOut++ = JOURNAL_PUT;
+	_pOut = PutString(_pOut, name);
+	_pOut = PutVar(_pOut, nFields);
+	for (size_t i = 0; i < nFields; i++)
+		_pOut = PutString(_pOut, pFields[i]);
+	return QueueChange(std::move(_vChange));
+}
+
+bool DocHandler::PutEntry(std::string_view name, const pass_fields& fields)
+{
+	std::vector<std::string_view> _vFields(fields.begin(), fields.end());
+	return PutEntry(name, _vFields.data(), _vFields.size());
+}
+
+bool DocHandler::EraseEntry(std::string_view name)
+{
+	if (m_pPaged)
+		return m_pPaged->Erase(name);
+
+	u8SecureVec _vChange(1 + GetVarLength(name.size()) + name.size());
+	_vChange[0] = JOURNAL_ERASE;
+	PutString(&_vChange[1], name);
+	return QueueChange(std::move(_vChange));
+}
+
+size_t DocHandler::GetEntryCount() const
+{
+	return m_pPaged ? m_pPaged->GetCount() : m_store.GetCount();
+}
+
+bool DocHandler::FindEntry(std::string_view name, pass_fields& fields)
+{
+	if (m_pPaged)
+		return m_pPaged->Find(name, fields);
+
+	size_t _nEntry = m_store.Find(name);
+	if (_nEntry == PassStore::NOT_FOUND)
 		return false;
+	fields.clear();
+	for (size_t i = 0; i < m_store.GetFieldCount(_nEntry); i++)
+	{
+		std::string_view _field = m_store.GetField(_nEntry, i);
+		fields.emplace_back(_field.data(), _field.size());
+	}
+	return true;
+}
 
-	// Check hash
-	_fileIn.read((char*)&_vHashCipher[0], _vHashCipher.size());
-	_fileIn.read((char*)&_vHashPlain[0], _vHashPlain.size());
+bool DocHandler::ForEachEntry(const pass_visitor& fn)
+{
+	if (m_pPaged)
+		return m_pPaged->ForEach(fn);
+
+	std::vector<std::string_view> _vFields;
+	for (size_t i = 0; i < m_store.GetCount(); i++)
+	{
+		_vFields.clear();
+		for (size_t j = 0; j < m_store.GetFieldCount(i); j++)
+			_vFields.push_back(m_store.GetField(i, j));
+		if (!fn(m_store.GetName(i), _vFields.data(), _vFields.size()))
+			break;
+	}
+	return true;
+}
 
-	u8Vec _vCipher, _vPlain;
-	_vCipher.resize(_nFileSize - ((size_t)_sha.GetHashLength() * 2));
-	_fileIn.read((char*)&_vCipher[0], _vCipher.size());
-	_fileIn.close();
 
-	_sha.HashData(_vCipher, _vCalcHash);
-	if (memcmp(&_vHashCipher[0], &_vCalcHash[0], _vHashCipher.size()) != 0)
+bool DocHandler::ChangeUnlockKey(const CryptoKey& newKey)
+{
+	if (m_pCrypto == nullptr || m_pCrypto->GetTagLength() == 0)
+		return false;
+	if (m_vKeySlots.empty() && !InitEnvelope())
+		return false;
+	if (m_nOpenSlot < 0)
+		return false;
+	// Slots are written over the document on disk
+	WaitForSave();
+
+	u8Vec _vPrevious(m_vKeySlots);
+	int _nOldSlot = m_nOpenSlot;
+	int _nNewSlot = GetFreeKeySlot();
+	if (_nNewSlot >= 0 && m_bEnvelopeSaved)
 	{
-		//std::cout << "OpenDoc: Calc hash (cipher) does not match saved hash!\n";
+		// The new key is on disk before the old slot is cleared, a crash in
+		// between leaves both keys able to open the document
+		if (!SetKeySlot(_nNewSlot, &newKey) || !SaveKeySlot(_nNewSlot))
+		{
+			m_vKeySlots = _vPrevious;
+			return false;
+		}
+		m_nOpenSlot = _nNewSlot;
+		if (!SetKeySlot(_nOldSlot, nullptr) || !SaveKeySlot(_nOldSlot))
+		{
+			// Old key still opens the document
+			std::copy_n(&_vPrevious[_nOldSlot * DOC_SLOT_LENGTH], 
+				DOC_SLOT_LENGTH, &m_vKeySlots[_nOldSlot * DOC_SLOT_LENGTH]);
+			return false;
+		}
+		return true;
+	}
+
+	// Every slot is in use or the document on disk has none yet. The whole
+	// document is written to a temporary file and renamed over the old one,
+	// which paged documents do not support
+	if (m_pPaged)
+		return false;
+	if (_nNewSlot < 0)
+		_nNewSlot = _nOldSlot;
+	bool _bChanged = SetKeySlot(_nNewSlot, &newKey) && 
+		(_nNewSlot == _nOldSlot || SetKeySlot(_nOldSlot, nullptr)) &&
+		QueueDoc() && WaitForSave();
+	if (!_bChanged)
+	{
+		m_vKeySlots = _vPrevious;
 		return false;
 	}
+	m_nOpenSlot = _nNewSlot;
+	return true;
+}
 
-	m_pCrypto->DecryptData(_vCipher, _vPlain, m_pKeyHandler->GetKeyValue(), _vIV);
-	_sha.HashData(_vPlain, _vCalcHash);
-	if (memcmp(&_vHashPlain[0], &_vCalcHash[0], _vHashPlain.size()) != 0)
+bool DocHandler::AddUnlockKey(const CryptoKey& newKey)
+{
+	if (m_pCrypto == nullptr || m_pCrypto->GetTagLength() == 0)
+		return false;
+	if (m_vKeySlots.empty() && !InitEnvelope())
+		return false;
+
+	CryptoKey _unwrapped;
+	for (int i = 0; i < DOC_KEY_SLOTS; i++)
 	{
-		//std::cout << "OpenDoc: Calc hash (plain) does not match saved hash!\n";
+		const u8* _pSlot = &m_vKeySlots[i * DOC_SLOT_LENGTH];
+		if (_pSlot[0] == DOC_SLOT_USED && newKey.UnwrapKey(_pSlot + 1, 
+			DOC_SLOT_LENGTH - 1, _unwrapped) == CRYPTO_ERROR_CODES::CRYPT_OK)
+			return true;	// Key already opens the document
+	}
+	int _nFreeSlot = GetFreeKeySlot();
+	if (_nFreeSlot < 0)
+		return false;
+	// Slots are written over the document on disk
+	WaitForSave();
+
+	// Only the free slot is written, the others stay intact
+	u8Vec _vPrevious(m_vKeySlots);
+	if (!SetKeySlot(_nFreeSlot, &newKey) || !SaveKeySlot(_nFreeSlot))
+	{
+		m_vKeySlots = _vPrevious;
 		return false;
 	}
+	return true;
+}
+
+int DocHandler::GetUnlockKeyCount() const
+{
+	int _nCount = 0;
+	for (size_t i = 0; i < m_vKeySlots.size(); i += DOC_SLOT_LENGTH)
+	{
+		if (m_vKeySlots[i] == DOC_SLOT_USED)
+			_nCount++;
+	}
+	return _nCount;
+}
+
+
+bool DocHandler::QueueDoc()
+{
+	if (m_pCrypto->GetTagLength() > 0 && m_vKeySlots.empty() && 
+		!InitEnvelope())
+		return false;
+	CryptoKey* _pKey = m_pCrypto->GetTagLength() > 0 ? &m_dataKey : 
+		m_pKeyHandler;
 
+	// The writer works on copies, entries can change while it runs
+	std::unique_ptr<SaveJob> _pJob(new SaveJob());
+	_pJob->strFileName = m_strFileName;
+	_pJob->pCrypto = m_pCrypto;
+	_pJob->store = m_store;
+	_pJob->vKeySlots = m_vKeySlots;
+	if (_pJob->key.SetKeyValue(_pKey->GetKeyValue().data(), 
+		_pKey->GetKeyValue().size()) != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	// The snapshot holds every change, the journal restarts after it
+	m_vPending.clear();
+	m_nJournalLength = 0;
+	m_nJournalRecords = 0;
+
+	{
+		std::lock_guard<std::mutex> _lock(m_saveMutex);
+		if (!m_writer.joinable())
+			m_writer = std::thread(&DocHandler::RunWriter, this);
+		m_pSaveJob = std::move(_pJob);
+		m_bSaveBusy = true;
+	}
+	m_saveCond.notify_all();
+	return true;
+}
+
+void DocHandler::RunWriter()
+{
+	std::unique_lock<std::mutex> _lock(m_saveMutex);
+	while (true)
+	{
+		m_saveCond.wait(_lock, [this] { return m_bSaveBusy || m_bStopWriter; });
+		if (!m_bSaveBusy)
+			return;
+
+		SaveJob* _pJob = m_pSaveJob.get();
+		_lock.unlock();
+		bool _bSaved = WriteDoc(*_pJob);
+		_lock.lock();
+		_pJob->bSaved = _bSaved;
+		m_bSaveBusy = false;
+		m_saveCond.notify_all();
+	}
+}
+
+bool DocHandler::WriteDoc(SaveJob& job)
+{
+	// Written next to the document and renamed over it once it is on disk, 
+	// a crash leaves either the old or the new document
+	// Nothing is written until only the owner can read it. A temp file left
+	// by an earlier save may be open elsewhere, so it is not reused
+	std::string _strTemp = job.strFileName + DOC_TEMP_EXT;
+	std::error_code _error;
+	std::filesystem::remove(_strTemp, _error);
+	std::ofstream _fileOut(_strTemp.c_str(), std::ios::out | 
+		std::ios::binary | std::ios::trunc);
+	if (!_fileOut.is_open())
+	{
+		// Failed to establish file handle
+		//std::cout << "SaveDoc: Failed to establish file handle!\n";
+		return false;
+	}
+	std::filesystem::permissions(_strTemp, 
+		std::filesystem::perms::owner_read | std::filesystem::perms::owner_write,
+		_error);
+	if (_error)
+	{
+		_fileOut.close();
+		std::filesystem::remove(_strTemp, _error);
+		return false;
+	}
+
+	// Contents are serialized, encrypted and written a chunk at a time
+	bool _bWritten;
+	if (job.pCrypto->GetTagLength() > 0)
+		_bWritten = WriteAuthDoc(_fileOut, job);
+	else
+		_bWritten = WriteHashedDoc(_fileOut, job);
+	_fileOut.close();
+
+	// Keep the document's permissions
+	std::filesystem::file_status _status = 
+		std::filesystem::status(job.strFileName, _error);
+	if (!_error)
+		std::filesystem::permissions(_strTemp, _status.permissions(), _error);
+
+	if (!_bWritten || _fileOut.fail() || !SyncFile(_strTemp) || 
+		!ReplaceFileAtomic(_strTemp, job.strFileName))
+	{
+		std::filesystem::remove(_strTemp, _error);
+		return false;
+	}
+
+	// The document holds every change, a journal left behind would be stale
+	std::filesystem::remove(job.strFileName + DOC_JOURNAL_EXT, _error);
+	return true;
+}
+
+
+bool DocHandler::ReadContents(CipherStream& stream, const u8* pCipher, 
+	size_t nLength, HashStream* pHash, u8SecureVec& vLegacy, bool& bLegacy)
+{
+	ContentsReader _reader(m_store, nLength);
+	size_t _nBlock = m_pCrypto->GetBlockSize();
+	for (size_t _nOffset = 0; _nOffset < nLength; _nOffset += DOC_CHUNK_LENGTH)
+	{
+		size_t _nChunk = std::min(DOC_CHUNK_LENGTH, nLength - _nOffset);
+		u8* _pPlain = _reader.GetInput(_nChunk + _nBlock);
+		size_t _nWritten;
+		if (stream.Update(pCipher + _nOffset, _nChunk, _pPlain, 
+			_nChunk + _nBlock, _nWritten) != CRYPTO_ERROR_CODES::CRYPT_OK)
+			return false;
+		if (pHash != nullptr && pHash->Update(_pPlain, _nWritten) != 
+			CRYPTO_ERROR_CODES::CRYPT_OK)
+			return false;
+		if (!_reader.Commit(_nWritten))
+			return false;
+	}
+	if (!_reader.Finish())
+		return false;
+
+	// Legacy contents cannot be parsed in pieces, the reader collects them.
+	// They are only parsed once the caller has authenticated them
+	bLegacy = _reader.IsLegacy();
+	if (bLegacy)
+		vLegacy.swap(_reader.GetLegacy());
+	return true;
+}
+
+bool DocHandler::ReadLegacyContents(const u8SecureVec& vPlain)
+{
 	size_t _nMapSize = 0;
 	size_t _nFieldSize = 0;
 	size_t _nIndx = 0;
-	size_t* _nTmp;
 
-	// Read number of entries
-	_nTmp = (size_t*)&_vPlain[_nIndx];
-	_nIndx += sizeof(size_t);
-	_nMapSize = *_nTmp;
-	m_mapData.reserve(_nMapSize);
-	for (int i = 0; i < _nMapSize; i++)
+	// Every size is checked against the bytes left
+	auto _getSize = [&](size_t& nValue) -> bool
 	{
-		pass_entry _entry;
-		
-		// Read key size
-		_nTmp = (size_t*)&_vPlain[_nIndx];
+		if (vPlain.size() - _nIndx < sizeof(size_t))
+			return false;
+		memcpy(&nValue, &vPlain[_nIndx], sizeof(size_t));
 		_nIndx += sizeof(size_t);
-		// Read key
-		_entry.first.append((char*)&_vPlain[_nIndx], *_nTmp);
-		_nIndx += *_nTmp;
+		return true;
+	};
+	auto _getString = [&](std::string_view& str) -> bool
+	{
+		size_t _nLength;
+		if (!_getSize(_nLength) || _nLength > vPlain.size() - _nIndx)
+			return false;
+		str = std::string_view((const char*)&vPlain[_nIndx], _nLength);
+		_nIndx += _nLength;
+		return true;
+	};
 
-		// Read num entries
-		_nTmp = (size_t*)&_vPlain[_nIndx];
-		_nIndx += sizeof(size_t);
-		_nFieldSize = *_nTmp;
-		_entry.second.reserve(_nFieldSize);
-		for (int j = 0; j < _nFieldSize; j++)
+	// Read number of entries. The plaintext bounds the bytes the store needs
+	if (!_getSize(_nMapSize) || 
+		_nMapSize > vPlain.size() / (sizeof(size_t) * 2))
+		return false;
+	m_store.Clear();
+	m_store.Reserve(_nMapSize, _nMapSize * 2, vPlain.size());
+	std::vector<std::string_view> _vFields;
+	for (size_t i = 0; i < _nMapSize; i++)
+	{
+		// Read key, then num entries
+		std::string_view _name;
+		if (!_getString(_name) || !_getSize(_nFieldSize) ||
+			_nFieldSize > (vPlain.size() - _nIndx) / sizeof(size_t))
+			return false;
+		_vFields.clear();
+		for (size_t j = 0; j < _nFieldSize; j++)
 		{
-			// Read entry size
-			_nTmp = (size_t*)&_vPlain[_nIndx];
-			_nIndx += sizeof(size_t);
-			// Read entry
-			_entry.second.push_back(std::string((char*)&_vPlain[_nIndx], *_nTmp));
-			_nIndx += *_nTmp;
+			// Read entry, copied into the store's arena below
+			std::string_view _field;
+			if (!_getString(_field))
+				return false;
+			_vFields.push_back(_field);
 		}
 		
-		m_mapData.insert(_entry);
+		m_store.Insert(_name, _vFields.data(), _vFields.size());
 	}
 
-	// Clear any sensitive data
-	memset(&_vPlain[0], 0, _vPlain.size());
-	
 	return true;
 }
 
-
-bool DocHandler::SaveDoc()
+bool DocHandler::WriteContents(const PassStore& store, 
+	const chunk_sink& fnWrite)
 {
-	// If data is empty return
-	if (m_mapData.size() == 0)
+	u8SecureVec _vChunk(DOC_CHUNK_LENGTH);
+	size_t _nUsed = 0;
+	// Values larger than the space left are split across chunks
+	auto _put = [&](const void* pData, size_t nLength) -> bool
+	{
+		const u8* _pData = (const u8*)pData;
+		while (nLength > 0)
+		{
+			if (_nUsed == _vChunk.size())
+			{
+				if (!fnWrite(_vChunk.data(), _nUsed))
+					return false;
+				_nUsed = 0;
+			}
+			size_t _nTake = std::min(nLength, _vChunk.size() - _nUsed);
+			memcpy(&_vChunk[_nUsed], _pData, _nTake);
+			_nUsed += _nTake;
+			_pData += _nTake;
+			nLength -= _nTake;
+		}
 		return true;
+	};
+	auto _putVar = [&](size_t nValue) -> bool
+	{
+		u8 _var[(sizeof(size_t) * 8 + 6) / 7];
+		return _put(_var, PutVar(_var, nValue) - _var);
+	};
 
-	std::ofstream _fileOut(m_strFileName.c_str(), std::ios::out | std::ios::binary);
-	if (!_fileOut.is_open())
+	u8 _header[CONTENTS_HEADER_LENGTH];
+	memcpy(_header, CONTENTS_MAGIC, CONTENTS_MAGIC_LENGTH);
+	_header[CONTENTS_MAGIC_LENGTH] = CONTENTS_VERSION;
+	if (!_put(_header, sizeof(_header)) || !_putVar(store.GetCount()))
+		return false;
+
+	for (size_t i = 0; i < store.GetCount(); i++)
 	{
-		// Failed to establish file handle
-		//std::cout << "SaveDoc: Failed to establish file handle!\n";
+		std::string_view _name = store.GetName(i);
+		if (!_putVar(_name.size()) || !_put(_name.data(), _name.size()) ||
+			!_putVar(store.GetFieldCount(i)))
+			return false;
+
+		for (size_t j = 0; j < store.GetFieldCount(i); j++)
+		{
+			std::string_view _data = store.GetField(i, j);
+			if (!_putVar(_data.size()) || !_put(_data.data(), _data.size()))
+				return false;
+		}
+	}
+
+	return _nUsed == 0 || fnWrite(_vChunk.data(), _nUsed);
+}
+
+
+bool DocHandler::ReadAuthDoc(const u8* pFile, size_t nFileSize)
+{
+	size_t _nIVLength = m_pCrypto->GetIVLength();
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	size_t _nHeaderLength = DOC_HEADER_FIXED_LENGTH + _nIVLength;
+	if (nFileSize < _nHeaderLength + _nTagLength)
+		return false;
+
+	// Header is verified by the tag, but must match the selected mode
+	if (memcmp(pFile, DOC_MAGIC, DOC_MAGIC_LENGTH) != 0 ||
+		pFile[DOC_MAGIC_LENGTH + 1] != GetDocCipherId(m_pCrypto->GetMode()) ||
+		pFile[DOC_MAGIC_LENGTH + 2] != _nIVLength)
+		return false;
+
+	const u8* _pBody = pFile + _nHeaderLength;
+	size_t _nBodyLength = nFileSize - _nHeaderLength - _nTagLength;
+	CryptoKey* _pDocKey = m_pKeyHandler;
+	switch (pFile[DOC_MAGIC_LENGTH])
+	{
+	case DOC_VERSION_LEGACY:
+		break;
+	case DOC_VERSION:
+	{
+		if (_nBodyLength < 1 + DOC_SLOTS_LENGTH || _pBody[0] != DOC_KEY_SLOTS)
+			return false;
+		m_vKeySlots.assign(_pBody + 1, _pBody + 1 + DOC_SLOTS_LENGTH);
+		if (!OpenKeySlots())
+			return false;
+		_pBody += 1 + DOC_SLOTS_LENGTH;
+		_nBodyLength -= 1 + DOC_SLOTS_LENGTH;
+		_pDocKey = &m_dataKey;
+	} break;
+	default:
 		return false;
 	}
 
-	HashSHA _sha;
-	u8Vec _vPlain, _vCipher, _vIV, _vHashPlain, _vHashCipher;
-	
+	const CryptoKeySchedule* _pKey = 
+		_pDocKey->GetKeySchedule(m_pCrypto->GetMode());
+	if (_pKey == nullptr)
+		return false;
 
-	// Calculate size and add padding
-	size_t _nTargetSize = sizeof(size_t);		// size of map
-	for (pass_map::iterator entries = m_mapData.begin(); entries != m_mapData.end(); entries++)
+	// Entries reach the store before the tag is checked, they are wiped if
+	// it does not match. Legacy contents are only parsed after the check
+	CipherStream _stream;
+	if (_stream.Init(m_pCrypto->GetMode(), false, *_pKey, 
+		pFile + DOC_HEADER_FIXED_LENGTH, _nIVLength, pFile, _nHeaderLength)
+		!= CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+	u8Vec _vTag(_pBody + _nBodyLength, _pBody + _nBodyLength + _nTagLength);
+	u8SecureVec _vLegacy;
+	bool _bLegacy = false;
+	bool _bRead = ReadContents(_stream, _pBody, _nBodyLength, nullptr, 
+		_vLegacy, _bLegacy);
+	_bRead = _stream.Finish(_vTag.data(), _vTag.size()) == 
+		CRYPTO_ERROR_CODES::CRYPT_OK && _bRead && 
+		(!_bLegacy || ReadLegacyContents(_vLegacy));
+	if (!_bRead)
 	{
-		_nTargetSize += sizeof(size_t);			// size of key
-		_nTargetSize += entries->first.size();	// key value
-		_nTargetSize += sizeof(size_t);			// number entries
-		for (pass_fields::iterator data = entries->second.begin(); data != entries->second.end(); data++)
-		{
-			_nTargetSize += sizeof(size_t);		// size of data
-			_nTargetSize += data->size();		// data value
-		}
+		m_store.Clear();
+		return false;
 	}
-	if (_nTargetSize % m_pCrypto->GetBlockSize() != 0)
-	_nTargetSize += m_pCrypto->GetBlockSize() - (_nTargetSize % m_pCrypto->GetBlockSize());
 
+	// Legacy documents get a data key now and move to slots on the next save
+	m_bEnvelopeSaved = _pDocKey == &m_dataKey;
+	m_vDocIV.assign(pFile + DOC_HEADER_FIXED_LENGTH, pFile + _nHeaderLength);
+	m_nDocLength = nFileSize;
+	return m_bEnvelopeSaved || InitEnvelope();
+}
+
+bool DocHandler::CreatePagedDoc()
+{
+	if (m_pCrypto->GetTagLength() == 0 || 
+		GetDocCipherId(m_pCrypto->GetMode()) == 0 || !InitEnvelope())
+		return false;
+
+	u8Vec _vPage(PagedStore::PAGE_SIZE, 0);
+	memcpy(&_vPage[0], PAGED_MAGIC, DOC_MAGIC_LENGTH);
+	_vPage[DOC_MAGIC_LENGTH] = PAGED_VERSION;
+	_vPage[DOC_MAGIC_LENGTH + 1] = GetDocCipherId(m_pCrypto->GetMode());
+	_vPage[DOC_MAGIC_LENGTH + 2] = (u8)m_pCrypto->GetIVLength();
+	_vPage[DOC_HEADER_FIXED_LENGTH] = DOC_KEY_SLOTS;
+	memcpy(&_vPage[DOC_HEADER_FIXED_LENGTH + 1], &m_vKeySlots[0], 
+		m_vKeySlots.size());
+
+	std::ofstream _fileOut(m_strFileName.c_str(), std::ios::out | 
+		std::ios::binary | std::ios::trunc);
+	_fileOut.write((char*)&_vPage[0], _vPage.size());
+	_fileOut.close();
+	if (!_fileOut)
+		return false;
 
-	// Populate buffer for encryption
-	size_t _nTmp, _nIndx = 0;
-	_vPlain.resize(_nTargetSize);
-	
-	_nTmp = m_mapData.size();
-	memcpy(&_vPlain[_nIndx], &_nTmp, sizeof(size_t));
-	_nIndx += sizeof(size_t);
-	for (pass_map::iterator entries = m_mapData.begin(); entries != m_mapData.end(); entries++)
+	u8Vec _vContext(_vPage.begin(), _vPage.begin() + DOC_HEADER_FIXED_LENGTH);
+	m_pPaged.reset(new PagedStore());
+	m_store.Clear();
+	m_bEnvelopeSaved = true;
+	if (!m_pPaged->Create(m_strFileName, m_pCrypto, &m_dataKey, _vContext))
 	{
-		// Key size
-		_nTmp = entries->first.size();
-		memcpy(&_vPlain[_nIndx], &_nTmp, sizeof(size_t));
-		_nIndx += sizeof(size_t);
-		// Key value
-		memcpy(&_vPlain[_nIndx], entries->first.c_str(), entries->first.size());
-		_nIndx += entries->first.size();
-		// Num Entries
-		_nTmp = entries->second.size();
-		memcpy(&_vPlain[_nIndx], &_nTmp, sizeof(size_t));
-		_nIndx += sizeof(size_t);
+		m_pPaged.reset();
+		return false;
+	}
+	return true;
+}
+
+bool DocHandler::OpenPagedDoc(const u8* pFile, size_t nFileSize)
+{
+	if (m_pCrypto->GetTagLength() == 0)
+		return false;
+
+	// Only the header and the tree's meta page are read here
+	if (nFileSize < DOC_HEADER_FIXED_LENGTH + 1 + DOC_SLOTS_LENGTH ||
+		pFile[DOC_MAGIC_LENGTH] != PAGED_VERSION ||
+		pFile[DOC_MAGIC_LENGTH + 1] != GetDocCipherId(m_pCrypto->GetMode()) ||
+		pFile[DOC_MAGIC_LENGTH + 2] != m_pCrypto->GetIVLength() ||
+		pFile[DOC_HEADER_FIXED_LENGTH] != DOC_KEY_SLOTS)
+		return false;
+	m_vKeySlots.assign(pFile + DOC_HEADER_FIXED_LENGTH + 1, 
+		pFile + DOC_HEADER_FIXED_LENGTH + 1 + DOC_SLOTS_LENGTH);
+	if (!OpenKeySlots())
+		return false;
+
+	u8Vec _vContext(pFile, pFile + DOC_HEADER_FIXED_LENGTH);
+	m_pPaged.reset(new PagedStore());
+	m_store.Clear();
+	m_bEnvelopeSaved = true;
+	if (!m_pPaged->Open(m_strFileName, m_pCrypto, &m_dataKey, _vContext))
+	{
+		m_pPaged.reset();
+		return false;
+	}
+	return true;
+}
+
+bool DocHandler::ReadHashedDoc(const u8* pFile, size_t nFileSize)
+{
+	HashDigest<HASH_MODES::SHA256> _hashPlain, _hashCipher, _calcHash;
+
+	// Make sure file is appropriate size
+	size_t _nIVLength = GetHashedIVLength(m_pCrypto);
+	if (nFileSize < (_calcHash.size() * (size_t)2) + _nIVLength + 
+		m_pCrypto->GetBlockSize())
+		return false;
+
+	// Check hash
+	memcpy(_hashCipher.data(), pFile, _hashCipher.size());
+	memcpy(_hashPlain.data(), pFile + _hashCipher.size(), _hashPlain.size());
+
+	const u8* _pCipher = pFile + (_calcHash.size() * 2);
+	size_t _nCipherLength = nFileSize - (_calcHash.size() * 2);
+	HashSHA::Digest<HASH_MODES::SHA256>(_pCipher, _nCipherLength, _calcHash);
+	if (_calcHash != _hashCipher)
+	{
+		//std::cout << "OpenDoc: Calc hash (cipher) does not match saved hash!\n";
+		return false;
+	}
+	const u8* _pIV = _pCipher;
+	_pCipher += _nIVLength;
+	_nCipherLength -= _nIVLength;
+
+	const CryptoKeySchedule* _pKey = 
+		m_pKeyHandler->GetKeySchedule(m_pCrypto->GetMode());
+	if (_pKey == nullptr)
+		return false;
+	CipherStream _stream;
+	HashStream _hash;
+	if (_stream.Init(m_pCrypto->GetMode(), false, *_pKey, _pIV, _nIVLength) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK || _hash.Init(HASH_MODES::SHA256) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	// Plaintext hash is checked once every chunk has been parsed, legacy
+	// contents are parsed after it
+	u8SecureVec _vLegacy;
+	bool _bLegacy = false;
+	bool _bRead = ReadContents(_stream, _pCipher, _nCipherLength, &_hash, 
+		_vLegacy, _bLegacy) &&
+		_stream.Finish() == CRYPTO_ERROR_CODES::CRYPT_OK &&
+		_hash.Finish(_calcHash.data(), _calcHash.size()) == 
+		CRYPTO_ERROR_CODES::CRYPT_OK && _calcHash == _hashPlain &&
+		(!_bLegacy || ReadLegacyContents(_vLegacy));
+	if (!_bRead)
+	{
+		//std::cout << "OpenDoc: Calc hash (plain) does not match saved hash!\n";
+		m_store.Clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool DocHandler::WriteAuthDoc(std::ofstream& fileOut, SaveJob& job)
+{
+	ICrypto* _pCrypto = job.pCrypto;
+	const CryptoKeySchedule* _pKey = 
+		job.key.GetKeySchedule(_pCrypto->GetMode());
+	if (_pKey == nullptr)
+		return false;
+
+	// Fresh nonce for every save, the key is reused across saves
+	size_t _nIVLength = _pCrypto->GetIVLength();
+	u8Vec _vHeader(DOC_HEADER_FIXED_LENGTH + _nIVLength);
+	memcpy(&_vHeader[0], DOC_MAGIC, DOC_MAGIC_LENGTH);
+	_vHeader[DOC_MAGIC_LENGTH] = DOC_VERSION;
+	_vHeader[DOC_MAGIC_LENGTH + 1] = GetDocCipherId(_pCrypto->GetMode());
+	_vHeader[DOC_MAGIC_LENGTH + 2] = (u8)_nIVLength;
+	if (_vHeader[DOC_MAGIC_LENGTH + 1] == 0 || 
+		GetRandomBytes(&_vHeader[DOC_HEADER_FIXED_LENGTH], _nIVLength) 
+		!= CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	// Single pass encrypts the contents and authenticates them with the
+	// header up to the IV, the slot table follows unauthenticated
+	CipherStream _stream;
+	if (_stream.Init(_pCrypto->GetMode(), true, *_pKey, 
+		&_vHeader[DOC_HEADER_FIXED_LENGTH], _nIVLength, _vHeader.data(), 
+		_vHeader.size()) != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	u8 _nSlots = DOC_KEY_SLOTS;
+	fileOut.write((char*)&_vHeader[0], _vHeader.size());
+	fileOut.write((char*)&_nSlots, 1);
+	fileOut.write((char*)&job.vKeySlots[0], job.vKeySlots.size());
+
+	u8Vec _vCipher(DOC_CHUNK_LENGTH);
+	size_t _nContentsLength = 0;
+	bool _bWritten = WriteContents(job.store, [&](const u8* pData, size_t nLength)
+	{
+		size_t _nWritten;
+		if (_stream.Update(pData, nLength, _vCipher.data(), _vCipher.size(),
+			_nWritten) != CRYPTO_ERROR_CODES::CRYPT_OK)
+			return false;
+		fileOut.write((char*)_vCipher.data(), _nWritten);
+		_nContentsLength += _nWritten;
+		return fileOut.good();
+	});
+
+	u8Vec _vTag(_pCrypto->GetTagLength());
+	if (!_bWritten || _stream.Finish(_vTag.data(), _vTag.size()) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+	fileOut.write((char*)&_vTag[0], _vTag.size());
+	job.vDocIV.assign(_vHeader.begin() + DOC_HEADER_FIXED_LENGTH, 
+		_vHeader.end());
+	job.nDocLength = _vHeader.size() + 1 + job.vKeySlots.size() + 
+		_nContentsLength + _vTag.size();
+	return fileOut.good();
+}
 
-		for (pass_fields::iterator data = entries->second.begin(); data != entries->second.end(); data++)
+bool DocHandler::WriteHashedDoc(std::ofstream& fileOut, SaveJob& job)
+{
+	HashDigest<HASH_MODES::SHA256> _hashPlain, _hashCipher;
+
+	ICrypto* _pCrypto = job.pCrypto;
+	const CryptoKeySchedule* _pKey = 
+		job.key.GetKeySchedule(_pCrypto->GetMode());
+	if (_pKey == nullptr)
+		return false;
+	u8Vec _vIV(GetHashedIVLength(_pCrypto));
+	if (!_vIV.empty() && GetRandomBytes(&_vIV[0], _vIV.size()) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+	CipherStream _stream;
+	HashStream _plain, _cipher;
+	if (_stream.Init(_pCrypto->GetMode(), true, *_pKey, _vIV.data(), 
+		_vIV.size()) != CRYPTO_ERROR_CODES::CRYPT_OK || 
+		_plain.Init(HASH_MODES::SHA256) != CRYPTO_ERROR_CODES::CRYPT_OK || 
+		_cipher.Init(HASH_MODES::SHA256) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_cipher.Update(_vIV.data(), _vIV.size()) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	// Hashes lead the file but are only known at the end, their space is
+	// filled in last
+	u8Vec _vHashes(_hashCipher.size() + _hashPlain.size(), 0);
+	fileOut.write((char*)&_vHashes[0], _vHashes.size());
+	fileOut.write((char*)_vIV.data(), _vIV.size());
+
+	// Hash plaintext, then encrypt and hash ciphertext
+	size_t _nBlock = _pCrypto->GetBlockSize();
+	u8Vec _vCipher(DOC_CHUNK_LENGTH + _nBlock);
+	size_t _nPlainLength = 0;
+	auto _write = [&](const u8* pData, size_t nLength)
+	{
+		size_t _nWritten;
+		if (_plain.Update(pData, nLength) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+			_stream.Update(pData, nLength, _vCipher.data(), _vCipher.size(),
+			_nWritten) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+			_cipher.Update(_vCipher.data(), _nWritten) != 
+			CRYPTO_ERROR_CODES::CRYPT_OK)
+			return false;
+		fileOut.write((char*)_vCipher.data(), _nWritten);
+		_nPlainLength += nLength;
+		return fileOut.good();
+	};
+	if (!WriteContents(job.store, _write))
+		return false;
+
+	// Zero padding to a whole block
+	u8Vec _vPadding((_nBlock - _nPlainLength % _nBlock) % _nBlock, 0);
+	if ((!_vPadding.empty() && !_write(_vPadding.data(), _vPadding.size())) ||
+		_stream.Finish() != CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_plain.Finish(_hashPlain.data(), _hashPlain.size()) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK ||
+		_cipher.Finish(_hashCipher.data(), _hashCipher.size()) != 
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	fileOut.seekp(0, fileOut.beg);
+	fileOut.write((char*)_hashCipher.data(), _hashCipher.size());
+	fileOut.write((char*)_hashPlain.data(), _hashPlain.size());
+	return fileOut.good();
+}
+
+bool DocHandler::InitEnvelope()
+{
+	u8 _dataKey[DOC_DATA_KEY_LENGTH];
+	bool _bInit = GetRandomBytes(_dataKey, sizeof(_dataKey)) == 
+		CRYPTO_ERROR_CODES::CRYPT_OK && m_dataKey.SetKeyValue(_dataKey, 
+		sizeof(_dataKey)) == CRYPTO_ERROR_CODES::CRYPT_OK;
+	memset(_dataKey, 0, sizeof(_dataKey));
+	if (!_bInit)
+		return false;
+
+	// Key handler takes the first slot
+	m_vKeySlots.assign(DOC_SLOTS_LENGTH, DOC_SLOT_EMPTY);
+	m_vKeySlots[0] = DOC_SLOT_USED;
+	m_nOpenSlot = 0;
+	m_bEnvelopeSaved = false;
+	if (m_pKeyHandler->WrapKey(m_dataKey, &m_vKeySlots[1], 
+		DOC_SLOT_LENGTH - 1) != CRYPTO_ERROR_CODES::CRYPT_OK)
+	{
+		m_vKeySlots.clear();
+		return false;
+	}
+	return true;
+}
+
+bool DocHandler::OpenKeySlots()
+{
+	// Wrong unlock keys fail the key wrap integrity check
+	for (int i = 0; i < DOC_KEY_SLOTS; i++)
+	{
+		const u8* _pSlot = &m_vKeySlots[i * DOC_SLOT_LENGTH];
+		if (_pSlot[0] == DOC_SLOT_USED && m_pKeyHandler->UnwrapKey(_pSlot + 1,
+			DOC_SLOT_LENGTH - 1, m_dataKey) == CRYPTO_ERROR_CODES::CRYPT_OK)
 		{
-			// Data size
-			_nTmp = data->size();
-			memcpy(&_vPlain[_nIndx], &_nTmp, sizeof(size_t));
-			_nIndx += sizeof(size_t);
-			// Data value
-			memcpy(&_vPlain[_nIndx], data->c_str(), data->size());
-			_nIndx += data->size();
+			m_nOpenSlot = i;
+			return true;
 		}
 	}
+	return false;
+}
 
-	// Encrypt and compute hashes
-	m_pCrypto->EncryptData(_vPlain, _vCipher, m_pKeyHandler->GetKeyValue(), _vIV);
+int DocHandler::GetFreeKeySlot() const
+{
+	for (int i = 0; i < DOC_KEY_SLOTS; i++)
+	{
+		if (m_vKeySlots[i * DOC_SLOT_LENGTH] != DOC_SLOT_USED)
+			return i;
+	}
+	return -1;
+}
 
-	
-	_sha.HashData(_vPlain, _vHashPlain);
-	_sha.HashData(_vCipher, _vHashCipher);
+bool DocHandler::SetKeySlot(int nSlot, const CryptoKey* pKey)
+{
+	if (nSlot < 0 || nSlot >= DOC_KEY_SLOTS || 
+		m_vKeySlots.size() != DOC_SLOTS_LENGTH)
+		return false;
 
-	_fileOut.write((char*)&_vHashCipher[0], _vHashCipher.size());
-	_fileOut.write((char*)&_vHashPlain[0], _vHashPlain.size());
-	_fileOut.write((char*)&_vCipher[0], _vCipher.size());
-	_fileOut.flush();
-	_fileOut.close();
+	u8* _pSlot = &m_vKeySlots[nSlot * DOC_SLOT_LENGTH];
+	if (pKey == nullptr)
+	{
+		memset(_pSlot, 0, DOC_SLOT_LENGTH);
+		_pSlot[0] = DOC_SLOT_EMPTY;
+		return true;
+	}
+	_pSlot[0] = DOC_SLOT_USED;
+	return pKey->WrapKey(m_dataKey, _pSlot + 1, DOC_SLOT_LENGTH - 1) 
+		== CRYPTO_ERROR_CODES::CRYPT_OK;
+}
 
-	// Clear any sensitive data
-	memset(&_vPlain[0], 0, _vPlain.size());
+bool DocHandler::SaveKeySlot(int nSlot)
+{
+	// Documents without slots on disk are rewritten whole
+	if (!m_bEnvelopeSaved)
+		return QueueDoc() && WaitForSave();
 
+	// Slot table sits at a fixed offset, only the one slot is rewritten. 
+	// Paged headers have no IV
+	std::fstream _file(m_strFileName.c_str(), std::ios::in | 
+		std::ios::out | std::ios::binary);
+	_file.seekp(DOC_HEADER_FIXED_LENGTH + 1 + 
+		(m_pPaged ? 0 : m_pCrypto->GetIVLength()) + nSlot * DOC_SLOT_LENGTH);
+	_file.write((char*)&m_vKeySlots[nSlot * DOC_SLOT_LENGTH], DOC_SLOT_LENGTH);
+	_file.close();
+	return !_file.fail() && SyncFile(m_strFileName);
+}
+
+bool DocHandler::QueueChange(u8SecureVec&& vChange)
+{
+	if (!ApplyChange(vChange.data(), vChange.size()))
+		return false;
+	m_vPending.push_back(std::move(vChange));
 	return true;
-}
\ No newline at end of file
+}
+
+bool DocHandler::ApplyChange(const u8* pChange, size_t nLength)
+{
+	const u8* _pEnd = pChange + nLength;
+	if (nLength == 0)
+		return false;
+	u8 _nOp = *pChange++;
+
+	size_t _nLength, _nFieldSize;
+	if (!GetVar(pChange, _pEnd, _nLength) || 
+		_nLength > (size_t)(_pEnd - pChange))
+		return false;
+	std::string_view _name((const char*)pChange, _nLength);
+	pChange += _nLength;
+
+	if (_nOp == JOURNAL_ERASE)
+		return pChange == _pEnd && m_store.Erase(_name);
+	if (_nOp != JOURNAL_PUT)
+		return false;
+
+	if (!GetVar(pChange, _pEnd, _nFieldSize) || 
+		_nFieldSize > (size_t)(_pEnd - pChange))
+		return false;
+	std::vector<std::string_view> _vFields;
+	for (size_t i = 0; i < _nFieldSize; i++)
+	{
+		if (!GetVar(pChange, _pEnd, _nLength) || 
+			_nLength > (size_t)(_pEnd - pChange))
+			return false;
+		_vFields.push_back(std::string_view((const char*)pChange, _nLength));
+		pChange += _nLength;
+	}
+	if (pChange != _pEnd)
+		return false;
+
+	// Views point into the change, not the store, so the old entry can go
+	m_store.Erase(_name);
+	return m_store.Insert(_name, _vFields.data(), _vFields.size());
+}
+
+bool DocHandler::ReadJournal()
+{
+	m_nJournalLength = 0;
+	m_nJournalRecords = 0;
+	std::string _strJournal = m_strFileName + DOC_JOURNAL_EXT;
+	std::ifstream _fileIn(_strJournal.c_str(), std::ios::in | std::ios::binary);
+	if (!_fileIn.is_open())
+		return true;	// No changes since the last full save
+
+	size_t _nFileSize;
+	_fileIn.seekg(0, _fileIn.end);
+	_nFileSize = _fileIn.tellg();
+	_fileIn.seekg(0, _fileIn.beg);
+
+	// A journal for another save of the document is already part of it
+	u8Vec _vAAD = GetJournalHeader();
+	size_t _nHeaderLength = _vAAD.size();
+	u8Vec _vHeader(_nHeaderLength);
+	if (_nFileSize < _nHeaderLength)
+		return true;
+	_fileIn.read((char*)&_vHeader[0], _vHeader.size());
+	if (!_fileIn || _vHeader != _vAAD)
+		return true;
+	m_nJournalLength = _nHeaderLength;
+
+	const CryptoKeySchedule* _pKey = 
+		m_dataKey.GetKeySchedule(m_pCrypto->GetMode());
+	if (_pKey == nullptr)
+		return false;
+
+	size_t _nIVLength = m_pCrypto->GetIVLength();
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	u8 _length[4];
+	u8Vec _vIV(_nIVLength), _vTag(_nTagLength);
+	u8SecureVec _vChange;
+	_vAAD.resize(_nHeaderLength + 8);
+	while (m_nJournalLength + GetJournalRecordLength(0) <= _nFileSize)
+	{
+		_fileIn.read((char*)_length, sizeof(_length));
+		size_t _nLength = (size_t)GetLittleEndian(_length, sizeof(_length));
+		// Record cut short by an interrupted save, WriteJournal drops it
+		if (_nLength > _nFileSize - m_nJournalLength - 
+			GetJournalRecordLength(0))
+			break;
+
+		_vChange.resize(_nLength);
+		_fileIn.read((char*)&_vIV[0], _vIV.size());
+		_fileIn.read((char*)_vChange.data(), _vChange.size());
+		_fileIn.read((char*)&_vTag[0], _vTag.size());
+		if (!_fileIn)
+			return false;
+
+		// Tampered records fail the open like a tampered document
+		PutLittleEndian(&_vAAD[_nHeaderLength], m_nJournalRecords, 8);
+		if (m_pCrypto->DecryptAuthData(_vChange.data(), _vChange.size(), 
+			_vChange.data(), *_pKey, _vIV.data(), _vIV.size(), _vAAD.data(), 
+			_vAAD.size(), _vTag.data(), _vTag.size()) 
+			!= CRYPTO_ERROR_CODES::CRYPT_OK || 
+			!ApplyChange(_vChange.data(), _vChange.size()))
+			return false;
+		m_nJournalLength += GetJournalRecordLength(_nLength);
+		m_nJournalRecords++;
+	}
+
+	return true;
+}
+
+bool DocHandler::WriteJournal()
+{
+	if (m_vPending.empty())
+		return true;
+	if (m_nJournalLength == 0 && !ResetJournal())
+		return false;
+
+	// Drop anything past the last valid record
+	std::string _strJournal = m_strFileName + DOC_JOURNAL_EXT;
+	std::error_code _error;
+	if (std::filesystem::file_size(_strJournal, _error) != m_nJournalLength)
+	{
+		std::filesystem::resize_file(_strJournal, m_nJournalLength, _error);
+		if (_error)
+			return false;
+	}
+
+	std::fstream _file(_strJournal.c_str(), std::ios::in | std::ios::out | 
+		std::ios::binary);
+	if (!_file.is_open())
+		return false;
+	_file.seekp(m_nJournalLength);
+
+	const CryptoKeySchedule* _pKey = 
+		m_dataKey.GetKeySchedule(m_pCrypto->GetMode());
+	if (_pKey == nullptr)
+		return false;
+
+	size_t _nIVLength = m_pCrypto->GetIVLength();
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	u8Vec _vAAD = GetJournalHeader();
+	size_t _nHeaderLength = _vAAD.size();
+	_vAAD.resize(_nHeaderLength + 8);
+	u8Vec _vRecord;
+	size_t _nJournalLength = m_nJournalLength;
+	uint64_t _nJournalRecords = m_nJournalRecords;
+	for (const u8SecureVec& change : m_vPending)
+	{
+		// Fresh nonce for every record, the data key is shared with the
+		// document
+		_vRecord.resize(GetJournalRecordLength(change.size()));
+		u8* _pIV = &_vRecord[4];
+		u8* _pCipher = _pIV + _nIVLength;
+		PutLittleEndian(&_vRecord[0], change.size(), 4);
+		PutLittleEndian(&_vAAD[_nHeaderLength], _nJournalRecords, 8);
+		if (GetRandomBytes(_pIV, _nIVLength) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+			m_pCrypto->EncryptAuthData(change.data(), change.size(), _pCipher,
+			*_pKey, _pIV, _nIVLength, _vAAD.data(), _vAAD.size(), 
+			_pCipher + change.size(), _nTagLength) 
+			!= CRYPTO_ERROR_CODES::CRYPT_OK)
+			return false;
+
+		_file.write((char*)&_vRecord[0], _vRecord.size());
+		_nJournalLength += _vRecord.size();
+		_nJournalRecords++;
+	}
+	_file.close();
+	if (_file.fail() || !SyncFile(_strJournal))
+		return false;
+
+	m_vPending.clear();
+	m_nJournalLength = _nJournalLength;
+	m_nJournalRecords = _nJournalRecords;
+	return true;
+}
+
+bool DocHandler::ResetJournal()
+{
+	u8Vec _vHeader = GetJournalHeader();
+	std::string _strJournal = m_strFileName + DOC_JOURNAL_EXT;
+	std::ofstream _fileOut(_strJournal.c_str(), std::ios::out | 
+		std::ios::binary | std::ios::trunc);
+	if (!_fileOut.is_open())
+		return false;
+	_fileOut.write((char*)&_vHeader[0], _vHeader.size());
+	_fileOut.close();
+	if (_fileOut.fail() || !SyncParentDir(_strJournal))
+		return false;
+
+	m_nJournalLength = _vHeader.size();
+	m_nJournalRecords = 0;
+	return true;
+}
+
+size_t DocHandler::GetJournalRecordLength(size_t nChangeLength) const
+{
+	return 4 + m_pCrypto->GetIVLength() + nChangeLength + 
+		m_pCrypto->GetTagLength();
+}
+
+u8Vec DocHandler::GetJournalHeader() const
+{
+	// The document IV changes with every full save, which ends the journal
+	u8Vec _vHeader(JOURNAL_HEADER_FIXED_LENGTH);
+	memcpy(&_vHeader[0], JOURNAL_MAGIC, JOURNAL_MAGIC_LENGTH);
+	_vHeader[JOURNAL_MAGIC_LENGTH] = JOURNAL_VERSION;
+	_vHeader[JOURNAL_MAGIC_LENGTH + 1] = GetDocCipherId(m_pCrypto->GetMode());
+	_vHeader[JOURNAL_MAGIC_LENGTH + 2] = (u8)m_vDocIV.size();
+	_vHeader.insert(_vHeader.end(), m_vDocIV.begin(), m_vDocIV.end());
+	return _vHeader;
+}
@@ -0,0 +1,56 @@
+#include "FileSync.h"
+
+#include <cstdio>
+#include <filesystem>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+bool SyncFile(const std::string& strFileName)
+{
+#ifdef _WIN32
+	HANDLE _hFile = CreateFileA(strFileName.c_str(), GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_hFile == INVALID_HANDLE_VALUE)
+		return false;
+	bool _bSynced = FlushFileBuffers(_hFile) != 0;
+	CloseHandle(_hFile);
+	return _bSynced;
+#else
+	// fsync covers every descriptor of the file, read only is enough and
+	// also opens directories
+	int _fd = open(strFileName.c_str(), O_RDONLY);
+	if (_fd < 0)
+		return false;
+	bool _bSynced = fsync(_fd) == 0;
+	close(_fd);
+	return _bSynced;
+#endif
+}
+
+bool SyncParentDir(const std::string& strFileName)
+{
+#ifdef _WIN32
+	(void)strFileName;
+	return true;
+#else
+	std::filesystem::path _dir = std::filesystem::path(strFileName).parent_path();
+	return SyncFile(_dir.empty() ? "." : _dir.string());
+#endif
+}
+
+bool ReplaceFileAtomic(const std::string& strFrom, const std::string& strTo)
+{
+#ifdef _WIN32
+	return MoveFileExA(strFrom.c_str(), strTo.c_str(),
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(strFrom.c_str(), strTo.c_str()) == 0 &&
+		SyncParentDir(strTo);
+#endif
+}
@@ -0,0 +1,130 @@
+#include "MappedFile.h"
+
+#include <fstream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile()
+{
+	m_pData = nullptr;
+	m_nSize = 0;
+	m_bMapped = false;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = nullptr;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& strFileName)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE _hFile = CreateFileA(strFileName.c_str(), GENERIC_READ,
+		FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr);
+	if (_hFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER _size;
+	if (!GetFileSizeEx(_hFile, &_size))
+	{
+		CloseHandle(_hFile);
+		return false;
+	}
+	m_hFile = _hFile;
+	m_nSize = (size_t)_size.QuadPart;
+	if (m_nSize == 0)
+		return true;
+
+	HANDLE _hMapping = CreateFileMappingA(_hFile, nullptr, PAGE_READONLY, 0,
+		0, nullptr);
+	if (_hMapping != nullptr)
+	{
+		m_pData = (const u8*)MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_pData != nullptr)
+		{
+			m_hMapping = _hMapping;
+			m_bMapped = true;
+			return true;
+		}
+		CloseHandle(_hMapping);
+	}
+#else
+	int _fd = open(strFileName.c_str(), O_RDONLY);
+	if (_fd < 0)
+		return false;
+	struct stat _stat;
+	if (fstat(_fd, &_stat) != 0)
+	{
+		close(_fd);
+		return false;
+	}
+	m_nSize = (size_t)_stat.st_size;
+	if (m_nSize == 0)
+	{
+		close(_fd);
+		return true;
+	}
+
+	// The mapping outlives the descriptor
+	void* _pMap = mmap(nullptr, m_nSize, PROT_READ, MAP_PRIVATE, _fd, 0);
+	close(_fd);
+	if (_pMap != MAP_FAILED)
+	{
+#ifdef MADV_SEQUENTIAL
+		madvise(_pMap, m_nSize, MADV_SEQUENTIAL);
+#endif
+		m_pData = (const u8*)_pMap;
+		m_bMapped = true;
+		return true;
+	}
+#endif
+
+	// Not mappable, e.g. a pipe or an unsupported file system
+	std::ifstream _fileIn(strFileName.c_str(), std::ios::in | std::ios::binary);
+	m_vBuffer.resize(m_nSize);
+	if (!_fileIn.read((char*)&m_vBuffer[0], m_vBuffer.size()))
+	{
+		Close();
+		return false;
+	}
+	m_pData = m_vBuffer.data();
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_bMapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(m_pData);
+		CloseHandle(m_hMapping);
+		m_hMapping = nullptr;
+#else
+		munmap((void*)m_pData, m_nSize);
+#endif
+	}
+#ifdef _WIN32
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+#endif
+	m_vBuffer.clear();
+	m_pData = nullptr;
+	m_nSize = 0;
+	m_bMapped = false;
+}
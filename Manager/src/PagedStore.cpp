@@ -0,0 +1,819 @@
+#include "PagedStore.h"
+#include "FileSync.h"
+#include "CryptoRandom.h"
+#include "Serialize.h"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+
+Each page is stored as:
+[ u8 iv[ivSize], CRYPTO[BODY], TAG ]
+The AAD is the caller's context followed by the u32 page number, BODY fills
+the rest of the page and is zero past its contents.
+
+META BODY = [
+	u8 type 3, u64 generation, u32 rootPage, u8 rootTag[tagSize],
+	u64 numEntries, u32 numPages, u32 numFree, u32 free0, ... u32 freeN
+]
+LEAF BODY = [
+	u8 type 1, var numKeys,
+	var key0Size, str key0, var numEntries, var data0Size, str data0, ...
+	...
+]
+INTERNAL BODY = [
+	u8 type 2, var numKeys, u32 child0, u8 tag0[tagSize],
+	var key0Size, str key0, u32 child1, u8 tag1[tagSize],
+	...
+]
+Keys are in byte order. Child i holds the keys from key i-1 up to, but not
+including, key i. The meta page with the highest generation that
+authenticates is current. Free pages beyond what fits in the meta page are
+not recorded, the file does not shrink.
+
+*/
+
+#define PAGE_TYPE_LEAF 1
+#define PAGE_TYPE_INTERNAL 2
+#define PAGE_TYPE_META 3
+#define PAGE_META_FIRST 1		// Meta pages alternate between 1 and 2
+#define PAGE_FIRST_NODE 3
+#define PAGE_CACHE_SIZE 1024	// Cached nodes before clean ones are dropped
+#define META_FIXED_LENGTH(tag) (1 + 8 + 4 + (tag) + 8 + 4 + 4)
+
+static bool KeyLess(const SecureString& key, std::string_view name)
+{
+	return std::string_view(key) < name;
+}
+
+static bool NameLess(std::string_view name, const SecureString& key)
+{
+	return name < std::string_view(key);
+}
+
+PagedStore::PagedStore()
+{
+	m_pCrypto = nullptr;
+	m_pKey = nullptr;
+	m_nBodyLength = 0;
+	m_root.nPage = 0;
+	memset(m_root.tag, 0, sizeof(m_root.tag));
+	m_nCount = 0;
+	m_nGeneration = 0;
+	m_nPageCount = PAGE_FIRST_NODE;
+	m_bDirty = false;
+	m_nCacheLimit = PAGE_CACHE_SIZE;
+	m_nPagesRead = 0;
+	m_nPagesWritten = 0;
+}
+
+PagedStore::~PagedStore()
+{
+	// Cached nodes are wiped by the secure allocator as they are freed
+}
+
+bool PagedStore::Create(const std::string& strFileName, ICrypto* pCrypto,
+	CryptoKey* pKey, const u8Vec& vContext)
+{
+	if (!Init(strFileName, pCrypto, pKey, vContext))
+		return false;
+
+	NewNode(true, m_root);
+	m_bDirty = true;
+	return Flush();
+}
+
+bool PagedStore::Open(const std::string& strFileName, ICrypto* pCrypto,
+	CryptoKey* pKey, const u8Vec& vContext)
+{
+	if (!Init(strFileName, pCrypto, pKey, vContext))
+		return false;
+
+	// A torn meta write leaves the other one current
+	uint64_t _nGeneration1 = 0, _nGeneration2 = 0;
+	bool _bMeta1 = ReadMeta(PAGE_META_FIRST, _nGeneration1, false);
+	bool _bMeta2 = ReadMeta(PAGE_META_FIRST + 1, _nGeneration2, false);
+	if (!_bMeta1 && !_bMeta2)
+		return false;
+	uint _nMeta = _bMeta1 && (!_bMeta2 || _nGeneration1 > _nGeneration2) ?
+		PAGE_META_FIRST : PAGE_META_FIRST + 1;
+	return ReadMeta(_nMeta, m_nGeneration, true);
+}
+
+bool PagedStore::Init(const std::string& strFileName, ICrypto* pCrypto,
+	CryptoKey* pKey, const u8Vec& vContext)
+{
+	size_t _nTagLength = pCrypto->GetTagLength();
+	if (_nTagLength == 0 || _nTagLength > sizeof(m_root.tag) ||
+		pCrypto->GetIVLength() + _nTagLength > PAGE_SIZE / 4)
+		return false;
+
+	m_file.close();
+	m_file.clear();
+	m_file.open(strFileName.c_str(), std::ios::in | std::ios::out |
+		std::ios::binary);
+	if (!m_file.is_open())
+		return false;
+
+	m_strFileName = strFileName;
+	m_pCrypto = pCrypto;
+	m_pKey = pKey;
+	m_nBodyLength = PAGE_SIZE - pCrypto->GetIVLength() - _nTagLength;
+	m_vAAD = vContext;
+	m_vAAD.resize(vContext.size() + 4);
+
+	m_mapNodes.clear();
+	m_vFree.clear();
+	m_vFreed.clear();
+	m_nCount = 0;
+	m_nGeneration = 0;
+	m_nPageCount = PAGE_FIRST_NODE;
+	m_bDirty = false;
+	m_nCacheLimit = PAGE_CACHE_SIZE;
+	m_nPagesRead = 0;
+	m_nPagesWritten = 0;
+	return true;
+}
+
+
+bool PagedStore::Find(std::string_view name, pass_fields& fields)
+{
+	PageRef _ref = m_root;
+	for (;;)
+	{
+		Node* _pNode = LoadNode(_ref);
+		if (_pNode == nullptr)
+			return false;
+
+		if (!_pNode->bLeaf)
+		{
+			_ref = _pNode->vChildren[std::upper_bound(_pNode->vKeys.begin(),
+				_pNode->vKeys.end(), name, NameLess) - _pNode->vKeys.begin()];
+			continue;
+		}
+
+		auto _it = std::lower_bound(_pNode->vKeys.begin(),
+			_pNode->vKeys.end(), name, KeyLess);
+		bool _bFound = _it != _pNode->vKeys.end() &&
+			std::string_view(*_it) == name;
+		if (_bFound)
+		{
+			const pass_fields& _fields =
+				_pNode->vFields[_it - _pNode->vKeys.begin()];
+			fields.assign(_fields.begin(), _fields.end());
+		}
+		TrimCache();
+		return _bFound;
+	}
+}
+
+bool PagedStore::Put(std::string_view name, const std::string_view* pFields,
+	size_t nFields)
+{
+	// Keeps every split within a page
+	size_t _nLength = GetVarLength(name.size()) + name.size() +
+		GetVarLength(nFields);
+	for (size_t i = 0; i < nFields; i++)
+		_nLength += GetVarLength(pFields[i].size()) + pFields[i].size();
+	if (_nLength > m_nBodyLength / 4)
+		return false;
+
+	Split _split;
+	if (!PutNode(m_root, name, pFields, nFields, _split))
+		return false;
+	if (_split.bSplit)
+	{
+		// Tree grows at the root
+		PageRef _oldRoot = m_root;
+		Node* _pRoot = NewNode(false, m_root);
+		_pRoot->vKeys.push_back(std::move(_split.key));
+		_pRoot->vChildren.push_back(_oldRoot);
+		_pRoot->vChildren.push_back(_split.right);
+	}
+
+	m_bDirty = true;
+	TrimCache();
+	return true;
+}
+
+bool PagedStore::Erase(std::string_view name)
+{
+	bool _bEmpty;
+	if (!EraseNode(m_root, name, _bEmpty))
+		return false;
+
+	// Tree shrinks while the root has a single child, an emptied tree starts
+	// over from a leaf
+	Node* _pRoot = LoadNode(m_root);
+	while (_pRoot != nullptr && !_pRoot->bLeaf &&
+		_pRoot->vChildren.size() <= 1)
+	{
+		std::vector<PageRef> _vChildren;
+		_vChildren.swap(_pRoot->vChildren);
+		FreeNode(m_root.nPage);
+		if (_vChildren.empty())
+		{
+			NewNode(true, m_root);
+			break;
+		}
+		m_root = _vChildren[0];
+		_pRoot = LoadNode(m_root);
+	}
+
+	m_bDirty = true;
+	TrimCache();
+	return true;
+}
+
+bool PagedStore::ForEach(const pass_visitor& fn)
+{
+	bool _bStop = false;
+	return VisitNode(m_root, fn, _bStop);
+}
+
+bool PagedStore::Flush()
+{
+	if (!m_bDirty)
+		return true;
+
+	// Nothing in memory changes until the meta page is written, a failed
+	// flush can be retried
+	std::vector<uint> _vFreeBefore(m_vFree);
+	uint _nPageCountBefore = m_nPageCount;
+	std::unordered_map<uint, PageRef> _mapWritten;
+	std::vector<uint> _vReleased(m_vFreed);
+	PageRef _root;
+	bool _bWritten = WriteNode(m_root, _root, _mapWritten, _vReleased);
+
+	// The new pages reach the disk before the meta page that commits them
+	m_file.flush();
+	_bWritten = _bWritten && m_file.good() && SyncFile(m_strFileName);
+
+	// Pages the new tree released are free once it is committed
+	std::vector<uint> _vFree(m_vFree);
+	_vFree.insert(_vFree.end(), _vReleased.begin(), _vReleased.end());
+	if (_bWritten)
+		_bWritten = WriteMeta(m_nGeneration + 1, _root, _vFree);
+	m_file.flush();
+	if (!_bWritten || !m_file.good() || !SyncFile(m_strFileName))
+	{
+		m_file.clear();
+		m_vFree = _vFreeBefore;
+		m_nPageCount = _nPageCountBefore;
+		return false;
+	}
+
+	// Nodes move to the pages they were written to
+	std::unordered_map<uint, std::unique_ptr<Node>> _mapNodes;
+	for (auto& entry : m_mapNodes)
+	{
+		Node& _node = *entry.second;
+		for (PageRef& child : _node.vChildren)
+		{
+			auto _it = _mapWritten.find(child.nPage);
+			if (_it != _mapWritten.end())
+				child = _it->second;
+		}
+		_node.bDirty = false;
+		_node.bFresh = false;
+		auto _it = _mapWritten.find(entry.first);
+		uint _nPage = _it != _mapWritten.end() ? _it->second.nPage :
+			entry.first;
+		_mapNodes[_nPage] = std::move(entry.second);
+	}
+	m_mapNodes.swap(_mapNodes);
+	m_root = _root;
+	m_vFree.swap(_vFree);
+	m_vFreed.clear();
+	m_nGeneration++;
+	m_bDirty = false;
+	TrimCache();
+	return true;
+}
+
+
+bool PagedStore::ReadPage(uint nPage, u8SecureVec& vBody, u8* pTag)
+{
+	size_t _nIVLength = m_pCrypto->GetIVLength();
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	const CryptoKeySchedule* _pKey =
+		m_pKey->GetKeySchedule(m_pCrypto->GetMode());
+	if (_pKey == nullptr || (nPage >= m_nPageCount && nPage >= PAGE_FIRST_NODE))
+		return false;
+
+	u8 _iv[PAGE_SIZE / 4];
+	vBody.resize(m_nBodyLength);
+	m_file.seekg((std::streamoff)nPage * PAGE_SIZE);
+	m_file.read((char*)_iv, _nIVLength);
+	m_file.read((char*)vBody.data(), vBody.size());
+	m_file.read((char*)pTag, _nTagLength);
+	if (!m_file)
+	{
+		m_file.clear();
+		return false;
+	}
+	m_nPagesRead++;
+
+	// Plaintext is zeroed if authentication fails
+	PutLittleEndian(&m_vAAD[m_vAAD.size() - 4], nPage, 4);
+	return m_pCrypto->DecryptAuthData(vBody.data(), vBody.size(),
+		vBody.data(), *_pKey, _iv, _nIVLength, m_vAAD.data(), m_vAAD.size(),
+		pTag, _nTagLength) == CRYPTO_ERROR_CODES::CRYPT_OK;
+}
+
+bool PagedStore::WritePage(uint nPage, u8SecureVec& vBody, u8* pTag)
+{
+	size_t _nIVLength = m_pCrypto->GetIVLength();
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	const CryptoKeySchedule* _pKey =
+		m_pKey->GetKeySchedule(m_pCrypto->GetMode());
+	if (_pKey == nullptr)
+		return false;
+
+	// Fresh nonce for every page write, the key is shared by all pages
+	u8 _iv[PAGE_SIZE / 4];
+	PutLittleEndian(&m_vAAD[m_vAAD.size() - 4], nPage, 4);
+	if (GetRandomBytes(_iv, _nIVLength) != CRYPTO_ERROR_CODES::CRYPT_OK ||
+		m_pCrypto->EncryptAuthData(vBody.data(), vBody.size(), vBody.data(),
+		*_pKey, _iv, _nIVLength, m_vAAD.data(), m_vAAD.size(), pTag,
+		_nTagLength) != CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	m_file.seekp((std::streamoff)nPage * PAGE_SIZE);
+	m_file.write((char*)_iv, _nIVLength);
+	m_file.write((char*)vBody.data(), vBody.size());
+	m_file.write((char*)pTag, _nTagLength);
+	m_nPagesWritten++;
+	return m_file.good();
+}
+
+bool PagedStore::DecodeNode(const u8SecureVec& vBody, Node& node) const
+{
+	const u8* _pIn = vBody.data() + 1;
+	const u8* _pEnd = vBody.data() + vBody.size();
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	size_t _nKeys, _nFieldSize;
+	std::string_view _str;
+	if (vBody[0] != PAGE_TYPE_LEAF && vBody[0] != PAGE_TYPE_INTERNAL)
+		return false;
+	node.bLeaf = vBody[0] == PAGE_TYPE_LEAF;
+	if (!GetVar(_pIn, _pEnd, _nKeys) || _nKeys > vBody.size())
+		return false;
+
+	node.vKeys.reserve(_nKeys);
+	if (node.bLeaf)
+	{
+		node.vFields.resize(_nKeys);
+		for (size_t i = 0; i < _nKeys; i++)
+		{
+			if (!GetString(_pIn, _pEnd, _str) ||
+				!GetVar(_pIn, _pEnd, _nFieldSize) ||
+				_nFieldSize > (size_t)(_pEnd - _pIn))
+				return false;
+			node.vKeys.emplace_back(_str.data(), _str.size());
+			node.vFields[i].reserve(_nFieldSize);
+			for (size_t j = 0; j < _nFieldSize; j++)
+			{
+				if (!GetString(_pIn, _pEnd, _str))
+					return false;
+				node.vFields[i].emplace_back(_str.data(), _str.size());
+			}
+		}
+		return true;
+	}
+
+	node.vChildren.resize(_nKeys + 1);
+	for (size_t i = 0; i <= _nKeys; i++)
+	{
+		if (i > 0)
+		{
+			if (!GetString(_pIn, _pEnd, _str))
+				return false;
+			node.vKeys.emplace_back(_str.data(), _str.size());
+		}
+		if ((size_t)(_pEnd - _pIn) < 4 + _nTagLength)
+			return false;
+		PageRef& _child = node.vChildren[i];
+		_child.nPage = (uint)GetLittleEndian(_pIn, 4);
+		memset(_child.tag, 0, sizeof(_child.tag));
+		memcpy(_child.tag, _pIn + 4, _nTagLength);
+		_pIn += 4 + _nTagLength;
+		if (_child.nPage < PAGE_FIRST_NODE || _child.nPage >= m_nPageCount)
+			return false;
+	}
+	return true;
+}
+
+void PagedStore::EncodeNode(const Node& node,
+	const std::vector<PageRef>& vChildren, u8SecureVec& vBody) const
+{
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	vBody.assign(m_nBodyLength, 0);
+	u8* _pOut = vBody.data();
+	*_pOut++ = node.bLeaf ? PAGE_TYPE_LEAF : PAGE_TYPE_INTERNAL;
+	_pOut = PutVar(_pOut, node.vKeys.size());
+
+	if (node.bLeaf)
+	{
+		for (size_t i = 0; i < node.vKeys.size(); i++)
+		{
+			_pOut = PutString(_pOut, node.vKeys[i]);
+			_pOut = PutVar(_pOut, node.vFields[i].size());
+			for (const SecureString& field : node.vFields[i])
+				_pOut = PutString(_pOut, field);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < vChildren.size(); i++)
+	{
+		if (i > 0)
+			_pOut = PutString(_pOut, node.vKeys[i - 1]);
+		PutLittleEndian(_pOut, vChildren[i].nPage, 4);
+		memcpy(_pOut + 4, vChildren[i].tag, _nTagLength);
+		_pOut += 4 + _nTagLength;
+	}
+}
+
+size_t PagedStore::GetNodeLength(const Node& node) const
+{
+	size_t _nLength = 1 + GetVarLength(node.vKeys.size());
+	if (node.bLeaf)
+	{
+		for (size_t i = 0; i < node.vKeys.size(); i++)
+			_nLength += GetEntryLength(node, i);
+		return _nLength;
+	}
+
+	_nLength += 4 + m_pCrypto->GetTagLength();	// child0
+	for (size_t i = 0; i < node.vKeys.size(); i++)
+		_nLength += GetKeyLength(node, i);
+	return _nLength;
+}
+
+size_t PagedStore::GetEntryLength(const Node& node, size_t nEntry) const
+{
+	size_t _nLength = GetVarLength(node.vKeys[nEntry].size()) +
+		node.vKeys[nEntry].size();
+	_nLength += GetVarLength(node.vFields[nEntry].size());
+	for (const SecureString& field : node.vFields[nEntry])
+		_nLength += GetVarLength(field.size()) + field.size();
+	return _nLength;
+}
+
+size_t PagedStore::GetKeyLength(const Node& node, size_t nKey) const
+{
+	// Separator and the child after it
+	return GetVarLength(node.vKeys[nKey].size()) + node.vKeys[nKey].size() +
+		4 + m_pCrypto->GetTagLength();
+}
+
+
+PagedStore::Node* PagedStore::LoadNode(const PageRef& ref)
+{
+	auto _it = m_mapNodes.find(ref.nPage);
+	if (_it != m_mapNodes.end())
+		return _it->second.get();
+
+	// A page that authenticates but is not the one its parent last wrote
+	// is an older copy
+	u8SecureVec _vBody;
+	u8 _tag[sizeof(ref.tag)];
+	std::unique_ptr<Node> _pNode(new Node());
+	if (!ReadPage(ref.nPage, _vBody, _tag) ||
+		memcmp(_tag, ref.tag, m_pCrypto->GetTagLength()) != 0 ||
+		!DecodeNode(_vBody, *_pNode))
+		return nullptr;
+
+	Node* _pLoaded = _pNode.get();
+	m_mapNodes[ref.nPage] = std::move(_pNode);
+	return _pLoaded;
+}
+
+PagedStore::Node* PagedStore::NewNode(bool bLeaf, PageRef& ref)
+{
+	ref.nPage = AllocatePage();
+	memset(ref.tag, 0, sizeof(ref.tag));
+
+	std::unique_ptr<Node> _pNode(new Node());
+	_pNode->bLeaf = bLeaf;
+	_pNode->bDirty = true;
+	_pNode->bFresh = true;
+	Node* _pNew = _pNode.get();
+	m_mapNodes[ref.nPage] = std::move(_pNode);
+	return _pNew;
+}
+
+void PagedStore::FreeNode(uint nPage)
+{
+	// Fresh pages were never committed and can be reused right away
+	auto _it = m_mapNodes.find(nPage);
+	bool _bFresh = _it != m_mapNodes.end() && _it->second->bFresh;
+	if (_it != m_mapNodes.end())
+		m_mapNodes.erase(_it);
+	if (_bFresh)
+		m_vFree.push_back(nPage);
+	else
+		m_vFreed.push_back(nPage);
+}
+
+uint PagedStore::AllocatePage()
+{
+	if (m_vFree.empty())
+		return m_nPageCount++;
+	uint _nPage = m_vFree.back();
+	m_vFree.pop_back();
+	return _nPage;
+}
+
+void PagedStore::TrimCache()
+{
+	if (m_mapNodes.size() <= m_nCacheLimit)
+		return;
+	for (auto _it = m_mapNodes.begin(); _it != m_mapNodes.end(); )
+	{
+		if (_it->second->bDirty)
+			++_it;
+		else
+			_it = m_mapNodes.erase(_it);
+	}
+	// Dirty nodes stay until the next flush, waiting for the cache to double
+	// keeps trimming linear
+	m_nCacheLimit = std::max((size_t)PAGE_CACHE_SIZE, m_mapNodes.size() * 2);
+}
+
+
+bool PagedStore::PutNode(const PageRef& ref, std::string_view name,
+	const std::string_view* pFields, size_t nFields, Split& split)
+{
+	Node* _pNode = LoadNode(ref);
+	if (_pNode == nullptr)
+		return false;
+
+	if (_pNode->bLeaf)
+	{
+		// Copied before the entry is touched, pFields may point into it
+		pass_fields _fields;
+		_fields.reserve(nFields);
+		for (size_t i = 0; i < nFields; i++)
+			_fields.emplace_back(pFields[i].data(), pFields[i].size());
+
+		auto _it = std::lower_bound(_pNode->vKeys.begin(),
+			_pNode->vKeys.end(), name, KeyLess);
+		size_t _nEntry = _it - _pNode->vKeys.begin();
+		if (_it != _pNode->vKeys.end() && std::string_view(*_it) == name)
+			_pNode->vFields[_nEntry].swap(_fields);
+		else
+		{
+			_pNode->vKeys.emplace(_it, name.data(), name.size());
+			_pNode->vFields.emplace(_pNode->vFields.begin() + _nEntry,
+				std::move(_fields));
+			m_nCount++;
+		}
+	}
+	else
+	{
+		size_t _nChild = std::upper_bound(_pNode->vKeys.begin(),
+			_pNode->vKeys.end(), name, NameLess) - _pNode->vKeys.begin();
+		PageRef _child = _pNode->vChildren[_nChild];
+		Split _childSplit;
+		if (!PutNode(_child, name, pFields, nFields, _childSplit))
+			return false;
+		if (_childSplit.bSplit)
+		{
+			_pNode->vKeys.insert(_pNode->vKeys.begin() + _nChild,
+				std::move(_childSplit.key));
+			_pNode->vChildren.insert(_pNode->vChildren.begin() + _nChild + 1,
+				_childSplit.right);
+		}
+	}
+
+	// Parents are rewritten with their children, they hold the child's tag
+	_pNode->bDirty = true;
+	if (GetNodeLength(*_pNode) > m_nBodyLength)
+		SplitNode(*_pNode, split);
+	return true;
+}
+
+bool PagedStore::EraseNode(const PageRef& ref, std::string_view name,
+	bool& bEmpty)
+{
+	Node* _pNode = LoadNode(ref);
+	if (_pNode == nullptr)
+		return false;
+
+	if (_pNode->bLeaf)
+	{
+		auto _it = std::lower_bound(_pNode->vKeys.begin(),
+			_pNode->vKeys.end(), name, KeyLess);
+		if (_it == _pNode->vKeys.end() || std::string_view(*_it) != name)
+			return false;
+		_pNode->vFields.erase(_pNode->vFields.begin() +
+			(_it - _pNode->vKeys.begin()));
+		_pNode->vKeys.erase(_it);
+		m_nCount--;
+	}
+	else
+	{
+		size_t _nChild = std::upper_bound(_pNode->vKeys.begin(),
+			_pNode->vKeys.end(), name, NameLess) - _pNode->vKeys.begin();
+		PageRef _child = _pNode->vChildren[_nChild];
+		bool _bChildEmpty;
+		if (!EraseNode(_child, name, _bChildEmpty))
+			return false;
+		if (_bChildEmpty)
+		{
+			// A neighbour takes over the emptied child's key range
+			FreeNode(_child.nPage);
+			_pNode->vChildren.erase(_pNode->vChildren.begin() + _nChild);
+			if (!_pNode->vKeys.empty())
+				_pNode->vKeys.erase(_pNode->vKeys.begin() +
+					(_nChild > 0 ? _nChild - 1 : 0));
+		}
+	}
+
+	_pNode->bDirty = true;
+	bEmpty = _pNode->bLeaf ? _pNode->vKeys.empty() :
+		_pNode->vChildren.empty();
+	return true;
+}
+
+void PagedStore::SplitNode(Node& node, Split& split)
+{
+	Node* _pRight = NewNode(node.bLeaf, split.right);
+	size_t _nHalf = GetNodeLength(node) / 2;
+	size_t _nLeft = 0;
+	size_t i = 0;
+
+	if (node.bLeaf)
+	{
+		// Right node takes the entries past half of the bytes
+		for (; i + 1 < node.vKeys.size() && _nLeft < _nHalf; i++)
+			_nLeft += GetEntryLength(node, i);
+		_pRight->vKeys.assign(std::make_move_iterator(node.vKeys.begin() + i),
+			std::make_move_iterator(node.vKeys.end()));
+		_pRight->vFields.assign(
+			std::make_move_iterator(node.vFields.begin() + i),
+			std::make_move_iterator(node.vFields.end()));
+		node.vKeys.erase(node.vKeys.begin() + i, node.vKeys.end());
+		node.vFields.erase(node.vFields.begin() + i, node.vFields.end());
+		split.key = _pRight->vKeys[0];
+	}
+	else
+	{
+		// Key i moves up, the children on either side of it stay apart
+		for (; i + 2 < node.vKeys.size() && _nLeft < _nHalf; i++)
+			_nLeft += GetKeyLength(node, i);
+		split.key = std::move(node.vKeys[i]);
+		_pRight->vKeys.assign(
+			std::make_move_iterator(node.vKeys.begin() + i + 1),
+			std::make_move_iterator(node.vKeys.end()));
+		_pRight->vChildren.assign(node.vChildren.begin() + i + 1,
+			node.vChildren.end());
+		node.vKeys.erase(node.vKeys.begin() + i, node.vKeys.end());
+		node.vChildren.erase(node.vChildren.begin() + i + 1,
+			node.vChildren.end());
+	}
+	split.bSplit = true;
+}
+
+bool PagedStore::VisitNode(const PageRef& ref, const pass_visitor& fn,
+	bool& bStop)
+{
+	// Pages are not cached by a scan, it would evict the working set
+	Node _node;
+	const Node* _pNode;
+	auto _it = m_mapNodes.find(ref.nPage);
+	if (_it != m_mapNodes.end())
+		_pNode = _it->second.get();
+	else
+	{
+		u8SecureVec _vBody;
+		u8 _tag[sizeof(ref.tag)];
+		if (!ReadPage(ref.nPage, _vBody, _tag) ||
+			memcmp(_tag, ref.tag, m_pCrypto->GetTagLength()) != 0 ||
+			!DecodeNode(_vBody, _node))
+			return false;
+		_pNode = &_node;
+	}
+
+	if (_pNode->bLeaf)
+	{
+		std::vector<std::string_view> _vFields;
+		for (size_t i = 0; i < _pNode->vKeys.size() && !bStop; i++)
+		{
+			_vFields.assign(_pNode->vFields[i].begin(),
+				_pNode->vFields[i].end());
+			bStop = !fn(_pNode->vKeys[i], _vFields.data(), _vFields.size());
+		}
+		return true;
+	}
+
+	for (size_t i = 0; i < _pNode->vChildren.size() && !bStop; i++)
+	{
+		if (!VisitNode(_pNode->vChildren[i], fn, bStop))
+			return false;
+	}
+	return true;
+}
+
+bool PagedStore::WriteNode(const PageRef& ref, PageRef& written,
+	std::unordered_map<uint, PageRef>& mapWritten,
+	std::vector<uint>& vReleased)
+{
+	uint _nOldPage = ref.nPage;
+	auto _it = m_mapNodes.find(_nOldPage);
+	if (_it == m_mapNodes.end() || !_it->second->bDirty)
+	{
+		written = ref;
+		return true;
+	}
+	Node& _node = *_it->second;
+
+	// Children first, their new pages and tags go into this node
+	std::vector<PageRef> _vChildren(_node.vChildren);
+	for (PageRef& child : _vChildren)
+	{
+		if (!WriteNode(child, child, mapWritten, vReleased))
+			return false;
+	}
+
+	// Committed pages are never overwritten, the node moves
+	u8SecureVec _vBody;
+	EncodeNode(_node, _vChildren, _vBody);
+	PageRef _written;
+	memset(_written.tag, 0, sizeof(_written.tag));
+	_written.nPage = _node.bFresh ? _nOldPage : AllocatePage();
+	if (!WritePage(_written.nPage, _vBody, _written.tag))
+		return false;
+	if (!_node.bFresh)
+		vReleased.push_back(_nOldPage);
+
+	mapWritten[_nOldPage] = _written;
+	written = _written;
+	return true;
+}
+
+bool PagedStore::WriteMeta(uint64_t nGeneration, const PageRef& root,
+	const std::vector<uint>& vFree)
+{
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	size_t _nFree = std::min(vFree.size(),
+		(m_nBodyLength - META_FIXED_LENGTH(_nTagLength)) / 4);
+
+	u8SecureVec _vBody(m_nBodyLength, 0);
+	u8* _pOut = _vBody.data();
+	*_pOut++ = PAGE_TYPE_META;
+	PutLittleEndian(_pOut, nGeneration, 8);
+	PutLittleEndian(_pOut + 8, root.nPage, 4);
+	memcpy(_pOut + 12, root.tag, _nTagLength);
+	_pOut += 12 + _nTagLength;
+	PutLittleEndian(_pOut, m_nCount, 8);
+	PutLittleEndian(_pOut + 8, m_nPageCount, 4);
+	PutLittleEndian(_pOut + 12, _nFree, 4);
+	_pOut += 16;
+	for (size_t i = 0; i < _nFree; i++, _pOut += 4)
+		PutLittleEndian(_pOut, vFree[i], 4);
+
+	u8 _tag[sizeof(root.tag)];
+	return WritePage(PAGE_META_FIRST + (uint)(nGeneration % 2), _vBody, _tag);
+}
+
+bool PagedStore::ReadMeta(uint nPage, uint64_t& nGeneration, bool bLoad)
+{
+	u8SecureVec _vBody;
+	u8 _tag[sizeof(m_root.tag)];
+	if (!ReadPage(nPage, _vBody, _tag) || _vBody[0] != PAGE_TYPE_META)
+		return false;
+
+	size_t _nTagLength = m_pCrypto->GetTagLength();
+	const u8* _pIn = _vBody.data() + 1;
+	nGeneration = GetLittleEndian(_pIn, 8);
+	PageRef _root;
+	_root.nPage = (uint)GetLittleEndian(_pIn + 8, 4);
+	memset(_root.tag, 0, sizeof(_root.tag));
+	memcpy(_root.tag, _pIn + 12, _nTagLength);
+	_pIn += 12 + _nTagLength;
+	uint64_t _nCount = GetLittleEndian(_pIn, 8);
+	uint _nPageCount = (uint)GetLittleEndian(_pIn + 8, 4);
+	size_t _nFree = (size_t)GetLittleEndian(_pIn + 12, 4);
+	_pIn += 16;
+	if (_root.nPage < PAGE_FIRST_NODE || _root.nPage >= _nPageCount ||
+		_nFree > (m_nBodyLength - META_FIXED_LENGTH(_nTagLength)) / 4)
+		return false;
+	if (!bLoad)
+		return true;
+
+	m_vFree.resize(_nFree);
+	for (size_t i = 0; i < _nFree; i++, _pIn += 4)
+	{
+		m_vFree[i] = (uint)GetLittleEndian(_pIn, 4);
+		if (m_vFree[i] < PAGE_FIRST_NODE || m_vFree[i] >= _nPageCount)
+			return false;
+	}
+	m_root = _root;
+	m_nCount = _nCount;
+	m_nPageCount = _nPageCount;
+	return true;
+}
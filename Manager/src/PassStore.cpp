@@ -0,0 +1,241 @@
+#include "PassStore.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+#define INDEX_MIN_SIZE 16
+#define COMPACT_MIN_BYTES 4096	// Erased bytes tolerated before compacting
+
+uint PassStore::HashName(std::string_view name)
+{
+	// FNV-1a
+	uint _nHash = 2166136261u;
+	for (char ch : name)
+	{
+		_nHash ^= (u8)ch;
+		_nHash *= 16777619u;
+	}
+	return _nHash;
+}
+
+std::string_view PassStore::GetView(const PassSpan& span) const
+{
+	return std::string_view((const char*)m_vArena.data() + span.nOffset,
+		span.nLength);
+}
+
+size_t PassStore::FindSlot(std::string_view name, uint nHash) const
+{
+	// Linear probing, the index is never more than half full
+	size_t _nMask = m_vIndex.size() - 1;
+	for (size_t _nSlot = nHash & _nMask; ; _nSlot = (_nSlot + 1) & _nMask)
+	{
+		uint _nEntry = m_vIndex[_nSlot];
+		if (_nEntry == 0)
+			return _nSlot;
+		const PassRecord& _record = m_vEntries[_nEntry - 1];
+		if (_record.nHash == nHash && GetView(_record.name) == name)
+			return _nSlot;
+	}
+}
+
+size_t PassStore::Find(std::string_view name) const
+{
+	if (m_vEntries.empty())
+		return NOT_FOUND;
+	uint _nEntry = m_vIndex[FindSlot(name, HashName(name))];
+	return _nEntry == 0 ? NOT_FOUND : _nEntry - 1;
+}
+
+std::string_view PassStore::GetName(size_t nEntry) const
+{
+	return GetView(m_vEntries[nEntry].name);
+}
+
+size_t PassStore::GetFieldCount(size_t nEntry) const
+{
+	return m_vEntries[nEntry].nFieldCount;
+}
+
+std::string_view PassStore::GetField(size_t nEntry, size_t nField) const
+{
+	return GetView(m_vFields[m_vEntries[nEntry].nFirstField + nField]);
+}
+
+bool PassStore::Insert(std::string_view name, const std::string_view* pFields,
+	size_t nFields)
+{
+	size_t _nBytes = name.size();
+	for (size_t i = 0; i < nFields; i++)
+		_nBytes += pFields[i].size();
+	// Offsets are 32-bit
+	if (m_vArena.size() + _nBytes > (uint)-1 ||
+		m_vFields.size() + nFields > (uint)-1 ||
+		m_vEntries.size() + 1 >= ((uint)-1 >> 1))
+		return false;
+
+	if ((m_vEntries.size() + 1) * 2 > m_vIndex.size())
+		GrowIndex(m_vEntries.size() + 1);
+	uint _nHash = HashName(name);
+	size_t _nSlot = FindSlot(name, _nHash);
+	if (m_vIndex[_nSlot] != 0)
+		return false;
+
+	// Name and values are stored back to back
+	PassRecord _record;
+	_record.name.nOffset = (uint)m_vArena.size();
+	_record.name.nLength = (uint)name.size();
+	_record.nFirstField = (uint)m_vFields.size();
+	_record.nFieldCount = (uint)nFields;
+	_record.nHash = _nHash;
+	m_vArena.insert(m_vArena.end(), name.begin(), name.end());
+	for (size_t i = 0; i < nFields; i++)
+	{
+		PassSpan _span;
+		_span.nOffset = (uint)m_vArena.size();
+		_span.nLength = (uint)pFields[i].size();
+		m_vFields.push_back(_span);
+		m_vArena.insert(m_vArena.end(), pFields[i].begin(), pFields[i].end());
+	}
+	m_vEntries.push_back(_record);
+	m_vIndex[_nSlot] = (uint)m_vEntries.size();
+	return true;
+}
+
+bool PassStore::Insert(std::string_view name, const pass_fields& fields)
+{
+	std::vector<std::string_view> _vFields(fields.begin(), fields.end());
+	return Insert(name, _vFields.data(), _vFields.size());
+}
+
+bool PassStore::Erase(std::string_view name)
+{
+	if (m_vEntries.empty())
+		return false;
+	size_t _nSlot = FindSlot(name, HashName(name));
+	if (m_vIndex[_nSlot] == 0)
+		return false;
+	size_t _nEntry = m_vIndex[_nSlot] - 1;
+
+	// Wipe the entry's bytes, they stay in the arena until it is compacted
+	const PassRecord& _record = m_vEntries[_nEntry];
+	size_t _nEnd = _record.name.nOffset + _record.name.nLength;
+	if (_record.nFieldCount > 0)
+	{
+		const PassSpan& _last =
+			m_vFields[_record.nFirstField + _record.nFieldCount - 1];
+		_nEnd = _last.nOffset + _last.nLength;
+	}
+	memset(m_vArena.data() + _record.name.nOffset, 0,
+		_nEnd - _record.name.nOffset);
+	m_nErasedBytes += _nEnd - _record.name.nOffset;
+	m_nErasedFields += _record.nFieldCount;
+
+	// Backward shift deletion keeps probe sequences intact without
+	// tombstones
+	size_t _nMask = m_vIndex.size() - 1;
+	size_t _nHole = _nSlot;
+	m_vIndex[_nHole] = 0;
+	for (size_t _nNext = (_nHole + 1) & _nMask; m_vIndex[_nNext] != 0;
+		_nNext = (_nNext + 1) & _nMask)
+	{
+		size_t _nHome = m_vEntries[m_vIndex[_nNext] - 1].nHash & _nMask;
+		// Entries whose home lies cyclically in (hole, next] stay put
+		bool _bStays = _nHole <= _nNext ?
+			(_nHole < _nHome && _nHome <= _nNext) :
+			(_nHole < _nHome || _nHome <= _nNext);
+		if (_bStays)
+			continue;
+		m_vIndex[_nHole] = m_vIndex[_nNext];
+		m_vIndex[_nNext] = 0;
+		_nHole = _nNext;
+	}
+
+	// Move the last entry into the freed record
+	size_t _nLast = m_vEntries.size() - 1;
+	if (_nEntry != _nLast)
+	{
+		const PassRecord& _moved = m_vEntries[_nLast];
+		size_t _nMovedSlot = FindSlot(GetView(_moved.name), _moved.nHash);
+		m_vIndex[_nMovedSlot] = (uint)_nEntry + 1;
+		m_vEntries[_nEntry] = _moved;
+	}
+	m_vEntries.pop_back();
+
+	if (m_nErasedBytes > COMPACT_MIN_BYTES &&
+		m_nErasedBytes * 2 > m_vArena.size())
+		Compact();
+	return true;
+}
+
+void PassStore::Clear()
+{
+	// Single pass over the arena, capacity is kept for reuse
+	if (!m_vArena.empty())
+		memset(&m_vArena[0], 0, m_vArena.size());
+	m_vArena.clear();
+	m_vFields.clear();
+	m_vEntries.clear();
+	std::fill(m_vIndex.begin(), m_vIndex.end(), 0);
+	m_nErasedBytes = 0;
+	m_nErasedFields = 0;
+}
+
+void PassStore::Reserve(size_t nEntries, size_t nFields, size_t nBytes)
+{
+	m_vArena.reserve(nBytes);
+	m_vFields.reserve(nFields);
+	m_vEntries.reserve(nEntries);
+	if (nEntries * 2 > m_vIndex.size())
+		GrowIndex(nEntries);
+}
+
+void PassStore::GrowIndex(size_t nEntries)
+{
+	size_t _nSize = INDEX_MIN_SIZE;
+	while (_nSize < nEntries * 2)
+		_nSize <<= 1;
+	if (_nSize <= m_vIndex.size())
+		return;
+
+	m_vIndex.assign(_nSize, 0);
+	size_t _nMask = _nSize - 1;
+	for (size_t i = 0; i < m_vEntries.size(); i++)
+	{
+		size_t _nSlot = m_vEntries[i].nHash & _nMask;
+		while (m_vIndex[_nSlot] != 0)
+			_nSlot = (_nSlot + 1) & _nMask;
+		m_vIndex[_nSlot] = (uint)i + 1;
+	}
+}
+
+void PassStore::Compact()
+{
+	// The old arena is wiped by the secure allocator when it is released
+	u8SecureVec _vArena;
+	std::vector<PassSpan> _vFields;
+	_vArena.reserve(m_vArena.size() - m_nErasedBytes);
+	_vFields.reserve(m_vFields.size() - m_nErasedFields);
+	for (PassRecord& record : m_vEntries)
+	{
+		const u8* _pName = m_vArena.data() + record.name.nOffset;
+		record.name.nOffset = (uint)_vArena.size();
+		_vArena.insert(_vArena.end(), _pName, _pName + record.name.nLength);
+
+		uint _nFirstField = (uint)_vFields.size();
+		for (uint i = 0; i < record.nFieldCount; i++)
+		{
+			PassSpan _span = m_vFields[record.nFirstField + i];
+			const u8* _pValue = m_vArena.data() + _span.nOffset;
+			_span.nOffset = (uint)_vArena.size();
+			_vArena.insert(_vArena.end(), _pValue, _pValue + _span.nLength);
+			_vFields.push_back(_span);
+		}
+		record.nFirstField = _nFirstField;
+	}
+	m_vArena.swap(_vArena);
+	m_vFields.swap(_vFields);
+	m_nErasedBytes = 0;
+	m_nErasedFields = 0;
+}
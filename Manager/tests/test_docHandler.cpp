@@ -0,0 +1,317 @@
+#include "DocHandler.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#define TEST_FILE "test_docHandler.db"
+#define TEST_JOURNAL TEST_FILE ".jnl"
+#define TEST_ENTRIES 500
+
+typedef std::map<std::string, std::string> entry_map;
+
+static CryptoAES s_aes;
+static u8 s_keyValue[32];
+
+static void InitDoc(DocHandler& doc)
+{
+	doc.SetCrypto(&s_aes);
+	doc.GetKeyHandler()->SetKeyValue(s_keyValue, sizeof(s_keyValue));
+}
+
+static bool Put(DocHandler& doc, entry_map& mapEntries,
+	const std::string& strName, const std::string& strValue)
+{
+	std::string_view _fields[1] = { strValue };
+	mapEntries[strName] = strValue;
+	return doc.PutEntry(strName, _fields, 1);
+}
+
+// Document on disk holds exactly the expected entries
+static bool Matches(const entry_map& mapExpected)
+{
+	DocHandler _doc;
+	InitDoc(_doc);
+	if (!_doc.OpenDoc(TEST_FILE) || _doc.GetEntryCount() != mapExpected.size())
+		return false;
+	entry_map _mapRead;
+	_doc.ForEachEntry([&](std::string_view name,
+		const std::string_view* pFields, size_t nFields) {
+		if (nFields == 1)
+			_mapRead[std::string(name)] = std::string(pFields[0]);
+		return true;
+	});
+	return _mapRead == mapExpected;
+}
+
+static void FlipByte(const char* pFileName, size_t nOffset)
+{
+	std::fstream _file(pFileName, std::ios::in | std::ios::out |
+		std::ios::binary);
+	char _ch;
+	_file.seekg(nOffset);
+	_file.read(&_ch, 1);
+	_ch ^= 1;
+	_file.seekp(nOffset);
+	_file.write(&_ch, 1);
+}
+
+// Document written before key slots and the compact contents layout: 
+// version 1 header, contents with size_t lengths encrypted by the unlock key
+static bool WriteLegacyDoc(const entry_map& mapEntries)
+{
+	u8Vec _vPlain;
+	auto _putSize = [&](size_t nValue) {
+		const u8* _pValue = (const u8*)&nValue;
+		_vPlain.insert(_vPlain.end(), _pValue, _pValue + sizeof(size_t));
+	};
+	auto _putString = [&](const std::string& str) {
+		_putSize(str.size());
+		_vPlain.insert(_vPlain.end(), str.begin(), str.end());
+	};
+	_putSize(mapEntries.size());
+	for (auto& entry : mapEntries)
+	{
+		_putString(entry.first);
+		_putSize(1);
+		_putString(entry.second);
+	}
+
+	CryptoKey _key;
+	_key.SetKeyValue(s_keyValue, sizeof(s_keyValue));
+	const CryptoKeySchedule* _pKey = _key.GetKeySchedule(s_aes.GetMode());
+	u8Vec _vDoc = { 'P', 'M', 'D', 'B', 1, 1, (u8)s_aes.GetIVLength() };
+	_vDoc.resize(_vDoc.size() + s_aes.GetIVLength(), 0x5A);
+	size_t _nHeaderLength = _vDoc.size();
+	_vDoc.resize(_nHeaderLength + _vPlain.size() + s_aes.GetTagLength());
+	if (_pKey == nullptr || s_aes.EncryptAuthData(_vPlain.data(), 
+		_vPlain.size(), &_vDoc[_nHeaderLength], *_pKey, &_vDoc[7], 
+		s_aes.GetIVLength(), &_vDoc[0], _nHeaderLength, 
+		&_vDoc[_nHeaderLength + _vPlain.size()], s_aes.GetTagLength()) !=
+		CRYPTO_ERROR_CODES::CRYPT_OK)
+		return false;
+
+	std::ofstream _fileOut(TEST_FILE, std::ios::out | std::ios::binary |
+		std::ios::trunc);
+	_fileOut.write((const char*)&_vDoc[0], _vDoc.size());
+	return _fileOut.good();
+}
+
+// Entries with any number of fields, empty values and lengths that need
+// multi byte vars or span contents chunks survive a full save
+static bool TestContents(CRYPTO_MODES nMode)
+{
+	CryptoAES _aes;
+	_aes.Init(nMode);
+	std::map<std::string, std::vector<std::string>> _mapEntries = {
+		{ "no fields", {} },
+		{ "empty field", { "" } },
+		{ std::string(300, 'n'), { "a", "b", std::string(200, 'c') } },
+		{ "spans chunks", { std::string(200000, 'x'), "after" } },
+	};
+	std::remove(TEST_FILE);
+	{
+		DocHandler _doc;
+		_doc.SetCrypto(&_aes);
+		_doc.GetKeyHandler()->SetKeyValue(s_keyValue, sizeof(s_keyValue));
+		bool _bSaved = _doc.CreateDoc(TEST_FILE) && _doc.OpenDoc(TEST_FILE);
+		for (auto& entry : _mapEntries)
+		{
+			std::vector<std::string_view> _vFields(entry.second.begin(),
+				entry.second.end());
+			_bSaved = _bSaved && _doc.PutEntry(entry.first, _vFields.data(),
+				_vFields.size());
+		}
+		if (!_bSaved || !_doc.SaveDoc() || !_doc.WaitForSave())
+			return false;
+	}
+
+	DocHandler _doc;
+	_doc.SetCrypto(&_aes);
+	_doc.GetKeyHandler()->SetKeyValue(s_keyValue, sizeof(s_keyValue));
+	if (!_doc.OpenDoc(TEST_FILE) || _doc.GetEntryCount() != _mapEntries.size())
+		return false;
+	for (auto& entry : _mapEntries)
+	{
+		pass_fields _fields;
+		if (!_doc.FindEntry(entry.first, _fields) ||
+			_fields.size() != entry.second.size())
+			return false;
+		for (size_t i = 0; i < _fields.size(); i++)
+		{
+			if (std::string_view(_fields[i]) != entry.second[i])
+				return false;
+		}
+	}
+	return true;
+}
+
+int main()
+{
+	uint nNumErrors = 0;
+	s_aes.Init(CRYPTO_MODES::AES_GCM);
+	for (size_t i = 0; i < sizeof(s_keyValue); i++)
+		s_keyValue[i] = (u8)(i * 29 + 3);
+
+	std::remove(TEST_FILE);
+	std::remove(TEST_JOURNAL);
+
+	entry_map _mapEntries;
+	{
+		DocHandler _doc;
+		InitDoc(_doc);
+		bool _bCreated = _doc.CreateDoc(TEST_FILE) && _doc.OpenDoc(TEST_FILE);
+		for (size_t i = 0; i < TEST_ENTRIES; i++)
+			_bCreated = _bCreated && Put(_doc, _mapEntries,
+				"entry" + std::to_string(i), "value" + std::to_string(i));
+		if (!_bCreated || !_doc.SaveDoc() || !_doc.WaitForSave())
+		{
+			std::cout << "Failed to create document" << std::endl;
+			return 1;
+		}
+	}
+	size_t _nDocSize = std::filesystem::file_size(TEST_FILE);
+	if (std::filesystem::exists(TEST_JOURNAL) || !Matches(_mapEntries))
+	{
+		std::cout << "Full save does not match" << std::endl;
+		nNumErrors++;
+	}
+
+	// Small changes are appended to the journal and replayed on open
+	{
+		DocHandler _doc;
+		InitDoc(_doc);
+		bool _bSaved = _doc.OpenDoc(TEST_FILE) &&
+			Put(_doc, _mapEntries, "entry5", "replaced") &&
+			Put(_doc, _mapEntries, "added", "new") &&
+			_doc.EraseEntry("entry7") && !_doc.EraseEntry("missing") &&
+			_doc.SaveDoc();
+		_mapEntries.erase("entry7");
+		if (!_bSaved)
+		{
+			std::cout << "Journal save failed" << std::endl;
+			nNumErrors++;
+		}
+	}
+	if (std::filesystem::file_size(TEST_FILE) != _nDocSize ||
+		!std::filesystem::exists(TEST_JOURNAL) || !Matches(_mapEntries))
+	{
+		std::cout << "Journal replay does not match" << std::endl;
+		nNumErrors++;
+	}
+
+	// A record cut short by an interrupted save is dropped, and overwritten
+	// by the next one
+	size_t _nJournalSize = std::filesystem::file_size(TEST_JOURNAL);
+	{
+		std::ofstream _fileOut(TEST_JOURNAL, std::ios::out |
+			std::ios::binary | std::ios::app);
+		_fileOut.write("\x50\x00\x00\x00torn", 8);
+	}
+	if (!Matches(_mapEntries))
+	{
+		std::cout << "Torn trailing record was not dropped" << std::endl;
+		nNumErrors++;
+	}
+	{
+		DocHandler _doc;
+		InitDoc(_doc);
+		if (!_doc.OpenDoc(TEST_FILE) ||
+			!Put(_doc, _mapEntries, "after torn", "1") || !_doc.SaveDoc() ||
+			!Matches(_mapEntries))
+		{
+			std::cout << "Save after a torn record failed" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// A tampered record fails the open and leaves no replayed changes behind
+	FlipByte(TEST_JOURNAL, _nJournalSize - 1);
+	{
+		DocHandler _doc;
+		InitDoc(_doc);
+		if (_doc.OpenDoc(TEST_FILE) || _doc.GetEntryCount() != 0)
+		{
+			std::cout << "Tampered journal was accepted" << std::endl;
+			nNumErrors++;
+		}
+	}
+	FlipByte(TEST_JOURNAL, _nJournalSize - 1);
+
+	// Once the journal outgrows half the document the next save is full.
+	// A journal kept from before it belongs to another save and is ignored
+	std::filesystem::copy_file(TEST_JOURNAL, TEST_JOURNAL ".old",
+		std::filesystem::copy_options::overwrite_existing);
+	bool _bCompacted = false;
+	for (size_t i = 0; i < TEST_ENTRIES && !_bCompacted; i++)
+	{
+		DocHandler _doc;
+		InitDoc(_doc);
+		if (!_doc.OpenDoc(TEST_FILE) || !Put(_doc, _mapEntries, "entry1",
+			std::string(100, (char)('a' + i % 26))) || !_doc.SaveDoc() ||
+			!_doc.WaitForSave())
+			break;
+		_bCompacted = !std::filesystem::exists(TEST_JOURNAL);
+	}
+	if (!_bCompacted || std::filesystem::file_size(TEST_FILE) == _nDocSize ||
+		!Matches(_mapEntries))
+	{
+		std::cout << "Journal was not folded into a full save" << std::endl;
+		nNumErrors++;
+	}
+	std::filesystem::rename(TEST_JOURNAL ".old", TEST_JOURNAL);
+	if (!Matches(_mapEntries))
+	{
+		std::cout << "Stale journal was replayed" << std::endl;
+		nNumErrors++;
+	}
+
+	std::remove(TEST_JOURNAL);
+
+	// Authenticated and hashed contents
+	if (!TestContents(CRYPTO_MODES::AES_GCM) ||
+		!TestContents(CRYPTO_MODES::AES_CBC) ||
+		!TestContents(CRYPTO_MODES::AES_CTR))
+	{
+		std::cout << "Contents do not round trip" << std::endl;
+		nNumErrors++;
+	}
+
+	// Legacy documents open and are rewritten with key slots and compact
+	// contents by the next save
+	_mapEntries = { { "first", "1" }, { "second", std::string(300, '2') },
+		{ "third", "" } };
+	bool _bMigrated = WriteLegacyDoc(_mapEntries) && Matches(_mapEntries);
+	{
+		DocHandler _doc;
+		InitDoc(_doc);
+		_bMigrated = _bMigrated && _doc.OpenDoc(TEST_FILE) &&
+			_doc.SaveDoc() && _doc.WaitForSave();
+	}
+	{
+		std::ifstream _fileIn(TEST_FILE, std::ios::in | std::ios::binary);
+		char _header[5] = {};
+		_fileIn.read(_header, sizeof(_header));
+		_bMigrated = _bMigrated && _header[4] == 2 && Matches(_mapEntries);
+	}
+	if (!_bMigrated)
+	{
+		std::cout << "Legacy document was not migrated" << std::endl;
+		nNumErrors++;
+	}
+
+	std::remove(TEST_FILE);
+	std::remove(TEST_JOURNAL);
+
+	if (nNumErrors == 0)
+		std::cout << "*** DocHandler test: PASS" << std::endl;
+	else
+		std::cout << "*** DocHandler test: FAIL (" << nNumErrors <<
+			" errors)" << std::endl;
+
+	return nNumErrors;
+}
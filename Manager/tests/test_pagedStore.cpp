@@ -0,0 +1,308 @@
+#include "PagedStore.h"
+#include "CryptoRandom.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#define TEST_FILE "test_pagedStore.db"
+#define TEST_ENTRIES 10000	// Enough to split internal nodes too
+
+typedef std::map<std::string, std::string> entry_map;
+
+static std::string ReadFile()
+{
+	std::ifstream _fileIn(TEST_FILE, std::ios::in | std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(_fileIn),
+		std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(const std::string& strContents)
+{
+	std::ofstream _fileOut(TEST_FILE, std::ios::out | std::ios::binary |
+		std::ios::trunc);
+	_fileOut.write(strContents.data(), strContents.size());
+}
+
+// Empty past the end of the file
+static std::string GetPage(const std::string& strContents, size_t nPage)
+{
+	if (nPage * PagedStore::PAGE_SIZE >= strContents.size())
+		return std::string();
+	return strContents.substr(nPage * PagedStore::PAGE_SIZE,
+		PagedStore::PAGE_SIZE);
+}
+
+static void SetPage(std::string& strContents, size_t nPage,
+	const std::string& strPage)
+{
+	strContents.replace(nPage * PagedStore::PAGE_SIZE, strPage.size(),
+		strPage);
+}
+
+static bool Put(PagedStore& store, const std::string& strName,
+	const std::string& strValue)
+{
+	std::string_view _fields[2] = { "user", strValue };
+	return store.Put(strName, _fields, 2);
+}
+
+// Store holds exactly the expected entries, in name order
+static bool Matches(PagedStore& store, const entry_map& mapExpected)
+{
+	if (store.GetCount() != mapExpected.size())
+		return false;
+	auto _it = mapExpected.begin();
+	bool _bMatch = true;
+	bool _bVisited = store.ForEach([&](std::string_view name,
+		const std::string_view* pFields, size_t nFields) {
+		_bMatch = _it != mapExpected.end() && name == _it->first &&
+			nFields == 2 && pFields[1] == _it->second;
+		if (_bMatch)
+			++_it;
+		return _bMatch;
+	});
+	return _bVisited && _bMatch && _it == mapExpected.end();
+}
+
+// Every page of the tree loads and authenticates, whatever it holds
+static bool Readable(ICrypto* pCrypto, CryptoKey* pKey, const u8Vec& vContext)
+{
+	PagedStore _store;
+	return _store.Open(TEST_FILE, pCrypto, pKey, vContext) &&
+		_store.ForEach([](std::string_view, const std::string_view*, size_t) {
+			return true;
+		});
+}
+
+static bool Reopen(ICrypto* pCrypto, CryptoKey* pKey, const u8Vec& vContext,
+	const entry_map& mapExpected)
+{
+	PagedStore _store;
+	return _store.Open(TEST_FILE, pCrypto, pKey, vContext) &&
+		Matches(_store, mapExpected);
+}
+
+int main()
+{
+	uint nNumErrors = 0;
+
+	CryptoAES _aes;
+	_aes.Init(CRYPTO_MODES::AES_GCM);
+	CryptoKey _key;
+	u8 _keyValue[32];
+	GetRandomBytes(_keyValue, sizeof(_keyValue));
+	_key.SetKeyValue(_keyValue, sizeof(_keyValue));
+	u8Vec _vContext = { 'P', 'M', 'P', 'G' };
+
+	// Page 0 belongs to the caller
+	std::remove(TEST_FILE);
+	WriteFile(std::string(PagedStore::PAGE_SIZE, '\0'));
+
+	entry_map _mapEntries;
+	{
+		PagedStore _store;
+		if (!_store.Create(TEST_FILE, &_aes, &_key, _vContext))
+		{
+			std::cout << "PagedStore create failed" << std::endl;
+			return 1;
+		}
+
+		// Inserts in an order that splits leaves on both sides
+		for (size_t i = 0; i < TEST_ENTRIES; i++)
+		{
+			size_t _nEntry = (i * 7919) % TEST_ENTRIES;
+			std::string _strName = "entry" + std::to_string(_nEntry);
+			std::string _strValue(_nEntry % 200, 'v');
+			_strValue += std::to_string(_nEntry);
+			if (!Put(_store, _strName, _strValue))
+			{
+				std::cout << "Put failed for " << _strName << std::endl;
+				nNumErrors++;
+				break;
+			}
+			_mapEntries[_strName] = _strValue;
+		}
+		pass_fields _fields;
+		if (!Matches(_store, _mapEntries) ||
+			!_store.Find("entry1234", _fields) || _fields.size() != 2 ||
+			std::string_view(_fields[1]) != _mapEntries["entry1234"] ||
+			_store.Find("missing", _fields))
+		{
+			std::cout << "Entries do not match after splits" << std::endl;
+			nNumErrors++;
+		}
+
+		// Replacing an entry keeps the count
+		if (!Put(_store, "entry5", "replaced") ||
+			_store.GetCount() != _mapEntries.size())
+		{
+			std::cout << "Replacing an entry failed" << std::endl;
+			nNumErrors++;
+		}
+		_mapEntries["entry5"] = "replaced";
+
+		if (!_store.Flush() || _store.IsDirty())
+		{
+			std::cout << "Flush failed" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	if (!Reopen(&_aes, &_key, _vContext, _mapEntries))
+	{
+		std::cout << "Entries do not match after reopen" << std::endl;
+		nNumErrors++;
+	}
+
+	// Pages are bound to the context they were written with
+	u8Vec _vOtherContext = { 'P', 'M', 'P', 'H' };
+	{
+		PagedStore _store;
+		if (_store.Open(TEST_FILE, &_aes, &_key, _vOtherContext))
+		{
+			std::cout << "Opened with a different context" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Commit one more change, the previous tree stays on disk
+	std::string _strBefore = ReadFile();
+	entry_map _mapBefore = _mapEntries;
+	{
+		PagedStore _store;
+		bool _bChanged = _store.Open(TEST_FILE, &_aes, &_key, _vContext) &&
+			Put(_store, "entry10", "changed") && _store.Erase("entry11") &&
+			_store.Flush();
+		if (!_bChanged)
+		{
+			std::cout << "Failed to commit a change" << std::endl;
+			nNumErrors++;
+		}
+		_mapEntries["entry10"] = "changed";
+		_mapEntries.erase("entry11");
+	}
+	std::string _strAfter = ReadFile();
+
+	// A corrupted newest meta page falls back to the previous commit
+	size_t _nNewestMeta = GetPage(_strBefore, 1) != GetPage(_strAfter, 1) ?
+		1 : 2;
+	{
+		std::string _strCorrupt = _strAfter;
+		_strCorrupt[_nNewestMeta * PagedStore::PAGE_SIZE + 40] ^= 1;
+		WriteFile(_strCorrupt);
+		if (!Reopen(&_aes, &_key, _vContext, _mapBefore))
+		{
+			std::cout << "Did not fall back to the older meta page" <<
+				std::endl;
+			nNumErrors++;
+		}
+
+		// Both meta pages corrupted
+		_strCorrupt[(3 - _nNewestMeta) * PagedStore::PAGE_SIZE + 40] ^= 1;
+		WriteFile(_strCorrupt);
+		PagedStore _store;
+		if (_store.Open(TEST_FILE, &_aes, &_key, _vContext))
+		{
+			std::cout << "Opened without a valid meta page" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Pages the commit wrote are on the path to the changed entries, reused
+	// free pages or appended ones. Reused pages rolled back to their previous
+	// contents still decrypt, the tags held by their parents must reject them
+	std::vector<size_t> _vWritten;
+	size_t _nReused = 0;
+	for (size_t i = 3; i * PagedStore::PAGE_SIZE < _strAfter.size(); i++)
+	{
+		if (GetPage(_strBefore, i) != GetPage(_strAfter, i))
+			_vWritten.push_back(i);
+	}
+	{
+		std::string _strStale = _strAfter;
+		for (size_t nPage : _vWritten)
+		{
+			if (nPage * PagedStore::PAGE_SIZE < _strBefore.size())
+			{
+				SetPage(_strStale, nPage, GetPage(_strBefore, nPage));
+				_nReused++;
+			}
+		}
+		WriteFile(_strStale);
+		if (_nReused == 0 || Readable(&_aes, &_key, _vContext))
+		{
+			std::cout << "Stale pages were accepted" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Two pages of the tree swapped with each other are rejected
+	if (_vWritten.size() < 2)
+	{
+		std::cout << "Commit wrote fewer pages than expected" << std::endl;
+		nNumErrors++;
+	}
+	else
+	{
+		std::string _strSwapped = _strAfter;
+		SetPage(_strSwapped, _vWritten[0], GetPage(_strAfter, _vWritten[1]));
+		SetPage(_strSwapped, _vWritten[1], GetPage(_strAfter, _vWritten[0]));
+		WriteFile(_strSwapped);
+		if (Readable(&_aes, &_key, _vContext))
+		{
+			std::cout << "Swapped pages were accepted" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	WriteFile(_strAfter);
+	if (!Reopen(&_aes, &_key, _vContext, _mapEntries))
+	{
+		std::cout << "Entries do not match after restore" << std::endl;
+		nNumErrors++;
+	}
+
+	// Erase everything, the emptied tree is usable again after reopen
+	{
+		PagedStore _store;
+		bool _bErased = _store.Open(TEST_FILE, &_aes, &_key, _vContext);
+		for (auto& entry : _mapEntries)
+			_bErased = _bErased && _store.Erase(entry.first);
+		_bErased = _bErased && !_store.Erase("entry0") &&
+			_store.GetCount() == 0 && Matches(_store, entry_map()) &&
+			_store.Flush();
+		if (!_bErased)
+		{
+			std::cout << "Erasing every entry failed" << std::endl;
+			nNumErrors++;
+		}
+	}
+	{
+		PagedStore _store;
+		pass_fields _fields;
+		bool _bEmpty = _store.Open(TEST_FILE, &_aes, &_key, _vContext) &&
+			_store.GetCount() == 0 && !_store.Find("entry0", _fields) &&
+			Put(_store, "again", "1") && _store.Flush();
+		if (!_bEmpty || !Reopen(&_aes, &_key, _vContext, { { "again", "1" } }))
+		{
+			std::cout << "Emptied store is not reusable" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	std::remove(TEST_FILE);
+
+	if (nNumErrors == 0)
+		std::cout << "*** PagedStore test: PASS" << std::endl;
+	else
+		std::cout << "*** PagedStore test: FAIL (" << nNumErrors <<
+			" errors)" << std::endl;
+
+	return nNumErrors;
+}
@@ -0,0 +1,206 @@
+#include "PassStore.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#define INDEX_MIN_SIZE 16	// Smallest index PassStore allocates
+
+typedef std::map<std::string, std::string> entry_map;
+
+// Same FNV-1a as PassStore, to pick names that share a home slot
+static uint HashName(const std::string& strName)
+{
+	uint _nHash = 2166136261u;
+	for (char ch : strName)
+	{
+		_nHash ^= (u8)ch;
+		_nHash *= 16777619u;
+	}
+	return _nHash;
+}
+
+// First nCount names whose home slot in the smallest index is nSlot
+static std::vector<std::string> GetNamesForSlot(size_t nSlot, size_t nCount)
+{
+	std::vector<std::string> _vNames;
+	for (size_t i = 0; _vNames.size() < nCount; i++)
+	{
+		std::string _strName = "name" + std::to_string(i);
+		if ((HashName(_strName) & (INDEX_MIN_SIZE - 1)) == nSlot)
+			_vNames.push_back(_strName);
+	}
+	return _vNames;
+}
+
+static bool Insert(PassStore& store, entry_map& mapEntries,
+	const std::string& strName, const std::string& strValue)
+{
+	std::string_view _fields[2] = { "user", strValue };
+	mapEntries[strName] = strValue;
+	return store.Insert(strName, _fields, 2);
+}
+
+static bool Erase(PassStore& store, entry_map& mapEntries,
+	const std::string& strName)
+{
+	mapEntries.erase(strName);
+	return store.Erase(strName);
+}
+
+// Every expected entry is found by name and every index holds one of them
+static bool Matches(const PassStore& store, const entry_map& mapExpected)
+{
+	if (store.GetCount() != mapExpected.size())
+		return false;
+	size_t _nBytes = 0;
+	for (auto& entry : mapExpected)
+	{
+		size_t _nEntry = store.Find(entry.first);
+		if (_nEntry == PassStore::NOT_FOUND ||
+			store.GetName(_nEntry) != entry.first ||
+			store.GetFieldCount(_nEntry) != 2 ||
+			store.GetField(_nEntry, 0) != "user" ||
+			store.GetField(_nEntry, 1) != entry.second)
+			return false;
+		_nBytes += entry.first.size() + 4 + entry.second.size();
+	}
+	for (size_t i = 0; i < store.GetCount(); i++)
+	{
+		if (mapExpected.count(std::string(store.GetName(i))) == 0)
+			return false;
+	}
+	return store.GetDataSize() == _nBytes;
+}
+
+int main()
+{
+	uint nNumErrors = 0;
+
+	// Probe chain that wraps from the end of the index to its start, names
+	// homed at the last and first slot alternating. Erasing any link must 
+	// shift entries back across the wrap, but never before their home
+	std::vector<std::string> _vLast = GetNamesForSlot(INDEX_MIN_SIZE - 1, 3);
+	std::vector<std::string> _vFirst = GetNamesForSlot(0, 3);
+	std::vector<std::string> _vWrapped;
+	for (size_t i = 0; i < _vLast.size(); i++)
+	{
+		_vWrapped.push_back(_vLast[i]);
+		_vWrapped.push_back(_vFirst[i]);
+	}
+	for (size_t i = 0; i < _vWrapped.size(); i++)
+	{
+		PassStore _store;
+		entry_map _mapEntries;
+		bool _bOK = true;
+		for (const std::string& strName : _vWrapped)
+			_bOK = _bOK && Insert(_store, _mapEntries, strName, strName + "v");
+		_bOK = _bOK && Erase(_store, _mapEntries, _vWrapped[i]) &&
+			Matches(_store, _mapEntries) && !_store.Erase(_vWrapped[i]);
+		if (!_bOK)
+		{
+			std::cout << "Erase in a wrapped probe chain failed (" <<
+				_vWrapped[i] << ")" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Erasing the last entry, a middle one and the first one. The last
+	// entry moves into an erased record
+	{
+		PassStore _store;
+		entry_map _mapEntries;
+		bool _bOK = true;
+		for (size_t i = 0; i < 20; i++)
+			_bOK = _bOK && Insert(_store, _mapEntries,
+				"entry" + std::to_string(i), std::to_string(i * i));
+		_bOK = _bOK &&
+			Erase(_store, _mapEntries, std::string(_store.GetName(19))) &&
+			Matches(_store, _mapEntries) &&
+			Erase(_store, _mapEntries, std::string(_store.GetName(7))) &&
+			Matches(_store, _mapEntries) &&
+			Erase(_store, _mapEntries, std::string(_store.GetName(0))) &&
+			Matches(_store, _mapEntries) && !_store.Erase("missing");
+		if (!_bOK)
+		{
+			std::cout << "Erasing the last or a middle entry failed" <<
+				std::endl;
+			nNumErrors++;
+		}
+
+		// A name can be inserted again once erased, but not twice
+		_bOK = Insert(_store, _mapEntries, "entry7", "again") &&
+			Matches(_store, _mapEntries) &&
+			!_store.Insert("entry7", nullptr, 0);
+		if (!_bOK)
+		{
+			std::cout << "Reinserting an erased entry failed" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Growing the index many times over, then erasing most entries so the
+	// arena is compacted
+	{
+		PassStore _store;
+		entry_map _mapEntries;
+		bool _bOK = true;
+		for (size_t i = 0; i < 2000; i++)
+			_bOK = _bOK && Insert(_store, _mapEntries,
+				"entry" + std::to_string(i), std::string(i % 50, 'x'));
+		_bOK = _bOK && Matches(_store, _mapEntries);
+		if (!_bOK)
+		{
+			std::cout << "Lookup after growing the index failed" << std::endl;
+			nNumErrors++;
+		}
+
+		size_t _nArenaBefore = _store.GetDataSize();
+		for (size_t i = 0; i < 2000 && _bOK; i++)
+		{
+			if (i % 10 != 0)
+				_bOK = Erase(_store, _mapEntries, "entry" + std::to_string(i));
+		}
+		_bOK = _bOK && Matches(_store, _mapEntries) &&
+			_store.GetDataSize() < _nArenaBefore / 4;
+		if (!_bOK)
+		{
+			std::cout << "Lookup after compaction failed" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Clear keeps the index for reuse
+	{
+		PassStore _store;
+		entry_map _mapEntries;
+		bool _bOK = true;
+		for (size_t i = 0; i < 100; i++)
+			_bOK = _bOK && Insert(_store, _mapEntries,
+				"entry" + std::to_string(i), "value");
+		_store.Clear();
+		_mapEntries.clear();
+		_bOK = _bOK && Matches(_store, _mapEntries) &&
+			_store.Find("entry1") == PassStore::NOT_FOUND &&
+			!_store.Erase("entry1");
+		for (size_t i = 0; i < 10; i++)
+			_bOK = _bOK && Insert(_store, _mapEntries,
+				"entry" + std::to_string(i * 3), "reused");
+		_bOK = _bOK && Matches(_store, _mapEntries) &&
+			_store.Find("entry1") == PassStore::NOT_FOUND;
+		if (!_bOK)
+		{
+			std::cout << "Reuse after Clear failed" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	if (nNumErrors == 0)
+		std::cout << "*** PassStore test: PASS" << std::endl;
+	else
+		std::cout << "*** PassStore test: FAIL (" << nNumErrors <<
+			" errors)" << std::endl;
+
+	return nNumErrors;
+}
@@ -0,0 +1,109 @@
+#include "Serialize.h"
+
+#include <iostream>
+#include <string>
+
+#define VAR_MAX_LENGTH ((sizeof(size_t) * 8 + 6) / 7)
+
+static const size_t s_values[] = {
+	0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0xFFFFFFFF, (size_t)1 << 35,
+	(size_t)-1 >> 1, (size_t)-1
+};
+
+static bool Decode(const u8* pIn, size_t nLength, size_t& nValue,
+	size_t& nUsed)
+{
+	const u8* _pIn = pIn;
+	bool _bDecoded = GetVar(_pIn, pIn + nLength, nValue);
+	nUsed = _pIn - pIn;
+	return _bDecoded;
+}
+
+int main()
+{
+	uint nNumErrors = 0;
+
+	// Every value round trips in GetVarLength bytes, and fails to decode
+	// from any shorter input
+	for (size_t nValue : s_values)
+	{
+		u8 _var[VAR_MAX_LENGTH];
+		size_t _nLength = PutVar(_var, nValue) - _var;
+		size_t _nDecoded = 0, _nUsed = 0;
+		bool _bOK = _nLength == GetVarLength(nValue) &&
+			Decode(_var, _nLength, _nDecoded, _nUsed) &&
+			_nDecoded == nValue && _nUsed == _nLength;
+		for (size_t i = 0; i < _nLength && _bOK; i++)
+			_bOK = !Decode(_var, i, _nDecoded, _nUsed);
+		if (!_bOK)
+		{
+			std::cout << "Var " << nValue << " does not round trip" <<
+				std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Encodings of more than size_t bits are rejected
+	{
+		u8 _var[VAR_MAX_LENGTH + 1];
+		size_t _nLength = PutVar(_var, (size_t)-1) - _var;
+		size_t _nDecoded, _nUsed;
+		_var[_nLength - 1] |= 0x02;
+		if (sizeof(size_t) == 8 && Decode(_var, _nLength, _nDecoded, _nUsed))
+		{
+			std::cout << "Var past 64 bits was accepted" << std::endl;
+			nNumErrors++;
+		}
+		_var[_nLength - 1] = 0x81;
+		_var[_nLength] = 0x00;
+		if (Decode(_var, _nLength + 1, _nDecoded, _nUsed))
+		{
+			std::cout << "Var longer than size_t was accepted" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Strings are bounded by the input
+	{
+		u8 _buffer[300];
+		std::string _str(200, 's');
+		size_t _nLength = PutString(_buffer, _str) - _buffer;
+		std::string_view _view;
+		const u8* _pIn = _buffer;
+		bool _bOK = _nLength == 2 + _str.size() &&
+			GetString(_pIn, _buffer + _nLength, _view) && _view == _str &&
+			_pIn == _buffer + _nLength;
+		_pIn = _buffer;
+		_bOK = _bOK && !GetString(_pIn, _buffer + _nLength - 1, _view);
+		if (!_bOK)
+		{
+			std::cout << "String does not round trip" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	// Little endian integers of every width, nothing past them is written
+	for (size_t nBytes = 1; nBytes <= 8; nBytes++)
+	{
+		uint64_t _nValue = 0x0123456789ABCDEFull;
+		if (nBytes < 8)
+			_nValue &= ((uint64_t)1 << (nBytes * 8)) - 1;
+		u8 _buffer[16] = {};
+		PutLittleEndian(_buffer, _nValue, nBytes);
+		if (GetLittleEndian(_buffer, nBytes) != _nValue ||
+			_buffer[0] != (u8)_nValue || _buffer[nBytes] != 0)
+		{
+			std::cout << "Little endian (" << nBytes << " bytes) does not " <<
+				"round trip" << std::endl;
+			nNumErrors++;
+		}
+	}
+
+	if (nNumErrors == 0)
+		std::cout << "*** Serialize test: PASS" << std::endl;
+	else
+		std::cout << "*** Serialize test: FAIL (" << nNumErrors <<
+			" errors)" << std::endl;
+
+	return nNumErrors;
+}
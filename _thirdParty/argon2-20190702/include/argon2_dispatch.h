@@ -0,0 +1,32 @@
+/*
+ * Runtime selection of the Argon2 block fill kernel
+ *
+ * ref.c and opt.c are built once per supported instruction set, the fastest
+ * kernel the CPU can run is used unless another one is requested.
+ */
+
+#ifndef ARGON2_DISPATCH_H
+#define ARGON2_DISPATCH_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * Name of the kernel used by fill_segment ("ref", "sse2", "ssse3", "avx2" or
+ * "avx512f")
+ */
+const char *argon2_fill_kernel_name(void);
+
+/*
+ * Force a kernel by name, NULL restores automatic selection. Returns
+ * ARGON2_OK, or ARGON2_INCORRECT_TYPE if the kernel was not built or the CPU
+ * cannot run it. Not safe to call while hashing is in progress
+ */
+int argon2_set_fill_kernel(const char *name);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Runtime selection of the Argon2 block fill kernel, see argon2_dispatch.h
+ */
+
+#include <string.h>
+
+#include "argon2.h"
+#include "argon2_dispatch.h"
+#include "core.h"
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+typedef void (*fill_segment_fn)(const argon2_instance_t *instance,
+                                argon2_position_t position);
+
+typedef struct {
+    const char *name;
+    fill_segment_fn fill;
+    int (*supported)(void);
+} fill_kernel_t;
+
+void argon2_fill_segment_ref(const argon2_instance_t *instance,
+                             argon2_position_t position);
+#if defined(ARGON2_FILL_SSE2)
+void argon2_fill_segment_sse2(const argon2_instance_t *instance,
+                              argon2_position_t position);
+#endif
+#if defined(ARGON2_FILL_SSSE3)
+void argon2_fill_segment_ssse3(const argon2_instance_t *instance,
+                               argon2_position_t position);
+#endif
+#if defined(ARGON2_FILL_AVX2)
+void argon2_fill_segment_avx2(const argon2_instance_t *instance,
+                              argon2_position_t position);
+#endif
+#if defined(ARGON2_FILL_AVX512F)
+void argon2_fill_segment_avx512f(const argon2_instance_t *instance,
+                                 argon2_position_t position);
+#endif
+
+static int cpu_has_none(void) { return 1; }
+
+#if defined(_MSC_VER) && !defined(__clang__)
+/* CPUID leaf 1 ECX / leaf 7 EBX bits, OS must also save the vector state */
+static int cpu_os_saves(unsigned long long mask) {
+    int regs[4];
+    __cpuid(regs, 1);
+    if (!(regs[2] & (1 << 27))) /* OSXSAVE */
+        return 0;
+    return (_xgetbv(0) & mask) == mask;
+}
+static int cpu_has_sse2(void) { return 1; }
+static int cpu_has_avx2(void) {
+    int regs[4];
+    if (!cpu_os_saves(0x6))
+        return 0;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+}
+static int cpu_has_avx512f(void) {
+    int regs[4];
+    if (!cpu_os_saves(0xE6))
+        return 0;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 16)) != 0;
+}
+#elif defined(ARGON2_FILL_SSE2)
+/* __builtin_cpu_supports also checks that the OS saves AVX state */
+static int cpu_has_sse2(void) { return __builtin_cpu_supports("sse2"); }
+static int cpu_has_ssse3(void) { return __builtin_cpu_supports("ssse3"); }
+static int cpu_has_avx2(void) { return __builtin_cpu_supports("avx2"); }
+static int cpu_has_avx512f(void) { return __builtin_cpu_supports("avx512f"); }
+#endif
+
+/* Fastest first */
+static const fill_kernel_t fill_kernels[] = {
+#if defined(ARGON2_FILL_AVX512F)
+    {"avx512f", argon2_fill_segment_avx512f, cpu_has_avx512f},
+#endif
+#if defined(ARGON2_FILL_AVX2)
+    {"avx2", argon2_fill_segment_avx2, cpu_has_avx2},
+#endif
+#if defined(ARGON2_FILL_SSSE3)
+    {"ssse3", argon2_fill_segment_ssse3, cpu_has_ssse3},
+#endif
+#if defined(ARGON2_FILL_SSE2)
+    {"sse2", argon2_fill_segment_sse2, cpu_has_sse2},
+#endif
+    {"ref", argon2_fill_segment_ref, cpu_has_none},
+};
+
+#define FILL_KERNEL_COUNT (sizeof(fill_kernels) / sizeof(fill_kernels[0]))
+
+/* Selected kernel, NULL until first use. Every thread computes the same
+ * automatic choice, so a race on first use is harmless */
+static const fill_kernel_t *volatile selected_kernel = NULL;
+
+static const fill_kernel_t *auto_select_kernel(void) {
+    size_t i;
+    for (i = 0; i < FILL_KERNEL_COUNT; i++) {
+        if (fill_kernels[i].supported())
+            return &fill_kernels[i];
+    }
+    return &fill_kernels[FILL_KERNEL_COUNT - 1];
+}
+
+static const fill_kernel_t *get_kernel(void) {
+    const fill_kernel_t *kernel = selected_kernel;
+    if (kernel == NULL) {
+        kernel = auto_select_kernel();
+        selected_kernel = kernel;
+    }
+    return kernel;
+}
+
+void fill_segment(const argon2_instance_t *instance,
+                  argon2_position_t position) {
+    get_kernel()->fill(instance, position);
+}
+
+const char *argon2_fill_kernel_name(void) { return get_kernel()->name; }
+
+int argon2_set_fill_kernel(const char *name) {
+    size_t i;
+    if (name == NULL) {
+        selected_kernel = auto_select_kernel();
+        return ARGON2_OK;
+    }
+    for (i = 0; i < FILL_KERNEL_COUNT; i++) {
+        if (strcmp(fill_kernels[i].name, name) == 0 &&
+            fill_kernels[i].supported()) {
+            selected_kernel = &fill_kernels[i];
+            return ARGON2_OK;
+        }
+    }
+    return ARGON2_INCORRECT_TYPE;
+}